@@ -0,0 +1,160 @@
+// Benchmark: what compression costs against what it saves. Compresses
+// generated corpora shaped like typical responses (HTML, JSON, CSS, and
+// random bytes as the incompressible worst case) at several gzip levels and
+// brotli qualities, plus the streaming path handlers use, and reports CPU
+// time per MB of input next to the bytes saved per MB.
+#include "compression.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Corpus {
+    const char* name;
+    std::string data;
+};
+
+std::string makeHtml(size_t size, std::mt19937& random) {
+    static const char* kWords[] = {"server", "request", "latency", "buffer", "connection", "worker",
+                                   "response", "header", "socket", "queue", "cache", "route"};
+    std::string html = "<!DOCTYPE html>\n<html><head><title>Report</title></head><body>\n";
+    while (html.size() < size) {
+        html += "<div class=\"row\"><span class=\"label\">";
+        html += kWords[random() % 12];
+        html += "</span><p>";
+        for (int i = 0; i < 12; ++i) {
+            html += kWords[random() % 12];
+            html += ' ';
+        }
+        html += "</p></div>\n";
+    }
+    html.resize(size);
+    return html;
+}
+
+std::string makeJson(size_t size, std::mt19937& random) {
+    std::string json = "[";
+    for (unsigned id = 0; json.size() < size; ++id) {
+        json += "{\"id\":" + std::to_string(id) + ",\"status\":\"" + (random() % 4 ? "active" : "idle") +
+                "\",\"latencyMs\":" + std::to_string(random() % 5000) +
+                ",\"tags\":[\"edge\",\"http\"],\"owner\":\"team-" + std::to_string(random() % 16) + "\"},";
+    }
+    json.resize(size);
+    return json;
+}
+
+std::string makeCss(size_t size, std::mt19937& random) {
+    std::string css;
+    for (unsigned rule = 0; css.size() < size; ++rule) {
+        css += ".component-" + std::to_string(rule) + " {\n  margin: " + std::to_string(random() % 32) +
+               "px;\n  color: #" + std::to_string(100000 + random() % 899999) +
+               ";\n  display: flex;\n}\n";
+    }
+    css.resize(size);
+    return css;
+}
+
+std::string makeRandom(size_t size, std::mt19937& random) {
+    std::string bytes(size, '\0');
+    for (char& c : bytes) {
+        c = static_cast<char>(random());
+    }
+    return bytes;
+}
+
+struct Result {
+    double msPerMb;
+    double ratio;
+};
+
+// Best of a few passes over the corpus, one whole body per call
+Result measureBuffer(const std::string& input, ContentEncoding encoding, int level, int passes) {
+    std::string output;
+    double best = 1e30;
+    for (int pass = 0; pass < passes; ++pass) {
+        auto start = std::chrono::steady_clock::now();
+        if (!compressBuffer(encoding, input, output, level)) {
+            return {0, 0};
+        }
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - start).count());
+    }
+    double megabytes = static_cast<double>(input.size()) / (1024 * 1024);
+    return {best / megabytes, static_cast<double>(output.size()) / static_cast<double>(input.size())};
+}
+
+// The handler streaming path: 16 KB writes with a flush every 64 KB, as
+// RequestContext::stream() and flush() drive it
+Result measureStream(const std::string& input, ContentEncoding encoding, int passes) {
+    constexpr size_t kWrite = 16 * 1024;
+    double best = 1e30;
+    size_t produced = 0;
+    for (int pass = 0; pass < passes; ++pass) {
+        std::string output;
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<StreamCompressor> compressor = StreamCompressor::create(encoding);
+        if (!compressor) {
+            return {0, 0};
+        }
+        for (size_t offset = 0; offset < input.size(); offset += kWrite) {
+            std::string_view piece = std::string_view(input).substr(offset, kWrite);
+            bool flush = (offset / kWrite) % 4 == 3;
+            compressor->write(piece, flush ? StreamCompressor::Mode::Flush : StreamCompressor::Mode::Process,
+                              output);
+        }
+        compressor->write({}, StreamCompressor::Mode::Finish, output);
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - start).count());
+        produced = output.size();
+    }
+    double megabytes = static_cast<double>(input.size()) / (1024 * 1024);
+    return {best / megabytes, static_cast<double>(produced) / static_cast<double>(input.size())};
+}
+
+void report(const char* label, const Result& result) {
+    if (result.ratio == 0) {
+        printf("  %-16s unavailable in this build\n", label);
+        return;
+    }
+    printf("  %-16s %8.2f ms/MB  ratio %5.3f  saves %4.0f KB/MB\n", label, result.msPerMb, result.ratio,
+           (1 - result.ratio) * 1024);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    size_t kilobytes = argc > 1 ? static_cast<size_t>(std::atol(argv[1])) : 1024;
+    constexpr int kPasses = 5;
+
+    std::mt19937 random(42);
+    size_t size = kilobytes * 1024;
+    std::vector<Corpus> corpora;
+    corpora.push_back({"html", makeHtml(size, random)});
+    corpora.push_back({"json", makeJson(size, random)});
+    corpora.push_back({"css", makeCss(size, random)});
+    corpora.push_back({"random", makeRandom(size, random)});
+
+    printf("Compression of %zu KB bodies, best of %d passes\n", kilobytes, kPasses);
+    for (const Corpus& corpus : corpora) {
+        printf("%s\n", corpus.name);
+        for (int level : {1, kGzipLevel, 9}) {
+            std::string label = "gzip -" + std::to_string(level);
+            report(label.c_str(), measureBuffer(corpus.data, ContentEncoding::Gzip, level, kPasses));
+        }
+        for (int quality : {1, kBrotliQuality, 9, 11}) {
+            std::string label = "br q" + std::to_string(quality);
+            // Quality 11 is for precompressing at build time, so fewer passes
+            int passes = quality == 11 ? 1 : kPasses;
+            report(label.c_str(), measureBuffer(corpus.data, ContentEncoding::Brotli, quality, passes));
+        }
+        report("gzip stream", measureStream(corpus.data, ContentEncoding::Gzip, kPasses));
+        report("br stream", measureStream(corpus.data, ContentEncoding::Brotli, kPasses));
+    }
+    return 0;
+}
@@ -0,0 +1,995 @@
+// Load generator: opens N connections from M threads against a running
+// server, keeps every connection busy with requests (optionally pipelined,
+// optionally reconnecting for each request) for a fixed duration, and reports
+// requests/sec, bytes/sec and the latency distribution from an HDR-style
+// histogram. `--json` prints the same results as one JSON object for
+// regression tracking.
+//
+// Closed loop: each connection sends its next request only when a response
+// comes back, so latencies under saturation understate what an open-loop
+// client arriving at a fixed rate would see.
+//
+// `--slowloris N` adds N connections alongside the load that send a request
+// line and then one header byte per interval, never finishing the head, to
+// check that the server cuts them off (408) rather than holding a worker or
+// a slot for them indefinitely.
+#include "platform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Log-linear buckets in the style of HdrHistogram: values below 256 are exact,
+// above that every power of two is split into 128 sub-buckets, so any
+// recorded value is within 1/128 (< 0.8%) of its bucket. Covers all of uint64.
+class LatencyHistogram {
+private:
+    static constexpr unsigned kSubBucketBits = 7;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+    static constexpr size_t kBucketCount = (64 - kSubBucketBits) * kSubBuckets + 2 * kSubBuckets;
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t minimum;
+    uint64_t maximum;
+    double sum;
+
+    static size_t indexOf(uint64_t value) {
+        if (value < 2 * kSubBuckets) {
+            return static_cast<size_t>(value);
+        }
+        unsigned shift = 63 - static_cast<unsigned>(__builtin_clzll(value)) - kSubBucketBits;
+        return shift * kSubBuckets + static_cast<size_t>(value >> shift);
+    }
+
+    // Largest value that maps to `index`
+    static uint64_t highestEquivalent(size_t index) {
+        if (index < 2 * kSubBuckets) {
+            return index;
+        }
+        unsigned shift = static_cast<unsigned>(index / kSubBuckets) - 1;
+        uint64_t sub = index - shift * kSubBuckets;
+        return ((sub + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() : counts(kBucketCount, 0), total(0), minimum(UINT64_MAX), maximum(0), sum(0) {}
+
+    void record(uint64_t value) {
+        counts[indexOf(value)] += 1;
+        total += 1;
+        minimum = std::min(minimum, value);
+        maximum = std::max(maximum, value);
+        sum += static_cast<double>(value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < kBucketCount; ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        minimum = std::min(minimum, other.minimum);
+        maximum = std::max(maximum, other.maximum);
+        sum += other.sum;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total > 0 ? minimum : 0; }
+    uint64_t max() const { return maximum; }
+    double mean() const { return total > 0 ? sum / static_cast<double>(total) : 0; }
+
+    // Smallest recorded bucket covering `percentile` percent of the values
+    uint64_t percentile(double percentile) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(total) + 0.5);
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBucketCount; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(highestEquivalent(i), maximum);
+            }
+        }
+        return maximum;
+    }
+};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int connections = 64;
+    int threads = 0;              // 0: one per core
+    double durationSeconds = 10;
+    std::string method = "GET";
+    std::string path = "/";
+    std::vector<std::string> headers;
+    int pipeline = 1;
+    bool keepAlive = true;
+    bool http10 = false;
+    bool json = false;
+    int slowConnections = 0;
+    int slowIntervalMs = 1000;
+};
+
+struct Results {
+    LatencyHistogram latency;
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t connectErrors = 0;
+    uint64_t readErrors = 0;
+    uint64_t writeErrors = 0;
+    uint64_t parseErrors = 0;
+    uint64_t statusErrors = 0;   // Anything outside 2xx/3xx
+    uint64_t reconnects = 0;
+
+    void merge(const Results& other) {
+        latency.merge(other.latency);
+        requests += other.requests;
+        bytes += other.bytes;
+        connectErrors += other.connectErrors;
+        readErrors += other.readErrors;
+        writeErrors += other.writeErrors;
+        parseErrors += other.parseErrors;
+        statusErrors += other.statusErrors;
+        reconnects += other.reconnects;
+    }
+};
+
+// Incremental HTTP/1.x response framing: Content-Length, chunked, bodyless
+// statuses and read-until-close. Body bytes are counted, not kept.
+class ResponseParser {
+private:
+    enum class Stage { Head, Body, ChunkSize, ChunkData, ChunkEnd, Trailers, UntilClose };
+
+    static constexpr size_t kMaxHead = 64 * 1024;
+
+    Stage stage = Stage::Head;
+    std::string line;        // Head or chunk-size line being assembled
+    uint64_t remaining = 0;  // Body or chunk bytes still expected
+    int status = 0;
+    bool closeAfter = false;
+    bool headRequest = false;
+
+    static bool headerIs(const std::string& head, size_t begin, size_t end, const char* name) {
+        size_t length = strlen(name);
+        if (end - begin < length + 1 || head[begin + length] != ':') {
+            return false;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            if (tolower(static_cast<unsigned char>(head[begin + i])) != name[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool valueContains(const std::string& head, size_t begin, size_t end, const char* token) {
+        std::string value = head.substr(begin, end - begin);
+        for (char& c : value) {
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+        return value.find(token) != std::string::npos;
+    }
+
+    bool parseHead() {
+        if (line.compare(0, 7, "HTTP/1.") != 0 || line.size() < 12) {
+            return false;
+        }
+        status = atoi(line.c_str() + 9);
+        closeAfter = line[7] == '0';
+        bool chunked = false;
+        bool hasLength = false;
+        uint64_t contentLength = 0;
+
+        size_t begin = line.find("\r\n") + 2;
+        while (begin < line.size()) {
+            size_t end = line.find("\r\n", begin);
+            if (end == std::string::npos || end == begin) {
+                break;
+            }
+            size_t value = begin;
+            while (value < end && line[value] != ':') {
+                ++value;
+            }
+            size_t valueBegin = value + 1;
+            while (valueBegin < end && line[valueBegin] == ' ') {
+                ++valueBegin;
+            }
+            if (headerIs(line, begin, end, "content-length")) {
+                hasLength = true;
+                contentLength = strtoull(line.c_str() + valueBegin, nullptr, 10);
+            } else if (headerIs(line, begin, end, "transfer-encoding")) {
+                chunked = valueContains(line, valueBegin, end, "chunked");
+            } else if (headerIs(line, begin, end, "connection")) {
+                if (valueContains(line, valueBegin, end, "close")) {
+                    closeAfter = true;
+                } else if (valueContains(line, valueBegin, end, "keep-alive")) {
+                    closeAfter = false;
+                }
+            }
+            begin = end + 2;
+        }
+
+        line.clear();
+        if (headRequest || status / 100 == 1 || status == 204 || status == 304) {
+            remaining = 0;
+            stage = Stage::Body;
+        } else if (chunked) {
+            stage = Stage::ChunkSize;
+        } else if (hasLength) {
+            remaining = contentLength;
+            stage = Stage::Body;
+        } else {
+            closeAfter = true;
+            stage = Stage::UntilClose;
+        }
+        return true;
+    }
+
+    // Appends up to and including the next '\n'; true once the line is complete
+    bool takeLine(const char*& data, const char* end) {
+        const char* newline = static_cast<const char*>(memchr(data, '\n', end - data));
+        const char* stop = newline ? newline + 1 : end;
+        line.append(data, stop - data);
+        data = stop;
+        return newline != nullptr;
+    }
+
+public:
+    enum class Result { NeedMore, Complete, Error };
+
+    void reset(bool forHead) {
+        stage = Stage::Head;
+        line.clear();
+        remaining = 0;
+        status = 0;
+        closeAfter = false;
+        headRequest = forHead;
+    }
+
+    int getStatus() const { return status; }
+    bool shouldClose() const { return closeAfter; }
+    bool readsUntilClose() const { return stage == Stage::UntilClose; }
+
+    // Consumes bytes from [data, end) up to the end of one response
+    Result feed(const char*& data, const char* end) {
+        while (true) {
+            switch (stage) {
+            case Stage::Head:
+                // Only the head is copied; body bytes are skipped in place
+                do {
+                    if (!takeLine(data, end)) {
+                        return line.size() > kMaxHead ? Result::Error : Result::NeedMore;
+                    }
+                } while (line.size() < 4 || line.compare(line.size() - 4, 4, "\r\n\r\n") != 0);
+                if (line.size() > kMaxHead || !parseHead()) {
+                    return Result::Error;
+                }
+                break;
+            case Stage::Body: {
+                uint64_t step = std::min<uint64_t>(remaining, static_cast<uint64_t>(end - data));
+                data += step;
+                remaining -= step;
+                if (remaining > 0) {
+                    return Result::NeedMore;
+                }
+                return Result::Complete;
+            }
+            case Stage::ChunkSize:
+                if (!takeLine(data, end)) {
+                    return line.size() > 1024 ? Result::Error : Result::NeedMore;
+                }
+                {
+                    char* parsedEnd = nullptr;
+                    remaining = strtoull(line.c_str(), &parsedEnd, 16);
+                    if (parsedEnd == line.c_str()) {
+                        return Result::Error;
+                    }
+                }
+                line.clear();
+                stage = remaining > 0 ? Stage::ChunkData : Stage::Trailers;
+                break;
+            case Stage::ChunkData: {
+                uint64_t step = std::min<uint64_t>(remaining, static_cast<uint64_t>(end - data));
+                data += step;
+                remaining -= step;
+                if (remaining > 0) {
+                    return Result::NeedMore;
+                }
+                stage = Stage::ChunkEnd;
+                break;
+            }
+            case Stage::ChunkEnd:
+                if (!takeLine(data, end)) {
+                    return Result::NeedMore;
+                }
+                line.clear();
+                stage = Stage::ChunkSize;
+                break;
+            case Stage::Trailers:
+                if (!takeLine(data, end)) {
+                    return line.size() > kMaxHead ? Result::Error : Result::NeedMore;
+                }
+                if (line == "\r\n" || line == "\n") {
+                    line.clear();
+                    return Result::Complete;
+                }
+                line.clear();
+                break;
+            case Stage::UntilClose:
+                data = end;
+                return Result::NeedMore;
+            }
+        }
+    }
+};
+
+struct Connection {
+    SOCKET_TYPE socket = INVALID_SOCKET;
+    bool connecting = false;
+    Clock::time_point connectStarted;
+    std::string pending;       // Request bytes not yet written
+    size_t pendingOffset = 0;
+    std::vector<Clock::time_point> sentAt;   // One per request in flight, oldest first
+    size_t sentHead = 0;
+    ResponseParser parser;
+};
+
+class LoadThread {
+private:
+    const Options& options;
+    const struct sockaddr_storage& address;
+    const SOCKET_SIZE_TYPE addressLength;
+    const std::string& request;
+    const std::atomic<bool>& running;
+    std::vector<Connection> connections;
+    Results results;
+
+    size_t inFlight(const Connection& connection) const {
+        return connection.sentAt.size() - connection.sentHead;
+    }
+
+    void queueRequest(Connection& connection, Clock::time_point now) {
+        if (connection.sentHead == connection.sentAt.size()) {
+            connection.sentAt.clear();
+            connection.sentHead = 0;
+        }
+        connection.pending.append(request);
+        // Without keep-alive the clock starts at connect(), so the handshake counts
+        connection.sentAt.push_back(options.keepAlive ? now : connection.connectStarted);
+        connection.parser.reset(options.method == "HEAD");
+    }
+
+    void fillWindow(Connection& connection, Clock::time_point now) {
+        size_t window = options.keepAlive ? static_cast<size_t>(options.pipeline) : 1;
+        while (inFlight(connection) < window) {
+            queueRequest(connection, now);
+        }
+    }
+
+    bool open(Connection& connection) {
+        connection.socket = socket(address.ss_family, SOCK_STREAM, 0);
+        if (connection.socket == INVALID_SOCKET) {
+            results.connectErrors += 1;
+            return false;
+        }
+        int one = 1;
+        setsockopt(connection.socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(connection.socket, F_SETFL, fcntl(connection.socket, F_GETFL, 0) | O_NONBLOCK);
+
+        connection.connectStarted = Clock::now();
+        connection.pending.clear();
+        connection.pendingOffset = 0;
+        connection.sentAt.clear();
+        connection.sentHead = 0;
+
+        int result = connect(connection.socket, reinterpret_cast<const struct sockaddr*>(&address),
+                             addressLength);
+        if (result < 0 && SOCKET_ERROR_CODE != EINPROGRESS) {
+            results.connectErrors += 1;
+            CLOSE_SOCKET(connection.socket);
+            connection.socket = INVALID_SOCKET;
+            return false;
+        }
+        connection.connecting = result < 0;
+        fillWindow(connection, connection.connectStarted);
+        return true;
+    }
+
+    void disconnect(Connection& connection) {
+        if (connection.socket != INVALID_SOCKET) {
+            CLOSE_SOCKET(connection.socket);
+            connection.socket = INVALID_SOCKET;
+        }
+    }
+
+    void reopen(Connection& connection, bool counted) {
+        disconnect(connection);
+        if (counted) {
+            results.reconnects += 1;
+        }
+        if (running.load(std::memory_order_relaxed)) {
+            open(connection);
+        }
+    }
+
+    void completeResponse(Connection& connection, Clock::time_point now) {
+        int status = connection.parser.getStatus();
+        if (status < 200 || status >= 400) {
+            results.statusErrors += 1;
+        }
+        auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - connection.sentAt[connection.sentHead++]);
+        results.latency.record(static_cast<uint64_t>(latency.count()));
+        results.requests += 1;
+    }
+
+    bool handleWrite(Connection& connection) {
+        if (connection.connecting) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(connection.socket, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                results.connectErrors += 1;
+                return false;
+            }
+            connection.connecting = false;
+        }
+        while (connection.pendingOffset < connection.pending.size()) {
+            ssize_t written = send(connection.socket, connection.pending.data() + connection.pendingOffset,
+                                   connection.pending.size() - connection.pendingOffset, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (SOCKET_ERROR_CODE == EINTR) {
+                    continue;
+                }
+                if (SOCKET_ERROR_CODE == EAGAIN || SOCKET_ERROR_CODE == EWOULDBLOCK) {
+                    return true;
+                }
+                results.writeErrors += 1;
+                return false;
+            }
+            connection.pendingOffset += static_cast<size_t>(written);
+        }
+        connection.pending.clear();
+        connection.pendingOffset = 0;
+        return true;
+    }
+
+    // Returns false when the connection was closed (and possibly reopened)
+    bool handleRead(Connection& connection, char* buffer, size_t capacity) {
+        while (true) {
+            ssize_t received = recv(connection.socket, buffer, capacity, 0);
+            if (received < 0) {
+                if (SOCKET_ERROR_CODE == EINTR) {
+                    continue;
+                }
+                if (SOCKET_ERROR_CODE == EAGAIN || SOCKET_ERROR_CODE == EWOULDBLOCK) {
+                    return true;
+                }
+                results.readErrors += 1;
+                reopen(connection, true);
+                return false;
+            }
+            Clock::time_point now = Clock::now();
+            if (received == 0) {
+                // Read-until-close bodies end here; anything else in flight is lost
+                if (inFlight(connection) > 0 && connection.parser.readsUntilClose()) {
+                    completeResponse(connection, now);
+                } else if (inFlight(connection) > 0) {
+                    results.readErrors += 1;
+                }
+                reopen(connection, options.keepAlive);
+                return false;
+            }
+            results.bytes += static_cast<uint64_t>(received);
+
+            const char* data = buffer;
+            const char* end = buffer + received;
+            while (data < end) {
+                if (inFlight(connection) == 0) {
+                    results.parseErrors += 1;   // Bytes nobody asked for
+                    reopen(connection, true);
+                    return false;
+                }
+                ResponseParser::Result result = connection.parser.feed(data, end);
+                if (result == ResponseParser::Result::Error) {
+                    results.parseErrors += 1;
+                    reopen(connection, true);
+                    return false;
+                }
+                if (result == ResponseParser::Result::NeedMore) {
+                    break;
+                }
+                completeResponse(connection, now);
+                if (connection.parser.shouldClose() || !options.keepAlive) {
+                    // The server is done with this connection (or we asked it to be)
+                    reopen(connection, options.keepAlive);
+                    return false;
+                }
+                connection.parser.reset(options.method == "HEAD");
+                if (running.load(std::memory_order_relaxed)) {
+                    fillWindow(connection, now);
+                }
+            }
+            if (!connection.pending.empty() && !handleWrite(connection)) {
+                reopen(connection, true);
+                return false;
+            }
+        }
+    }
+
+public:
+    LoadThread(const Options& options, const struct sockaddr_storage& address,
+               SOCKET_SIZE_TYPE addressLength, const std::string& request,
+               const std::atomic<bool>& running, int connectionCount)
+        : options(options), address(address), addressLength(addressLength),
+          request(request), running(running), connections(static_cast<size_t>(connectionCount)) {}
+
+    void run() {
+        for (Connection& connection : connections) {
+            open(connection);
+        }
+
+        std::vector<struct pollfd> fds;
+        std::vector<size_t> owners;
+        std::vector<char> buffer(64 * 1024);
+
+        while (running.load(std::memory_order_relaxed)) {
+            fds.clear();
+            owners.clear();
+            for (size_t i = 0; i < connections.size(); ++i) {
+                Connection& connection = connections[i];
+                if (connection.socket == INVALID_SOCKET && !open(connection)) {
+                    continue;
+                }
+                struct pollfd fd = {};
+                fd.fd = connection.socket;
+                fd.events = POLLIN;
+                if (connection.connecting || !connection.pending.empty()) {
+                    fd.events |= POLLOUT;
+                }
+                fds.push_back(fd);
+                owners.push_back(i);
+            }
+            if (fds.empty()) {
+                // Every connect failed outright; don't spin
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+
+            int ready = poll(fds.data(), fds.size(), 100);
+            if (ready < 0 && SOCKET_ERROR_CODE != EINTR) {
+                break;
+            }
+            for (size_t i = 0; ready > 0 && i < fds.size(); ++i) {
+                Connection& connection = connections[owners[i]];
+                short revents = fds[i].revents;
+                if (revents == 0) {
+                    continue;
+                }
+                if ((revents & (POLLOUT | POLLERR | POLLHUP)) &&
+                    (connection.connecting || !connection.pending.empty())) {
+                    if (!handleWrite(connection)) {
+                        reopen(connection, false);
+                        continue;
+                    }
+                }
+                if (revents & (POLLIN | POLLERR | POLLHUP)) {
+                    handleRead(connection, buffer.data(), buffer.size());
+                }
+            }
+        }
+
+        for (Connection& connection : connections) {
+            disconnect(connection);
+        }
+    }
+
+    const Results& getResults() const { return results; }
+};
+
+// How the server ended each slow connection
+struct SlowResults {
+    uint64_t connectErrors = 0;
+    uint64_t timedOut = 0;   // Answered 408
+    uint64_t shed = 0;       // Answered 503
+    uint64_t dropped = 0;    // Closed with no response, or some other one
+    uint64_t stillOpen = 0;
+};
+
+class SlowlorisThread {
+private:
+    struct Slow {
+        SOCKET_TYPE socket = INVALID_SOCKET;
+        std::string reply;
+    };
+
+    // Repeated a byte at a time: a head with no end
+    static constexpr const char* kTrickle = "X-Slow: 1\r\n";
+
+    const Options& options;
+    const struct sockaddr_storage& address;
+    const SOCKET_SIZE_TYPE addressLength;
+    const std::atomic<bool>& running;
+    std::vector<Slow> slows;
+    SlowResults results;
+
+    void finish(Slow& slow) {
+        int status = slow.reply.compare(0, 7, "HTTP/1.") == 0 && slow.reply.size() >= 12
+                         ? atoi(slow.reply.c_str() + 9) : 0;
+        if (status == 408) {
+            results.timedOut += 1;
+        } else if (status == 503) {
+            results.shed += 1;
+        } else {
+            results.dropped += 1;
+        }
+        CLOSE_SOCKET(slow.socket);
+        slow.socket = INVALID_SOCKET;
+    }
+
+public:
+    SlowlorisThread(const Options& options, const struct sockaddr_storage& address,
+                    SOCKET_SIZE_TYPE addressLength, const std::atomic<bool>& running)
+        : options(options), address(address), addressLength(addressLength), running(running),
+          slows(static_cast<size_t>(options.slowConnections)) {}
+
+    void run() {
+        std::string start = "GET / HTTP/1.1\r\nHost: " + options.host + "\r\n";
+        for (Slow& slow : slows) {
+            slow.socket = socket(address.ss_family, SOCK_STREAM, 0);
+            if (slow.socket == INVALID_SOCKET ||
+                connect(slow.socket, reinterpret_cast<const struct sockaddr*>(&address), addressLength) < 0 ||
+                send(slow.socket, start.data(), start.size(), 0) < 0) {
+                results.connectErrors += 1;
+                if (slow.socket != INVALID_SOCKET) {
+                    CLOSE_SOCKET(slow.socket);
+                    slow.socket = INVALID_SOCKET;
+                }
+                continue;
+            }
+            fcntl(slow.socket, F_SETFL, fcntl(slow.socket, F_GETFL, 0) | O_NONBLOCK);
+        }
+
+        std::vector<struct pollfd> pollSet;
+        std::vector<Slow*> polled;
+        size_t trickled = 0;
+        Clock::time_point nextByte = Clock::now();
+        while (running) {
+            Clock::time_point now = Clock::now();
+            if (now >= nextByte) {
+                char byte = kTrickle[trickled++ % strlen(kTrickle)];
+                for (Slow& slow : slows) {
+                    if (slow.socket != INVALID_SOCKET && send(slow.socket, &byte, 1, 0) < 0 &&
+                        SOCKET_ERROR_CODE != EAGAIN) {
+                        finish(slow);
+                    }
+                }
+                nextByte = now + std::chrono::milliseconds(options.slowIntervalMs);
+            }
+
+            pollSet.clear();
+            polled.clear();
+            for (Slow& slow : slows) {
+                if (slow.socket != INVALID_SOCKET) {
+                    pollSet.push_back({slow.socket, POLLIN, 0});
+                    polled.push_back(&slow);
+                }
+            }
+            // Wake at least every 100 ms to notice the end of the run
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextByte - Clock::now()).count();
+            int timeout = static_cast<int>(std::clamp<long long>(wait, 0, 100));
+            if (poll(pollSet.data(), pollSet.size(), timeout) <= 0) {
+                continue;
+            }
+            for (size_t i = 0; i < pollSet.size(); ++i) {
+                if (pollSet[i].revents == 0) {
+                    continue;
+                }
+                char buffer[4096];
+                ssize_t received = recv(polled[i]->socket, buffer, sizeof(buffer), 0);
+                if (received > 0) {
+                    polled[i]->reply.append(buffer, static_cast<size_t>(received));
+                } else if (received == 0 || SOCKET_ERROR_CODE != EAGAIN) {
+                    finish(*polled[i]);
+                }
+            }
+        }
+
+        for (Slow& slow : slows) {
+            if (slow.socket != INVALID_SOCKET) {
+                results.stillOpen += 1;
+                CLOSE_SOCKET(slow.socket);
+            }
+        }
+    }
+
+    const SlowResults& getResults() const { return results; }
+};
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --host HOST          Server address (default 127.0.0.1)\n"
+              << "  --port N             Server port (default 8080)\n"
+              << "  --connections N      Concurrent connections (default 64)\n"
+              << "  --threads N          Client threads (default: one per core)\n"
+              << "  --duration SECONDS   Length of the run (default 10)\n"
+              << "  --method NAME        Request method (default GET)\n"
+              << "  --path PATH          Request target (default /)\n"
+              << "  --header 'K: V'      Extra request header (repeatable)\n"
+              << "  --pipeline N         Requests in flight per connection (default 1)\n"
+              << "  --no-keepalive       New connection for every request\n"
+              << "  --http10             Send HTTP/1.0 requests\n"
+              << "  --slowloris N        Also hold N connections that never finish their head;\n"
+              << "                       the run fails if any is still open at the end\n"
+              << "  --slowloris-interval MS  Delay between their header bytes (default 1000)\n"
+              << "  --json               Print results as JSON" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--host" && hasValue) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && hasValue) {
+            options.port = atoi(argv[++i]);
+        } else if ((arg == "--connections" || arg == "-c") && hasValue) {
+            options.connections = atoi(argv[++i]);
+        } else if ((arg == "--threads" || arg == "-t") && hasValue) {
+            options.threads = atoi(argv[++i]);
+        } else if ((arg == "--duration" || arg == "-d") && hasValue) {
+            options.durationSeconds = atof(argv[++i]);
+        } else if (arg == "--method" && hasValue) {
+            options.method = argv[++i];
+        } else if (arg == "--path" && hasValue) {
+            options.path = argv[++i];
+        } else if (arg == "--header" && hasValue) {
+            options.headers.push_back(argv[++i]);
+        } else if (arg == "--pipeline" && hasValue) {
+            options.pipeline = atoi(argv[++i]);
+        } else if (arg == "--no-keepalive") {
+            options.keepAlive = false;
+        } else if (arg == "--http10") {
+            options.http10 = true;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--slowloris" && hasValue) {
+            options.slowConnections = atoi(argv[++i]);
+        } else if (arg == "--slowloris-interval" && hasValue) {
+            options.slowIntervalMs = atoi(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (options.threads <= 0) {
+        options.threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    options.threads = std::min(options.threads, options.connections);
+    if (options.port <= 0 || options.connections <= 0 || options.durationSeconds <= 0 ||
+        options.pipeline <= 0 || options.slowConnections < 0 || options.slowIntervalMs <= 0) {
+        printUsage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+std::string buildRequest(const Options& options) {
+    std::string request = options.method + " " + options.path + (options.http10 ? " HTTP/1.0\r\n" : " HTTP/1.1\r\n");
+    request += "Host: " + options.host + ":" + std::to_string(options.port) + "\r\n";
+    for (const std::string& header : options.headers) {
+        request += header + "\r\n";
+    }
+    if (!options.keepAlive) {
+        request += "Connection: close\r\n";
+    } else if (options.http10) {
+        request += "Connection: keep-alive\r\n";
+    }
+    return request + "\r\n";
+}
+
+bool resolve(const Options& options, struct sockaddr_storage& address, SOCKET_SIZE_TYPE& length) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    std::string port = std::to_string(options.port);
+    int error = getaddrinfo(options.host.c_str(), port.c_str(), &hints, &result);
+    if (error != 0 || !result) {
+        std::cerr << "Cannot resolve " << options.host << ": " << gai_strerror(error) << std::endl;
+        return false;
+    }
+    memcpy(&address, result->ai_addr, result->ai_addrlen);
+    length = static_cast<SOCKET_SIZE_TYPE>(result->ai_addrlen);
+    freeaddrinfo(result);
+    return true;
+}
+
+double micros(uint64_t nanoseconds) {
+    return static_cast<double>(nanoseconds) / 1000.0;
+}
+
+void printText(const Options& options, const Results& results, double seconds) {
+    const LatencyHistogram& latency = results.latency;
+    printf("%.1fs test @ http://%s:%d%s\n", seconds, options.host.c_str(), options.port, options.path.c_str());
+    printf("  %d threads, %d connections, pipeline depth %d, %s\n", options.threads,
+           options.connections, options.keepAlive ? options.pipeline : 1,
+           options.keepAlive ? "keep-alive" : "connection per request");
+    printf("Requests:     %llu (%.1f/s)\n", static_cast<unsigned long long>(results.requests),
+           static_cast<double>(results.requests) / seconds);
+    printf("Transfer:     %.2f MB (%.2f MB/s)\n", static_cast<double>(results.bytes) / 1e6,
+           static_cast<double>(results.bytes) / 1e6 / seconds);
+    printf("Latency (us): min %.1f, mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+           micros(latency.min()), latency.mean() / 1000.0, micros(latency.percentile(50)),
+           micros(latency.percentile(90)), micros(latency.percentile(99)),
+           micros(latency.percentile(99.9)), micros(latency.max()));
+    printf("Errors:       connect %llu, read %llu, write %llu, parse %llu, status %llu\n",
+           static_cast<unsigned long long>(results.connectErrors),
+           static_cast<unsigned long long>(results.readErrors),
+           static_cast<unsigned long long>(results.writeErrors),
+           static_cast<unsigned long long>(results.parseErrors),
+           static_cast<unsigned long long>(results.statusErrors));
+    printf("Reconnects:   %llu\n", static_cast<unsigned long long>(results.reconnects));
+}
+
+void printSlowText(const Options& options, const SlowResults& slow) {
+    printf("Slowloris:    %d connections, a byte every %d ms: %llu timed out (408), %llu shed (503), "
+           "%llu dropped, %llu still open, %llu failed to connect\n",
+           options.slowConnections, options.slowIntervalMs,
+           static_cast<unsigned long long>(slow.timedOut), static_cast<unsigned long long>(slow.shed),
+           static_cast<unsigned long long>(slow.dropped), static_cast<unsigned long long>(slow.stillOpen),
+           static_cast<unsigned long long>(slow.connectErrors));
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Everything but the closing brace, so optional sections can follow
+void printJsonFields(const Options& options, const Results& results, double seconds) {
+    const LatencyHistogram& latency = results.latency;
+    printf("{\"host\": \"%s\", \"port\": %d, \"method\": \"%s\", \"path\": \"%s\", "
+           "\"threads\": %d, \"connections\": %d, \"pipeline\": %d, \"keep_alive\": %s, "
+           "\"duration_s\": %.3f, \"requests\": %llu, \"requests_per_sec\": %.1f, "
+           "\"bytes\": %llu, \"bytes_per_sec\": %.1f, "
+           "\"latency_us\": {\"min\": %.1f, \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+           "\"p99\": %.1f, \"p99_9\": %.1f, \"max\": %.1f}, "
+           "\"errors\": {\"connect\": %llu, \"read\": %llu, \"write\": %llu, \"parse\": %llu, "
+           "\"status\": %llu}, \"reconnects\": %llu",
+           jsonEscape(options.host).c_str(), options.port, jsonEscape(options.method).c_str(),
+           jsonEscape(options.path).c_str(), options.threads, options.connections,
+           options.keepAlive ? options.pipeline : 1, options.keepAlive ? "true" : "false", seconds,
+           static_cast<unsigned long long>(results.requests),
+           static_cast<double>(results.requests) / seconds,
+           static_cast<unsigned long long>(results.bytes),
+           static_cast<double>(results.bytes) / seconds,
+           micros(latency.min()), latency.mean() / 1000.0, micros(latency.percentile(50)),
+           micros(latency.percentile(90)), micros(latency.percentile(99)),
+           micros(latency.percentile(99.9)), micros(latency.max()),
+           static_cast<unsigned long long>(results.connectErrors),
+           static_cast<unsigned long long>(results.readErrors),
+           static_cast<unsigned long long>(results.writeErrors),
+           static_cast<unsigned long long>(results.parseErrors),
+           static_cast<unsigned long long>(results.statusErrors),
+           static_cast<unsigned long long>(results.reconnects));
+}
+
+void printJson(const Options& options, const Results& results, const SlowResults& slow, double seconds) {
+    printJsonFields(options, results, seconds);
+    if (options.slowConnections > 0) {
+        printf(", \"slowloris\": {\"connections\": %d, \"interval_ms\": %d, \"timed_out\": %llu, "
+               "\"shed\": %llu, \"dropped\": %llu, \"still_open\": %llu, \"connect_errors\": %llu}",
+               options.slowConnections, options.slowIntervalMs,
+               static_cast<unsigned long long>(slow.timedOut), static_cast<unsigned long long>(slow.shed),
+               static_cast<unsigned long long>(slow.dropped), static_cast<unsigned long long>(slow.stillOpen),
+               static_cast<unsigned long long>(slow.connectErrors));
+    }
+    printf("}\n");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_storage address = {};
+    SOCKET_SIZE_TYPE addressLength = 0;
+    if (!resolve(options, address, addressLength)) {
+        return 1;
+    }
+
+    std::string request = buildRequest(options);
+    std::atomic<bool> running(true);
+
+    // Spread connections as evenly as possible across threads
+    std::vector<std::unique_ptr<LoadThread>> loaders;
+    for (int i = 0; i < options.threads; ++i) {
+        int share = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        loaders.emplace_back(new LoadThread(options, address, addressLength, request, running, share));
+    }
+
+    SlowlorisThread slowloris(options, address, addressLength, running);
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (auto& loader : loaders) {
+        threads.emplace_back([&loader]() { loader->run(); });
+    }
+    if (options.slowConnections > 0) {
+        threads.emplace_back([&slowloris]() { slowloris.run(); });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.durationSeconds));
+    running = false;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Results total;
+    for (auto& loader : loaders) {
+        total.merge(loader->getResults());
+    }
+
+    const SlowResults& slow = slowloris.getResults();
+    if (options.json) {
+        printJson(options, total, slow, seconds);
+    } else {
+        printText(options, total, seconds);
+        if (options.slowConnections > 0) {
+            printSlowText(options, slow);
+        }
+    }
+
+    bool failed = total.requests == 0 || total.connectErrors > 0 || total.readErrors > 0 ||
+                  total.writeErrors > 0 || total.parseErrors > 0 || slow.stillOpen > 0;
+    return failed ? 1 : 0;
+}
+
+#else
+
+int main() {
+    std::cout << "bench_load needs POSIX sockets and poll()" << std::endl;
+    return 0;
+}
+
+#endif // _WIN32
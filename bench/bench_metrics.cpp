@@ -0,0 +1,293 @@
+// Benchmark: cost of the hot-path metrics. Runs an in-process event loop on
+// a loopback listener with and without a MetricsRegistry, drives pipelined
+// keep-alive traffic at it, and reports throughput for each along with the
+// measured per-request price of the instrumentation itself.
+//
+// The instrumentation share is the figure that bounds the overhead: it times
+// everything the metrics path adds, clock reads included, against the cost
+// of a request. The end-to-end delta is reported with a 95% confidence
+// interval over paired, alternating rounds as a cross-check; loopback
+// throughput on a shared machine is noisy enough that it can only confirm
+// the bound, not replace it.
+#include "event_loop.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_EPOLL
+
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+
+constexpr int kPipelineDepth = 16;
+// Paired rounds: at least the minimum, then until the confidence interval
+// is narrower than the target or the time budget runs out
+constexpr size_t kMinRounds = 20;
+constexpr double kTargetHalfWidth = 0.5;   // Percentage points
+constexpr auto kTimeBudget = std::chrono::seconds(60);
+constexpr const char* kRequest = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+SOCKET_TYPE openLoopbackListener(int& port) {
+    SOCKET_TYPE listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SOCKET_SIZE_TYPE length = sizeof(addr);
+    if (listenSocket == INVALID_SOCKET ||
+        bind(listenSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listenSocket, 16) < 0 ||
+        getsockname(listenSocket, reinterpret_cast<struct sockaddr*>(&addr), &length) < 0) {
+        std::cerr << "Failed to open listener. Error: " << errno << std::endl;
+        return INVALID_SOCKET;
+    }
+    port = ntohs(addr.sin_port);
+    return listenSocket;
+}
+
+SOCKET_TYPE connectTo(int port) {
+    SOCKET_TYPE clientSocket = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (connect(clientSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        CLOSE_SOCKET(clientSocket);
+        return INVALID_SOCKET;
+    }
+    int one = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return clientSocket;
+}
+
+// Every response to GET / is the same size, so a batch is complete once
+// depth * size bytes have arrived
+bool runBatches(SOCKET_TYPE socket, size_t batches, size_t responseSize) {
+    char batch[kPipelineDepth * 64];
+    size_t requestLength = strlen(kRequest);
+    for (int i = 0; i < kPipelineDepth; ++i) {
+        memcpy(batch + i * requestLength, kRequest, requestLength);
+    }
+    static char buffer[256 * 1024];
+    size_t expected = responseSize * kPipelineDepth;
+
+    for (size_t b = 0; b < batches; ++b) {
+        if (send(socket, batch, requestLength * kPipelineDepth, MSG_NOSIGNAL) !=
+            static_cast<ssize_t>(requestLength * kPipelineDepth)) {
+            return false;
+        }
+        size_t received = 0;
+        while (received < expected) {
+            ssize_t n = recv(socket, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                return false;
+            }
+            received += static_cast<size_t>(n);
+        }
+    }
+    return true;
+}
+
+size_t measureResponseSize(SOCKET_TYPE socket) {
+    send(socket, kRequest, strlen(kRequest), MSG_NOSIGNAL);
+    char buffer[1024];
+    ssize_t n = recv(socket, buffer, sizeof(buffer), 0);
+    return n > 0 ? static_cast<size_t>(n) : 0;
+}
+
+// Keeps the loop and the client on fixed CPUs (the same one on a single-core
+// machine), so runs are not skewed by the scheduler moving them around
+void pinThread(pthread_t thread, int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+}
+
+int clientCpu() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 1 ? 1 : 0;
+}
+
+// One event loop on its own loopback listener and thread, with or without
+// counters, and a client connection to it. Both variants stay up for the
+// whole run so rounds can alternate between them without setup in between.
+class LoopUnderTest {
+private:
+    ServerConfig config;
+    SOCKET_TYPE listenSocket = INVALID_SOCKET;
+    SOCKET_TYPE clientSocket = INVALID_SOCKET;
+    std::atomic<bool> running{true};
+    std::unique_ptr<EventLoop> loop;
+    std::thread worker;
+    size_t responseSize = 0;
+
+public:
+    LoopUnderTest() {
+        config.keepAliveTimeoutMs = 0;
+        config.maxRequestsPerConnection = 0;
+    }
+    ~LoopUnderTest() {
+        if (clientSocket != INVALID_SOCKET) {
+            CLOSE_SOCKET(clientSocket);
+        }
+        if (worker.joinable()) {
+            running = false;
+            loop->wakeup();
+            worker.join();
+        }
+        if (listenSocket != INVALID_SOCKET) {
+            CLOSE_SOCKET(listenSocket);
+        }
+    }
+
+    bool start(MetricsRegistry* registry, size_t warmupBatches) {
+        int port = 0;
+        listenSocket = openLoopbackListener(port);
+        if (listenSocket == INVALID_SOCKET) {
+            return false;
+        }
+        loop = std::make_unique<EventLoop>(listenSocket, running, config, nullptr, nullptr, registry, nullptr);
+        if (!loop->init()) {
+            return false;
+        }
+        worker = std::thread([this]() { loop->run(); });
+        pinThread(worker.native_handle(), 0);
+        clientSocket = connectTo(port);
+        responseSize = clientSocket != INVALID_SOCKET ? measureResponseSize(clientSocket) : 0;
+        return responseSize > 0 && runBatches(clientSocket, warmupBatches, responseSize);
+    }
+
+    // Seconds to serve `batches` pipelined batches; 0 on failure
+    double time(size_t batches) {
+        auto start = std::chrono::steady_clock::now();
+        if (!runBatches(clientSocket, batches, responseSize)) {
+            return 0;
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// What one pipelined batch pays: per-request counters, the per-read and
+// per-flush byte counters, and the first-byte and response latency
+// observations with the two clock reads they need. The loop reads the clock
+// for its timeouts anyway, so counting them here overstates the cost.
+double instrumentationNsPerRequest(size_t iterations) {
+    MetricsRegistry registry;
+    WorkerMetrics* metrics = registry.acquire();
+    auto readAt = std::chrono::steady_clock::now();
+    auto start = readAt;
+    for (size_t i = 0; i < iterations; ++i) {
+        auto received = std::chrono::steady_clock::now();
+        metrics->firstByte.observe(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(received - readAt).count()));
+        for (int r = 0; r < kPipelineDepth; ++r) {
+            bumpCounter(metrics->requests);
+            metrics->countResponse(200);
+        }
+        bumpCounter(metrics->bytesIn, 592);
+        bumpCounter(metrics->bytesOut, 1232);
+        auto written = std::chrono::steady_clock::now();
+        metrics->requestLatency.observe(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(written - received).count()), kPipelineDepth);
+        readAt = written;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    registry.release(metrics);
+    return elapsed / static_cast<double>(iterations * kPipelineDepth);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    size_t batches = argc > 1 ? static_cast<size_t>(std::atol(argv[1])) : 20000;
+    pinThread(pthread_self(), clientCpu());
+
+    MetricsRegistry registry;
+    LoopUnderTest plain;
+    LoopUnderTest instrumented;
+    if (!plain.start(nullptr, batches / 10) || !instrumented.start(&registry, batches / 10)) {
+        std::cerr << "Benchmark run failed" << std::endl;
+        return 1;
+    }
+
+    // Paired rounds in alternating order, so drift (thermal, other load)
+    // hits both sides equally; each round yields one throughput delta. Loopback
+    // timings are heavy-tailed, so the summary is the median with a
+    // distribution-free 95% interval (order statistics n/2 -/+ 0.98 sqrt(n)).
+    std::vector<double> deltas;
+    std::vector<double> sorted;
+    double secondsOff = 0;
+    double median = 0;
+    double lower = 0;
+    double upper = 0;
+    auto started = std::chrono::steady_clock::now();
+    for (size_t round = 0;; ++round) {
+        double off = 0;
+        double on = 0;
+        if (round % 2 == 0) {
+            off = plain.time(batches);
+            on = instrumented.time(batches);
+        } else {
+            on = instrumented.time(batches);
+            off = plain.time(batches);
+        }
+        if (off == 0 || on == 0) {
+            std::cerr << "Benchmark run failed" << std::endl;
+            return 1;
+        }
+        secondsOff += off;
+        // Throughput ratio is the inverse of the time ratio
+        deltas.push_back((off / on - 1) * 100);
+
+        sorted = deltas;
+        std::sort(sorted.begin(), sorted.end());
+        size_t n = sorted.size();
+        double spread = 0.98 * std::sqrt(static_cast<double>(n));
+        double center = static_cast<double>(n) / 2;
+        median = sorted[n / 2];
+        lower = sorted[static_cast<size_t>(std::max(0.0, std::floor(center - spread)))];
+        upper = sorted[std::min(n - 1, static_cast<size_t>(std::ceil(center + spread)))];
+        if (n >= kMinRounds &&
+            ((upper - lower) / 2 <= kTargetHalfWidth || std::chrono::steady_clock::now() - started > kTimeBudget)) {
+            break;
+        }
+    }
+
+    double instrumentation = instrumentationNsPerRequest(2000000);
+    double meanOff = static_cast<double>(deltas.size() * batches * kPipelineDepth) / secondsOff;
+    double requestNs = 1e9 / meanOff;
+    double share = instrumentation / requestNs * 100;
+
+    printf("Pipelined GET /, depth %d, %zu paired rounds of %zu requests each way\n",
+           kPipelineDepth, deltas.size(), batches * kPipelineDepth);
+    printf("  metrics off:  %.0f requests/s (mean)\n", meanOff);
+    printf("  instrumentation: %.2f ns/request = %.3f%% of %.0f ns/request\n",
+           instrumentation, share, requestNs);
+    printf("  end-to-end with metrics: %+.2f%% median, 95%% CI [%+.2f%%, %+.2f%%]\n", median, lower, upper);
+    printf("Overhead bound (instrumentation share): %.3f%% -> %s the 1%% budget\n",
+           share, share < 1 ? "within" : "OVER");
+    printf("End-to-end cross-check: CI %s inside +/-1%%\n",
+           lower >= -1 && upper <= 1 ? "lies" : "does NOT lie");
+    return share < 1 ? 0 : 1;
+}
+
+#else
+
+int main() {
+    std::cout << "Skipped: the metrics benchmark drives the epoll event loop" << std::endl;
+    return 0;
+}
+
+#endif // HAVE_EPOLL
@@ -0,0 +1,95 @@
+// Benchmark: scalar vs. SSE4.2 vs. AVX2 delimiter scanning, both as a raw
+// kernel and inside HTTPRequest::parse(), over browser-sized header blocks.
+// Reports GB/s of request bytes processed.
+#include "http_request.h"
+#include "simd_scan.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Headers a desktop browser typically sends, padded with cookies and
+// client hints until the block reaches `targetSize` bytes
+std::string browserRequest(size_t targetSize) {
+    std::string request =
+        "GET /assets/css/main.min.css?v=7f3c2a HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+        "Accept: text/css,*/*;q=0.1\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: en-GB,en-US;q=0.9,en;q=0.8\r\n"
+        "Referer: https://www.example.com/products/widgets?page=2&sort=price\r\n";
+
+    static const char* kFillers[] = {
+        "sec-ch-ua: \"Not_A Brand\";v=\"8\", \"Chromium\";v=\"120\", \"Google Chrome\";v=\"120\"\r\n",
+        "Cookie: _ga=GA1.1.1234567890.1700000000; _gid=GA1.1.987654321.1700000000; "
+        "session_id=9c1f2e7a4b3d8c6e5f0a1b2c3d4e5f60; cart=%7B%22items%22%3A3%7D\r\n",
+        "X-Request-ID: 6f1c2b8e-4d3a-4f6b-9e2d-1a7c3b5d9e0f\r\n",
+    };
+
+    size_t next = 0;
+    while (request.size() + 2 < targetSize) {
+        request += kFillers[next++ % 3];
+    }
+    return request + "\r\n";
+}
+
+template <typename Fn>
+double gigabytesPerSecond(size_t bytesPerIteration, size_t iterations, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        fn();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(bytesPerIteration) * static_cast<double>(iterations) / seconds / 1e9;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? static_cast<size_t>(std::atol(argv[1])) : 200000;
+    volatile size_t sink = 0;
+
+    std::vector<simd::Level> levels;
+    for (simd::Level level : {simd::Level::Scalar, simd::Level::SSE42, simd::Level::AVX2}) {
+        if (simd::setLevel(level)) {
+            levels.push_back(level);
+        }
+    }
+    simd::Level best = simd::bestSupportedLevel();
+
+    std::cout << "Best supported kernel: " << simd::levelName(best) << std::endl;
+
+    for (size_t size : {500, 1024, 2048, 4096}) {
+        std::string request = browserRequest(size);
+        // Header values only: the longest run the value kernel sees per call
+        std::string value(request.size(), 'a');
+
+        std::cout << "\nHeader block " << request.size() << " bytes" << std::endl;
+        for (simd::Level level : levels) {
+            simd::setLevel(level);
+
+            double kernel = gigabytesPerSecond(value.size(), iterations, [&]() {
+                sink = sink + simd::findFirstNotIn(simd::kFieldValueChars, value.data(), value.size());
+            });
+
+            double parse = gigabytesPerSecond(request.size(), iterations, [&]() {
+                HTTPRequest parsed;
+                parsed.parse(request);
+                sink = sink + parsed.getHeaderCount();
+            });
+
+            std::cout << "  " << simd::levelName(level) << ":\tkernel " << kernel
+                      << " GB/s\tparse " << parse << " GB/s" << std::endl;
+        }
+    }
+
+    simd::setLevel(best);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// One access log line, fixed-size so rings are preallocated and filled in
+// place. Formatting happens on the drain thread.
+struct AccessLogRecord {
+    static constexpr size_t kMaxMethod = 16;
+    static constexpr size_t kMaxPath = 208;
+
+    int64_t finishedNs;     // steady_clock time the response was queued
+    uint64_t bytes;         // Response bytes queued
+    uint32_t latencyUs;     // From the read that completed the request
+    uint32_t peerAddress;   // IPv4, network byte order
+    uint16_t peerPort;
+    uint16_t status;
+    uint8_t minorVersion;
+    uint8_t methodLength;
+    uint16_t pathLength;    // Before truncation to kMaxPath
+    char method[kMaxMethod];
+    char path[kMaxPath];
+};
+
+struct AccessLogStats {
+    uint64_t records = 0;   // Accepted into a ring
+    uint64_t dropped = 0;   // Sampled but lost to a full ring
+};
+
+// Single-producer, single-consumer ring owned by one request-handling thread
+// and drained by the log's background thread. The producer never blocks or
+// locks: when the drain falls behind, records are dropped and counted.
+class AccessLogRing {
+private:
+    friend class AccessLog;
+
+    // Consumer and producer positions live on separate cache lines
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    size_t cachedHead;        // Producer's last view of head
+    uint32_t sampleCountdown;
+    std::atomic<uint64_t> records;
+    std::atomic<uint64_t> dropped;
+    const uint32_t sampleEvery;
+    const size_t mask;
+    std::unique_ptr<AccessLogRecord[]> slots;
+
+public:
+    AccessLogRing(size_t capacity, uint32_t sampleEvery);
+
+    AccessLogRing(const AccessLogRing&) = delete;
+    AccessLogRing& operator=(const AccessLogRing&) = delete;
+
+    // True for every sampleEvery-th request
+    bool sample() {
+        if (--sampleCountdown > 0) {
+            return false;
+        }
+        sampleCountdown = sampleEvery;
+        return true;
+    }
+
+    // Next free slot to fill, or null (counted as a drop) when the ring is full
+    AccessLogRecord* reserve();
+    // Hand the slot from reserve() to the drain thread
+    void publish();
+};
+
+// Access log written in batches by one background thread. Every thread that
+// handles requests takes a ring with acquireRing() and gives it back with
+// releaseRing(); released rings are reused, so threads mode needs only as
+// many rings as it has concurrent clients.
+class AccessLog {
+private:
+    const std::string path;
+    const size_t ringCapacity;
+    const uint32_t sampleEvery;
+    FILE* file;
+    // Maps record timestamps (steady_clock) onto wall-clock time
+    int64_t steadyToSystemNs;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::vector<std::unique_ptr<AccessLogRing>> rings;
+    std::vector<AccessLogRing*> freeRings;
+    std::thread drainThread;
+
+    // Formatted lines waiting for fwrite; capacity is kept across batches
+    std::string batch;
+    // The rings one drain pass walks, copied under the mutex so that it is
+    // never held during formatting or file I/O (threads mode takes it for
+    // every connection)
+    std::vector<AccessLogRing*> draining;
+
+    size_t drain();
+    void format(const AccessLogRecord& record);
+    void drainLoop();
+
+public:
+    static constexpr size_t kDefaultRingCapacity = 4096;
+
+    // `path` "-" writes to stdout. Logs one request in `sampleEvery`.
+    AccessLog(const std::string& path, uint32_t sampleEvery,
+              size_t ringCapacity = kDefaultRingCapacity);
+    ~AccessLog();
+
+    AccessLog(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+
+    bool start();
+    // Drain what is left and close the file. Producers must have stopped.
+    void stop();
+
+    AccessLogRing* acquireRing();
+    void releaseRing(AccessLogRing* ring);
+
+    AccessLogStats getStats();
+};
+
+// Fill in and publish one record if this request is sampled
+void logAccess(AccessLogRing* ring, uint32_t peerAddress, uint16_t peerPort,
+               std::string_view method, std::string_view path, int minorVersion,
+               int status, size_t bytes, std::chrono::steady_clock::time_point received);
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+struct BufferPoolStats {
+    size_t blockSize = 0;
+    size_t slabs = 0;
+    size_t totalBlocks = 0;
+    size_t blocksInUse = 0;
+    size_t peakBlocksInUse = 0;
+};
+
+// Fixed-size blocks carved out of large slabs. Owned by one thread (an event
+// loop or a client thread), so acquire/release take no lock; once the pool
+// has grown to its working size they never touch the heap again. Slabs are
+// only freed with the pool. Occupancy counters may be read from any thread.
+class BufferPool {
+private:
+    const size_t blockSize;
+    const size_t blocksPerSlab;
+    std::vector<std::unique_ptr<char[]>> slabs;
+    std::vector<char*> freeBlocks;
+    std::atomic<size_t> totalBlocks;
+    std::atomic<size_t> blocksInUse;
+    std::atomic<size_t> peakBlocksInUse;
+
+    void grow();
+
+public:
+    static constexpr size_t kDefaultBlockSize = 16 * 1024;
+    static constexpr size_t kDefaultBlocksPerSlab = 64;
+
+    explicit BufferPool(size_t blockSize = kDefaultBlockSize,
+                        size_t blocksPerSlab = kDefaultBlocksPerSlab);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    char* acquire();
+    void release(char* block);
+
+    size_t getBlockSize() const { return blockSize; }
+    BufferPoolStats getStats() const;
+};
+
+// Receive buffer for one connection, backed by a single pool block. The
+// block is held only while unconsumed bytes remain, so idle keep-alive
+// connections cost no buffer memory.
+class InputBuffer {
+private:
+    BufferPool& pool;
+    char* block;
+    size_t start;   // First unconsumed byte
+    size_t end;     // One past the last received byte
+
+public:
+    explicit InputBuffer(BufferPool& pool) : pool(pool), block(nullptr), start(0), end(0) {}
+    ~InputBuffer();
+
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer& operator=(const InputBuffer&) = delete;
+
+    std::string_view view() const { return std::string_view(block + start, end - start); }
+    size_t size() const { return end - start; }
+    bool empty() const { return start == end; }
+    bool full() const { return size() == pool.getBlockSize(); }
+
+    // Bytes writePointer() would offer, without acquiring a block
+    size_t writableSize() const { return pool.getBlockSize() - size(); }
+    // Space to receive into, acquiring a block or compacting as needed.
+    // Sets `available` to 0 when the buffer is full.
+    char* writePointer(size_t& available);
+    // Mark `count` bytes at writePointer() as received
+    void commit(size_t count);
+    // Drop `count` bytes from the front; the block goes back to the pool when empty
+    void consume(size_t count);
+    // Slide the contents to the start of the block, so later reads never move them
+    void compact();
+    // Remove `count` bytes starting `offset` bytes in, closing the gap
+    void erase(size_t offset, size_t count);
+};
+
+// Bump allocator for the bytes of queued responses. Allocations live until
+// reset(), which returns every block to the pool. Requests larger than a
+// block fall back to the heap.
+class Arena {
+private:
+    BufferPool& pool;
+    std::vector<char*> blocks;
+    std::vector<std::unique_ptr<char[]>> oversized;
+    size_t used;   // Bytes taken from blocks.back()
+
+public:
+    explicit Arena(BufferPool& pool) : pool(pool), used(0) {}
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    char* allocate(size_t size);
+    // Grow the most recent allocation, which ends at `end`, by `size` bytes.
+    // Returns false (and changes nothing) if it cannot grow in place.
+    bool extend(const char* end, size_t size);
+    void reset();
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Content codings the server can produce. gzip needs zlib (HAVE_ZLIB) and
+// br needs libbrotlienc (HAVE_BROTLI); without them only identity is offered.
+enum class ContentEncoding : uint8_t { Identity, Gzip, Brotli };
+
+// Bit per ContentEncoding, for the set a response can be offered in
+constexpr unsigned encodingBit(ContentEncoding encoding) { return 1u << static_cast<unsigned>(encoding); }
+
+// Token for the Content-Encoding header; empty for identity
+const char* contentEncodingName(ContentEncoding encoding);
+// File name suffix of a precompressed sibling (".gz", ".br"); empty for identity
+const char* contentEncodingSuffix(ContentEncoding encoding);
+// Encodings this build can compress with
+unsigned availableEncodings();
+
+// The coding `acceptEncoding` ranks highest among `offered` (RFC 9110
+// section 12.5.3): q-values first, then br over gzip. Identity when nothing
+// offered is acceptable or the header is absent.
+ContentEncoding negotiateEncoding(std::string_view acceptEncoding, unsigned offered);
+
+// Text-like media types worth compressing; images, fonts and archives
+// are compressed already
+bool isCompressible(std::string_view contentType);
+
+// Compression levels: zlib 1-9, brotli quality 0-11. The defaults trade a
+// little ratio for speed, since bodies are compressed on the request path.
+constexpr int kGzipLevel = 6;
+constexpr int kBrotliQuality = 5;
+
+// Compresses a whole body into `output` (replacing its contents). False if
+// the encoding is unavailable or the library fails.
+bool compressBuffer(ContentEncoding encoding, std::string_view input, std::string& output,
+                    int level = -1);
+
+// Incremental compressor for bodies produced in pieces. Output is appended
+// to the string passed in, so the caller decides when to send it.
+class StreamCompressor {
+public:
+    enum class Mode {
+        Process,   // Buffer freely for the best ratio
+        Flush,     // Everything so far is decodable by the client
+        Finish     // End of the body
+    };
+
+    virtual ~StreamCompressor() = default;
+    virtual bool write(std::string_view input, Mode mode, std::string& output) = 0;
+
+    // Null if the encoding is unavailable
+    static std::unique_ptr<StreamCompressor> create(ContentEncoding encoding, int level = -1);
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "server_config.h"
+
+#include <string>
+
+// Sets one option by its command-line name without the dashes ("port",
+// "keepalive-timeout", "pin-cpus", ...). False with `error` set if the name
+// is unknown or the value does not parse.
+bool applyConfigOption(const std::string& name, const std::string& value, ServerConfig& config,
+                       std::string& error);
+
+// Reads `name = value` lines into `config`, using the same names as
+// applyConfigOption. Blank lines and anything after '#' are ignored, and a
+// value may be quoted. Options not in the file keep their current value. The
+// file is read again on every reload, so it is the place for settings meant
+// to change without a restart.
+bool loadConfigFile(const std::string& path, ServerConfig& config, std::string& error);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+
+// Counters that one thread writes and others only read (statistics,
+// /metrics). With a single writer a relaxed load and store is enough, and
+// avoids the locked read-modify-write of fetch_add.
+template <typename T>
+inline void bumpCounter(std::atomic<T>& counter, std::type_identity_t<T> delta = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+template <typename T>
+inline void dropCounter(std::atomic<T>& counter, std::type_identity_t<T> delta = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) - delta, std::memory_order_relaxed);
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "platform.h"
+
+#ifdef HAVE_EPOLL
+
+#include "buffer_pool.h"
+#include "http_handler.h"
+#include "response_queue.h"
+#include "server_config.h"
+#include "timer_wheel.h"
+#include "tls.h"
+#include "worker_loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+class AccessLog;
+class AccessLogRing;
+class FileCache;
+class MetricsRegistry;
+class ResponseCache;
+class Router;
+struct WorkerMetrics;
+
+// Per-connection state machine driven by the event loop:
+// Reading -> (complete requests parsed) -> Writing -> Reading (keep-alive) or Closing.
+// Waiting means a routed handler is parked on a timer or a socket of its own,
+// with everything it queued already written; it goes back to Writing when resumed.
+// A Closing connection stays registered only while MSG_ZEROCOPY sends are in flight.
+// One timer per connection enforces whichever deadline its state implies
+// (see EventLoop::armTimer).
+struct Connection {
+    enum class State { Reading, Writing, Waiting, Closing };
+
+    SOCKET_TYPE socket;
+    State state;
+    InputBuffer inBuffer;
+    ResponseQueue output;
+    PipelineState pipeline;
+    bool peerClosed;
+    // Stopped draining the socket because inBuffer filled up mid-write
+    bool readPaused;
+    // No request byte received yet; lastActivity is still the accept time
+    bool awaitingFirstByte;
+    // Responses queued by the last serviceRequests() and when their requests were read
+    size_t responsesPending;
+    std::chrono::steady_clock::time_point requestsReadAt;
+    // Bytes still in the kernel send queue when a lingering close last checked
+    size_t lingerQueued;
+    // Last read, or last write that made progress
+    std::chrono::steady_clock::time_point lastActivity;
+    // When the first byte of the (partial) request at the front of the input
+    // arrived, or the accept time before the first request
+    std::chrono::steady_clock::time_point requestStartedAt;
+    TimerNode timer;
+    // Set for connections from the TLS listener; all I/O goes through it
+    std::unique_ptr<TlsStream> tls;
+
+    Connection(SOCKET_TYPE socket, BufferPool& pool)
+        : socket(socket), state(State::Reading), inBuffer(pool), output(pool),
+          peerClosed(false), readPaused(false), awaitingFirstByte(true), responsesPending(0),
+          lingerQueued(SIZE_MAX) {
+        timer.owner = this;
+    }
+};
+
+// Single-threaded, edge-triggered epoll reactor. Every socket is non-blocking
+// and registered once for both read and write readiness, so the loop never
+// has to re-arm interest with epoll_ctl between state transitions.
+class EventLoop : public WorkerLoop {
+private:
+    SOCKET_TYPE listenSocket;
+    // Optional second listener whose connections speak TLS
+    SOCKET_TYPE tlsListenSocket;
+    const TlsContext* tlsContext;
+    std::atomic<bool>& running;
+    const ServerConfig& config;
+    int epollFd;
+    int wakeFd;
+    // This worker's share of config.maxConnections; 0 = unlimited
+    size_t connectionLimit;
+    // Input buffers and response arenas for every connection on this loop,
+    // and the timers linked through them; declared before the connections
+    // so they outlive them
+    BufferPool pool;
+    TimerWheel timers;
+    std::unordered_map<SOCKET_TYPE, std::unique_ptr<Connection>> connections;
+    // Set by drain() from any thread; run() then stops accepting
+    std::atomic<bool> drainRequested;
+    bool draining;
+    // Ends a drain that outlasts config.drainTimeoutMs
+    TimerNode drainTimer;
+    // Accepting again after a failure that left connections queued, since
+    // the edge-triggered listeners are not reported again until a new one
+    TimerNode acceptTimer;
+    SpareDescriptor spare;
+    // Per-worker open-file cache when serving a document root
+    std::unique_ptr<FileCache> files;
+    // Owned by the server and shared with the other workers; may be null
+    ResponseCache* responses;
+    AccessLog* accessLog;
+    // This loop's producer ring in accessLog
+    AccessLogRing* accessLogRing;
+    // Counters live in the server's registry so /metrics can sum them; may be null
+    MetricsRegistry* metricsRegistry;
+    WorkerMetrics* metrics;
+    // Shared, read-only route table; may be null
+    const Router* router;
+    // Parked handlers polling their own sockets, by fd
+    std::unordered_map<int, Connection*> handlerSockets;
+
+public:
+    EventLoop(SOCKET_TYPE listenSocket, std::atomic<bool>& running, const ServerConfig& config,
+              ResponseCache* responses, AccessLog* accessLog, MetricsRegistry* metricsRegistry,
+              const Router* router);
+    ~EventLoop() override;
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Also accept TLS connections on `socket`; call before init()
+    void addTlsListener(SOCKET_TYPE socket, const TlsContext* context);
+
+    bool init() override;
+    void run() override;
+
+    // Break out of epoll_wait from another thread (used by stop())
+    void wakeup() override;
+    void drain() override;
+
+    size_t connectionCount() const { return connections.size(); }
+    const WorkerMetrics* getMetrics() const override { return metrics; }
+    BufferPoolStats getPoolStats() const override { return pool.getStats(); }
+
+private:
+    void acceptConnections(SOCKET_TYPE listener);
+    void beginDrain();
+    // Closes every connection, lingering ones included
+    void closeAll();
+    void handleRead(Connection& conn);
+    void handleWrite(Connection& conn);
+    // Each returns false once the connection has been closed (conn is dangling)
+    bool fillInput(Connection& conn);
+    bool serviceRequests(Connection& conn);
+    bool flushOutput(Connection& conn);
+    size_t runPipeline(Connection& conn);
+    void parkHandler(Connection& conn);
+    void unparkHandler(Connection& conn);
+    void resumeHandler(Connection& conn);
+    // Fires due timers; returns ms until the next one, or -1
+    int runTimers();
+    void armTimer(Connection& conn);
+    void expireTimer(Connection& conn);
+    bool stillDraining(Connection& conn);
+    void closeConnection(Connection& conn);
+};
+
+#endif // HAVE_EPOLL
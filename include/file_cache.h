@@ -0,0 +1,115 @@
+#pragma once
+
+#include "compression.h"
+#include "platform.h"
+
+#ifdef HAVE_STATIC_FILES
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+// An open file plus everything needed to answer for it without touching
+// the filesystem again. The descriptor stays open while any in-flight
+// response still references the entry, even after eviction.
+struct CachedFile {
+    std::string path;            // Absolute path, used to revalidate
+    int fd = -1;
+    off_t size = 0;
+    time_t modified = 0;
+    dev_t device = 0;
+    ino_t inode = 0;
+    std::string etag;            // Quoted strong validator
+    std::string lastModified;    // IMF-fixdate
+    const char* contentType = "";
+    // Content-Type, Content-Length, Last-Modified and ETag lines (plus
+    // Content-Encoding and Vary where they apply), each CRLF-terminated
+    std::string headers;
+
+    // Codings a response for this file may use (bit per ContentEncoding):
+    // those with a precompressed sibling, plus every available one when
+    // the file is worth compressing on the fly
+    unsigned encodings = 0;
+    // Siblings such as "app.js.br", indexed by ContentEncoding; each is an
+    // ordinary entry with its own size and validators
+    std::shared_ptr<const CachedFile> precompressed[3];
+    // ETags of the variants compressed on the fly, indexed by ContentEncoding
+    std::string encodedEtags[3];
+
+    CachedFile() = default;
+    CachedFile(const CachedFile&) = delete;
+    CachedFile& operator=(const CachedFile&) = delete;
+    ~CachedFile();
+};
+
+// Map a request-target onto a path relative to the document root.
+// Drops the query string, percent-decodes, removes "." and empty segments
+// and maps a trailing '/' to index.html. Returns false for targets that
+// are malformed, contain a backslash or NUL (decoded or not), or try to
+// climb out of the root with "..".
+bool resolveRequestPath(std::string_view target, std::string& relativePath);
+
+const char* contentTypeFor(std::string_view path);
+
+// True if the If-None-Match value lists `etag` or is "*". Tags compare
+// whole, with any W/ prefix ignored on either side: the weak comparison
+// that If-None-Match calls for (RFC 9110 section 13.1.2).
+bool etagMatches(std::string_view ifNoneMatch, std::string_view etag);
+
+// LRU cache of open file descriptors and their precomputed headers, keyed by
+// request path with the query string removed. A hit costs no open() or
+// stat(); entries are re-stat'ed at most once per revalidate interval to
+// pick up changes on disk. Missing paths are remembered for the same
+// interval, so repeated 404s skip the filesystem too.
+class FileCache {
+public:
+    enum class Status { Found, NotFound, Forbidden };
+
+private:
+    struct Entry {
+        std::shared_ptr<const CachedFile> file;   // Null for a path known not to exist
+        std::list<std::string>::iterator lruPosition;
+        std::chrono::steady_clock::time_point validatedAt;
+    };
+
+    std::string root;   // realpath() of the document root
+    size_t capacity;
+    std::chrono::milliseconds revalidateInterval;
+    // Smallest file compressed on the fly; 0 = only precompressed siblings
+    size_t compressMinimum;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;   // Most recently used first
+    std::string probe;            // Lookup key scratch, guarded by mutex
+    std::mutex mutex;
+
+    std::shared_ptr<const CachedFile> load(const std::string& relativePath, Status& status);
+    std::shared_ptr<const CachedFile> loadSibling(const CachedFile& original, ContentEncoding encoding);
+    bool stillCurrent(const CachedFile& file);
+    void insert(const std::string& target, std::shared_ptr<const CachedFile> file);
+
+public:
+    // Files larger than this are only served compressed from a sibling:
+    // compressing them per request would cost more than it saves
+    static constexpr off_t kMaxCompressOnTheFly = 256 * 1024;
+
+    FileCache(size_t capacity, int revalidateMs, int compressMinBytes = 0);
+
+    FileCache(const FileCache&) = delete;
+    FileCache& operator=(const FileCache&) = delete;
+
+    // Resolve the document root; false if it does not exist
+    bool init(const std::string& documentRoot);
+
+    std::shared_ptr<const CachedFile> lookup(std::string_view target, Status& status);
+
+    size_t size();
+};
+
+#endif // HAVE_STATIC_FILES
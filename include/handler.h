@@ -0,0 +1,440 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "compression.h"
+#include "response_queue.h"
+
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+class HTTPRequest;
+
+// What a suspended handler is waiting for. The worker running it satisfies
+// the wait (flushes the connection, lets the timer expire, polls the fd) and
+// then resumes `resume`, which is the innermost awaiting coroutine.
+struct HandlerWait {
+    enum class Kind {
+        None,
+        Flush,      // Everything queued on the connection has been written
+        Timer,      // steady_clock reached `deadline`
+        Readable,   // `fd` is readable (or has an error/hangup)
+        Writable,   // `fd` is writable (or has an error/hangup)
+        Body        // More of the request body has arrived (or the peer closed)
+    };
+
+    Kind kind = Kind::None;
+    // When a Timer wait ends. A Readable or Writable wait with a deadline
+    // (any but the epoch) is also resumed once it passes, ready or not.
+    std::chrono::steady_clock::time_point deadline;
+    int fd = -1;
+    std::coroutine_handle<> resume;
+
+    bool hasDeadline() const { return deadline != std::chrono::steady_clock::time_point(); }
+};
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+struct TaskPromiseBase {
+    // Resumed when this task finishes; null for a handler the worker started
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    // Lazy: nothing runs until the task is awaited or started
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            std::coroutine_handle<> next = handle.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+};
+
+}
+
+// Coroutine result for handlers and anything they co_await. Awaiting a Task
+// runs it to completion (across any number of suspensions) and yields its
+// value, rethrowing what it threw.
+template <typename T = void>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+public:
+    Task() = default;
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    explicit operator bool() const { return static_cast<bool>(handle); }
+    bool done() const { return handle.done(); }
+    std::coroutine_handle<> getHandle() const { return handle; }
+    std::exception_ptr getError() const { return handle.promise().error; }
+
+    bool await_ready() const noexcept { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+    T await_resume() {
+        if (handle.promise().error) {
+            std::rethrow_exception(handle.promise().error);
+        }
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*handle.promise().value);
+        }
+    }
+};
+
+template <typename T>
+Task<T> detail::TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// Canonical reason phrase for a status code ("Unknown" if unlisted)
+const char* statusReason(int status);
+
+// A handler's response, serialized straight into the connection's queue.
+// Either send() a whole body, or begin() with the body length and write()
+// it in pieces, co_awaiting RequestContext::flush() in between to hand
+// each piece to the socket before producing the next. When the length is
+// not known up front, beginStream() instead: each write() becomes a chunk,
+// and end() (or the handler returning) terminates the body.
+//
+// Bodies are compressed when the client accepts it (see setCompression()):
+// a send() of at least the threshold, and every beginStream() body, of a
+// compressible type. Setting a Content-Encoding header opts out.
+class Response {
+public:
+    enum class Framing : uint8_t {
+        Length,    // Content-Length
+        Chunked,   // Transfer-Encoding: chunked (HTTP/1.1 clients)
+        Close,     // Delimited by closing the connection (HTTP/1.0 clients)
+        None       // No body, whatever the head says (see sendHead())
+    };
+
+private:
+    ResponseQueue& output;
+    // Connection header matching the keep-alive decision for this request
+    const char* connectionHeader;
+    std::string headers;
+    int status;
+    bool started;
+    bool ended;
+    bool continued;
+    // Whether the client understands chunked responses (HTTP/1.1)
+    bool chunkedAllowed;
+    Framing framing;
+    // Body bytes announced by Content-Length and not yet written
+    size_t remaining;
+    size_t bytes;
+    // Best coding the client accepts; compression is off while minimum is 0
+    ContentEncoding accepted;
+    size_t compressMinimum;
+    bool encodedByHandler;
+    // Set while a streamed body is being compressed
+    std::unique_ptr<StreamCompressor> compressor;
+    std::string compressed;
+
+    void appendHead(size_t contentLength, std::string_view contentType);
+    void appendBody(std::string_view data);
+    void appendHeader(std::string_view name, std::string_view value);
+    // Adds Vary and returns whether to compress a body of this type
+    bool negotiate(std::string_view contentType);
+
+public:
+    Response(ResponseQueue& output, const char* connectionHeader, bool chunkedAllowed)
+        : output(output), connectionHeader(connectionHeader), status(200), started(false),
+          ended(false), continued(false), chunkedAllowed(chunkedAllowed), framing(Framing::Length), remaining(0),
+          bytes(0), accepted(ContentEncoding::Identity), compressMinimum(0), encodedByHandler(false) {}
+
+    // The coding the client accepts and the smallest send() body worth
+    // compressing; set by the server before the handler runs. A minimum of
+    // 0 turns compression off.
+    void setCompression(ContentEncoding encoding, size_t minimum) {
+        accepted = encoding;
+        compressMinimum = minimum;
+    }
+
+    // Both only take effect before the head is queued
+    void setStatus(int code) { status = code; }
+    void setHeader(std::string_view name, std::string_view value);
+
+    void send(std::string_view body, std::string_view contentType = "text/plain");
+    void begin(size_t contentLength, std::string_view contentType = "text/plain");
+    void beginStream(std::string_view contentType = "text/plain");
+    // The whole response for one that never has a body: an answer to HEAD,
+    // a 1xx, 204 or 304. `contentLength` is the length a GET would have
+    // had, sent as is; without one the head has no Content-Length (a 204
+    // must not carry one).
+    void sendHead(std::optional<uint64_t> contentLength, std::string_view contentType = {});
+    // Bytes past the announced length are dropped
+    void write(std::string_view data);
+    #ifdef HAVE_SPLICE
+    // Whether writePipe() may be used: a begin() body on a plain socket
+    bool canSplice() const { return started && framing == Framing::Length && output.spliceEnabled(); }
+    // Like write() for `length` bytes already in `pipe`; they are spliced to
+    // the socket without passing through user space
+    void writePipe(std::shared_ptr<SplicePipe> pipe, size_t length);
+    #endif
+    // Terminates a streamed body; a no-op otherwise
+    void end();
+    // Pushes out what a stream compressor is holding back, so the client
+    // can decode everything written so far
+    void flush();
+    // "100 Continue" ahead of the final response; ignored once the head is queued
+    void sendContinue();
+
+    int getStatus() const { return status; }
+    Framing getFraming() const { return framing; }
+    bool headSent() const { return started; }
+    bool complete() const { return started && (framing == Framing::Length ? remaining == 0 : ended); }
+    // Head and body bytes queued so far
+    size_t getBytes() const { return bytes; }
+    // Bytes queued on the connection and not yet written to the socket
+    size_t queuedBytes() const { return output.size(); }
+};
+
+// Decodes the request body in place in the connection's input buffer, which
+// holds the request head followed by whatever body bytes have arrived.
+// Pieces are views into that buffer. Once more input is needed, the bytes of
+// pieces already handed out and of chunk framing are erased, so a body of
+// any size passes through one buffer block.
+class BodyReader {
+public:
+    enum class Status {
+        Piece,       // `piece` holds the next bytes of the body
+        End,         // The body is complete
+        NeedInput,   // Read more from the socket, then call next() again
+        Error        // Bad chunk framing, over the size limit, or the peer closed early
+    };
+
+    // Longest chunk-size or trailer line, and all trailer lines together
+    static constexpr size_t kMaxLineLength = 1024;
+    static constexpr size_t kMaxTrailerBytes = 8192;
+
+private:
+    enum class Stage : uint8_t { SizeLine, Data, DataEnd, Trailers, Done, Failed };
+
+    InputBuffer* input = nullptr;
+    size_t headLength = 0;
+    // Bytes after the head already decoded (handed-out pieces and framing)
+    size_t consumed = 0;
+    Stage stage = Stage::Done;
+    bool chunked = false;
+    bool inputClosed = false;
+    bool tooLarge = false;
+    // Bytes left in the current chunk, or in a Content-Length body
+    uint64_t remaining = 0;
+    uint64_t received = 0;
+    uint64_t limit = 0;
+    size_t trailerBytes = 0;
+
+    Status fail() {
+        stage = Stage::Failed;
+        return Status::Error;
+    }
+    Status needInput();
+    // Offset just past the next line terminator in `data`, 0 if incomplete
+    size_t lineEnd(std::string_view data);
+
+public:
+    // `buffer` starts with the request's head and must not be compacted or
+    // consumed until the body is finished. maxBytes 0 = unlimited.
+    void begin(InputBuffer& buffer, const HTTPRequest& request, uint64_t maxBytes);
+    Status next(std::string_view& piece);
+    // Decode and drop the rest of the body; false unless it reached the end
+    bool skip();
+
+    // Set by the worker once the peer has stopped sending
+    void setInputClosed() { inputClosed = true; }
+    bool complete() const { return stage == Stage::Done; }
+    bool failed() const { return stage == Stage::Failed; }
+    bool isTooLarge() const { return tooLarge; }
+    // Body bytes handed out so far
+    uint64_t getReceived() const { return received; }
+    // Bytes at the front of the input that belong to the request
+    size_t requestBytes() const { return headLength + consumed; }
+};
+
+// Values of a matched route's `{name}` segments, in route order. Names point
+// into the Router and values into the request, so filling it never allocates.
+class RouteParameters {
+public:
+    static constexpr size_t kMaxParameters = 8;
+
+private:
+    std::array<std::string_view, kMaxParameters> names;
+    std::array<std::string_view, kMaxParameters> values;
+    size_t count = 0;
+
+public:
+    void clear() { count = 0; }
+    void add(std::string_view name, std::string_view value) {
+        if (count < kMaxParameters) {
+            names[count] = name;
+            values[count++] = value;
+        }
+    }
+    // Empty if the route has no such parameter
+    std::string_view get(std::string_view name) const {
+        for (size_t i = 0; i < count; ++i) {
+            if (names[i] == name) {
+                return values[i];
+            }
+        }
+        return {};
+    }
+    size_t size() const { return count; }
+};
+
+// Handed to a route's handler. The request's views stay valid until the
+// handler finishes: the connection reads nothing more until then.
+class RequestContext {
+private:
+    struct Awaiter {
+        HandlerWait& wait;
+        HandlerWait next;
+
+        // Set when there is nothing to wait for
+        bool ready;
+
+        bool await_ready() const noexcept { return ready; }
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            wait = next;
+            wait.resume = handle;
+        }
+        void await_resume() noexcept { wait = HandlerWait(); }
+    };
+
+    Awaiter waitFor(HandlerWait::Kind kind, int fd = -1,
+                    std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+        HandlerWait next;
+        next.kind = kind;
+        next.fd = fd;
+        if (timeout.count() > 0) {
+            next.deadline = std::chrono::steady_clock::now() + timeout;
+        }
+        return Awaiter{wait, next, false};
+    }
+
+public:
+    // Queued body bytes past which stream() waits for the socket
+    static constexpr size_t kStreamHighWater = 64 * 1024;
+
+    const HTTPRequest& request;
+    const RouteParameters& parameters;
+    // The request body; readBody() is the usual way in
+    BodyReader& body;
+    Response response;
+    // Set while suspended; read by the worker
+    HandlerWait wait;
+    // Client IPv4 address in network byte order; 0 where the engine does not know it
+    uint32_t peerAddress = 0;
+
+    RequestContext(const HTTPRequest& request, const RouteParameters& parameters, BodyReader& body,
+                   ResponseQueue& output, const char* connectionHeader);
+
+    // Request path without the query string, and the query string alone
+    std::string_view path() const;
+    std::string_view query() const;
+    // Value of `name` in the query string (not percent-decoded); empty if absent
+    std::string_view queryParameter(std::string_view name) const;
+    // Path segment captured by `{name}` in the route (not percent-decoded)
+    std::string_view pathParameter(std::string_view name) const { return parameters.get(name); }
+
+    // co_await these. Everything queued on the response is written before
+    // the worker starts waiting, so data goes out ahead of a slow step.
+    Awaiter flush() {
+        response.flush();
+        return waitFor(HandlerWait::Kind::Flush);
+    }
+    Awaiter sleepFor(std::chrono::milliseconds duration) {
+        Awaiter awaiter = waitFor(HandlerWait::Kind::Timer);
+        awaiter.next.deadline = std::chrono::steady_clock::now() + duration;
+        return awaiter;
+    }
+    // For the handler's own non-blocking sockets (e.g. a backend connection);
+    // resume and retry the read or write that returned EAGAIN. A timeout
+    // (0 = none) resumes it regardless once it runs out, and the retry
+    // reports EAGAIN again.
+    Awaiter readable(int fd, std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+        return waitFor(HandlerWait::Kind::Readable, fd, timeout);
+    }
+    Awaiter writable(int fd, std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+        return waitFor(HandlerWait::Kind::Writable, fd, timeout);
+    }
+
+    // Writes `data` and, once more than kStreamHighWater bytes are queued,
+    // suspends until the socket has taken them: a producer of any size holds
+    // about that much in memory and runs at the speed of the client
+    Awaiter stream(std::string_view data) {
+        response.write(data);
+        Awaiter awaiter = waitFor(HandlerWait::Kind::Flush);
+        awaiter.ready = response.queuedBytes() <= kStreamHighWater;
+        return awaiter;
+    }
+
+    // The next piece of the request body, read from the socket as needed;
+    // empty once the body is over. A piece is valid until the next call.
+    // Afterwards bodyComplete() tells a full body from a truncated or
+    // malformed one (body.isTooLarge() for one over the size limit).
+    Task<std::string_view> readBody();
+    bool bodyComplete() const { return body.complete(); }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "handler.h"
+#include "http_request.h"
+#include "response_queue.h"
+#include "server_config.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+class AccessLogRing;
+class FileCache;
+class MetricsRegistry;
+class ResponseCache;
+class Router;
+class TlsStream;
+struct WorkerMetrics;
+
+// Everything request handling needs beyond the request itself
+struct HandlerContext {
+    const ServerConfig& config;
+    // Open-file cache for the document root; null when serving the built-in response
+    FileCache* files;
+    // Serialized responses shared by all workers; null when disabled
+    ResponseCache* responses;
+    // This thread's access log ring; null when logging is off
+    AccessLogRing* accessLog;
+    // This thread's counters; null when not collecting
+    WorkerMetrics* metrics;
+    // Rendered at config.metricsPath; null when there is no endpoint
+    MetricsRegistry* metricsRegistry;
+    // Coroutine handlers tried before the built-in or static response; may be null
+    const Router* router;
+};
+
+// A routed request whose handler has suspended. The engine satisfies
+// wait() and calls resume() until the task is done; the next
+// processPipelinedRequests() then accounts for the response and moves on.
+struct PendingHandler {
+    // Filled by Router::match for each routed request; outlives the context
+    RouteParameters parameters;
+    // Decodes the request body; the engine reads more input when the
+    // handler waits on HandlerWait::Kind::Body
+    BodyReader body;
+    std::optional<RequestContext> context;
+    // Declared after the context it refers to, so its frame goes first
+    Task<> task;
+    std::chrono::steady_clock::time_point received;
+
+    bool active() const { return static_cast<bool>(task); }
+    bool suspended() const { return task && !task.done(); }
+    const HandlerWait& wait() const { return context->wait; }
+    void resume() {
+        std::coroutine_handle<> next = context->wait.resume ? context->wait.resume : task.getHandle();
+        next.resume();
+    }
+    // Destroys the coroutine wherever it is suspended
+    void reset() {
+        task = Task<>();
+        context.reset();
+    }
+};
+
+// Per-connection keep-alive bookkeeping shared by both server engines
+struct PipelineState {
+    int requestsServed = 0;
+    bool keepAlive = true;
+    // The worker is handing over to a new generation: the next response
+    // closes the connection
+    bool draining = false;
+    // Parser for the (possibly partial) request at the front of the input
+    HTTPRequest request;
+    // Client address for the access log: IPv4 in network byte order, host-order port
+    uint32_t peerAddress = 0;
+    uint16_t peerPort = 0;
+    // Handler for the request at the front of the input. While it is
+    // suspended no further requests are parsed, and input is read only to
+    // feed its body.
+    PendingHandler handler;
+};
+
+// Answer every complete request at the front of `input` in order, queueing
+// the responses on `output` so they can be flushed together. Consumed
+// bytes are erased from `input`. Stops early (and clears state.keepAlive)
+// once a response closes the connection. Returns the number of responses.
+// A routed request whose handler suspends stops the batch: the engine drives
+// state.handler and calls this again once it has finished.
+size_t processPipelinedRequests(InputBuffer& input, ResponseQueue& output,
+                                PipelineState& state, const HandlerContext& context);
+
+// Fixed responses the engines send on their own, outside any request
+enum class ConnectionNotice {
+    RequestTimeout,       // 408: the request head did not arrive in time
+    ServiceUnavailable    // 503 with Retry-After: over the connection limit
+};
+
+// Writes the notice without blocking and discards input already received,
+// for a connection the caller is about to close. Best effort: a full send
+// buffer drops it. A TLS connection gets it only once the handshake is done.
+void sendNotice(SOCKET_TYPE socket, ConnectionNotice notice, TlsStream* tls = nullptr);
+
+// How long the engines wait before accepting again after a failure that
+// leaves the connection queued (out of descriptors or memory)
+constexpr int kAcceptRetryMs = 100;
+
+// A descriptor held in reserve for accept() failing with EMFILE or ENFILE.
+// The connection stays queued, so an edge-triggered listener is not reported
+// again and a level-triggered one is reported at once, over and over.
+class SpareDescriptor {
+private:
+    int fd = -1;
+
+public:
+    SpareDescriptor();
+    ~SpareDescriptor();
+
+    SpareDescriptor(const SpareDescriptor&) = delete;
+    SpareDescriptor& operator=(const SpareDescriptor&) = delete;
+
+    // Gives up the spare to accept one queued connection on `listener` and
+    // close it, then takes the spare back. False with errno set when there
+    // was nothing to accept (EAGAIN) or no spare to give up.
+    bool shed(SOCKET_TYPE listener);
+};
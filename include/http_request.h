@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+enum class ParseResult {
+    Incomplete,   // Need more data; call parse() again once more bytes arrive
+    Complete,     // Request head fully parsed; see getHeadLength()
+    Error         // Malformed or over a size limit; answer 400 and close
+};
+
+// How the request body is delimited (RFC 9112 section 6.3)
+enum class BodyFraming : uint8_t {
+    None,      // No body (or Content-Length: 0)
+    Length,    // getContentLength() bytes follow the head
+    Chunked    // Transfer-Encoding: chunked
+};
+
+// Resumable, allocation-free HTTP/1.x request head parser.
+//
+// parse() is handed the connection buffer starting at the first byte of the
+// request. Progress is kept as offsets rather than pointers, so the caller
+// may append to (and reallocate) its buffer between calls as long as the
+// bytes already seen are left untouched. The string_views returned by the
+// getters point into the buffer passed to the most recent parse() call.
+class HTTPRequest {
+public:
+    // Largest request head (request line + headers) we buffer before answering 400
+    static constexpr size_t kMaxRequestSize = 8192;
+    // Headers beyond this count are rejected rather than silently dropped
+    static constexpr size_t kMaxHeaders = 32;
+
+private:
+    enum class Stage : uint8_t { RequestLine, Headers, Done };
+    enum class LineResult : uint8_t { Done, Incomplete, Error };
+
+    // Byte range within the parsed buffer
+    struct Span {
+        uint16_t offset = 0;
+        uint16_t length = 0;
+    };
+
+    struct Header {
+        Span name;
+        Span value;
+    };
+
+    const char* base;
+    Stage stage;
+    // Start of the first line not yet parsed; a partial line is rescanned
+    size_t lineStart;
+    size_t headLength;
+    Span method;
+    Span path;
+    Span version;
+    Header headers[kMaxHeaders];
+    size_t headerCount;
+    int minorVersion;
+    bool isValid;
+    BodyFraming bodyFraming;
+    uint64_t contentLength;
+
+    std::string_view view(Span span) const { return std::string_view(base + span.offset, span.length); }
+    LineResult parseRequestLine(std::string_view head);
+    LineResult parseHeaderLine(std::string_view head);
+    bool parseBodyFraming();
+
+public:
+    HTTPRequest() { reset(); }
+
+    // Forget all progress so the object can parse the next request
+    void reset();
+
+    ParseResult parse(std::string_view buffer);
+    // The parsed bytes have been moved to `buffer`; getters follow them
+    void rebase(const char* buffer) { base = buffer; }
+
+    // Bytes occupied by the request line, headers and blank line
+    size_t getHeadLength() const { return headLength; }
+
+    std::string_view getMethod() const { return view(method); }
+    std::string_view getPath() const { return view(path); }
+    std::string_view getVersion() const { return view(version); }
+    int getMinorVersion() const { return minorVersion; }
+    // Syntactically complete, with unambiguous body framing
+    bool getIsValid() const { return isValid; }
+
+    BodyFraming getBodyFraming() const { return bodyFraming; }
+    bool hasBody() const { return bodyFraming != BodyFraming::None; }
+    // Declared length for BodyFraming::Length, otherwise 0
+    uint64_t getContentLength() const { return contentLength; }
+
+    size_t getHeaderCount() const { return headerCount; }
+    std::string_view getHeaderName(size_t index) const { return view(headers[index].name); }
+    std::string_view getHeaderValue(size_t index) const { return view(headers[index].value); }
+    // Case-insensitive lookup; empty if absent
+    std::string_view getHeader(std::string_view name) const;
+
+    // HTTP/1.1 defaults to persistent connections, HTTP/1.0 to close;
+    // an explicit Connection header overrides either default
+    bool wantsKeepAlive() const;
+
+    // keepAlive selects the Connection header sent back to the client
+    std::string generateResponse(bool keepAlive = false) const;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "counters.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Upper bounds of the latency buckets, in microseconds (Prometheus `le`)
+constexpr uint64_t kLatencyBucketsUs[] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+};
+constexpr size_t kLatencyBucketCount = sizeof(kLatencyBucketsUs) / sizeof(kLatencyBucketsUs[0]);
+
+// Fixed-bucket latency histogram written by one thread. Buckets are not
+// cumulative here; rendering sums them into Prometheus form.
+struct MetricsHistogram {
+    std::atomic<uint64_t> buckets[kLatencyBucketCount + 1] = {};   // Last one is +Inf
+    std::atomic<uint64_t> sumUs{0};
+    std::atomic<uint64_t> count{0};
+
+    void observe(uint64_t microseconds, uint64_t times = 1) {
+        size_t bucket = 0;
+        while (bucket < kLatencyBucketCount && microseconds > kLatencyBucketsUs[bucket]) {
+            ++bucket;
+        }
+        bumpCounter(buckets[bucket], times);
+        bumpCounter(sumUs, microseconds * times);
+        bumpCounter(count, times);
+    }
+};
+
+// Deadline that closed a connection, indexing WorkerMetrics::timeouts
+enum class TimeoutPhase : uint8_t { Header, Body, Idle, Write };
+constexpr size_t kTimeoutPhases = 4;
+
+// Counters for one event loop worker (or one client thread in threads mode).
+// Only the owning thread writes; /metrics and shutdown stats read them.
+// Cache-line aligned so neighbouring workers never false-share.
+struct alignas(64) WorkerMetrics {
+    std::atomic<uint64_t> accepts{0};
+    std::atomic<uint64_t> activeConnections{0};   // Incremented and decremented by the owner
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> parseErrors{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint64_t> responses[5] = {};      // By status class, 1xx..5xx
+    std::atomic<uint64_t> shedConnections{0};     // Turned away at the cap (503) or out of descriptors
+    std::atomic<uint64_t> timeouts[kTimeoutPhases] = {};
+    std::atomic<uint64_t> tlsHandshakes[2] = {};  // Full, resumed
+    std::atomic<uint64_t> tlsHandshakeErrors{0};
+    std::atomic<uint64_t> tlsKernelOffload{0};    // Connections whose records the kernel encrypts
+    MetricsHistogram firstByte;                   // Accept to first request byte
+    MetricsHistogram requestLatency;              // Request read to response written
+
+    void countResponse(int status) {
+        if (status >= 100 && status < 600) {
+            bumpCounter(responses[status / 100 - 1]);
+        }
+    }
+    void countTimeout(TimeoutPhase phase) { bumpCounter(timeouts[static_cast<size_t>(phase)]); }
+};
+
+// Owns every WorkerMetrics block and renders their sum. Event loops take a
+// block for their lifetime; client threads take one per connection and give
+// it back, and a released block is handed out again without being reset, so
+// totals stay correct while the number of blocks tracks peak concurrency.
+class MetricsRegistry {
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<WorkerMetrics>> blocks;
+    std::vector<WorkerMetrics*> freeBlocks;
+
+public:
+    WorkerMetrics* acquire();
+    void release(WorkerMetrics* metrics);
+
+    // Sum of every block in the Prometheus text exposition format
+    std::string render();
+};
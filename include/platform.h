@@ -0,0 +1,70 @@
+#pragma once
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "ws2_32.lib")
+    using SOCKET_TYPE = SOCKET;
+    using SOCKET_SIZE_TYPE = int;
+    #define CLOSE_SOCKET closesocket
+    #define SOCKET_ERROR_CODE WSAGetLastError()
+#else
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <cerrno>
+    using SOCKET_TYPE = int;
+    using SOCKET_SIZE_TYPE = socklen_t;
+    #define CLOSE_SOCKET close
+    #define SOCKET_ERROR_CODE errno
+    #define INVALID_SOCKET -1
+    #define SOCKET_ERROR -1
+#endif
+
+// macOS and Windows have no MSG_NOSIGNAL; SIGPIPE is ignored process-wide instead
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+// Windows has no per-call non-blocking flag; callers skip what would block
+#ifndef MSG_DONTWAIT
+    #define MSG_DONTWAIT 0
+#endif
+
+// The epoll engine is Linux-only; other platforms fall back to threads.
+#ifdef __linux__
+    #define HAVE_EPOLL 1
+    #define HAVE_SENDFILE 1
+    #define HAVE_SPLICE 1
+#endif
+
+// MSG_ZEROCOPY (Linux 4.14+): completions arrive on the socket error queue
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+    #define HAVE_ZEROCOPY 1
+#endif
+
+// io_uring engine, driven through raw syscalls (no liburing). Whether the
+// running kernel supports it (5.19+) is only known at startup.
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define HAVE_IO_URING 1
+    #endif
+#endif
+
+// Static file serving needs POSIX file descriptors
+#ifndef _WIN32
+    #define HAVE_STATIC_FILES 1
+#endif
+
+// TLS listeners need OpenSSL (HAVE_OPENSSL, found by CMake) and POSIX
+// sockets: the TLS calls report through errno like recv() and send()
+#if defined(HAVE_OPENSSL) && !defined(_WIN32)
+    #define HAVE_TLS 1
+#endif
+
+// The reverse proxy drives its upstream sockets with non-blocking POSIX calls
+#ifndef _WIN32
+    #define HAVE_PROXY 1
+#endif
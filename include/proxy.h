@@ -0,0 +1,84 @@
+#pragma once
+
+#include "handler.h"
+#include "platform.h"
+#include "server_config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Router;
+
+// One upstream server of a proxied route
+struct Upstream {
+    std::string name;   // "host:port" as configured
+    struct sockaddr_in address = {};
+    // Milliseconds on the steady clock until which it is out of rotation;
+    // 0 = in rotation, INT64_MAX = until a health check passes
+    std::atomic<int64_t> downUntil{0};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> connectionsOpened{0};
+    std::atomic<uint64_t> failures{0};
+};
+
+// Forwards requests under the configured prefixes to upstream HTTP servers
+// (see ServerConfig::proxyRoutes). Each route is a coroutine handler, so a
+// proxied request holds a connection, never a worker, while the upstream
+// works. Upstreams are taken in turn, skipping those that are down.
+//
+// Upstream connections are kept alive and pooled per worker thread, so
+// nothing on the request path is shared beyond the turn counter and the
+// upstream states. Response bodies with a Content-Length are spliced from
+// the upstream socket into the client's through a pipe, without a copy to
+// user space, where the client socket allows it (plain sockets on Linux).
+class ReverseProxy {
+private:
+    struct Route {
+        std::string prefix;
+        std::vector<std::unique_ptr<Upstream>> upstreams;
+        std::atomic<uint32_t> turn{0};
+    };
+
+    std::vector<std::unique_ptr<Route>> routes;
+    std::chrono::milliseconds timeout{0};
+    size_t poolSize = 0;
+    std::chrono::milliseconds idleTimeout{0};
+    int healthIntervalMs = 0;
+    std::string healthPath;
+
+    std::thread healthThread;
+    std::mutex healthMutex;
+    std::condition_variable healthWake;
+    bool stopping = false;
+
+    // The next upstream in rotation that is not down and not `avoid`
+    Upstream* pick(Route& route, const Upstream* avoid);
+    void markFailed(Upstream& upstream);
+    void runHealthChecks();
+    bool probe(const Upstream& upstream) const;
+    Task<> forward(RequestContext& ctx, Route& route);
+
+public:
+    ReverseProxy() = default;
+    ~ReverseProxy();
+
+    ReverseProxy(const ReverseProxy&) = delete;
+    ReverseProxy& operator=(const ReverseProxy&) = delete;
+
+    // Resolves every upstream; false (with a message) if one does not resolve
+    bool init(const ServerConfig& config);
+    // Registers a handler for every route's prefix, any method
+    void addRoutes(Router& router);
+    // Starts the health check thread, if health checks are on
+    void start();
+    void stop();
+
+    void printStats() const;
+};
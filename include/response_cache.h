@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Fully serialized response bytes (status line, headers and body) in one
+// contiguous, immutable, refcounted buffer. Sharing it never copies the bytes.
+using ResponseBuffer = std::shared_ptr<const std::string>;
+
+struct ResponseCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// Cache of serialized responses shared by every worker thread.
+//
+// Reads take no lock: the table is immutable once published, and each thread
+// keeps its own reference to the latest version, re-fetching it (under the
+// writer mutex) only after an atomic generation counter says it changed.
+// Writers copy the table, insert, evict and publish the copy. A key must be
+// missed twice before it is inserted, so one-off paths never trigger a copy.
+// Eviction is CLOCK: entries read since the last sweep get a second chance.
+class ResponseCache {
+private:
+    struct Entry {
+        std::string key;
+        uint64_t hash;
+        ResponseBuffer buffer;
+        mutable std::atomic<bool> referenced{false};
+    };
+
+    // Open-addressed, linear probing; power-of-two sized, at most half full
+    struct Table {
+        std::vector<std::shared_ptr<const Entry>> slots;
+        size_t entries = 0;
+        size_t bytes = 0;
+        uint64_t generation = 0;
+    };
+
+    // Written only by the owning thread, so increments need no atomic RMW
+    struct alignas(64) ThreadCounters {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    // Outlives the cache if a thread still holds counters when it is destroyed;
+    // exiting threads fold their counts into the retired totals
+    struct CounterRegistry {
+        std::mutex mutex;
+        std::vector<ThreadCounters*> live;
+        uint64_t retiredHits = 0;
+        uint64_t retiredMisses = 0;
+    };
+
+    // The calling thread's view of one cache (the most recently used)
+    struct ThreadState {
+        uint64_t ownerId = 0;
+        uint64_t generation = 0;
+        std::shared_ptr<const Table> table;
+        std::shared_ptr<CounterRegistry> registry;
+        std::unique_ptr<ThreadCounters> counters;
+
+        ~ThreadState() { retire(); }
+        void retire();
+    };
+
+    static constexpr size_t kDoorkeeperSlots = 4096;
+
+    const size_t maxBytes;
+    const size_t maxEntries;
+    const uint64_t id;
+    std::atomic<uint64_t> generation;
+    std::atomic<uint32_t> doorkeeper[kDoorkeeperSlots];
+    std::shared_ptr<CounterRegistry> registry;
+
+    // Writer state
+    mutable std::mutex mutex;
+    std::shared_ptr<const Table> current;
+    size_t clockHand;
+    uint64_t evictions;
+
+    ThreadState& threadState() const;
+    bool admit(uint64_t hash);
+    static uint64_t hashKey(std::string_view key);
+    static const Entry* find(const Table& table, std::string_view key, uint64_t hash);
+    static void place(Table& table, std::shared_ptr<const Entry> entry);
+
+public:
+    // Largest single response worth caching
+    static constexpr size_t kMaxResponseSize = 64 * 1024;
+
+    ResponseCache(size_t maxBytes, size_t maxEntries = 4096);
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    // Lock-free; null on a miss
+    ResponseBuffer find(std::string_view key) const;
+    // Called after a miss; may decline (admission, size limits)
+    void insert(std::string_view key, ResponseBuffer buffer);
+
+    ResponseCacheStats getStats() const;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "platform.h"
+#include "buffer_pool.h"
+#include "response_cache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#ifdef HAVE_IO_URING
+#include <sys/uio.h>
+#endif
+
+struct CachedFile;
+class TlsStream;
+
+#ifdef HAVE_SPLICE
+// A pipe that carries bytes from another socket to a connection with
+// splice(), so they never pass through user space. `buffered` counts what
+// is in it; only an empty pipe can be handed to the next response.
+struct SplicePipe {
+    int readFd = -1;
+    int writeFd = -1;
+    size_t buffered = 0;
+
+    SplicePipe() = default;
+    ~SplicePipe();
+    SplicePipe(const SplicePipe&) = delete;
+    SplicePipe& operator=(const SplicePipe&) = delete;
+
+    bool open();
+    // Moves up to `length` bytes from `socket` into the pipe, like recv()
+    ssize_t fill(int socket, size_t length);
+};
+#endif
+
+// Outgoing bytes for one connection: in-memory response heads/bodies,
+// shared prebuilt responses, file bodies sent straight from the page cache
+// and pipes filled from other sockets.
+// Pipelined responses accumulate here and are flushed together: runs of
+// in-memory segments go out as one vectored write, so a status line, headers
+// and body never have to be concatenated first. Copied bytes live in an
+// arena that is reset once everything queued has been sent, so the steady
+// state allocates nothing.
+class ResponseQueue {
+public:
+    enum class FlushResult {
+        Done,         // Everything was written
+        WouldBlock,   // Socket buffer full; call flush() again when writable
+        Error         // Peer gone or write failed
+    };
+
+    // Segments gathered into one sendmsg()
+    static constexpr size_t kMaxIovecs = 64;
+
+private:
+    struct Segment {
+        const char* data = nullptr;               // In-memory bytes
+        std::shared_ptr<const void> owner;        // Keeps referenced bytes alive
+        std::shared_ptr<const CachedFile> file;   // Set for file segments
+        #ifdef HAVE_SPLICE
+        std::shared_ptr<SplicePipe> pipe;         // Set for pipe segments
+        #endif
+        size_t offset = 0;                        // Progress within data/file
+        size_t length = 0;                        // Bytes to send
+
+        bool inMemory() const {
+            #ifdef HAVE_SPLICE
+            return !file && !pipe;
+            #else
+            return !file;
+            #endif
+        }
+    };
+
+    // A MSG_ZEROCOPY send whose pages the kernel may still be reading
+    struct ZeroCopySend {
+        std::shared_ptr<const void> owner;        // Reset once completed
+        uint32_t id;
+    };
+
+    Arena arena;
+    // Unsent segments are [head, size()); cleared (keeping capacity) when drained
+    std::vector<Segment> segments;
+    size_t head = 0;
+    size_t queuedBytes = 0;
+
+    // Shared buffers at least this large are sent with MSG_ZEROCOPY; 0 = off
+    size_t zeroCopyThreshold = 0;
+    std::vector<ZeroCopySend> zeroCopySends;
+    size_t zeroCopyHead = 0;
+    uint32_t zeroCopyNextId = 0;
+
+    // Whether the socket takes pipe segments (a plain socket, not TLS)
+    bool spliceAllowed = false;
+
+    void pushBytes(const char* data, size_t length, std::shared_ptr<const void> owner);
+    void advance(size_t written);
+    ssize_t sendGathered(SOCKET_TYPE socket);
+    ssize_t sendZeroCopy(SOCKET_TYPE socket, Segment& segment);
+    ssize_t sendFileSegment(SOCKET_TYPE socket, Segment& segment);
+    ssize_t sendPipeSegment(SOCKET_TYPE socket, Segment& segment);
+    ssize_t sendTls(TlsStream& tls);
+    void completeZeroCopy(uint32_t first, uint32_t last);
+
+public:
+    explicit ResponseQueue(BufferPool& pool) : arena(pool) {}
+
+    // Copy bytes into the queue's arena
+    void append(std::string_view bytes);
+    // Reference bytes with static storage duration (string literals)
+    void appendStatic(std::string_view bytes);
+    // Reference bytes that `owner` keeps alive until they are sent
+    void appendView(std::string_view bytes, std::shared_ptr<const void> owner);
+    // Queue a prebuilt response by reference; its bytes are never copied
+    void appendShared(ResponseBuffer buffer);
+    void appendFile(std::shared_ptr<const CachedFile> file);
+    #ifdef HAVE_SPLICE
+    // `length` bytes already in `pipe`, spliced to the socket when flushed.
+    // Only once enableSplice() was called.
+    void appendPipe(std::shared_ptr<SplicePipe> pipe, size_t length);
+    #endif
+
+    bool empty() const { return head == segments.size(); }
+    size_t size() const { return queuedBytes; }
+    void clear();
+
+    // Write as much as the socket accepts, resuming after partial writes.
+    // With `tls` the bytes go through it instead, a record at a time.
+    FlushResult flush(SOCKET_TYPE socket, TlsStream* tls = nullptr);
+
+    #ifdef HAVE_IO_URING
+    // For completion-based sends: describe the in-memory segments at the
+    // front as iovecs without writing anything. Returns 0 when a file body or
+    // pipe is first (send it with flush()). Report the bytes the send took with consume().
+    size_t gather(struct iovec* iov, size_t maxIovecs) const;
+    void consume(size_t written);
+    #endif
+
+    // For the engines to call on plain sockets that splice() can write to
+    void enableSplice() { spliceAllowed = true; }
+    bool spliceEnabled() const { return spliceAllowed; }
+
+    // Only valid after SO_ZEROCOPY was enabled on the socket
+    void enableZeroCopy(size_t threshold) { zeroCopyThreshold = threshold; }
+    bool zeroCopyEnabled() const { return zeroCopyThreshold > 0; }
+    // Sends the kernel has not yet released; their buffers must stay alive
+    bool zeroCopyInFlight() const { return zeroCopyHead < zeroCopySends.size(); }
+    // Drain completion notifications from the error queue; false on a socket error
+    bool reapZeroCopy(SOCKET_TYPE socket);
+};
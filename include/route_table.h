@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+struct RouteKey {
+    std::string_view method;
+    std::string_view path;
+};
+
+// Little-endian word of up to 8 bytes of `text` at `offset`
+constexpr uint64_t routeWord(std::string_view text, size_t offset, size_t count) {
+    uint64_t word = 0;
+    if (!std::is_constant_evaluated() && count == 8) {
+        memcpy(&word, text.data() + offset, 8);
+        return word;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        word |= static_cast<uint64_t>(static_cast<unsigned char>(text[offset + i])) << (8 * i);
+    }
+    return word;
+}
+
+// Hash of a (method, path) pair, eight bytes per multiply. constexpr, so a
+// table built by the compiler and a lookup at runtime hash identically.
+constexpr uint64_t routeHash(std::string_view method, std::string_view path) {
+    uint64_t hash = (static_cast<uint64_t>(method.size()) << 32) ^ path.size() ^ 0x243f6a8885a308d3ull;
+    auto absorb = [&hash](std::string_view text) {
+        size_t offset = 0;
+        for (; offset + 8 <= text.size(); offset += 8) {
+            hash = (hash ^ routeWord(text, offset, 8)) * 0x9e3779b97f4a7c15ull;
+            hash ^= hash >> 29;
+        }
+        if (offset < text.size()) {
+            // The tail as one (overlapping) word when the text allows it
+            uint64_t word = text.size() >= 8 ? routeWord(text, text.size() - 8, 8)
+                                              : routeWord(text, offset, text.size() - offset);
+            hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+            hash ^= hash >> 29;
+        }
+    };
+    absorb(method);
+    absorb(path);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Maps a 32-bit value onto [0, range) with a multiply instead of a division
+constexpr uint32_t routeReduce(uint32_t value, uint32_t range) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(value) * range) >> 32);
+}
+
+constexpr uint32_t routeBucket(uint64_t hash, uint32_t buckets) {
+    return routeReduce(static_cast<uint32_t>(hash), buckets);
+}
+
+// Slot of a key whose bucket uses `displacement`; every displacement gives
+// an independent-looking placement, so a search over them finds a free one
+constexpr uint32_t routeSlot(uint64_t hash, uint32_t displacement, uint32_t slots) {
+    uint32_t x = static_cast<uint32_t>(hash >> 32) ^ (displacement * 0x9e3779b9u);
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return routeReduce(x, slots);
+}
+
+// Size-independent view of a StaticRouteTable, so a Router can hold one
+// without being a template. Points into the table it came from.
+struct RouteTableView {
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    const RouteKey* keys = nullptr;
+    const uint32_t* displacements = nullptr;
+    const uint32_t* slots = nullptr;
+    size_t size = 0;
+    uint32_t bucketCount = 0;
+    uint32_t slotCount = 0;
+
+    // Index of the exact (method, path) key, or npos: one hash, one probe,
+    // one comparison
+    constexpr size_t find(std::string_view method, std::string_view path) const {
+        if (size == 0) {
+            return npos;
+        }
+        uint64_t hash = routeHash(method, path);
+        uint32_t bucket = routeBucket(hash, bucketCount);
+        uint32_t index = slots[routeSlot(hash, displacements[bucket], slotCount)];
+        if (index == kEmpty || keys[index].path != path || keys[index].method != method) {
+            return npos;
+        }
+        return index;
+    }
+};
+
+// Perfect-hash table over a fixed set of routes, built at compile time
+// ("hash and displace"): keys are split into buckets, and each bucket,
+// largest first, gets the first displacement that puts all its keys in
+// free slots. A duplicate key or a failed search is a compile error when
+// the table is constexpr.
+template <size_t N>
+class StaticRouteTable {
+public:
+    static constexpr uint32_t kBuckets = static_cast<uint32_t>(N / 4 + 1);
+    static constexpr uint32_t kSlots = static_cast<uint32_t>(N + N / 8 + 1);
+
+private:
+    std::array<RouteKey, N> keys{};
+    std::array<uint32_t, kBuckets> displacements{};
+    std::array<uint32_t, kSlots> slots{};
+
+public:
+    constexpr explicit StaticRouteTable(const std::array<RouteKey, N>& routes) {
+        std::array<uint64_t, N> hashes{};
+        std::array<uint32_t, kBuckets + 1> bucketStart{};
+        for (size_t i = 0; i < N; ++i) {
+            keys[i] = routes[i];
+            hashes[i] = routeHash(routes[i].method, routes[i].path);
+            ++bucketStart[routeBucket(hashes[i], kBuckets) + 1];
+        }
+        for (uint32_t b = 0; b < kBuckets; ++b) {
+            bucketStart[b + 1] += bucketStart[b];
+        }
+        // Keys grouped by bucket
+        std::array<uint32_t, N> members{};
+        std::array<uint32_t, kBuckets> filled{};
+        for (size_t i = 0; i < N; ++i) {
+            uint32_t b = routeBucket(hashes[i], kBuckets);
+            members[bucketStart[b] + filled[b]++] = static_cast<uint32_t>(i);
+        }
+
+        std::array<uint32_t, kBuckets> order{};
+        for (uint32_t b = 0; b < kBuckets; ++b) {
+            order[b] = b;
+        }
+        std::sort(order.begin(), order.end(), [&bucketStart](uint32_t a, uint32_t b) {
+            return bucketStart[a + 1] - bucketStart[a] > bucketStart[b + 1] - bucketStart[b];
+        });
+
+        for (uint32_t& slot : slots) {
+            slot = RouteTableView::kEmpty;
+        }
+        for (uint32_t b : order) {
+            uint32_t first = bucketStart[b];
+            uint32_t last = bucketStart[b + 1];
+            if (first == last) {
+                continue;
+            }
+            for (uint32_t i = first; i < last; ++i) {
+                for (uint32_t j = first; j < i; ++j) {
+                    if (hashes[members[i]] == hashes[members[j]]) {
+                        throw std::invalid_argument("duplicate route");
+                    }
+                }
+            }
+            uint32_t displacement = 0;
+            while (!tryPlace(hashes, members, first, last, displacement)) {
+                if (++displacement == (1u << 20)) {
+                    throw std::logic_error("no perfect hash found for routes");
+                }
+            }
+            displacements[b] = displacement;
+        }
+    }
+
+    constexpr RouteTableView view() const {
+        RouteTableView view;
+        view.keys = keys.data();
+        view.displacements = displacements.data();
+        view.slots = slots.data();
+        view.size = N;
+        view.bucketCount = kBuckets;
+        view.slotCount = kSlots;
+        return view;
+    }
+
+    constexpr size_t find(std::string_view method, std::string_view path) const {
+        return view().find(method, path);
+    }
+    constexpr const RouteKey& key(size_t index) const { return keys[index]; }
+    static constexpr size_t size() { return N; }
+
+private:
+    constexpr bool tryPlace(const std::array<uint64_t, N>& hashes, const std::array<uint32_t, N>& members,
+                            uint32_t first, uint32_t last, uint32_t displacement) {
+        for (uint32_t i = first; i < last; ++i) {
+            uint32_t slot = routeSlot(hashes[members[i]], displacement, kSlots);
+            if (slots[slot] != RouteTableView::kEmpty) {
+                for (uint32_t j = first; j < i; ++j) {
+                    slots[routeSlot(hashes[members[j]], displacement, kSlots)] = RouteTableView::kEmpty;
+                }
+                return false;
+            }
+            slots[slot] = members[i];
+        }
+        return true;
+    }
+};
+
+template <size_t N>
+constexpr StaticRouteTable<N> makeRouteTable(const RouteKey (&routes)[N]) {
+    return StaticRouteTable<N>(std::to_array(routes));
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "handler.h"
+#include "route_table.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using RouteHandler = std::function<Task<>(RequestContext&)>;
+
+// Dispatches requests to coroutine handlers by method and path.
+// Routes are registered before the server starts and never change after,
+// so workers share one Router without locking.
+//  - Static routes are exact paths fixed at compile time (a
+//    StaticRouteTable) and cost one perfect-hash probe.
+//  - Dynamic routes are added at runtime into a trie of path segments.
+//    They match as prefixes, by whole segments, and a `{name}` segment
+//    captures any one segment.
+// A static match wins; otherwise the dynamic route matching the most
+// segments does, with literal segments preferred over captures.
+class Router {
+private:
+    static constexpr uint32_t kNoNode = UINT32_MAX;
+
+    struct Endpoint {
+        std::string method;   // "*" matches any method
+        RouteHandler handler;
+        // Names of the route's `{name}` segments, in order
+        std::vector<std::string> parameterNames;
+    };
+
+    struct Node {
+        // Literal child segments, sorted for binary search
+        std::vector<std::pair<std::string, uint32_t>> children;
+        uint32_t capture = kNoNode;
+        std::vector<Endpoint> endpoints;
+    };
+
+    // Best match so far while walking the trie. Captures are kept as
+    // offsets into `path`; the arrays are deliberately left uninitialized.
+    struct Walk {
+        std::string_view method;
+        std::string_view path;
+        const Endpoint* best = nullptr;
+        size_t bestDepth = 0;
+        size_t count = 0;
+        uint32_t starts[RouteParameters::kMaxParameters];
+        uint32_t lengths[RouteParameters::kMaxParameters];
+        uint32_t bestStarts[RouteParameters::kMaxParameters];
+        uint32_t bestLengths[RouteParameters::kMaxParameters];
+    };
+
+    RouteTableView staticTable;
+    std::vector<RouteHandler> staticHandlers;
+    // nodes[0] is the root ("/")
+    std::vector<Node> nodes;
+
+    uint32_t childFor(uint32_t node, std::string_view segment);
+    void search(const Node& node, size_t position, size_t depth, Walk& walk) const;
+
+public:
+    Router();
+
+    // A prefix matches whole path segments: "/api" matches "/api",
+    // "/api/users" and "/api?x=1" but not "/apis"; "/users/{id}" matches
+    // "/users/42". Fails (with a message) past kMaxParameters captures.
+    bool add(std::string method, std::string_view prefix, RouteHandler handler);
+    bool get(std::string_view prefix, RouteHandler handler) { return add("GET", prefix, std::move(handler)); }
+
+    // Exact-path routes built at compile time; handlers[i] serves the
+    // table's key i. The table must outlive the router (declare it
+    // constexpr at namespace scope). Replaces any earlier static table.
+    bool setStatic(RouteTableView table, std::vector<RouteHandler> handlers);
+
+    // Null when no route matches. `target` may carry a query string; the
+    // captured values are left in `parameters`.
+    const RouteHandler* match(std::string_view method, std::string_view target,
+                              RouteParameters& parameters) const;
+
+    bool empty() const { return staticHandlers.empty() && nodes.size() == 1 && nodes[0].endpoints.empty(); }
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+#include <vector>
+
+// How accepted connections are serviced
+enum class ServerMode {
+    Threads,    // One blocking std::thread per connection
+    EventLoop,  // Non-blocking, edge-triggered epoll reactors (Linux only)
+    IoUring     // Completion-based io_uring workers (Linux 5.19+), else EventLoop
+};
+
+bool parseServerMode(const std::string& name, ServerMode& mode);
+const char* serverModeName(ServerMode mode);
+
+// Requests under `prefix` (whole path segments, as for Router::add) are
+// forwarded to one of `upstreams`, each "host:port"
+struct ProxyRoute {
+    std::string prefix;
+    std::vector<std::string> upstreams;
+
+    bool operator==(const ProxyRoute& other) const = default;
+};
+
+struct ServerConfig {
+    int port = 8080;
+    #ifdef HAVE_EPOLL
+    ServerMode mode = ServerMode::EventLoop;
+    #else
+    ServerMode mode = ServerMode::Threads;
+    #endif
+    // Event loop workers, each with its own SO_REUSEPORT listener; 0 = one per core
+    int workers = 0;
+    // Pin worker i to CPU (i % cores)
+    bool pinWorkers = false;
+    // Close a persistent connection after this long without traffic
+    int keepAliveTimeoutMs = 5000;
+    // A request head must be complete this long after its first byte (for
+    // the first request, after the accept); trickling bytes does not extend
+    // it. 0 = no limit
+    int headerTimeoutMs = 10000;
+    // Close a connection whose handler has waited this long for more of the
+    // request body; 0 = no limit
+    int bodyTimeoutMs = 30000;
+    // Close a connection whose client has taken none of a pending response
+    // for this long; 0 = no limit
+    int writeTimeoutMs = 30000;
+    // Open connections beyond which new ones get a 503 and are closed at
+    // once; split evenly across workers. 0 = unlimited
+    int maxConnections = 0;
+    // Connections the kernel queues per listener before they are accepted
+    // (capped by net.core.somaxconn on Linux)
+    int listenBacklog = SOMAXCONN;
+    // After a reload (or a graceful stop) connections of the old workers
+    // get this long to finish before they are closed; 0 = no limit
+    int drainTimeoutMs = 30000;
+    // Close a persistent connection after serving this many requests; 0 = unlimited
+    int maxRequestsPerConnection = 1000;
+    // Serve files from this directory; empty = built-in "Hello World!" response
+    std::string documentRoot;
+    // Open files (descriptor + stat + headers) cached per worker
+    int fileCacheEntries = 1024;
+    // Re-stat a cached file at most this often to notice changes on disk
+    int fileRevalidateMs = 1000;
+    // Bytes of serialized small-file responses shared by all workers; 0 = off
+    int responseCacheBytes = 1024 * 1024;
+    // Send shared response buffers at least this large with MSG_ZEROCOPY
+    // (epoll mode, Linux); 0 = always copy
+    int zeroCopyThreshold = 0;
+    // Append an access log line per request to this file ("-" = stdout); empty = off
+    std::string accessLogPath;
+    // Log one request in this many
+    int accessLogSampleEvery = 1;
+    // Compress bodies at least this large on the fly for clients that accept
+    // gzip or br; 0 = never (precompressed .gz/.br files are still served)
+    int compressionMinBytes = 1024;
+    // Largest request body handed to a route handler (413 beyond it); 0 = unlimited
+    long long maxRequestBodyBytes = 64LL * 1024 * 1024;
+    // Reserved path answered with Prometheus metrics; empty = no endpoint
+    std::string metricsPath = "/metrics";
+    // Second listener speaking TLS (needs OpenSSL); 0 = off
+    int tlsPort = 0;
+    // PEM certificate chain (leaf first) and private key for tlsPort
+    std::string tlsCertificateFile;
+    std::string tlsKeyFile;
+    // Hand record encryption to the kernel (kTLS) after the handshake where
+    // the kernel and cipher allow, so file bodies go out with sendfile()
+    bool tlsKernelOffload = true;
+    // Reverse-proxied path prefixes; read at startup only
+    std::vector<ProxyRoute> proxyRoutes;
+    // Longest the proxy waits on an upstream at a time: to connect, to send,
+    // and for each read of the response; past it the client gets a 504
+    int proxyTimeoutMs = 10000;
+    // Idle keep-alive connections each worker keeps open per upstream
+    int proxyPoolSize = 32;
+    // Close pooled connections idle this long; keep it below the upstream's
+    // own keep-alive timeout so a request never races the upstream's close
+    int proxyIdleTimeoutMs = 4000;
+    // Probe every upstream with GET proxyHealthPath this often, taking it out
+    // of rotation while it fails (no answer, or a 5xx); 0 = off (failed
+    // requests alone take an upstream out, for a second at a time)
+    int proxyHealthIntervalMs = 2000;
+    std::string proxyHealthPath = "/";
+};
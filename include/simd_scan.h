@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorised byte-class scanning for the HTTP parser.
+//
+// A ByteClass is a set of allowed bytes. findFirstNotIn() returns the index
+// of the first byte outside the set, which lets the parser find a delimiter
+// (' ', ':', '\r') and validate everything in front of it in one pass.
+//
+// The vector kernels classify 16 (SSE4.2) or 32 (AVX2) bytes at a time with
+// two pshufb lookups: bit h of lowNibble[c & 0xf] says whether the byte with
+// high nibble h is allowed, and highNibble[c >> 4] selects that bit. This
+// can express any subset of ASCII, plus "all" or "none" of 0x80-0xff.
+namespace simd {
+
+struct ByteClass {
+    bool allowed[256];
+    uint8_t lowNibble[16];
+    uint8_t highNibble[16];
+};
+
+template <typename Predicate>
+constexpr ByteClass makeByteClass(Predicate allowed) {
+    ByteClass cls = {};
+    for (int c = 0; c < 256; ++c) {
+        cls.allowed[c] = allowed(static_cast<unsigned char>(c));
+    }
+    for (int high = 0; high < 8; ++high) {
+        cls.highNibble[high] = static_cast<uint8_t>(1u << high);
+        for (int low = 0; low < 16; ++low) {
+            if (cls.allowed[(high << 4) | low]) {
+                cls.lowNibble[low] = static_cast<uint8_t>(cls.lowNibble[low] | (1u << high));
+            }
+        }
+    }
+    // Bytes 0x80-0xff must be uniformly allowed or rejected
+    bool highAllowed = cls.allowed[0x80];
+    for (int c = 0x80; c < 256; ++c) {
+        if (cls.allowed[c] != highAllowed) {
+            throw "ByteClass: 0x80-0xff must be all allowed or all rejected";
+        }
+    }
+    for (int high = 8; high < 16; ++high) {
+        cls.highNibble[high] = highAllowed ? 0xff : 0x00;
+    }
+    if (highAllowed) {
+        for (int low = 0; low < 16; ++low) {
+            if (cls.lowNibble[low] == 0) {
+                throw "ByteClass: allowing 0x80-0xff needs every low nibble used below 0x80";
+            }
+        }
+    }
+    return cls;
+}
+
+enum class Level { Scalar, SSE42, AVX2 };
+
+// Index of the first byte in [data, data + length) not in `cls`, or length
+size_t findFirstNotIn(const ByteClass& cls, const char* data, size_t length);
+
+// Best level this CPU supports; picked automatically at startup
+Level bestSupportedLevel();
+Level activeLevel();
+// Force a kernel (benchmarks and tests only; not thread-safe). False if unsupported.
+bool setLevel(Level level);
+const char* levelName(Level level);
+
+// RFC 9110 tchar: methods and header names
+extern const ByteClass kTokenChars;
+// Request-target: visible bytes, excluding SP and DEL
+extern const ByteClass kTargetChars;
+// Header field values: HTAB, SP, VCHAR and obs-text
+extern const ByteClass kFieldValueChars;
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string_view>
+
+// Helpers for header names, tokens and config lines, all ASCII.
+
+// Case-insensitive for letters; what header names and tokens need
+inline bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if ((a[i] | 0x20) != (b[i] | 0x20)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// `text` without leading and trailing `whitespace` (by default spaces and
+// tabs, the optional whitespace around header values)
+inline std::string_view trim(std::string_view text, std::string_view whitespace = " \t") {
+    size_t first = text.find_first_not_of(whitespace);
+    if (first == std::string_view::npos) {
+        return {};
+    }
+    return text.substr(first, text.find_last_not_of(whitespace) - first + 1);
+}
+
+// True if the comma-separated header value contains `token` (case-insensitive)
+inline bool hasToken(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        if (equalsIgnoreCase(trim(value.substr(0, comma)), token)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "platform.h"
+#include "router.h"
+#include "server_config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AccessLog;
+class FileCache;
+class MetricsRegistry;
+class ResponseCache;
+class ReverseProxy;
+class TlsContext;
+class WorkerLoop;
+
+class TCPServer {
+private:
+    struct ClientThread {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> finished;
+    };
+
+    // A listening socket, shared by every generation that accepts on it and
+    // closed when the last of them is gone
+    struct Listener {
+        SOCKET_TYPE socket;
+        explicit Listener(SOCKET_TYPE socket) : socket(socket) {}
+        ~Listener() { CLOSE_SOCKET(socket); }
+        Listener(const Listener&) = delete;
+        Listener& operator=(const Listener&) = delete;
+    };
+
+    // One reactor per worker: private listener, private loop, no shared state
+    struct Worker {
+        std::shared_ptr<Listener> listener;
+        // Its own TLS listener too, when tlsPort is set
+        std::shared_ptr<Listener> tlsListener;
+        std::unique_ptr<WorkerLoop> loop;
+        std::thread thread;
+    };
+
+    // Everything built from one version of the configuration. A reload
+    // starts a new generation on the same listeners, then drains the one
+    // before it: its workers stop accepting, close idle connections and
+    // finish the requests in hand, and it is destroyed once they return.
+    struct Generation {
+        unsigned number = 0;
+        ServerConfig config;
+        // Declared before the workers so every ring is released first
+        std::unique_ptr<AccessLog> accessLog;
+        // Certificate and ticket keys, when tlsPort is set
+        std::unique_ptr<TlsContext> tls;
+        // Shared by this generation's workers or client threads
+        std::unique_ptr<ResponseCache> responses;
+        // Threads mode: shared by the client threads (epoll workers own their own)
+        std::unique_ptr<FileCache> files;
+        // Threads mode: one listener, one accept thread, a thread per client
+        std::shared_ptr<Listener> listener;
+        std::shared_ptr<Listener> tlsListener;
+        std::thread acceptThread;
+        std::vector<ClientThread> clientThreads;
+        std::vector<Worker> workers;
+        std::atomic<bool> draining{false};
+        std::chrono::steady_clock::time_point drainStarted;
+        #ifndef _WIN32
+        // Threads mode: closing the write end wakes every thread of this
+        // generation blocked in poll(), for a drain or a stop
+        int wakePipe[2] = {-1, -1};
+        #endif
+        // Threads still running; the last one to return tells run()
+        std::atomic<int> threadsRunning{0};
+
+        ~Generation();
+    };
+
+    std::atomic<bool> running;
+    // Client threads still serving a connection, across generations (threads mode)
+    std::atomic<int> activeClients;
+    // Guards generations; signalled when a generation's last thread returns
+    std::mutex generationsMutex;
+    std::condition_variable generationsChanged;
+    // Oldest first; the last one is current, any before it are draining
+    std::vector<std::unique_ptr<Generation>> generations;
+    unsigned generationCount;
+    // The mode asked for, before any fallback; reloads keep the effective one
+    ServerMode requestedMode;
+    // Per-worker counters, summed for /metrics; outlives every generation
+    std::unique_ptr<MetricsRegistry> metrics;
+    // Routes for coroutine handlers; filled in before start(), read-only
+    // after and shared by all generations
+    Router router;
+    // Set when proxy routes are configured; like the routes, fixed at start()
+    std::unique_ptr<ReverseProxy> proxy;
+    ServerConfig config;
+
+public:
+    explicit TCPServer(const ServerConfig& config);
+    ~TCPServer();
+
+    // Opens the listeners and starts the first generation
+    bool start();
+    // Blocks until stop(), or until a graceful stop has drained everything
+    void run();
+    // Closes every connection now
+    void stop();
+    // Drains the current generation with no successor; run() returns after
+    void stopGracefully();
+    // Starts a generation with `next` and drains the current one. Mode
+    // changes need a restart, and so do fewer workers on the same port
+    // unless the kernel migrates queued connections. False (still serving
+    // as before) if the new generation cannot start, e.g. its port cannot
+    // be bound.
+    bool reload(const ServerConfig& next);
+
+    Router& getRouter() { return router; }
+
+private:
+    void normalize(ServerConfig& next) const;
+    SOCKET_TYPE openListenSocket(const ServerConfig& settings, int port, bool reusePort);
+    std::shared_ptr<Listener> listenOn(const ServerConfig& settings, int port, bool reusePort,
+                                       const std::shared_ptr<Listener>& reuse);
+    std::unique_ptr<Generation> buildGeneration(const ServerConfig& settings, const Generation* previous);
+    bool startWorkers(Generation& generation, const Generation* previous);
+    void launch(Generation& generation);
+    void threadFinished(Generation& generation);
+    void beginDrain(Generation& generation, const Generation* successor);
+    void wake(Generation& generation);
+    void retire(Generation& generation);
+    void printWorkerStats(const Generation& generation) const;
+    void runThreads(Generation& generation);
+    void reapClientThreads(Generation& generation);
+    void handleClient(Generation& generation, SOCKET_TYPE clientSocket, struct sockaddr_in clientAddr,
+                      bool secure, std::shared_ptr<std::atomic<bool>> finished);
+};
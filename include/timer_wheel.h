@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Entry in a TimerWheel, embedded in the object it times (a connection), so
+// arming, re-arming and cancelling never allocate
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    // Deadline in wheel ticks (milliseconds)
+    uint64_t expiry = 0;
+    // Level * kSlots + slot holding the node, or kDetached while it is due
+    uint16_t slot = 0;
+    // What expired, for the callback; set by the owner
+    void* owner = nullptr;
+
+    TimerNode() = default;
+    TimerNode(const TimerNode&) = delete;
+    TimerNode& operator=(const TimerNode&) = delete;
+
+    bool armed() const { return next != nullptr; }
+};
+
+// Hierarchical timing wheel with millisecond ticks, owned by one thread.
+// Level 0 has a slot per tick for the next 64 ms, level 1 a slot per 64 ms
+// for the next 4 s, and so on up six levels (about two years). A timer sits
+// in the level of the highest 6-bit group where its expiry differs from the
+// current tick and moves down a level each time the wheel reaches its slot,
+// so it is touched at most six times however far out it is. Scheduling and
+// cancelling are O(1) list operations, and a bitmap per level lets the
+// wheel skip straight to the next occupied slot rather than visit each tick.
+class TimerWheel {
+public:
+    static constexpr unsigned kSlotBits = 6;
+    static constexpr unsigned kSlots = 1u << kSlotBits;
+    static constexpr unsigned kLevels = 6;
+    static constexpr uint16_t kDetached = UINT16_MAX;
+
+private:
+    // Circular lists, one per slot; each head is a sentinel node
+    TimerNode slots[kLevels * kSlots];
+    uint64_t occupied[kLevels] = {};
+    // Next tick to process; every earlier one has fired
+    uint64_t current;
+    size_t count = 0;
+
+    void place(TimerNode& node);
+    void link(TimerNode& head, TimerNode& node);
+    void unlink(TimerNode& node);
+    // Moves every node of a slot onto `list`, leaving the slot empty
+    void detach(unsigned index, TimerNode& list);
+    // Moves nodes down from the slots of higher levels that start at `tick`
+    void cascade(uint64_t tick);
+    // The first tick at or after `current` with a slot to fire or cascade
+    uint64_t nextTick() const;
+
+public:
+    explicit TimerWheel(uint64_t now = tickNow());
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // Milliseconds of steady_clock time; deadlines round up so a timer
+    // never fires before its time point
+    static uint64_t tickNow();
+    static uint64_t tickAt(std::chrono::steady_clock::time_point time);
+
+    // (Re)arms `node` to fire at tick `expiry`; an expiry already past
+    // fires on the next advance()
+    void schedule(TimerNode& node, uint64_t expiry);
+    void cancel(TimerNode& node);
+
+    size_t size() const { return count; }
+
+    // Milliseconds until advance() has work to do: 0 if due, -1 if empty.
+    // Moving timers between levels counts as work, so this may end a wait a
+    // little early a few times per timer.
+    int timeoutMs(uint64_t now) const;
+
+    // Fires every timer due by `now`, calling expire(TimerNode&) on each
+    // after disarming it. The callback may schedule or cancel any timer,
+    // including the one that fired.
+    template <typename Expire>
+    void advance(uint64_t now, Expire&& expire);
+};
+
+template <typename Expire>
+void TimerWheel::advance(uint64_t now, Expire&& expire) {
+    while (count > 0) {
+        uint64_t tick = nextTick();
+        if (tick > now) {
+            break;
+        }
+        current = tick;
+        cascade(tick);
+        TimerNode due;
+        due.prev = due.next = &due;
+        detach(static_cast<unsigned>(tick & (kSlots - 1)), due);
+        // Timers scheduled for `tick` from inside a callback wait one tick
+        current = tick + 1;
+        while (due.next != &due) {
+            TimerNode& node = *due.next;
+            if (node.expiry > tick) {
+                // Clamped into the wheel's span when scheduled; not due yet
+                unlink(node);
+                place(node);
+                continue;
+            }
+            cancel(node);
+            expire(node);
+        }
+    }
+    if (current <= now) {
+        current = now + 1;
+    }
+}
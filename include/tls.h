@@ -0,0 +1,87 @@
+#pragma once
+
+#include "platform.h"
+#include "server_config.h"
+
+#include <cstddef>
+#include <memory>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+// OpenSSL's own typedefs, so this header does not pull in <openssl/ssl.h>
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+
+struct WorkerMetrics;
+class TlsStream;
+
+// Certificate, key and session state for the TLS listener, built once per
+// generation and shared by all its workers (an SSL_CTX may be used from
+// several threads). Resumption works two ways: TLS 1.3 and ticket-capable
+// 1.2 clients get session tickets sealed with keys only the server holds,
+// and other 1.2 clients hit a server-side session cache.
+class TlsContext {
+private:
+    SSL_CTX* context = nullptr;
+
+public:
+    TlsContext() = default;
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    // Loads config.tlsCertificateFile and config.tlsKeyFile. Given the
+    // generation being replaced, takes over its ticket keys so tickets
+    // issued before a reload still resume after it.
+    bool init(const ServerConfig& config, const TlsContext* previous);
+
+    // Server side of a new connection; the handshake runs in its first read()
+    std::unique_ptr<TlsStream> accept(SOCKET_TYPE socket, WorkerMetrics* metrics) const;
+};
+
+// One TLS connection over a socket of either kind. The calls mirror recv()
+// and send(): a byte count, 0 at the end of the stream, or -1 with errno
+// set. EAGAIN means "again once the socket is ready", for reading or
+// writing, since TLS may need to write while reading and the other way round.
+class TlsStream {
+public:
+    // Plaintext bytes per record; larger writes are split at this size
+    static constexpr size_t kRecordSize = 16 * 1024;
+
+private:
+    SSL* ssl;
+    WorkerMetrics* metrics;
+    bool established = false;
+    // With kTLS the kernel encrypts what is written to the socket
+    bool kernelSend = false;
+    // A write that would have blocked must be repeated with the same bytes
+    size_t retryLength = 0;
+
+    void finishHandshake();
+
+public:
+    TlsStream(SSL* ssl, WorkerMetrics* metrics);
+    ~TlsStream();
+
+    TlsStream(const TlsStream&) = delete;
+    TlsStream& operator=(const TlsStream&) = delete;
+
+    ssize_t read(char* buffer, size_t length);
+    ssize_t write(const char* data, size_t length);
+    // File body from the page cache. With kTLS this is sendfile(); otherwise
+    // at most kRecordSize bytes are read in and encrypted per call.
+    ssize_t sendFile(int fd, size_t offset, size_t length);
+
+    // Decrypted bytes buffered inside the stream, which poll() cannot see
+    bool pending() const;
+    bool isEstablished() const { return established; }
+    bool kernelOffload() const { return kernelSend; }
+    // Length the next write() must be given after one that returned EAGAIN; 0 = any
+    size_t pendingWriteLength() const { return retryLength; }
+
+    // Sends close_notify, without waiting for the peer's
+    void shutdown();
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "platform.h"
+
+#ifdef HAVE_IO_URING
+
+#include "buffer_pool.h"
+#include "http_handler.h"
+#include "response_queue.h"
+#include "server_config.h"
+#include "timer_wheel.h"
+#include "worker_loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+class AccessLog;
+class AccessLogRing;
+class FileCache;
+class MetricsRegistry;
+class ResponseCache;
+class Router;
+struct WorkerMetrics;
+
+// Submission and completion queues of one io_uring instance, mapped from
+// the kernel and driven with the raw syscalls.
+class IoRing {
+private:
+    int fd = -1;
+    void* rings = nullptr;     // SQ and CQ share one mapping (IORING_FEAT_SINGLE_MMAP)
+    size_t ringsSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned localTail = 0;    // SQEs prepared, published to the kernel on submit
+
+    int enter(unsigned minComplete, unsigned flags, int timeoutMs);
+    // Created disabled so the worker thread, not the one calling init(),
+    // becomes the single issuer when it enables the ring
+    bool disabled = false;
+
+public:
+    IoRing() = default;
+    ~IoRing();
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    bool init(unsigned entries);
+    bool enable();
+    int getFd() const { return fd; }
+
+    // A zeroed SQE; submits what is queued first if the ring is full
+    io_uring_sqe* nextSqe();
+    // Submit early unless `count` more SQEs fit, so a linked chain is never
+    // split across two submissions
+    void makeRoom(unsigned count);
+    // Submit everything prepared and wait for at least one completion or
+    // the timeout (-1 = none). Returns 0 or a negative errno; -ETIME and
+    // -EINTR just mean there may be nothing to reap.
+    int submitAndWait(int timeoutMs);
+    int submit();
+
+    // Calls handler(const io_uring_cqe&) for every completion ready now
+    template <typename Handler>
+    unsigned reap(Handler&& handler) {
+        unsigned count = 0;
+        unsigned head = *cqHead;
+        while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe cqe = cqes[head & cqMask];
+            // Free the slot before handling, which may queue more work
+            __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+            handler(cqe);
+            ++count;
+        }
+        return count;
+    }
+};
+
+// One connection on a UringLoop. The loop only has one operation of each
+// kind outstanding: a receive while waiting for requests, otherwise a send
+// (or a writability poll for a file body) until the responses are out, or
+// a poll on a parked handler's own socket.
+struct UringConnection {
+    SOCKET_TYPE socket;
+    InputBuffer inBuffer;
+    ResponseQueue output;
+    PipelineState pipeline;
+    // Submitted operations not yet completed; freed only once this is 0
+    int inFlight;
+    bool sending;
+    bool peerClosed;
+    // Closed by the loop; waiting for in-flight operations to finish
+    bool closing;
+    // A close is linked behind the final send; the kernel closes the socket
+    bool closeLinked;
+    bool socketOpen;
+    // No request byte received yet; lastActivity is still the accept time
+    bool awaitingFirstByte;
+    // A handler sleeps, waits for its body or polls a socket of its own
+    bool parked;
+    size_t responsesPending;
+    std::chrono::steady_clock::time_point requestsReadAt;
+    // Last receive, or last send completion
+    std::chrono::steady_clock::time_point lastActivity;
+    // First byte of the (partial) request at the front of the input, or the accept
+    std::chrono::steady_clock::time_point requestStartedAt;
+    // Deadline of whatever the connection waits for (see UringLoop::armTimer)
+    TimerNode timer;
+    // Read by the kernel while a sendmsg is in flight
+    struct msghdr message;
+    struct iovec iov[ResponseQueue::kMaxIovecs];
+
+    UringConnection(SOCKET_TYPE socket, BufferPool& pool)
+        : socket(socket), inBuffer(pool), output(pool), inFlight(0), sending(false),
+          peerClosed(false), closing(false), closeLinked(false), socketOpen(true),
+          awaitingFirstByte(true), parked(false), responsesPending(0), message() {
+        timer.owner = this;
+    }
+};
+
+// Completion-based worker: one io_uring per worker, with its own
+// SO_REUSEPORT listener like EventLoop and the same request handling.
+//  - A single multishot accept keeps producing new connections.
+//  - Receives pick a buffer from a provided buffer ring when data arrives,
+//    so idle connections pin no receive memory; bytes are copied into the
+//    connection's pooled input buffer and the ring buffer is recycled at once.
+//  - Responses go out with sendmsg over the same iovecs the epoll path uses;
+//    the last response on a connection is linked to a close.
+//  - File bodies still use sendfile() on the non-blocking socket, with a
+//    poll for writability when it fills.
+//  - Suspended handlers sleep on the loop's timer wheel, or on a poll of
+//    their own socket, like on EventLoop. The same wheel enforces the
+//    header, body, idle and write timeouts.
+// Every operation prepared while handling one batch of completions is
+// submitted by the next io_uring_enter, which also waits for the next batch.
+class UringLoop : public WorkerLoop {
+private:
+    SOCKET_TYPE listenSocket;
+    std::atomic<bool>& running;
+    const ServerConfig& config;
+    // Operations submitted and not yet completed, across all connections
+    size_t operations;
+    int wakeFd;
+    uint64_t wakeValue;
+    // Provided receive buffers, registered as buffer group 0; the storage
+    // is declared before the ring so it outlives any receive into it
+    io_uring_buf* bufferRing;
+    std::unique_ptr<char[]> receiveBuffers;
+    uint16_t bufferTail;
+    IoRing ring;
+    BufferPool pool;
+    // Declared before the connections, whose timers it links
+    TimerWheel timers;
+    // This worker's share of config.maxConnections; 0 = unlimited
+    size_t connectionLimit;
+    std::unordered_map<UringConnection*, std::unique_ptr<UringConnection>> connections;
+    // Set by drain() from any thread; run() then cancels the accept
+    std::atomic<bool> drainRequested;
+    bool draining;
+    // Ends a drain that outlasts config.drainTimeoutMs
+    TimerNode drainTimer;
+    // Re-arms the accept after it failed for want of descriptors or memory
+    TimerNode acceptTimer;
+    SpareDescriptor spare;
+    std::unique_ptr<FileCache> files;
+    ResponseCache* responses;
+    AccessLog* accessLog;
+    AccessLogRing* accessLogRing;
+    MetricsRegistry* metricsRegistry;
+    WorkerMetrics* metrics;
+    const Router* router;
+
+public:
+    UringLoop(SOCKET_TYPE listenSocket, std::atomic<bool>& running, const ServerConfig& config,
+              ResponseCache* responses, AccessLog* accessLog, MetricsRegistry* metricsRegistry,
+              const Router* router);
+    ~UringLoop() override;
+
+    UringLoop(const UringLoop&) = delete;
+    UringLoop& operator=(const UringLoop&) = delete;
+
+    bool init() override;
+    void run() override;
+    void wakeup() override;
+    void drain() override;
+
+    size_t connectionCount() const { return connections.size(); }
+    const WorkerMetrics* getMetrics() const override { return metrics; }
+    BufferPoolStats getPoolStats() const override { return pool.getStats(); }
+
+private:
+    bool setupBufferRing();
+    void recycleBuffer(uint16_t id);
+    void armAccept();
+    void beginDrain();
+    void closeAll();
+    void armWake();
+    void armReceive(UringConnection& conn);
+    io_uring_sqe* prepare(uint8_t opcode, int fd, uint64_t userData);
+    void handleCompletion(const io_uring_cqe& cqe);
+    void handleAccept(const io_uring_cqe& cqe);
+    void handleReceive(UringConnection& conn, const io_uring_cqe& cqe);
+    void handleSend(UringConnection& conn, const io_uring_cqe& cqe);
+    void handleClose(UringConnection& conn, const io_uring_cqe& cqe);
+    void serviceRequests(UringConnection& conn);
+    size_t runPipeline(UringConnection& conn);
+    void parkHandler(UringConnection& conn);
+    void resumeHandler(UringConnection& conn);
+    // Fires due timers; returns ms until the next one, or -1
+    int runTimers();
+    void armTimer(UringConnection& conn);
+    void expireTimer(UringConnection& conn);
+    void sendOutput(UringConnection& conn);
+    void responseWritten(UringConnection& conn);
+    void closeConnection(UringConnection& conn);
+    void releaseIfIdle(UringConnection& conn);
+    void drainOperations();
+};
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "buffer_pool.h"
+
+struct WorkerMetrics;
+
+// One worker's I/O engine (epoll or io_uring) as TCPServer drives it. Each
+// owns its listener, connections and buffer pool, and runs on its own thread.
+class WorkerLoop {
+public:
+    virtual ~WorkerLoop() = default;
+
+    // False when the engine cannot run here (e.g. the kernel lacks support)
+    virtual bool init() = 0;
+    virtual void run() = 0;
+    // Break out of the wait from another thread (used by stop())
+    virtual void wakeup() = 0;
+    // Hand over to a successor, from any thread: stop accepting and answer
+    // the next request on each connection with Connection: close. Idle
+    // connections close at their idle timeout as usual. run() returns once
+    // no connection is left, or when config.drainTimeoutMs runs out.
+    virtual void drain() = 0;
+
+    // Null when the loop was created without a registry
+    virtual const WorkerMetrics* getMetrics() const = 0;
+    virtual BufferPoolStats getPoolStats() const = 0;
+};
@@ -0,0 +1,252 @@
+#include "access_log.h"
+#include "counters.h"
+#include "platform.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+namespace {
+
+constexpr auto kDrainInterval = std::chrono::milliseconds(10);
+// Write out formatted lines once this many bytes have accumulated
+constexpr size_t kBatchBytes = 64 * 1024;
+
+size_t ringSize(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    return size;
+}
+
+int64_t nanoseconds(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+}
+
+AccessLogRing::AccessLogRing(size_t capacity, uint32_t sampleEvery)
+    : head(0), tail(0), cachedHead(0), sampleCountdown(sampleEvery > 0 ? sampleEvery : 1),
+      records(0), dropped(0), sampleEvery(sampleEvery > 0 ? sampleEvery : 1),
+      mask(ringSize(capacity) - 1), slots(new AccessLogRecord[mask + 1]) {}
+
+AccessLogRecord* AccessLogRing::reserve() {
+    size_t position = tail.load(std::memory_order_relaxed);
+    if (position - cachedHead > mask) {
+        // Looks full from here; only now pay for the consumer's cache line
+        cachedHead = head.load(std::memory_order_acquire);
+        if (position - cachedHead > mask) {
+            bumpCounter(dropped);
+            return nullptr;
+        }
+    }
+    return &slots[position & mask];
+}
+
+void AccessLogRing::publish() {
+    bumpCounter(records);
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+AccessLog::AccessLog(const std::string& path, uint32_t sampleEvery, size_t ringCapacity)
+    : path(path), ringCapacity(ringCapacity), sampleEvery(sampleEvery > 0 ? sampleEvery : 1),
+      file(nullptr), steadyToSystemNs(0), stopping(false) {}
+
+AccessLog::~AccessLog() {
+    stop();
+}
+
+bool AccessLog::start() {
+    if (path == "-") {
+        file = stdout;
+    } else {
+        file = fopen(path.c_str(), "a");
+        if (!file) {
+            std::cerr << "Failed to open access log " << path << ". Error: " << errno << std::endl;
+            return false;
+        }
+    }
+
+    auto system = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    steadyToSystemNs = system - nanoseconds(std::chrono::steady_clock::now());
+
+    batch.reserve(kBatchBytes + 1024);
+    drainThread = std::thread(&AccessLog::drainLoop, this);
+    return true;
+}
+
+void AccessLog::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (drainThread.joinable()) {
+        drainThread.join();
+    }
+    if (file && file != stdout) {
+        fclose(file);
+    }
+    file = nullptr;
+}
+
+AccessLogRing* AccessLog::acquireRing() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!freeRings.empty()) {
+        // The previous owner has stopped producing; the lock orders the handoff
+        AccessLogRing* ring = freeRings.back();
+        freeRings.pop_back();
+        return ring;
+    }
+    rings.push_back(std::make_unique<AccessLogRing>(ringCapacity, sampleEvery));
+    return rings.back().get();
+}
+
+void AccessLog::releaseRing(AccessLogRing* ring) {
+    if (!ring) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    freeRings.push_back(ring);
+}
+
+AccessLogStats AccessLog::getStats() {
+    AccessLogStats stats;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& ring : rings) {
+        stats.records += ring->records.load(std::memory_order_relaxed);
+        stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void AccessLog::format(const AccessLogRecord& record) {
+    // Common Log Format plus the client port and latency:
+    // 127.0.0.1:52814 - - [16/Oct/2026:09:12:01 +0000] "GET / HTTP/1.1" 200 80 42us
+    char line[192 + 4 * AccessLogRecord::kMaxPath];
+    char address[INET_ADDRSTRLEN];
+    struct in_addr peer;
+    peer.s_addr = record.peerAddress;
+    inet_ntop(AF_INET, &peer, address, sizeof(address));
+
+    time_t seconds = static_cast<time_t>((record.finishedNs + steadyToSystemNs) / 1000000000);
+    struct tm utc;
+    #ifdef _WIN32
+    gmtime_s(&utc, &seconds);
+    #else
+    gmtime_r(&seconds, &utc);
+    #endif
+    char timestamp[32];
+    strftime(timestamp, sizeof(timestamp), "%d/%b/%Y:%H:%M:%S +0000", &utc);
+
+    // Request bytes were validated by the parser, but keep the line unambiguous
+    char path[4 * AccessLogRecord::kMaxPath + 4];
+    size_t length = 0;
+    size_t stored = std::min<size_t>(record.pathLength, AccessLogRecord::kMaxPath);
+    for (size_t i = 0; i < stored; ++i) {
+        unsigned char c = static_cast<unsigned char>(record.path[i]);
+        if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\') {
+            length += static_cast<size_t>(snprintf(path + length, 5, "\\x%02x", c));
+        } else {
+            path[length++] = static_cast<char>(c);
+        }
+    }
+    if (stored < record.pathLength) {
+        memcpy(path + length, "...", 3);
+        length += 3;
+    }
+    path[length] = '\0';
+
+    char request[sizeof(path) + 32];
+    if (record.methodLength == 0) {
+        // Unparseable request: no request line to show
+        strcpy(request, "-");
+    } else {
+        snprintf(request, sizeof(request), "%.*s %s HTTP/1.%u", static_cast<int>(record.methodLength),
+                 record.method, path, record.minorVersion);
+    }
+
+    int written = snprintf(line, sizeof(line), "%s:%u - - [%s] \"%s\" %u %llu %uus\n",
+                           address, record.peerPort, timestamp, request, record.status,
+                           static_cast<unsigned long long>(record.bytes), record.latencyUs);
+    if (written > 0) {
+        batch.append(line, std::min(static_cast<size_t>(written), sizeof(line) - 1));
+    }
+}
+
+size_t AccessLog::drain() {
+    size_t drained = 0;
+    {
+        // Rings are never freed before the log, so the pointers stay valid
+        std::lock_guard<std::mutex> lock(mutex);
+        draining.clear();
+        for (const auto& ring : rings) {
+            draining.push_back(ring.get());
+        }
+    }
+    for (AccessLogRing* ring : draining) {
+        size_t first = ring->head.load(std::memory_order_relaxed);
+        size_t last = ring->tail.load(std::memory_order_acquire);
+        for (size_t position = first; position != last; ++position) {
+            format(ring->slots[position & ring->mask]);
+            if (batch.size() >= kBatchBytes) {
+                fwrite(batch.data(), 1, batch.size(), file);
+                batch.clear();
+            }
+        }
+        // Slots are free for the producer again once head moves past them
+        ring->head.store(last, std::memory_order_release);
+        drained += last - first;
+    }
+    if (!batch.empty()) {
+        fwrite(batch.data(), 1, batch.size(), file);
+        batch.clear();
+    }
+    if (drained > 0) {
+        fflush(file);
+    }
+    return drained;
+}
+
+void AccessLog::drainLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (wake.wait_for(lock, kDrainInterval, [this]() { return stopping; })) {
+                break;
+            }
+        }
+        drain();
+    }
+    // Final pass after producers have stopped
+    drain();
+}
+
+void logAccess(AccessLogRing* ring, uint32_t peerAddress, uint16_t peerPort,
+               std::string_view method, std::string_view path, int minorVersion,
+               int status, size_t bytes, std::chrono::steady_clock::time_point received) {
+    if (!ring || !ring->sample()) {
+        return;
+    }
+    AccessLogRecord* record = ring->reserve();
+    if (!record) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    record->finishedNs = nanoseconds(now);
+    record->bytes = bytes;
+    record->latencyUs = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - received).count());
+    record->peerAddress = peerAddress;
+    record->peerPort = peerPort;
+    record->status = static_cast<uint16_t>(status);
+    record->minorVersion = static_cast<uint8_t>(minorVersion);
+    record->methodLength = static_cast<uint8_t>(std::min(method.size(), AccessLogRecord::kMaxMethod));
+    memcpy(record->method, method.data(), record->methodLength);
+    record->pathLength = static_cast<uint16_t>(std::min<size_t>(path.size(), UINT16_MAX));
+    memcpy(record->path, path.data(), std::min(path.size(), AccessLogRecord::kMaxPath));
+    ring->publish();
+}
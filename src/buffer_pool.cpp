@@ -0,0 +1,137 @@
+#include "buffer_pool.h"
+#include "counters.h"
+
+#include <cstring>
+
+BufferPool::BufferPool(size_t blockSize, size_t blocksPerSlab)
+    : blockSize(blockSize), blocksPerSlab(blocksPerSlab > 0 ? blocksPerSlab : 1),
+      totalBlocks(0), blocksInUse(0), peakBlocksInUse(0) {}
+
+void BufferPool::grow() {
+    slabs.emplace_back(new char[blockSize * blocksPerSlab]);
+    char* slab = slabs.back().get();
+
+    // Room for every block ever created, so release() never reallocates
+    size_t total = totalBlocks.load(std::memory_order_relaxed) + blocksPerSlab;
+    freeBlocks.reserve(total);
+    for (size_t i = blocksPerSlab; i-- > 0;) {
+        freeBlocks.push_back(slab + i * blockSize);
+    }
+    totalBlocks.store(total, std::memory_order_relaxed);
+}
+
+char* BufferPool::acquire() {
+    if (freeBlocks.empty()) {
+        grow();
+    }
+    char* block = freeBlocks.back();
+    freeBlocks.pop_back();
+
+    bumpCounter(blocksInUse);
+    size_t inUse = blocksInUse.load(std::memory_order_relaxed);
+    if (inUse > peakBlocksInUse.load(std::memory_order_relaxed)) {
+        peakBlocksInUse.store(inUse, std::memory_order_relaxed);
+    }
+    return block;
+}
+
+void BufferPool::release(char* block) {
+    freeBlocks.push_back(block);
+    dropCounter(blocksInUse);
+}
+
+BufferPoolStats BufferPool::getStats() const {
+    BufferPoolStats stats;
+    stats.blockSize = blockSize;
+    stats.totalBlocks = totalBlocks.load(std::memory_order_relaxed);
+    stats.slabs = stats.totalBlocks / blocksPerSlab;
+    stats.blocksInUse = blocksInUse.load(std::memory_order_relaxed);
+    stats.peakBlocksInUse = peakBlocksInUse.load(std::memory_order_relaxed);
+    return stats;
+}
+
+InputBuffer::~InputBuffer() {
+    if (block) {
+        pool.release(block);
+    }
+}
+
+char* InputBuffer::writePointer(size_t& available) {
+    if (!block) {
+        block = pool.acquire();
+        start = end = 0;
+    } else if (end == pool.getBlockSize() && start > 0) {
+        // Slide the partial request down to make room behind it
+        memmove(block, block + start, end - start);
+        end -= start;
+        start = 0;
+    }
+    available = pool.getBlockSize() - end;
+    return block + end;
+}
+
+void InputBuffer::commit(size_t count) {
+    end += count;
+}
+
+void InputBuffer::consume(size_t count) {
+    start += count;
+    if (start == end && block) {
+        pool.release(block);
+        block = nullptr;
+        start = end = 0;
+    }
+}
+
+void InputBuffer::compact() {
+    if (block && start > 0) {
+        memmove(block, block + start, end - start);
+        end -= start;
+        start = 0;
+    }
+}
+
+void InputBuffer::erase(size_t offset, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    char* gap = block + start + offset;
+    memmove(gap, gap + count, end - start - offset - count);
+    end -= count;
+}
+
+Arena::~Arena() {
+    reset();
+}
+
+char* Arena::allocate(size_t size) {
+    if (size > pool.getBlockSize()) {
+        oversized.emplace_back(new char[size]);
+        return oversized.back().get();
+    }
+    if (blocks.empty() || used + size > pool.getBlockSize()) {
+        blocks.push_back(pool.acquire());
+        used = 0;
+    }
+    char* result = blocks.back() + used;
+    used += size;
+    return result;
+}
+
+bool Arena::extend(const char* end, size_t size) {
+    if (blocks.empty() || end != blocks.back() + used || used + size > pool.getBlockSize()) {
+        return false;
+    }
+    used += size;
+    return true;
+}
+
+void Arena::reset() {
+    for (char* block : blocks) {
+        pool.release(block);
+    }
+    // clear() keeps the capacity, so the next response reuses it
+    blocks.clear();
+    oversized.clear();
+    used = 0;
+}
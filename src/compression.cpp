@@ -0,0 +1,290 @@
+#include "compression.h"
+#include "string_util.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace {
+
+bool startsWith(std::string_view text, std::string_view prefix) {
+    return text.size() >= prefix.size() && equalsIgnoreCase(text.substr(0, prefix.size()), prefix);
+}
+
+// q-value in thousandths: "1", "0.5", "0.125"; -1 if malformed
+int parseQuality(std::string_view text) {
+    if (text.empty() || (text[0] != '0' && text[0] != '1')) {
+        return -1;
+    }
+    int quality = (text[0] - '0') * 1000;
+    if (text.size() == 1) {
+        return quality;
+    }
+    if (text[1] != '.' || text.size() > 5) {
+        return -1;
+    }
+    int scale = 100;
+    for (char c : text.substr(2)) {
+        if (c < '0' || c > '9') {
+            return -1;
+        }
+        quality += (c - '0') * scale;
+        scale /= 10;
+    }
+    return quality <= 1000 ? quality : -1;
+}
+
+#ifdef HAVE_ZLIB
+
+class GzipCompressor : public StreamCompressor {
+private:
+    z_stream stream = {};
+    bool ready = false;
+
+public:
+    explicit GzipCompressor(int level) {
+        // windowBits 15 + 16 selects the gzip wrapper
+        ready = deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~GzipCompressor() override {
+        if (ready) {
+            deflateEnd(&stream);
+        }
+    }
+
+    bool isReady() const { return ready; }
+    void reset() { deflateReset(&stream); }
+
+    bool write(std::string_view input, Mode mode, std::string& output) override {
+        if (!ready) {
+            return false;
+        }
+        int flush = mode == Mode::Finish ? Z_FINISH : mode == Mode::Flush ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        while (true) {
+            size_t used = output.size();
+            size_t room = deflateBound(&stream, stream.avail_in) + 64;
+            output.resize(used + room);
+            stream.next_out = reinterpret_cast<Bytef*>(&output[used]);
+            stream.avail_out = static_cast<uInt>(room);
+            int result = deflate(&stream, flush);
+            output.resize(used + room - stream.avail_out);
+            if (result == Z_STREAM_ERROR) {
+                return false;
+            }
+            // Done once the input is taken and, for a flush, the output was not cut short
+            if (stream.avail_in == 0 && stream.avail_out > 0 && (flush != Z_FINISH || result == Z_STREAM_END)) {
+                return true;
+            }
+        }
+    }
+};
+
+#endif
+
+#ifdef HAVE_BROTLI
+
+class BrotliCompressor : public StreamCompressor {
+private:
+    BrotliEncoderState* state;
+
+public:
+    explicit BrotliCompressor(int quality) : state(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr)) {
+        if (state) {
+            BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(quality));
+        }
+    }
+    ~BrotliCompressor() override {
+        if (state) {
+            BrotliEncoderDestroyInstance(state);
+        }
+    }
+
+    bool isReady() const { return state != nullptr; }
+
+    bool write(std::string_view input, Mode mode, std::string& output) override {
+        if (!state) {
+            return false;
+        }
+        BrotliEncoderOperation operation = mode == Mode::Finish ? BROTLI_OPERATION_FINISH
+                                           : mode == Mode::Flush ? BROTLI_OPERATION_FLUSH
+                                                                 : BROTLI_OPERATION_PROCESS;
+        size_t availableIn = input.size();
+        const uint8_t* nextIn = reinterpret_cast<const uint8_t*>(input.data());
+        while (true) {
+            size_t availableOut = 0;
+            if (!BrotliEncoderCompressStream(state, operation, &availableIn, &nextIn, &availableOut, nullptr,
+                                             nullptr)) {
+                return false;
+            }
+            // Output is taken straight from the encoder's own buffer
+            size_t length = 0;
+            const uint8_t* produced = BrotliEncoderTakeOutput(state, &length);
+            output.append(reinterpret_cast<const char*>(produced), length);
+            if (availableIn == 0 && !BrotliEncoderHasMoreOutput(state) &&
+                (operation != BROTLI_OPERATION_FINISH || BrotliEncoderIsFinished(state))) {
+                return true;
+            }
+        }
+    }
+};
+
+#endif
+
+}
+
+const char* contentEncodingName(ContentEncoding encoding) {
+    switch (encoding) {
+        case ContentEncoding::Gzip: return "gzip";
+        case ContentEncoding::Brotli: return "br";
+        default: return "";
+    }
+}
+
+const char* contentEncodingSuffix(ContentEncoding encoding) {
+    switch (encoding) {
+        case ContentEncoding::Gzip: return ".gz";
+        case ContentEncoding::Brotli: return ".br";
+        default: return "";
+    }
+}
+
+unsigned availableEncodings() {
+    unsigned encodings = encodingBit(ContentEncoding::Identity);
+    #ifdef HAVE_ZLIB
+    encodings |= encodingBit(ContentEncoding::Gzip);
+    #endif
+    #ifdef HAVE_BROTLI
+    encodings |= encodingBit(ContentEncoding::Brotli);
+    #endif
+    return encodings;
+}
+
+ContentEncoding negotiateEncoding(std::string_view acceptEncoding, unsigned offered) {
+    int gzip = -1;
+    int brotli = -1;
+    int any = -1;
+    while (!acceptEncoding.empty()) {
+        size_t comma = acceptEncoding.find(',');
+        std::string_view element = acceptEncoding.substr(0, comma);
+        acceptEncoding = comma == std::string_view::npos ? std::string_view() : acceptEncoding.substr(comma + 1);
+
+        size_t semicolon = element.find(';');
+        std::string_view coding = trim(element.substr(0, semicolon));
+        int quality = 1000;
+        if (semicolon != std::string_view::npos) {
+            std::string_view parameter = trim(element.substr(semicolon + 1));
+            if (startsWith(parameter, "q=")) {
+                quality = parseQuality(parameter.substr(2));
+            }
+        }
+        if (quality < 0) {
+            continue;
+        }
+        if (equalsIgnoreCase(coding, "gzip") || equalsIgnoreCase(coding, "x-gzip")) {
+            gzip = quality;
+        } else if (equalsIgnoreCase(coding, "br")) {
+            brotli = quality;
+        } else if (coding == "*") {
+            any = quality;
+        }
+    }
+    // Codings not listed take the "*" weight, if there is one
+    if (gzip < 0) {
+        gzip = any;
+    }
+    if (brotli < 0) {
+        brotli = any;
+    }
+    if (!(offered & encodingBit(ContentEncoding::Gzip))) {
+        gzip = 0;
+    }
+    if (!(offered & encodingBit(ContentEncoding::Brotli))) {
+        brotli = 0;
+    }
+    if (brotli > 0 && brotli >= gzip) {
+        return ContentEncoding::Brotli;
+    }
+    return gzip > 0 ? ContentEncoding::Gzip : ContentEncoding::Identity;
+}
+
+bool isCompressible(std::string_view contentType) {
+    std::string_view type = trim(contentType.substr(0, contentType.find(';')));
+    if (startsWith(type, "text/")) {
+        return true;
+    }
+    static const std::string_view kTypes[] = {
+        "application/json", "application/javascript", "application/xml", "image/svg+xml",
+        "application/wasm",
+    };
+    for (std::string_view candidate : kTypes) {
+        if (equalsIgnoreCase(type, candidate)) {
+            return true;
+        }
+    }
+    // Structured syntax suffixes: application/ld+json, application/atom+xml
+    return type.size() > 5 && (equalsIgnoreCase(type.substr(type.size() - 5), "+json") ||
+                               equalsIgnoreCase(type.substr(type.size() - 4), "+xml"));
+}
+
+bool compressBuffer(ContentEncoding encoding, std::string_view input, std::string& output, int level) {
+    output.clear();
+    #ifdef HAVE_ZLIB
+    if (encoding == ContentEncoding::Gzip) {
+        // One deflate state per thread, reset between bodies: initializing
+        // one allocates a few hundred KB
+        thread_local GzipCompressor compressor(kGzipLevel);
+        if (level >= 0 && level != kGzipLevel) {
+            GzipCompressor custom(level);
+            return custom.write(input, StreamCompressor::Mode::Finish, output);
+        }
+        compressor.reset();
+        return compressor.write(input, StreamCompressor::Mode::Finish, output);
+    }
+    #endif
+    #ifdef HAVE_BROTLI
+    if (encoding == ContentEncoding::Brotli) {
+        size_t length = BrotliEncoderMaxCompressedSize(input.size());
+        output.resize(length > 0 ? length : input.size() + 1024);
+        length = output.size();
+        int quality = level >= 0 ? level : kBrotliQuality;
+        if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, input.size(),
+                                   reinterpret_cast<const uint8_t*>(input.data()), &length,
+                                   reinterpret_cast<uint8_t*>(&output[0]))) {
+            return false;
+        }
+        output.resize(length);
+        return true;
+    }
+    #endif
+    (void)input;
+    (void)level;
+    (void)encoding;
+    return false;
+}
+
+std::unique_ptr<StreamCompressor> StreamCompressor::create(ContentEncoding encoding, int level) {
+    #ifdef HAVE_ZLIB
+    if (encoding == ContentEncoding::Gzip) {
+        auto compressor = std::make_unique<GzipCompressor>(level >= 0 ? level : kGzipLevel);
+        if (compressor->isReady()) {
+            return compressor;
+        }
+    }
+    #endif
+    #ifdef HAVE_BROTLI
+    if (encoding == ContentEncoding::Brotli) {
+        auto compressor = std::make_unique<BrotliCompressor>(level >= 0 ? level : kBrotliQuality);
+        if (compressor->isReady()) {
+            return compressor;
+        }
+    }
+    #endif
+    (void)encoding;
+    (void)level;
+    return nullptr;
+}
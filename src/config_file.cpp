@@ -0,0 +1,193 @@
+#include "config_file.h"
+#include "string_util.h"
+
+#include <charconv>
+#include <fstream>
+#include <utility>
+
+namespace {
+
+template <typename Number>
+bool parseNumber(const std::string& value, Number& result, std::string& error) {
+    Number parsed = 0;
+    auto [end, status] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+    if (status != std::errc() || end != value.data() + value.size() || parsed < 0) {
+        error = "expected a non-negative number, got \"" + value + "\"";
+        return false;
+    }
+    result = parsed;
+    return true;
+}
+
+bool parseBool(const std::string& value, bool& result, std::string& error) {
+    if (value == "true" || value == "on" || value == "yes" || value == "1") {
+        result = true;
+        return true;
+    }
+    if (value == "false" || value == "off" || value == "no" || value == "0") {
+        result = false;
+        return true;
+    }
+    error = "expected true or false, got \"" + value + "\"";
+    return false;
+}
+
+// "PREFIX=HOST:PORT[,HOST:PORT...]"
+bool parseProxyRoute(const std::string& value, ProxyRoute& route, std::string& error) {
+    size_t equals = value.find('=');
+    if (equals == std::string::npos || equals == 0 || value[0] != '/') {
+        error = "expected /prefix=host:port[,host:port...], got \"" + value + "\"";
+        return false;
+    }
+    route.prefix = value.substr(0, equals);
+    size_t start = equals + 1;
+    while (start <= value.size()) {
+        size_t comma = value.find(',', start);
+        std::string upstream = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        size_t colon = upstream.rfind(':');
+        int port = 0;
+        std::string problem;
+        if (colon == std::string::npos || colon == 0 || !parseNumber(upstream.substr(colon + 1), port, problem) ||
+            port < 1 || port > 65535) {
+            error = "expected host:port for an upstream, got \"" + upstream + "\"";
+            return false;
+        }
+        route.upstreams.push_back(upstream);
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+    return true;
+}
+
+}
+
+bool applyConfigOption(const std::string& name, const std::string& value, ServerConfig& config,
+                       std::string& error) {
+    if (name == "port") {
+        if (!parseNumber(value, config.port, error)) {
+            return false;
+        }
+        if (config.port < 1 || config.port > 65535) {
+            error = "port must be between 1 and 65535";
+            return false;
+        }
+        return true;
+    }
+    if (name == "tls-port") {
+        if (!parseNumber(value, config.tlsPort, error)) {
+            return false;
+        }
+        if (config.tlsPort > 65535) {
+            error = "tls-port must be between 1 and 65535 (0 = off)";
+            return false;
+        }
+        return true;
+    }
+    if (name == "proxy") {
+        // Repeatable: each one adds a route
+        ProxyRoute route;
+        if (!parseProxyRoute(value, route, error)) {
+            return false;
+        }
+        config.proxyRoutes.push_back(std::move(route));
+        return true;
+    }
+    if (name == "mode") {
+        if (!parseServerMode(value, config.mode)) {
+            error = "unknown mode \"" + value + "\"";
+            return false;
+        }
+        return true;
+    }
+    if (name == "workers")            return parseNumber(value, config.workers, error);
+    if (name == "pin-cpus")           return parseBool(value, config.pinWorkers, error);
+    if (name == "keepalive-timeout")  return parseNumber(value, config.keepAliveTimeoutMs, error);
+    if (name == "header-timeout")     return parseNumber(value, config.headerTimeoutMs, error);
+    if (name == "body-timeout")       return parseNumber(value, config.bodyTimeoutMs, error);
+    if (name == "write-timeout")      return parseNumber(value, config.writeTimeoutMs, error);
+    if (name == "drain-timeout")      return parseNumber(value, config.drainTimeoutMs, error);
+    if (name == "max-requests")       return parseNumber(value, config.maxRequestsPerConnection, error);
+    if (name == "max-connections")    return parseNumber(value, config.maxConnections, error);
+    if (name == "backlog")            return parseNumber(value, config.listenBacklog, error);
+    if (name == "file-cache")         return parseNumber(value, config.fileCacheEntries, error);
+    if (name == "response-cache")     return parseNumber(value, config.responseCacheBytes, error);
+    if (name == "zerocopy-threshold") return parseNumber(value, config.zeroCopyThreshold, error);
+    if (name == "access-log-sample")  return parseNumber(value, config.accessLogSampleEvery, error);
+    if (name == "compress-min")       return parseNumber(value, config.compressionMinBytes, error);
+    if (name == "max-body")           return parseNumber(value, config.maxRequestBodyBytes, error);
+    if (name == "ktls")               return parseBool(value, config.tlsKernelOffload, error);
+    if (name == "proxy-timeout")      return parseNumber(value, config.proxyTimeoutMs, error);
+    if (name == "proxy-pool")         return parseNumber(value, config.proxyPoolSize, error);
+    if (name == "proxy-idle-timeout") return parseNumber(value, config.proxyIdleTimeoutMs, error);
+    if (name == "proxy-health-interval") {
+        return parseNumber(value, config.proxyHealthIntervalMs, error);
+    }
+    if (name == "root") {
+        config.documentRoot = value;
+        return true;
+    }
+    if (name == "access-log") {
+        config.accessLogPath = value;
+        return true;
+    }
+    if (name == "tls-cert") {
+        config.tlsCertificateFile = value;
+        return true;
+    }
+    if (name == "tls-key") {
+        config.tlsKeyFile = value;
+        return true;
+    }
+    if (name == "proxy-health-path") {
+        config.proxyHealthPath = value;
+        return true;
+    }
+    if (name == "metrics-path") {
+        config.metricsPath = value == "off" ? "" : value;
+        return true;
+    }
+    error = "unknown option \"" + name + "\"";
+    return false;
+}
+
+bool loadConfigFile(const std::string& path, ServerConfig& config, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = path + ": cannot open";
+        return false;
+    }
+
+    // Files written on Windows keep a '\r' at the end of each line
+    constexpr std::string_view kWhitespace = " \t\r";
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        line = std::string(trim(line, kWhitespace));
+        if (line.empty()) {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            error = path + ":" + std::to_string(number) + ": expected name = value";
+            return false;
+        }
+        std::string name(trim(std::string_view(line).substr(0, equals), kWhitespace));
+        std::string value(trim(std::string_view(line).substr(equals + 1), kWhitespace));
+        if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front()) {
+            value = value.substr(1, value.size() - 2);
+        }
+
+        std::string problem;
+        if (!applyConfigOption(name, value, config, problem)) {
+            error = path + ":" + std::to_string(number) + ": " + problem;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,713 @@
+#include "event_loop.h"
+
+#ifdef HAVE_EPOLL
+
+#include "access_log.h"
+#include "file_cache.h"
+#include "metrics.h"
+
+#include <iostream>
+#include <vector>
+
+#include <linux/sockios.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+namespace {
+
+constexpr int kMaxEvents = 256;
+
+uint64_t tickAfter(std::chrono::steady_clock::time_point start, int timeoutMs) {
+    return TimerWheel::tickAt(start + std::chrono::milliseconds(timeoutMs));
+}
+
+}
+
+EventLoop::EventLoop(SOCKET_TYPE listenSocket, std::atomic<bool>& running, const ServerConfig& config,
+                     ResponseCache* responses, AccessLog* accessLog, MetricsRegistry* metricsRegistry,
+                     const Router* router)
+    : listenSocket(listenSocket), tlsListenSocket(INVALID_SOCKET), tlsContext(nullptr), running(running),
+      config(config), epollFd(-1), wakeFd(-1), connectionLimit(0), drainRequested(false), draining(false),
+      responses(responses), accessLog(accessLog), accessLogRing(nullptr),
+      metricsRegistry(metricsRegistry), metrics(nullptr), router(router) {
+    if (config.maxConnections > 0) {
+        size_t workers = static_cast<size_t>(std::max(config.workers, 1));
+        connectionLimit = (static_cast<size_t>(config.maxConnections) + workers - 1) / workers;
+    }
+}
+
+EventLoop::~EventLoop() {
+    for (auto& entry : connections) {
+        CLOSE_SOCKET(entry.first);
+    }
+    connections.clear();
+    handlerSockets.clear();
+
+    if (accessLog) {
+        accessLog->releaseRing(accessLogRing);
+    }
+    if (metricsRegistry) {
+        metricsRegistry->release(metrics);
+    }
+
+    if (wakeFd >= 0) {
+        close(wakeFd);
+    }
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+}
+
+void EventLoop::addTlsListener(SOCKET_TYPE socket, const TlsContext* context) {
+    tlsListenSocket = socket;
+    tlsContext = context;
+}
+
+bool EventLoop::init() {
+    #ifdef HAVE_STATIC_FILES
+    if (!config.documentRoot.empty()) {
+        files = std::make_unique<FileCache>(static_cast<size_t>(config.fileCacheEntries),
+                                            config.fileRevalidateMs, config.compressionMinBytes);
+        if (!files->init(config.documentRoot)) {
+            return false;
+        }
+    }
+    #endif
+
+    if (accessLog) {
+        accessLogRing = accessLog->acquireRing();
+    }
+    if (metricsRegistry) {
+        metrics = metricsRegistry->acquire();
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        std::cerr << "epoll_create1 failed. Error: " << errno << std::endl;
+        return false;
+    }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        std::cerr << "eventfd failed. Error: " << errno << std::endl;
+        return false;
+    }
+
+    struct epoll_event event = {};
+    for (SOCKET_TYPE listener : {listenSocket, tlsListenSocket}) {
+        if (listener == INVALID_SOCKET) {
+            continue;
+        }
+        // The listening socket must not block once accept() drains the backlog
+        int flags = fcntl(listener, F_GETFL, 0);
+        if (flags < 0 || fcntl(listener, F_SETFL, flags | O_NONBLOCK) < 0) {
+            std::cerr << "Failed to make listening socket non-blocking. Error: " << errno << std::endl;
+            return false;
+        }
+
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = listener;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, listener, &event) < 0) {
+            std::cerr << "Failed to register listening socket. Error: " << errno << std::endl;
+            return false;
+        }
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) < 0) {
+        std::cerr << "Failed to register wakeup descriptor. Error: " << errno << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void EventLoop::run() {
+    struct epoll_event events[kMaxEvents];
+
+    while (running && !(draining && connections.empty())) {
+        if (!draining && drainRequested.load(std::memory_order_acquire)) {
+            beginDrain();
+            continue;
+        }
+        int timeout = runTimers();
+        if (draining && connections.empty()) {
+            break;   // The drain timer closed the last ones
+        }
+        int ready = epoll_wait(epollFd, events, kMaxEvents, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "epoll_wait failed. Error: " << errno << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t flags = events[i].events;
+
+            if (fd == wakeFd) {
+                uint64_t value;
+                while (read(wakeFd, &value, sizeof(value)) > 0) {}
+                continue;
+            }
+
+            if (fd == listenSocket || fd == tlsListenSocket) {
+                acceptConnections(fd);
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) {
+                // A socket a parked handler is waiting on
+                auto waiter = handlerSockets.find(fd);
+                if (waiter != handlerSockets.end()) {
+                    Connection& conn = *waiter->second;
+                    unparkHandler(conn);
+                    resumeHandler(conn);
+                }
+                continue;
+            }
+            Connection& conn = *it->second;
+
+            if (flags & EPOLLERR && conn.output.zeroCopyEnabled()) {
+                // Zero-copy completions are reported on the error queue
+                if (!conn.output.reapZeroCopy(conn.socket)) {
+                    closeConnection(conn);
+                    continue;
+                }
+                flags &= ~EPOLLERR;
+            }
+
+            if (conn.state == Connection::State::Closing) {
+                // Lingering until the kernel releases our zero-copy buffers
+                if (!conn.output.zeroCopyInFlight() || (flags & (EPOLLERR | EPOLLHUP))) {
+                    closeConnection(conn);
+                }
+                continue;
+            }
+
+            if (flags & (EPOLLERR | EPOLLHUP)) {
+                closeConnection(conn);
+                continue;
+            }
+
+            if (conn.state == Connection::State::Waiting) {
+                if (flags & (EPOLLIN | EPOLLRDHUP) &&
+                    conn.pipeline.handler.wait().kind == HandlerWait::Kind::Body) {
+                    // More of its body: read it and resume the handler
+                    unparkHandler(conn);
+                    handleWrite(conn);
+                }
+                continue; // Otherwise input waits until the handler has finished
+            }
+
+            if (flags & EPOLLOUT && conn.state == Connection::State::Writing) {
+                // Drains any pipelined input too once the response is flushed
+                handleWrite(conn);
+                continue;
+            }
+
+            // A TLS handshake may be waiting to write, not to read
+            if (flags & (EPOLLIN | EPOLLRDHUP) || (conn.tls && flags & EPOLLOUT)) {
+                handleRead(conn);
+            }
+        }
+    }
+}
+
+void EventLoop::wakeup() {
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void EventLoop::drain() {
+    drainRequested.store(true, std::memory_order_release);
+    wakeup();
+}
+
+void EventLoop::beginDrain() {
+    draining = true;
+    // The listeners stay open: the next generation accepts on them
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, listenSocket, nullptr);
+    if (tlsListenSocket != INVALID_SOCKET) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, tlsListenSocket, nullptr);
+    }
+    if (config.drainTimeoutMs > 0) {
+        timers.schedule(drainTimer, tickAfter(std::chrono::steady_clock::now(), config.drainTimeoutMs));
+    }
+
+    // Connections are not closed between requests: a request may already be
+    // on its way. The next response carries Connection: close, and one that
+    // stays idle is closed by its idle timeout as usual.
+    for (auto& entry : connections) {
+        entry.second->pipeline.draining = true;
+    }
+}
+
+void EventLoop::closeAll() {
+    std::vector<SOCKET_TYPE> open;
+    open.reserve(connections.size());
+    for (auto& entry : connections) {
+        open.push_back(entry.first);
+    }
+    for (SOCKET_TYPE socket : open) {
+        // A connection lingering for zero-copy completions needs a second close
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            auto it = connections.find(socket);
+            if (it != connections.end()) {
+                closeConnection(*it->second);
+            }
+        }
+    }
+}
+
+void EventLoop::acceptConnections(SOCKET_TYPE listener) {
+    bool secure = listener == tlsListenSocket;
+    // Edge-triggered: keep accepting until the backlog is empty. Once a
+    // drain is requested the backlog is left to the next generation.
+    while (running && !drainRequested.load(std::memory_order_relaxed)) {
+        struct sockaddr_in clientAddr;
+        SOCKET_SIZE_TYPE clientAddrLen = sizeof(clientAddr);
+
+        SOCKET_TYPE clientSocket = accept4(listener,
+                                           reinterpret_cast<struct sockaddr*>(&clientAddr),
+                                           &clientAddrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket == INVALID_SOCKET) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && spare.shed(listener)) {
+                // Out of descriptors: closed unanswered, like one over the limit
+                if (metrics) {
+                    bumpCounter(metrics->shedConnections);
+                }
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Accept failed. Error: " << errno << std::endl;
+                if (!acceptTimer.armed()) {
+                    timers.schedule(acceptTimer, tickAfter(std::chrono::steady_clock::now(), kAcceptRetryMs));
+                }
+            }
+            return;
+        }
+
+        if (connectionLimit > 0 && connections.size() >= connectionLimit) {
+            // Shed load at the door: one non-blocking send, and the request
+            // is never read or parsed. TLS clients are just closed, since
+            // answering would first take a handshake.
+            if (!secure) {
+                sendNotice(clientSocket, ConnectionNotice::ServiceUnavailable);
+            }
+            CLOSE_SOCKET(clientSocket);
+            if (metrics) {
+                bumpCounter(metrics->shedConnections);
+            }
+            continue;
+        }
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = clientSocket;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &event) < 0) {
+            std::cerr << "Failed to register client socket. Error: " << errno << std::endl;
+            CLOSE_SOCKET(clientSocket);
+            continue;
+        }
+
+        auto conn = std::make_unique<Connection>(clientSocket, pool);
+        if (secure) {
+            conn->tls = tlsContext->accept(clientSocket, metrics);
+            if (!conn->tls) {
+                CLOSE_SOCKET(clientSocket);
+                continue;
+            }
+        }
+        conn->pipeline.peerAddress = clientAddr.sin_addr.s_addr;
+        conn->pipeline.peerPort = ntohs(clientAddr.sin_port);
+        if (!secure) {
+            conn->output.enableSplice();
+        }
+        #ifdef HAVE_ZEROCOPY
+        if (config.zeroCopyThreshold > 0 && !secure) {
+            int one = 1;
+            if (setsockopt(clientSocket, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+                conn->output.enableZeroCopy(static_cast<size_t>(config.zeroCopyThreshold));
+            }
+        }
+        #endif
+        conn->lastActivity = std::chrono::steady_clock::now();
+        conn->requestStartedAt = conn->lastActivity;
+        armTimer(*conn);
+        connections[clientSocket] = std::move(conn);
+        if (metrics) {
+            bumpCounter(metrics->accepts);
+            bumpCounter(metrics->activeConnections);
+        }
+    }
+}
+
+void EventLoop::handleRead(Connection& conn) {
+    // Loops only when reading paused on a full buffer and the pending
+    // response has since been flushed, so there may be more to drain
+    do {
+        if (!fillInput(conn)) {
+            return;
+        }
+        if (conn.state != Connection::State::Reading) {
+            return; // Resumes from handleWrite once the response is flushed
+        }
+        if (!serviceRequests(conn)) {
+            return;
+        }
+    } while (conn.readPaused && conn.state == Connection::State::Reading);
+}
+
+void EventLoop::handleWrite(Connection& conn) {
+    if (!flushOutput(conn) || conn.state != Connection::State::Reading) {
+        return;
+    }
+    // Pipelined requests may have arrived while the response was in flight
+    handleRead(conn);
+}
+
+bool EventLoop::fillInput(Connection& conn) {
+    const PendingHandler& handler = conn.pipeline.handler;
+    if (handler.active() && !(handler.suspended() && handler.wait().kind == HandlerWait::Kind::Body)) {
+        // Its request's views point into the buffer, which a read could
+        // compact. A handler reading its body is the exception: its request
+        // was moved to the start of the block, where reads leave it alone.
+        conn.readPaused = true;
+        return true;
+    }
+    conn.readPaused = false;
+
+    // Edge-triggered: drain the socket until it would block. Reads go
+    // straight into the pooled buffer; a full buffer (pipelined input
+    // arriving while a response is still being written) pauses reading.
+    while (true) {
+        size_t available;
+        char* buffer = conn.inBuffer.writePointer(available);
+        if (available == 0) {
+            conn.readPaused = true;
+            return true;
+        }
+
+        ssize_t bytesReceived = conn.tls ? conn.tls->read(buffer, available)
+                                         : recv(conn.socket, buffer, available, 0);
+        if (bytesReceived > 0) {
+            std::chrono::steady_clock::time_point previous = conn.lastActivity;
+            conn.lastActivity = std::chrono::steady_clock::now();
+            if (conn.inBuffer.empty() && !conn.awaitingFirstByte && !handler.active()) {
+                conn.requestStartedAt = conn.lastActivity;   // A new request begins
+            }
+            conn.inBuffer.commit(static_cast<size_t>(bytesReceived));
+            if (metrics) {
+                bumpCounter(metrics->bytesIn, static_cast<uint64_t>(bytesReceived));
+                if (conn.awaitingFirstByte) {
+                    conn.awaitingFirstByte = false;
+                    metrics->firstByte.observe(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(
+                            conn.lastActivity - previous).count()));
+                }
+            }
+            continue;
+        }
+        if (bytesReceived == 0) {
+            conn.peerClosed = true;
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        closeConnection(conn);
+        return false;
+    }
+}
+
+size_t EventLoop::runPipeline(Connection& conn) {
+    HandlerContext context{config, files.get(), responses, accessLogRing, metrics, metricsRegistry, router};
+    return processPipelinedRequests(conn.inBuffer, conn.output, conn.pipeline, context);
+}
+
+bool EventLoop::serviceRequests(Connection& conn) {
+    size_t answered = runPipeline(conn);
+    if (answered == 0 && !conn.pipeline.handler.suspended()) {
+        // Need more data; a half-closed peer will never send it
+        if (conn.peerClosed) {
+            closeConnection(conn);
+            return false;
+        }
+        armTimer(conn);
+        return true;
+    }
+
+    // The last read that completed these requests set lastActivity, and
+    // anything left over arrived with it
+    conn.responsesPending = answered;
+    conn.requestsReadAt = conn.lastActivity;
+    conn.requestStartedAt = conn.lastActivity;
+    conn.state = Connection::State::Writing;
+    return flushOutput(conn);
+}
+
+bool EventLoop::flushOutput(Connection& conn) {
+    while (true) {
+        // Every pipelined response goes out in as few syscalls as the socket allows
+        size_t queued = conn.output.size();
+        ResponseQueue::FlushResult result = conn.output.flush(conn.socket, conn.tls.get());
+        if (conn.output.size() != queued || result == ResponseQueue::FlushResult::Done) {
+            conn.lastActivity = std::chrono::steady_clock::now();
+        }
+
+        if (metrics) {
+            bumpCounter(metrics->bytesOut, queued - conn.output.size());
+            if (result == ResponseQueue::FlushResult::Done && conn.responsesPending > 0) {
+                auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                    conn.lastActivity - conn.requestsReadAt);
+                metrics->requestLatency.observe(static_cast<uint64_t>(elapsed.count()), conn.responsesPending);
+                conn.responsesPending = 0;
+            }
+        }
+
+        if (result == ResponseQueue::FlushResult::WouldBlock) {
+            armTimer(conn);
+            return true; // Resume on the next EPOLLOUT edge
+        }
+        if (result == ResponseQueue::FlushResult::Error) {
+            std::cerr << "Failed to send response to client. Error: " << errno << std::endl;
+            closeConnection(conn);
+            return false;
+        }
+
+        PendingHandler& handler = conn.pipeline.handler;
+        if (!handler.suspended()) {
+            break;
+        }
+        if (handler.wait().kind == HandlerWait::Kind::Body) {
+            size_t buffered = conn.inBuffer.size();
+            if (!fillInput(conn)) {
+                return false;
+            }
+            if (conn.peerClosed) {
+                handler.body.setInputClosed();
+            } else if (conn.inBuffer.size() == buffered) {
+                parkHandler(conn);   // Until the next EPOLLIN edge
+                return true;
+            }
+        } else if (handler.wait().kind != HandlerWait::Kind::Flush) {
+            parkHandler(conn);
+            return true;
+        }
+        // Everything it queued is on the wire (and any body it asked for is
+        // buffered): run it to its next wait, then write what that produced
+        // and any pipelined requests behind it
+        handler.resume();
+        conn.responsesPending += runPipeline(conn);
+    }
+
+    if (!conn.pipeline.keepAlive || conn.peerClosed || (draining && conn.inBuffer.empty())) {
+        closeConnection(conn);
+        return false;
+    }
+
+    conn.state = Connection::State::Reading;
+    armTimer(conn);
+    return true;
+}
+
+void EventLoop::parkHandler(Connection& conn) {
+    const HandlerWait& wait = conn.pipeline.handler.wait();
+    conn.state = Connection::State::Waiting;
+    // Edges that arrive meanwhile are not acted on; drain once it finishes
+    conn.readPaused = true;
+
+    if (wait.kind == HandlerWait::Kind::Readable || wait.kind == HandlerWait::Kind::Writable) {
+        struct epoll_event event = {};
+        event.events = wait.kind == HandlerWait::Kind::Readable ? EPOLLIN : EPOLLOUT;
+        event.data.fd = wait.fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wait.fd, &event) == 0) {
+            handlerSockets[wait.fd] = &conn;
+            armTimer(conn);
+            return;
+        }
+        // Not pollable: resume it on the next pass so its own call reports the error
+        std::cerr << "Failed to register handler socket. Error: " << errno << std::endl;
+        timers.schedule(conn.timer, 0);
+        return;
+    }
+    // A body wait's socket is registered already; it and a sleep need only the timer
+    armTimer(conn);
+}
+
+void EventLoop::unparkHandler(Connection& conn) {
+    const HandlerWait& wait = conn.pipeline.handler.wait();
+    int fd = wait.fd;
+    auto waiter = handlerSockets.find(fd);
+    bool polled = wait.kind == HandlerWait::Kind::Readable || wait.kind == HandlerWait::Kind::Writable;
+    if (polled && waiter != handlerSockets.end() && waiter->second == &conn) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        handlerSockets.erase(waiter);
+    }
+    timers.cancel(conn.timer);
+    conn.state = Connection::State::Writing;
+}
+
+void EventLoop::resumeHandler(Connection& conn) {
+    conn.pipeline.handler.resume();
+    conn.responsesPending += runPipeline(conn);
+    if (flushOutput(conn) && conn.state == Connection::State::Reading) {
+        // Input that arrived while the handler was parked
+        handleRead(conn);
+    }
+}
+
+int EventLoop::runTimers() {
+    timers.advance(TimerWheel::tickNow(), [this](TimerNode& node) {
+        if (&node == &drainTimer) {
+            closeAll();   // Out of time to drain
+            return;
+        }
+        if (&node == &acceptTimer) {
+            acceptConnections(listenSocket);
+            if (tlsListenSocket != INVALID_SOCKET) {
+                acceptConnections(tlsListenSocket);
+            }
+            return;
+        }
+        expireTimer(*static_cast<Connection*>(node.owner));
+    });
+    return timers.timeoutMs(TimerWheel::tickNow());
+}
+
+// The deadline a connection's state implies: the head of a request must
+// arrive within headerTimeoutMs of its first byte however slowly it
+// trickles in, while the others count from the last progress
+void EventLoop::armTimer(Connection& conn) {
+    int timeoutMs = 0;
+    std::chrono::steady_clock::time_point start = conn.lastActivity;
+    switch (conn.state) {
+        case Connection::State::Reading:
+            if (conn.inBuffer.empty() && !conn.awaitingFirstByte) {
+                timeoutMs = config.keepAliveTimeoutMs;
+            } else {
+                timeoutMs = config.headerTimeoutMs;
+                start = conn.requestStartedAt;
+            }
+            break;
+        case Connection::State::Writing:
+        case Connection::State::Closing:
+            timeoutMs = config.writeTimeoutMs;
+            break;
+        case Connection::State::Waiting: {
+            const HandlerWait& wait = conn.pipeline.handler.wait();
+            if (wait.kind == HandlerWait::Kind::Timer || wait.hasDeadline()) {
+                timers.schedule(conn.timer, TimerWheel::tickAt(wait.deadline));
+                return;
+            }
+            // A handler polling its own socket is busy, not idle
+            timeoutMs = wait.kind == HandlerWait::Kind::Body ? config.bodyTimeoutMs : 0;
+            break;
+        }
+    }
+    if (timeoutMs > 0) {
+        timers.schedule(conn.timer, tickAfter(start, timeoutMs));
+    } else {
+        timers.cancel(conn.timer);
+    }
+}
+
+void EventLoop::expireTimer(Connection& conn) {
+    TimeoutPhase phase = TimeoutPhase::Write;
+    switch (conn.state) {
+        case Connection::State::Waiting:
+            if (conn.pipeline.handler.wait().kind != HandlerWait::Kind::Body) {
+                // A handler's sleep is over, or its own socket took too long
+                unparkHandler(conn);
+                resumeHandler(conn);
+                return;
+            }
+            phase = TimeoutPhase::Body;
+            break;
+        case Connection::State::Reading:
+            if (conn.inBuffer.empty()) {
+                phase = conn.awaitingFirstByte ? TimeoutPhase::Header : TimeoutPhase::Idle;
+            } else {
+                // Part of a request came in, but not all of it in time
+                phase = TimeoutPhase::Header;
+                sendNotice(conn.socket, ConnectionNotice::RequestTimeout, conn.tls.get());
+            }
+            break;
+        case Connection::State::Writing:
+            break;
+        case Connection::State::Closing:
+            if (stillDraining(conn)) {
+                conn.lastActivity = std::chrono::steady_clock::now();
+                armTimer(conn);
+                return;
+            }
+            break;
+    }
+    if (metrics) {
+        metrics->countTimeout(phase);
+    }
+    closeConnection(conn);
+}
+
+// A lingering connection is not idle while a slow reader is still taking data
+bool EventLoop::stillDraining(Connection& conn) {
+    int queued = 0;
+    if (ioctl(conn.socket, SIOCOUTQ, &queued) < 0) {
+        return false;
+    }
+    bool progressed = static_cast<size_t>(queued) < conn.lingerQueued;
+    conn.lingerQueued = static_cast<size_t>(queued);
+    return progressed;
+}
+
+void EventLoop::closeConnection(Connection& conn) {
+    if (conn.output.zeroCopyInFlight()) {
+        if (conn.state != Connection::State::Closing) {
+            // Closing now could free buffers the kernel is still transmitting
+            // from. Send FIN after the queued data and linger until the
+            // completions arrive; a second close (or the idle timeout) aborts.
+            shutdown(conn.socket, SHUT_WR);
+            conn.state = Connection::State::Closing;
+            conn.lastActivity = std::chrono::steady_clock::now();
+            armTimer(conn);
+            return;
+        }
+        // A reset discards the send queue, so the kernel lets go of our buffers
+        struct linger abort = {1, 0};
+        setsockopt(conn.socket, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+    }
+
+    if (conn.state == Connection::State::Waiting) {
+        unparkHandler(conn);
+    }
+    SOCKET_TYPE socket = conn.socket;
+    conn.state = Connection::State::Closing;
+    timers.cancel(conn.timer);
+    if (metrics) {
+        dropCounter(metrics->activeConnections);
+    }
+
+    if (conn.tls) {
+        conn.tls->shutdown();
+    }
+    // Closing the descriptor also removes it from the epoll interest list
+    CLOSE_SOCKET(socket);
+    connections.erase(socket);
+}
+
+#endif // HAVE_EPOLL
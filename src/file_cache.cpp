@@ -0,0 +1,438 @@
+#include "file_cache.h"
+#include "string_util.h"
+
+#ifdef HAVE_STATIC_FILES
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+std::string httpDate(time_t time) {
+    struct tm parts;
+    gmtime_r(&time, &parts);
+    char buffer[64];
+    size_t length = strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return std::string(buffer, length);
+}
+
+std::string_view stripQuery(std::string_view target) {
+    size_t end = target.find_first_of("?#");
+    return end == std::string_view::npos ? target : target.substr(0, end);
+}
+
+// Same inode, size and mtime as when it was opened
+bool unchanged(const CachedFile& file) {
+    struct stat info;
+    if (stat(file.path.c_str(), &info) < 0) {
+        return false;
+    }
+    return info.st_ino == file.inode && info.st_dev == file.device &&
+           info.st_size == file.size && info.st_mtime == file.modified;
+}
+
+}
+
+CachedFile::~CachedFile() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool resolveRequestPath(std::string_view target, std::string& relativePath) {
+    target = stripQuery(target);
+    if (target.empty() || target.front() != '/') {
+        return false;
+    }
+
+    // Percent-decode first so "%2e%2e" cannot sneak past the segment check
+    std::string decoded;
+    decoded.reserve(target.size());
+    for (size_t i = 0; i < target.size(); ++i) {
+        char c = target[i];
+        if (c == '%') {
+            if (i + 2 >= target.size()) {
+                return false;
+            }
+            int high = hexValue(target[i + 1]);
+            int low = hexValue(target[i + 2]);
+            if (high < 0 || low < 0) {
+                return false;
+            }
+            c = static_cast<char>((high << 4) | low);
+            i += 2;
+        }
+        // NUL would cut the path short in open(), raw or as "%00"
+        if (c == '\\' || c == '\0') {
+            return false;
+        }
+        decoded += c;
+    }
+
+    relativePath.clear();
+    size_t start = 0;
+    while (start <= decoded.size()) {
+        size_t slash = decoded.find('/', start);
+        if (slash == std::string::npos) {
+            slash = decoded.size();
+        }
+        std::string_view segment(decoded.data() + start, slash - start);
+        start = slash + 1;
+
+        if (segment.empty() || segment == ".") {
+            continue;
+        }
+        if (segment == "..") {
+            return false;
+        }
+        if (!relativePath.empty()) {
+            relativePath += '/';
+        }
+        relativePath.append(segment.data(), segment.size());
+    }
+
+    if (decoded.back() == '/') {
+        if (!relativePath.empty()) {
+            relativePath += '/';
+        }
+        relativePath += "index.html";
+    }
+    return true;
+}
+
+bool etagMatches(std::string_view ifNoneMatch, std::string_view etag) {
+    auto opaque = [](std::string_view tag) {
+        return tag.substr(0, 2) == "W/" ? tag.substr(2) : tag;
+    };
+    etag = opaque(etag);
+    if (trim(ifNoneMatch) == "*") {
+        return true;
+    }
+    // A quoted tag may itself hold commas, so the list is walked tag by tag
+    size_t i = 0;
+    while (i < ifNoneMatch.size()) {
+        char c = ifNoneMatch[i];
+        if (c == ' ' || c == '\t' || c == ',') {
+            ++i;
+            continue;
+        }
+        size_t start = i;
+        if (ifNoneMatch.compare(i, 2, "W/") == 0) {
+            i += 2;
+        }
+        size_t close = i < ifNoneMatch.size() && ifNoneMatch[i] == '"' ? ifNoneMatch.find('"', i + 1)
+                                                                        : std::string_view::npos;
+        if (close == std::string_view::npos) {
+            // Not an entity-tag: skip to the next member
+            size_t comma = ifNoneMatch.find(',', start);
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            i = comma + 1;
+            continue;
+        }
+        if (ifNoneMatch.substr(i, close + 1 - i) == etag) {
+            return true;
+        }
+        i = close + 1;
+    }
+    return false;
+}
+
+const char* contentTypeFor(std::string_view path) {
+    struct Mapping {
+        const char* extension;
+        const char* type;
+    };
+    static const Mapping kTypes[] = {
+        {".html", "text/html; charset=utf-8"},
+        {".htm", "text/html; charset=utf-8"},
+        {".css", "text/css; charset=utf-8"},
+        {".js", "text/javascript; charset=utf-8"},
+        {".mjs", "text/javascript; charset=utf-8"},
+        {".json", "application/json"},
+        {".txt", "text/plain; charset=utf-8"},
+        {".xml", "application/xml"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".webp", "image/webp"},
+        {".ico", "image/x-icon"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+        {".pdf", "application/pdf"},
+        {".wasm", "application/wasm"},
+        {".mp4", "video/mp4"},
+    };
+
+    size_t dot = path.rfind('.');
+    if (dot != std::string_view::npos && path.find('/', dot) == std::string_view::npos) {
+        std::string_view extension = path.substr(dot);
+        for (const Mapping& mapping : kTypes) {
+            std::string_view candidate(mapping.extension);
+            if (candidate.size() != extension.size()) {
+                continue;
+            }
+            bool equal = true;
+            for (size_t i = 0; i < candidate.size(); ++i) {
+                if ((extension[i] | 0x20) != candidate[i]) {
+                    equal = false;
+                    break;
+                }
+            }
+            if (equal) {
+                return mapping.type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+FileCache::FileCache(size_t capacity, int revalidateMs, int compressMinBytes)
+    : capacity(capacity), revalidateInterval(revalidateMs),
+      compressMinimum(compressMinBytes > 0 ? static_cast<size_t>(compressMinBytes) : 0) {}
+
+bool FileCache::init(const std::string& documentRoot) {
+    char resolved[PATH_MAX];
+    if (realpath(documentRoot.c_str(), resolved) == nullptr) {
+        std::cerr << "Document root " << documentRoot << " not found. Error: " << errno << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (stat(resolved, &info) < 0 || !S_ISDIR(info.st_mode)) {
+        std::cerr << "Document root " << documentRoot << " is not a directory" << std::endl;
+        return false;
+    }
+
+    root = resolved;
+    return true;
+}
+
+std::shared_ptr<const CachedFile> FileCache::lookup(std::string_view target, Status& status) {
+    std::string_view path = stripQuery(target);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Reuse one key string so a hit does not allocate
+        probe.assign(path.data(), path.size());
+        auto it = entries.find(probe);
+        if (it != entries.end()) {
+            Entry& entry = it->second;
+            auto now = std::chrono::steady_clock::now();
+            bool fresh = now - entry.validatedAt < revalidateInterval;
+            if (!entry.file && fresh) {
+                // Remembered 404: skip path resolution and realpath()
+                lru.splice(lru.begin(), lru, entry.lruPosition);
+                status = Status::NotFound;
+                return nullptr;
+            }
+            if (entry.file && (fresh || stillCurrent(*entry.file))) {
+                if (!fresh) {
+                    entry.validatedAt = now;
+                }
+                lru.splice(lru.begin(), lru, entry.lruPosition);
+                status = Status::Found;
+                return entry.file;
+            }
+            // Changed on disk (or a 404 due for a recheck): load it again below
+            lru.erase(entry.lruPosition);
+            entries.erase(it);
+        }
+    }
+
+    std::string key(path);
+    std::string relativePath;
+    if (!resolveRequestPath(key, relativePath)) {
+        status = Status::Forbidden;
+        return nullptr;
+    }
+
+    std::shared_ptr<const CachedFile> file = load(relativePath, status);
+    if (file || status == Status::NotFound) {
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(key, file);
+    }
+    return file;
+}
+
+std::shared_ptr<const CachedFile> FileCache::load(const std::string& relativePath, Status& status) {
+    std::string fullPath = root + "/" + relativePath;
+
+    // Symlinks may point anywhere; only serve what really lives under the root
+    char resolved[PATH_MAX];
+    if (realpath(fullPath.c_str(), resolved) == nullptr) {
+        status = Status::NotFound;
+        return nullptr;
+    }
+    std::string resolvedPath(resolved);
+    if (resolvedPath.compare(0, root.size(), root) != 0 ||
+        (resolvedPath.size() > root.size() && resolvedPath[root.size()] != '/')) {
+        status = Status::Forbidden;
+        return nullptr;
+    }
+
+    int fd = open(resolved, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        status = errno == EACCES ? Status::Forbidden : Status::NotFound;
+        return nullptr;
+    }
+
+    auto file = std::make_shared<CachedFile>();
+    file->fd = fd;
+    file->path = resolvedPath;
+
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+        status = Status::NotFound;
+        return nullptr;
+    }
+
+    file->size = info.st_size;
+    file->modified = info.st_mtime;
+    file->device = info.st_dev;
+    file->inode = info.st_ino;
+
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx\"",
+             static_cast<unsigned long long>(info.st_ino),
+             static_cast<unsigned long long>(info.st_size),
+             static_cast<unsigned long long>(info.st_mtime));
+    file->etag = etag;
+    file->lastModified = httpDate(info.st_mtime);
+    file->contentType = contentTypeFor(relativePath);
+
+    bool compressible = isCompressible(file->contentType);
+    if (compressible && compressMinimum > 0 && static_cast<size_t>(file->size) >= compressMinimum &&
+        file->size <= kMaxCompressOnTheFly) {
+        file->encodings = availableEncodings() & ~encodingBit(ContentEncoding::Identity);
+    }
+    for (ContentEncoding encoding : {ContentEncoding::Gzip, ContentEncoding::Brotli}) {
+        size_t index = static_cast<size_t>(encoding);
+        // Serving one needs no compression library, so look even without zlib or brotli
+        if (compressible) {
+            file->precompressed[index] = loadSibling(*file, encoding);
+        }
+        if (file->precompressed[index]) {
+            file->encodings |= encodingBit(encoding);
+        }
+        // The same validator for two representations would let a cache
+        // answer a gzip request with identity bytes (RFC 9110 section 8.8.3)
+        file->encodedEtags[index] = file->etag.substr(0, file->etag.size() - 1) + "-" +
+                                    contentEncodingName(encoding) + "\"";
+    }
+
+    file->headers = std::string("Content-Type: ") + file->contentType + "\r\n"
+                    "Content-Length: " + std::to_string(file->size) + "\r\n"
+                    "Last-Modified: " + file->lastModified + "\r\n"
+                    "ETag: " + file->etag + "\r\n";
+    if (file->encodings != 0) {
+        file->headers += "Vary: Accept-Encoding\r\n";
+    }
+
+    status = Status::Found;
+    return file;
+}
+
+std::shared_ptr<const CachedFile> FileCache::loadSibling(const CachedFile& original, ContentEncoding encoding) {
+    std::string path = original.path + contentEncodingSuffix(encoding);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto file = std::make_shared<CachedFile>();
+    file->fd = fd;
+    file->path = path;
+
+    // One older than the original was left behind by an update; skip it
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || info.st_mtime < original.modified) {
+        return nullptr;
+    }
+    file->size = info.st_size;
+    file->modified = info.st_mtime;
+    file->device = info.st_dev;
+    file->inode = info.st_ino;
+
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx\"",
+             static_cast<unsigned long long>(info.st_ino),
+             static_cast<unsigned long long>(info.st_size),
+             static_cast<unsigned long long>(info.st_mtime));
+    file->etag = etag;
+    file->lastModified = original.lastModified;
+    file->contentType = original.contentType;
+    file->headers = std::string("Content-Type: ") + file->contentType + "\r\n"
+                    "Content-Encoding: " + contentEncodingName(encoding) + "\r\n"
+                    "Content-Length: " + std::to_string(file->size) + "\r\n"
+                    "Last-Modified: " + file->lastModified + "\r\n"
+                    "ETag: " + file->etag + "\r\n"
+                    "Vary: Accept-Encoding\r\n";
+    return file;
+}
+
+bool FileCache::stillCurrent(const CachedFile& file) {
+    if (!unchanged(file)) {
+        return false;
+    }
+    if (!isCompressible(file.contentType)) {
+        return true;
+    }
+    // A sibling that changed, vanished or appeared means loading it again
+    for (ContentEncoding encoding : {ContentEncoding::Gzip, ContentEncoding::Brotli}) {
+        const CachedFile* sibling = file.precompressed[static_cast<size_t>(encoding)].get();
+        struct stat info;
+        if (sibling ? !unchanged(*sibling)
+                    : stat((file.path + contentEncodingSuffix(encoding)).c_str(), &info) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FileCache::insert(const std::string& target, std::shared_ptr<const CachedFile> file) {
+    if (capacity == 0) {
+        return;
+    }
+
+    auto existing = entries.find(target);
+    if (existing != entries.end()) {
+        lru.erase(existing->second.lruPosition);
+        entries.erase(existing);
+    }
+
+    while (entries.size() >= capacity && !lru.empty()) {
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+
+    lru.push_front(target);
+    Entry entry;
+    entry.file = std::move(file);
+    entry.lruPosition = lru.begin();
+    entry.validatedAt = std::chrono::steady_clock::now();
+    entries.emplace(target, std::move(entry));
+}
+
+size_t FileCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+#endif // HAVE_STATIC_FILES
@@ -0,0 +1,426 @@
+#include "handler.h"
+#include "http_request.h"
+#include "string_util.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = static_cast<char>(c | 0x20);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+}
+
+const char* statusReason(int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 411: return "Length Required";
+        case 413: return "Content Too Large";
+        case 415: return "Unsupported Media Type";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+    }
+    return "Unknown";
+}
+
+void Response::setHeader(std::string_view name, std::string_view value) {
+    if (equalsIgnoreCase(name, "Content-Encoding")) {
+        encodedByHandler = true;
+    }
+    appendHeader(name, value);
+}
+
+void Response::appendHeader(std::string_view name, std::string_view value) {
+    headers.append(name);
+    headers.append(": ");
+    headers.append(value);
+    headers.append("\r\n");
+}
+
+void Response::appendHead(size_t contentLength, std::string_view contentType) {
+    // Appends coalesce in the queue's arena, so the head is built in place
+    char line[96];
+    int length;
+    if (framing == Framing::Length) {
+        length = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n",
+                          status, statusReason(status), contentLength);
+    } else if (framing == Framing::Chunked) {
+        length = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nTransfer-Encoding: chunked\r\n",
+                          status, statusReason(status));
+    } else {
+        length = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", status, statusReason(status));
+    }
+    size_t before = output.size();
+    output.append(std::string_view(line, static_cast<size_t>(length)));
+    if (!contentType.empty()) {
+        output.append("Content-Type: ");
+        output.append(contentType);
+        output.append("\r\n");
+    }
+    output.append(headers);
+    output.append(framing == Framing::Close ? "Connection: close\r\n" : connectionHeader);
+    output.append("\r\n");
+    bytes += output.size() - before;
+    started = true;
+    remaining = contentLength;
+}
+
+bool Response::negotiate(std::string_view contentType) {
+    if (started || compressMinimum == 0 || encodedByHandler || !isCompressible(contentType)) {
+        return false;
+    }
+    // Caches must key this response on the request's Accept-Encoding
+    appendHeader("Vary", "Accept-Encoding");
+    return accepted != ContentEncoding::Identity;
+}
+
+void Response::send(std::string_view body, std::string_view contentType) {
+    if (body.size() >= compressMinimum && negotiate(contentType) &&
+        compressBuffer(accepted, body, compressed)) {
+        appendHeader("Content-Encoding", contentEncodingName(accepted));
+        begin(compressed.size(), contentType);
+        write(compressed);
+        return;
+    }
+    begin(body.size(), contentType);
+    write(body);
+}
+
+void Response::begin(size_t contentLength, std::string_view contentType) {
+    if (!started) {
+        appendHead(contentLength, contentType);
+    }
+}
+
+void Response::beginStream(std::string_view contentType) {
+    if (started) {
+        return;
+    }
+    if (negotiate(contentType)) {
+        compressor = StreamCompressor::create(accepted);
+        if (compressor) {
+            appendHeader("Content-Encoding", contentEncodingName(accepted));
+        }
+    }
+    framing = chunkedAllowed ? Framing::Chunked : Framing::Close;
+    appendHead(0, contentType);
+}
+
+void Response::sendHead(std::optional<uint64_t> contentLength, std::string_view contentType) {
+    if (started) {
+        return;
+    }
+    if (contentLength) {
+        char length[24];
+        int size = snprintf(length, sizeof(length), "%llu", static_cast<unsigned long long>(*contentLength));
+        appendHeader("Content-Length", std::string_view(length, static_cast<size_t>(size)));
+    }
+    framing = Framing::None;
+    appendHead(0, contentType);
+    ended = true;
+}
+
+void Response::write(std::string_view data) {
+    if (framing == Framing::Length) {
+        size_t length = std::min(data.size(), remaining);
+        output.append(data.substr(0, length));
+        remaining -= length;
+        bytes += length;
+        return;
+    }
+    if (!started || ended) {
+        return;
+    }
+    if (compressor) {
+        // The compressor buffers internally; emit whatever it let go of
+        compressed.clear();
+        compressor->write(data, StreamCompressor::Mode::Process, compressed);
+        appendBody(compressed);
+        return;
+    }
+    appendBody(data);
+}
+
+#ifdef HAVE_SPLICE
+void Response::writePipe(std::shared_ptr<SplicePipe> pipe, size_t length) {
+    if (!canSplice()) {
+        return;
+    }
+    length = std::min(length, remaining);
+    output.appendPipe(std::move(pipe), length);
+    remaining -= length;
+    bytes += length;
+}
+#endif
+
+void Response::appendBody(std::string_view data) {
+    // An empty chunk would end the body
+    if (data.empty()) {
+        return;
+    }
+    if (framing == Framing::Chunked) {
+        char size[24];
+        int length = snprintf(size, sizeof(size), "%zx\r\n", data.size());
+        output.append(std::string_view(size, static_cast<size_t>(length)));
+        output.append(data);
+        output.append("\r\n");
+        bytes += static_cast<size_t>(length) + data.size() + 2;
+        return;
+    }
+    output.append(data);
+    bytes += data.size();
+}
+
+void Response::flush() {
+    if (compressor && started && !ended) {
+        compressed.clear();
+        compressor->write({}, StreamCompressor::Mode::Flush, compressed);
+        appendBody(compressed);
+    }
+}
+
+void Response::end() {
+    if (!started || ended || framing == Framing::Length) {
+        return;
+    }
+    if (compressor) {
+        compressed.clear();
+        compressor->write({}, StreamCompressor::Mode::Finish, compressed);
+        appendBody(compressed);
+        compressor.reset();
+    }
+    ended = true;
+    if (framing == Framing::Chunked) {
+        // Last chunk, no trailers
+        output.append("0\r\n\r\n");
+        bytes += 5;
+    }
+}
+
+void Response::sendContinue() {
+    if (!started && !continued) {
+        continued = true;
+        output.append("HTTP/1.1 100 Continue\r\n\r\n");
+        bytes += 25;
+    }
+}
+
+void BodyReader::begin(InputBuffer& buffer, const HTTPRequest& request, uint64_t maxBytes) {
+    input = &buffer;
+    headLength = request.getHeadLength();
+    consumed = 0;
+    inputClosed = false;
+    tooLarge = false;
+    received = 0;
+    limit = maxBytes;
+    trailerBytes = 0;
+    chunked = request.getBodyFraming() == BodyFraming::Chunked;
+    remaining = request.getBodyFraming() == BodyFraming::Length ? request.getContentLength() : 0;
+    switch (request.getBodyFraming()) {
+        case BodyFraming::None: stage = Stage::Done; break;
+        case BodyFraming::Length: stage = Stage::Data; break;
+        case BodyFraming::Chunked: stage = Stage::SizeLine; break;
+    }
+}
+
+BodyReader::Status BodyReader::needInput() {
+    // Everything decoded so far has been handed out; make room behind the head
+    input->erase(headLength, consumed);
+    consumed = 0;
+    if (inputClosed || input->writableSize() == 0) {
+        return fail();
+    }
+    return Status::NeedInput;
+}
+
+size_t BodyReader::lineEnd(std::string_view data) {
+    size_t newline = data.substr(0, kMaxLineLength).find('\n');
+    return newline == std::string_view::npos ? 0 : newline + 1;
+}
+
+BodyReader::Status BodyReader::next(std::string_view& piece) {
+    while (true) {
+        std::string_view data = input ? input->view().substr(headLength + consumed) : std::string_view();
+        switch (stage) {
+            case Stage::Done:
+                return Status::End;
+
+            case Stage::Failed:
+                return Status::Error;
+
+            case Stage::Data: {
+                if (remaining == 0) {
+                    stage = chunked ? Stage::DataEnd : Stage::Done;
+                    continue;
+                }
+                if (data.empty()) {
+                    return needInput();
+                }
+                size_t length = static_cast<size_t>(std::min<uint64_t>(data.size(), remaining));
+                if (limit > 0 && received + length > limit) {
+                    tooLarge = true;
+                    return fail();
+                }
+                piece = data.substr(0, length);
+                consumed += length;
+                remaining -= length;
+                received += length;
+                return Status::Piece;
+            }
+
+            case Stage::DataEnd: {
+                // The CRLF closing a chunk's data
+                if (data.empty() || (data[0] == '\r' && data.size() < 2)) {
+                    return needInput();
+                }
+                size_t length = data[0] == '\n' ? 1 : (data[0] == '\r' && data[1] == '\n') ? 2 : 0;
+                if (length == 0) {
+                    return fail();
+                }
+                consumed += length;
+                stage = Stage::SizeLine;
+                continue;
+            }
+
+            case Stage::SizeLine: {
+                // chunk-size [ chunk-ext ] CRLF; extensions are ignored
+                size_t end = lineEnd(data);
+                if (end == 0) {
+                    return data.size() >= kMaxLineLength ? fail() : needInput();
+                }
+                uint64_t size = 0;
+                size_t pos = 0;
+                for (int digit; pos < end && (digit = hexValue(data[pos])) >= 0; ++pos) {
+                    if (pos == 15) {
+                        return fail();
+                    }
+                    size = size * 16 + static_cast<uint64_t>(digit);
+                }
+                if (pos == 0) {
+                    return fail();
+                }
+                while (data[pos] == ' ' || data[pos] == '\t') {
+                    ++pos;
+                }
+                if (data[pos] != ';' && data[pos] != '\n' && (data[pos] != '\r' || pos + 2 != end)) {
+                    return fail();
+                }
+                consumed += end;
+                if (size == 0) {
+                    stage = Stage::Trailers;
+                } else {
+                    remaining = size;
+                    stage = Stage::Data;
+                }
+                continue;
+            }
+
+            case Stage::Trailers: {
+                // Trailer fields are read past and dropped, up to the blank line
+                size_t end = lineEnd(data);
+                if (end == 0) {
+                    return data.size() >= kMaxLineLength ? fail() : needInput();
+                }
+                consumed += end;
+                if (end == 1 || (end == 2 && data[0] == '\r')) {
+                    stage = Stage::Done;
+                    continue;
+                }
+                trailerBytes += end;
+                if (trailerBytes > kMaxTrailerBytes) {
+                    return fail();
+                }
+                continue;
+            }
+        }
+    }
+}
+
+bool BodyReader::skip() {
+    std::string_view piece;
+    Status status;
+    do {
+        status = next(piece);
+    } while (status == Status::Piece);
+    return status == Status::End;
+}
+
+RequestContext::RequestContext(const HTTPRequest& request, const RouteParameters& parameters,
+                               BodyReader& body, ResponseQueue& output, const char* connectionHeader)
+    : request(request), parameters(parameters), body(body),
+      response(output, connectionHeader, request.getMinorVersion() >= 1) {}
+
+Task<std::string_view> RequestContext::readBody() {
+    while (true) {
+        std::string_view piece;
+        BodyReader::Status status = body.next(piece);
+        if (status == BodyReader::Status::Piece) {
+            co_return piece;
+        }
+        if (status != BodyReader::Status::NeedInput) {
+            co_return std::string_view();
+        }
+        // A client that sent "Expect: 100-continue" holds the body back
+        // until told to go ahead (RFC 9110 section 10.1.1)
+        if (request.getMinorVersion() >= 1 && equalsIgnoreCase(request.getHeader("Expect"), "100-continue")) {
+            response.sendContinue();
+        }
+        co_await waitFor(HandlerWait::Kind::Body);
+    }
+}
+
+std::string_view RequestContext::path() const {
+    std::string_view target = request.getPath();
+    return target.substr(0, target.find('?'));
+}
+
+std::string_view RequestContext::query() const {
+    std::string_view target = request.getPath();
+    size_t mark = target.find('?');
+    return mark == std::string_view::npos ? std::string_view() : target.substr(mark + 1);
+}
+
+std::string_view RequestContext::queryParameter(std::string_view name) const {
+    std::string_view rest = query();
+    while (!rest.empty()) {
+        size_t end = rest.find('&');
+        std::string_view pair = rest.substr(0, end);
+        size_t equals = pair.find('=');
+        if (pair.substr(0, equals) == name) {
+            return equals == std::string_view::npos ? std::string_view() : pair.substr(equals + 1);
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        rest.remove_prefix(end + 1);
+    }
+    return {};
+}
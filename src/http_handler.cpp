@@ -0,0 +1,608 @@
+#include "http_handler.h"
+#include "access_log.h"
+#include "compression.h"
+#include "file_cache.h"
+#include "metrics.h"
+#include "router.h"
+#include "tls.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Which Connection header a response carries; prebuilt responses exist per variant
+enum ConnectionVariant { kClose, kKeepAlive, kKeepAliveHttp10, kVariants };
+
+const char* const kConnectionHeaders[kVariants] = {
+    "Connection: close\r\n",
+    "",
+    "Connection: keep-alive\r\n",
+};
+
+ConnectionVariant connectionVariant(const HTTPRequest& request, bool keepAlive) {
+    if (!keepAlive) {
+        return kClose;
+    }
+    return request.getMinorVersion() == 0 ? kKeepAliveHttp10 : kKeepAlive;
+}
+
+ResponseBuffer textResponse(const char* status, const std::string& body, ConnectionVariant variant,
+                            const char* extraHeaders = "") {
+    return std::make_shared<const std::string>(
+        std::string("HTTP/1.1 ") + status + "\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        + extraHeaders + kConnectionHeaders[variant] +
+        "\r\n"
+        + body);
+}
+
+// Responses that never change, serialized once and shared by every connection
+struct PrebuiltResponses {
+    ResponseBuffer badRequest;
+    // The unread body that follows would be taken for the next request
+    ResponseBuffer contentTooLarge;
+    // Sent by the engines themselves, to connections about to be closed
+    ResponseBuffer requestTimeout;
+    ResponseBuffer serviceUnavailable;
+    ResponseBuffer hello[kVariants];
+    ResponseBuffer forbidden[kVariants];
+    ResponseBuffer notFound[kVariants];
+    ResponseBuffer methodNotAllowed[kVariants];
+    ResponseBuffer internalError[kVariants];
+
+    PrebuiltResponses() {
+        // A default-constructed request is invalid, so this is the 400 response
+        badRequest = std::make_shared<const std::string>(HTTPRequest().generateResponse());
+        contentTooLarge = textResponse("413 Content Too Large", "413 Content Too Large", kClose);
+        requestTimeout = textResponse("408 Request Timeout", "408 Request Timeout", kClose);
+        serviceUnavailable = textResponse("503 Service Unavailable", "503 Service Unavailable", kClose,
+                                          "Retry-After: 1\r\n");
+        for (int variant = 0; variant < kVariants; ++variant) {
+            auto v = static_cast<ConnectionVariant>(variant);
+            hello[variant] = textResponse("200 OK", "Hello World!", v);
+            forbidden[variant] = textResponse("403 Forbidden", "403 Forbidden", v);
+            notFound[variant] = textResponse("404 Not Found", "404 Not Found", v);
+            methodNotAllowed[variant] = textResponse("405 Method Not Allowed", "405 Method Not Allowed", v,
+                                                     "Allow: GET, HEAD\r\n");
+            internalError[variant] = textResponse("500 Internal Server Error", "500 Internal Server Error", v);
+        }
+    }
+};
+
+const PrebuiltResponses& prebuilt() {
+    static const PrebuiltResponses responses;
+    return responses;
+}
+
+bool isHead(const HTTPRequest& request) {
+    return request.getMethod() == "HEAD";
+}
+
+// A whole serialized response, or for HEAD only its head: the same headers,
+// Content-Length included, and no body (RFC 9110 section 9.3.2)
+void appendResponse(ResponseQueue& output, ResponseBuffer response, bool headOnly) {
+    if (!headOnly) {
+        output.appendShared(std::move(response));
+        return;
+    }
+    std::string_view bytes(*response);
+    std::string_view head = bytes.substr(0, bytes.find("\r\n\r\n") + 4);
+    output.appendView(head, std::move(response));
+}
+
+#ifdef HAVE_STATIC_FILES
+
+// If-None-Match takes precedence over If-Modified-Since (RFC 9110 section 13.2.2)
+bool notModified(const HTTPRequest& request, std::string_view etag, std::string_view lastModified) {
+    std::string_view ifNoneMatch = request.getHeader("If-None-Match");
+    if (!ifNoneMatch.empty()) {
+        return etagMatches(ifNoneMatch, etag);
+    }
+    std::string_view ifModifiedSince = request.getHeader("If-Modified-Since");
+    return !ifModifiedSince.empty() && ifModifiedSince == lastModified;
+}
+
+void appendNotModified(std::string_view etag, const CachedFile& file, bool vary, ConnectionVariant variant,
+                       ResponseQueue& output) {
+    // Appends coalesce in the queue's arena, so no temporary string is built
+    output.append("HTTP/1.1 304 Not Modified\r\nETag: ");
+    output.append(etag);
+    output.append("\r\nLast-Modified: ");
+    output.append(file.lastModified);
+    output.append("\r\n");
+    if (vary) {
+        output.append("Vary: Accept-Encoding\r\n");
+    }
+    output.append(kConnectionHeaders[variant]);
+    output.append("\r\n");
+}
+
+// Response cache key: target, representation and Connection variant. HEAD
+// shares GET's entries and sends only their head. Keying on the ETag means a
+// changed file simply stops matching its old entry, and each encoded variant
+// (with its own ETag) gets an entry of its own.
+size_t buildCacheKey(char* key, size_t capacity, const HTTPRequest& request,
+                     std::string_view etag, ConnectionVariant variant) {
+    std::string_view parts[] = {request.getPath(), " ", etag};
+    size_t length = 0;
+    for (std::string_view part : parts) {
+        if (length + part.size() + 1 > capacity) {
+            return 0;
+        }
+        memcpy(key + length, part.data(), part.size());
+        length += part.size();
+    }
+    key[length++] = static_cast<char>('0' + variant);
+    return length;
+}
+
+// Head and body in one buffer, so a small file goes out in a single send()
+ResponseBuffer serializeFile(const std::string& head, const CachedFile& file) {
+    auto response = std::make_shared<std::string>(head);
+    response->resize(head.size() + static_cast<size_t>(file.size));
+    ssize_t bytesRead = pread(file.fd, &(*response)[head.size()], static_cast<size_t>(file.size), 0);
+    if (bytesRead != file.size) {
+        return nullptr;   // Changed underneath us; fall back to sendfile
+    }
+    return response;
+}
+
+// Reads and compresses a file the client wants encoded and that has no
+// precompressed sibling. The serialized response joins the response cache,
+// so a popular file is compressed about twice (the cache admits on the
+// second miss) rather than per request. Null if the file cannot be read.
+ResponseBuffer compressFile(const CachedFile& file, ContentEncoding encoding, ConnectionVariant variant) {
+    thread_local std::string contents;
+    thread_local std::string compressed;
+    contents.resize(static_cast<size_t>(file.size));
+    ssize_t bytesRead = pread(file.fd, &contents[0], contents.size(), 0);
+    if (bytesRead != file.size || !compressBuffer(encoding, contents, compressed)) {
+        return nullptr;
+    }
+    auto response = std::make_shared<std::string>(
+        std::string("HTTP/1.1 200 OK\r\n"
+                    "Content-Type: ") + file.contentType + "\r\n"
+        "Content-Encoding: " + contentEncodingName(encoding) + "\r\n"
+        "Content-Length: " + std::to_string(compressed.size()) + "\r\n"
+        "Last-Modified: " + file.lastModified + "\r\n"
+        "ETag: " + file.encodedEtags[static_cast<size_t>(encoding)] + "\r\n"
+        "Vary: Accept-Encoding\r\n" + kConnectionHeaders[variant] + "\r\n");
+    *response += compressed;
+    return response;
+}
+
+// Queues the response and returns its status code
+int serveStaticFile(const HTTPRequest& request, bool keepAlive, ResponseQueue& output,
+                    const HandlerContext& context) {
+    ConnectionVariant variant = connectionVariant(request, keepAlive);
+    bool headOnly = isHead(request);
+    FileCache::Status status;
+    std::shared_ptr<const CachedFile> file = context.files->lookup(request.getPath(), status);
+
+    if (status == FileCache::Status::Forbidden) {
+        appendResponse(output, prebuilt().forbidden[variant], headOnly);
+        return 403;
+    }
+    if (!file) {
+        appendResponse(output, prebuilt().notFound[variant], headOnly);
+        return 404;
+    }
+
+    // An acceptable precompressed sibling beats compressing on the fly, even
+    // in a coding the client ranks lower; it is served like any file, from
+    // its own entry
+    ContentEncoding encoding = ContentEncoding::Identity;
+    bool vary = file->encodings != 0;
+    if (vary) {
+        std::string_view acceptEncoding = request.getHeader("Accept-Encoding");
+        unsigned siblings = 0;
+        for (ContentEncoding candidate : {ContentEncoding::Gzip, ContentEncoding::Brotli}) {
+            if (file->precompressed[static_cast<size_t>(candidate)]) {
+                siblings |= encodingBit(candidate);
+            }
+        }
+        encoding = negotiateEncoding(acceptEncoding, siblings);
+        if (encoding != ContentEncoding::Identity) {
+            file = std::shared_ptr<const CachedFile>(file->precompressed[static_cast<size_t>(encoding)]);
+            encoding = ContentEncoding::Identity;
+        } else {
+            encoding = negotiateEncoding(acceptEncoding, file->encodings);
+        }
+    }
+    std::string_view etag = encoding == ContentEncoding::Identity
+                                ? std::string_view(file->etag)
+                                : std::string_view(file->encodedEtags[static_cast<size_t>(encoding)]);
+
+    if (notModified(request, etag, file->lastModified)) {
+        appendNotModified(etag, *file, vary, variant, output);
+        return 304;
+    }
+
+    char key[512];
+    size_t keyLength = 0;
+    if (encoding != ContentEncoding::Identity) {
+        if (context.responses) {
+            keyLength = buildCacheKey(key, sizeof(key), request, etag, variant);
+            if (keyLength > 0) {
+                if (ResponseBuffer cached = context.responses->find(std::string_view(key, keyLength))) {
+                    appendResponse(output, std::move(cached), headOnly);
+                    return 200;
+                }
+            }
+        }
+        // HEAD compresses too: Content-Length is the encoded size
+        if (ResponseBuffer response = compressFile(*file, encoding, variant)) {
+            appendResponse(output, response, headOnly);
+            if (keyLength > 0) {
+                context.responses->insert(std::string_view(key, keyLength), std::move(response));
+            }
+            return 200;
+        }
+        // Could not read it whole (changed underneath us): send it as it is
+        etag = file->etag;
+        keyLength = 0;
+    }
+
+    bool cacheable = context.responses &&
+                     static_cast<size_t>(file->size) + file->headers.size() < ResponseCache::kMaxResponseSize;
+    if (cacheable) {
+        keyLength = buildCacheKey(key, sizeof(key), request, etag, variant);
+        if (keyLength > 0) {
+            if (ResponseBuffer cached = context.responses->find(std::string_view(key, keyLength))) {
+                appendResponse(output, std::move(cached), headOnly);
+                return 200;
+            }
+        }
+    }
+
+    // No point reading the body of a HEAD response just to drop it
+    if (cacheable && !headOnly) {
+        std::string head = "HTTP/1.1 200 OK\r\n" + file->headers + kConnectionHeaders[variant] + "\r\n";
+        if (ResponseBuffer response = serializeFile(head, *file)) {
+            output.appendShared(response);
+            if (keyLength > 0) {
+                context.responses->insert(std::string_view(key, keyLength), std::move(response));
+            }
+            return 200;
+        }
+    }
+    // Status line, cached headers and body are gathered into one write
+    // without copying: the file entry keeps its header bytes alive
+    output.appendStatic("HTTP/1.1 200 OK\r\n");
+    output.appendView(file->headers, file);
+    output.appendStatic(kConnectionHeaders[variant]);
+    output.appendStatic("\r\n");
+    if (!headOnly) {
+        output.appendFile(std::move(file));
+    }
+    return 200;
+}
+
+#endif
+
+// The reserved metrics path, ignoring any query string
+bool isMetricsRequest(const HTTPRequest& request, const HandlerContext& context) {
+    const std::string& metricsPath = context.config.metricsPath;
+    if (!context.metricsRegistry || metricsPath.empty()) {
+        return false;
+    }
+    std::string_view path = request.getPath();
+    return path.substr(0, path.find('?')) == metricsPath;
+}
+
+int serveMetrics(const HTTPRequest& request, bool keepAlive, ResponseQueue& output,
+                 const HandlerContext& context) {
+    std::string body = context.metricsRegistry->render();
+    auto response = std::make_shared<std::string>(
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Cache-Control: no-store\r\n");
+    // Scrapers usually accept gzip, and the text compresses about tenfold
+    int minimum = context.config.compressionMinBytes;
+    if (minimum > 0 && body.size() >= static_cast<size_t>(minimum)) {
+        ContentEncoding encoding = negotiateEncoding(request.getHeader("Accept-Encoding"), availableEncodings());
+        std::string compressed;
+        if (encoding != ContentEncoding::Identity && compressBuffer(encoding, body, compressed)) {
+            *response += std::string("Content-Encoding: ") + contentEncodingName(encoding) + "\r\n";
+            body = std::move(compressed);
+        }
+        *response += "Vary: Accept-Encoding\r\n";
+    }
+    *response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    *response += kConnectionHeaders[connectionVariant(request, keepAlive)];
+    *response += "\r\n";
+    *response += body;
+    appendResponse(output, std::move(response), isHead(request));
+    return 200;
+}
+
+// `input` starts with the request, so its body can be read in place
+void startHandler(const RouteHandler& handler, bool keepAlive, InputBuffer& input, ResponseQueue& output,
+                  PipelineState& state, const HandlerContext& context,
+                  std::chrono::steady_clock::time_point received) {
+    PendingHandler& pending = state.handler;
+    pending.received = received;
+    long long maxBody = context.config.maxRequestBodyBytes;
+    pending.body.begin(input, state.request, maxBody > 0 ? static_cast<uint64_t>(maxBody) : 0);
+    pending.context.emplace(state.request, pending.parameters, pending.body, output,
+                            kConnectionHeaders[connectionVariant(state.request, keepAlive)]);
+    pending.context->peerAddress = state.peerAddress;
+    int minimum = context.config.compressionMinBytes;
+    if (minimum > 0) {
+        ContentEncoding encoding = negotiateEncoding(state.request.getHeader("Accept-Encoding"), availableEncodings());
+        pending.context->response.setCompression(encoding, static_cast<size_t>(minimum));
+    }
+    pending.task = handler(*pending.context);
+    // Runs until the first wait, or to the end if it never waits
+    pending.resume();
+}
+
+// Log and count a handler's response once its task is done. The request it
+// answered is still parsed in state.request. Returns the bytes the request,
+// body included, occupies at the front of the input.
+size_t finishHandler(ResponseQueue& output, PipelineState& state, const HandlerContext& context) {
+    PendingHandler& pending = state.handler;
+    const HTTPRequest& request = state.request;
+    Response& response = pending.context->response;
+    std::exception_ptr error = pending.task.getError();
+
+    // Whatever body the handler left unread must be read past before the
+    // next request; if it has not all arrived, give up on the connection
+    if (state.keepAlive && !pending.body.skip()) {
+        state.keepAlive = false;
+    }
+
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+            std::cerr << "Handler for " << request.getPath() << " failed: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Handler for " << request.getPath() << " failed" << std::endl;
+        }
+    }
+    int status = response.getStatus();
+    size_t bytes = response.getBytes();
+    if (!response.headSent()) {
+        // Returned (or threw) without answering
+        ResponseBuffer internalError = prebuilt().internalError[connectionVariant(request, state.keepAlive)];
+        bytes = internalError->size();
+        status = 500;
+        output.appendShared(std::move(internalError));
+    } else {
+        if (!error) {
+            // A stream the handler left open ends with it
+            response.end();
+        }
+        if (!response.complete() || response.getFraming() == Response::Framing::Close) {
+            // Fewer body bytes than announced, or the body runs to the close:
+            // either way the client cannot find the next response
+            state.keepAlive = false;
+        }
+    }
+
+    logAccess(context.accessLog, state.peerAddress, state.peerPort, request.getMethod(),
+              request.getPath(), request.getMinorVersion(), status, bytes, pending.received);
+    if (context.metrics) {
+        bumpCounter(context.metrics->requests);
+        context.metrics->countResponse(status);
+    }
+    size_t used = pending.body.requestBytes();
+    pending.reset();
+    return used;
+}
+
+// Queues the response and returns its status code
+int respond(const HTTPRequest& request, bool keepAlive, ResponseQueue& output,
+            const HandlerContext& context) {
+    if (!request.getIsValid()) {
+        output.appendShared(prebuilt().badRequest);
+        return 400;
+    }
+    // Other methods reach only routed handlers
+    if (request.getMethod() != "GET" && !isHead(request)) {
+        output.appendShared(prebuilt().methodNotAllowed[connectionVariant(request, keepAlive)]);
+        return 405;
+    }
+    if (isMetricsRequest(request, context)) {
+        return serveMetrics(request, keepAlive, output, context);
+    }
+    #ifdef HAVE_STATIC_FILES
+    if (context.files) {
+        return serveStaticFile(request, keepAlive, output, context);
+    }
+    #endif
+    appendResponse(output, prebuilt().hello[connectionVariant(request, keepAlive)], isHead(request));
+    return 200;
+}
+
+}
+
+size_t processPipelinedRequests(InputBuffer& input, ResponseQueue& output,
+                                PipelineState& state, const HandlerContext& context) {
+    size_t answered = 0;
+    size_t offset = 0;
+    int maxRequests = context.config.maxRequestsPerConnection;
+
+    if (state.handler.active()) {
+        if (state.handler.suspended()) {
+            return 0;
+        }
+        // Finished since the last call; its request is at the front
+        offset = finishHandler(output, state, context);
+        state.request.reset();
+        ++answered;
+    }
+
+    // Every request in this batch arrived by the read that just completed
+    std::chrono::steady_clock::time_point received;
+    if (context.accessLog) {
+        received = std::chrono::steady_clock::now();
+    }
+
+    while (state.keepAlive && offset < input.size()) {
+        HTTPRequest& request = state.request;
+        ParseResult result = request.parse(input.view().substr(offset));
+
+        if (result == ParseResult::Incomplete) {
+            break;
+        }
+
+        ++state.requestsServed;
+        size_t queuedBefore = output.size();
+
+        if (result == ParseResult::Error) {
+            ++answered;
+            // Framing is lost: answer 400 and drop the connection
+            output.appendShared(prebuilt().badRequest);
+            offset = input.size();
+            state.keepAlive = false;
+            request.reset();
+            logAccess(context.accessLog, state.peerAddress, state.peerPort, {}, {}, 1, 400,
+                      output.size() - queuedBefore, received);
+            if (context.metrics) {
+                bumpCounter(context.metrics->requests);
+                bumpCounter(context.metrics->parseErrors);
+                context.metrics->countResponse(400);
+            }
+            break;
+        }
+
+        bool underLimit = (maxRequests <= 0 || state.requestsServed < maxRequests) && !state.draining;
+        state.keepAlive = request.getIsValid() && request.wantsKeepAlive() && underLimit;
+
+        const RouteHandler* handler = nullptr;
+        if (context.router && request.getIsValid() && !isMetricsRequest(request, context)) {
+            handler = context.router->match(request.getMethod(), request.getPath(), state.handler.parameters);
+        }
+        long long maxBody = context.config.maxRequestBodyBytes;
+        if (handler && request.getBodyFraming() == BodyFraming::Length && maxBody > 0 &&
+            request.getContentLength() > static_cast<uint64_t>(maxBody)) {
+            handler = nullptr;
+            state.keepAlive = false;
+            ++answered;
+            output.appendShared(prebuilt().contentTooLarge);
+            logAccess(context.accessLog, state.peerAddress, state.peerPort, request.getMethod(),
+                      request.getPath(), request.getMinorVersion(), 413, output.size() - queuedBefore, received);
+            if (context.metrics) {
+                bumpCounter(context.metrics->requests);
+                context.metrics->countResponse(413);
+            }
+            break;
+        }
+        if (handler) {
+            if (request.hasBody()) {
+                // The body is decoded in place behind the head: put the head at
+                // the start of the block so reads never have to move it
+                input.consume(offset);
+                offset = 0;
+                input.compact();
+                request.rebase(input.view().data());
+            }
+            startHandler(*handler, state.keepAlive, input, output, state, context, received);
+            if (state.handler.suspended()) {
+                // Keep its request in place so the handler's views stay valid
+                input.consume(offset);
+                return answered;
+            }
+            offset += finishHandler(output, state, context);
+            ++answered;
+            request.reset();
+            continue;
+        }
+        if (request.hasBody()) {
+            // Nothing here reads the body, so nothing can find the request after it
+            state.keepAlive = false;
+        }
+
+        ++answered;
+        int status = respond(request, state.keepAlive, output, context);
+        logAccess(context.accessLog, state.peerAddress, state.peerPort, request.getMethod(),
+                  request.getPath(), request.getMinorVersion(), status,
+                  output.size() - queuedBefore, received);
+        if (context.metrics) {
+            bumpCounter(context.metrics->requests);
+            context.metrics->countResponse(status);
+        }
+
+        offset += request.getHeadLength();
+        request.reset();
+    }
+
+    input.consume(offset);
+    return answered;
+}
+
+void sendNotice(SOCKET_TYPE socket, ConnectionNotice notice, TlsStream* tls) {
+    const std::string& response = notice == ConnectionNotice::RequestTimeout ? *prebuilt().requestTimeout
+                                                                            : *prebuilt().serviceUnavailable;
+    // Nothing else is queued on the socket, so a short response fits the send buffer
+    if (!tls) {
+        send(socket, response.data(), static_cast<int>(response.size()), MSG_NOSIGNAL | MSG_DONTWAIT);
+    } else if (tls->isEstablished()) {
+        tls->write(response.data(), response.size());
+    }
+    #ifndef _WIN32
+    // Closing with unread input would reset the connection and could discard
+    // the response before the client reads it, so take what has arrived
+    char discard[4096];
+    for (int i = 0; i < 16 && recv(socket, discard, sizeof(discard), MSG_DONTWAIT) > 0; ++i) {
+    }
+    #endif
+}
+
+#ifndef _WIN32
+
+SpareDescriptor::SpareDescriptor() : fd(open("/dev/null", O_RDONLY | O_CLOEXEC)) {}
+
+SpareDescriptor::~SpareDescriptor() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool SpareDescriptor::shed(SOCKET_TYPE listener) {
+    if (fd < 0) {
+        // Lost to someone else when it was last given up; try again
+        fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+    }
+    // The listener may be blocking (io_uring's is)
+    struct pollfd watched = {};
+    watched.fd = listener;
+    watched.events = POLLIN;
+    if (poll(&watched, 1, 0) <= 0) {
+        errno = EAGAIN;
+        return false;
+    }
+    close(fd);
+    SOCKET_TYPE accepted = accept(listener, nullptr, nullptr);
+    int error = errno;
+    if (accepted != INVALID_SOCKET) {
+        CLOSE_SOCKET(accepted);
+    }
+    fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    errno = error;
+    return accepted != INVALID_SOCKET;
+}
+
+#else
+
+SpareDescriptor::SpareDescriptor() = default;
+SpareDescriptor::~SpareDescriptor() = default;
+
+bool SpareDescriptor::shed(SOCKET_TYPE) {
+    return false;
+}
+
+#endif
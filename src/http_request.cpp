@@ -0,0 +1,293 @@
+#include "http_request.h"
+#include "simd_scan.h"
+#include "string_util.h"
+
+#include <cstring>
+
+namespace {
+
+// Length of the line terminator at `pos` ("\r\n" or a bare "\n"),
+// 0 if more data is needed to tell, -1 if something else is there
+int lineTerminator(std::string_view head, size_t pos) {
+    if (pos >= head.size()) {
+        return 0;
+    }
+    if (head[pos] == '\n') {
+        return 1;
+    }
+    if (head[pos] != '\r') {
+        return -1;
+    }
+    if (pos + 1 >= head.size()) {
+        return 0;
+    }
+    return head[pos + 1] == '\n' ? 2 : -1;
+}
+
+// Strict 1*DIGIT: no sign, no list, at most 18 digits so it cannot overflow
+bool parseContentLength(std::string_view value, uint64_t& length) {
+    if (value.empty() || value.size() > 18) {
+        return false;
+    }
+    length = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        length = length * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return true;
+}
+
+size_t skipSpaces(std::string_view head, size_t pos) {
+    while (pos < head.size() && (head[pos] == ' ' || head[pos] == '\t')) {
+        ++pos;
+    }
+    return pos;
+}
+
+}
+
+void HTTPRequest::reset() {
+    base = nullptr;
+    stage = Stage::RequestLine;
+    lineStart = 0;
+    headLength = 0;
+    method = Span();
+    path = Span();
+    version = Span();
+    headerCount = 0;
+    minorVersion = 0;
+    isValid = false;
+    bodyFraming = BodyFraming::None;
+    contentLength = 0;
+}
+
+ParseResult HTTPRequest::parse(std::string_view buffer) {
+    base = buffer.data();
+
+    // The whole head, terminator included, must fit in kMaxRequestSize
+    std::string_view head = buffer.substr(0, kMaxRequestSize);
+
+    while (stage != Stage::Done) {
+        LineResult result = stage == Stage::RequestLine ? parseRequestLine(head)
+                                                        : parseHeaderLine(head);
+        if (result == LineResult::Error) {
+            return ParseResult::Error;
+        }
+        if (result == LineResult::Incomplete) {
+            return buffer.size() > kMaxRequestSize ? ParseResult::Error : ParseResult::Incomplete;
+        }
+    }
+    return ParseResult::Complete;
+}
+
+HTTPRequest::LineResult HTTPRequest::parseRequestLine(std::string_view head) {
+    // METHOD SP request-target SP HTTP-version CRLF
+    const char* data = head.data();
+    size_t size = head.size();
+    size_t pos = lineStart;
+
+    // Ignore empty lines ahead of the request line (RFC 9112 section 2.2)
+    while (true) {
+        int terminator = lineTerminator(head, pos);
+        if (terminator == 0) {
+            return LineResult::Incomplete;
+        }
+        if (terminator < 0) {
+            break;
+        }
+        pos += static_cast<size_t>(terminator);
+        lineStart = pos;
+    }
+
+    size_t methodEnd = pos + simd::findFirstNotIn(simd::kTokenChars, data + pos, size - pos);
+    if (methodEnd == size) {
+        return LineResult::Incomplete;
+    }
+    if (methodEnd == pos || data[methodEnd] != ' ') {
+        return LineResult::Error;
+    }
+
+    size_t targetStart = skipSpaces(head, methodEnd);
+    size_t targetEnd = targetStart +
+                       simd::findFirstNotIn(simd::kTargetChars, data + targetStart, size - targetStart);
+    if (targetEnd == size) {
+        return LineResult::Incomplete;
+    }
+    if (targetEnd == targetStart || data[targetEnd] != ' ') {
+        return LineResult::Error;
+    }
+
+    // Validate version format: HTTP/1.x, failing early on a wrong prefix
+    static constexpr char kVersionPrefix[] = "HTTP/1.";
+    constexpr size_t kPrefixLength = sizeof(kVersionPrefix) - 1;
+    size_t versionStart = skipSpaces(head, targetEnd);
+    size_t available = size - versionStart;
+    if (std::memcmp(data + versionStart, kVersionPrefix,
+                    available < kPrefixLength ? available : kPrefixLength) != 0) {
+        return LineResult::Error;
+    }
+    if (available <= kPrefixLength) {
+        return LineResult::Incomplete;
+    }
+    char minor = data[versionStart + kPrefixLength];
+    if (minor < '0' || minor > '9') {
+        return LineResult::Error;
+    }
+
+    size_t versionEnd = versionStart + kPrefixLength + 1;
+    int terminator = lineTerminator(head, versionEnd);
+    if (terminator == 0) {
+        return LineResult::Incomplete;
+    }
+    if (terminator < 0) {
+        return LineResult::Error;
+    }
+
+    method = {static_cast<uint16_t>(pos), static_cast<uint16_t>(methodEnd - pos)};
+    path = {static_cast<uint16_t>(targetStart), static_cast<uint16_t>(targetEnd - targetStart)};
+    version = {static_cast<uint16_t>(versionStart), static_cast<uint16_t>(versionEnd - versionStart)};
+    minorVersion = minor - '0';
+
+    stage = Stage::Headers;
+    lineStart = versionEnd + static_cast<size_t>(terminator);
+    return LineResult::Done;
+}
+
+HTTPRequest::LineResult HTTPRequest::parseHeaderLine(std::string_view head) {
+    // field-name ":" OWS field-value OWS CRLF, or the empty line ending the head
+    const char* data = head.data();
+    size_t size = head.size();
+    size_t pos = lineStart;
+
+    int terminator = lineTerminator(head, pos);
+    if (terminator == 0) {
+        return LineResult::Incomplete;
+    }
+    if (terminator > 0) {
+        stage = Stage::Done;
+        headLength = pos + static_cast<size_t>(terminator);
+        isValid = parseBodyFraming();
+        return LineResult::Done;
+    }
+
+    if (headerCount >= kMaxHeaders) {
+        return LineResult::Error;
+    }
+
+    // Obsolete line folding and whitespace before the colon are both rejected
+    size_t nameEnd = pos + simd::findFirstNotIn(simd::kTokenChars, data + pos, size - pos);
+    if (nameEnd == size) {
+        return LineResult::Incomplete;
+    }
+    if (nameEnd == pos || data[nameEnd] != ':') {
+        return LineResult::Error;
+    }
+
+    // One scan finds the end of the value and rejects stray control bytes
+    size_t valueStart = skipSpaces(head, nameEnd + 1);
+    size_t valueEnd = valueStart +
+                      simd::findFirstNotIn(simd::kFieldValueChars, data + valueStart, size - valueStart);
+    terminator = lineTerminator(head, valueEnd);
+    if (terminator == 0) {
+        return LineResult::Incomplete;
+    }
+    if (terminator < 0) {
+        return LineResult::Error;
+    }
+    size_t lineEnd = valueEnd + static_cast<size_t>(terminator);
+    while (valueEnd > valueStart && (data[valueEnd - 1] == ' ' || data[valueEnd - 1] == '\t')) {
+        --valueEnd;
+    }
+
+    Header& header = headers[headerCount++];
+    header.name = {static_cast<uint16_t>(pos), static_cast<uint16_t>(nameEnd - pos)};
+    header.value = {static_cast<uint16_t>(valueStart), static_cast<uint16_t>(valueEnd - valueStart)};
+
+    lineStart = lineEnd;
+    return LineResult::Done;
+}
+
+bool HTTPRequest::parseBodyFraming() {
+    // Anything a proxy in front of us might read differently is rejected
+    // rather than guessed at: that disagreement is how requests get smuggled
+    bool hasLength = false;
+    bool chunked = false;
+    for (size_t i = 0; i < headerCount; ++i) {
+        std::string_view name = getHeaderName(i);
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            uint64_t length;
+            if (!parseContentLength(getHeaderValue(i), length) || (hasLength && length != contentLength)) {
+                return false;
+            }
+            hasLength = true;
+            contentLength = length;
+        } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+            // Only a single "chunked" coding is decoded
+            if (chunked || !equalsIgnoreCase(getHeaderValue(i), "chunked")) {
+                return false;
+            }
+            chunked = true;
+        }
+    }
+    if (chunked && hasLength) {
+        return false;
+    }
+    if (chunked) {
+        bodyFraming = BodyFraming::Chunked;
+    } else if (contentLength > 0) {
+        bodyFraming = BodyFraming::Length;
+    }
+    return true;
+}
+
+std::string_view HTTPRequest::getHeader(std::string_view name) const {
+    for (size_t i = 0; i < headerCount; ++i) {
+        if (equalsIgnoreCase(getHeaderName(i), name)) {
+            return getHeaderValue(i);
+        }
+    }
+    return std::string_view();
+}
+
+bool HTTPRequest::wantsKeepAlive() const {
+    std::string_view connection = getHeader("Connection");
+    if (!isValid || hasToken(connection, "close")) {
+        return false;
+    }
+    if (minorVersion == 0) {
+        return hasToken(connection, "keep-alive");
+    }
+    return true;
+}
+
+std::string HTTPRequest::generateResponse(bool keepAlive) const {
+    if (!isValid) {
+        // A malformed request leaves the stream in an unknown state, so
+        // the connection is always closed after a 400
+        return "HTTP/1.1 400 Bad Request\r\n"
+               "Content-Type: text/plain\r\n"
+               "Content-Length: 15\r\n"
+               "Connection: close\r\n"
+               "\r\n"
+               "400 Bad Request";
+    }
+
+    std::string connectionHeader;
+    if (!keepAlive) {
+        connectionHeader = "Connection: close\r\n";
+    } else if (minorVersion == 0) {
+        connectionHeader = "Connection: keep-alive\r\n";
+    }
+
+    // Return the exact response format specified in acceptance criteria
+    std::string body = "Hello World!";
+    std::string response = "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: text/plain\r\n"
+                          "Content-Length: " + std::to_string(body.length()) + "\r\n"
+                          + connectionHeader +
+                          "\r\n"
+                          + body;
+    return response;
+}
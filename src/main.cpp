@@ -1,334 +1,283 @@
 #include <iostream>
 #include <string>
 #include <thread>
-#include <vector>
 #include <atomic>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <csignal>
-#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include "config_file.h"
+#include "tcp_server.h"
 
 #ifdef _WIN32
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    #pragma comment(lib, "ws2_32.lib")
-    using SOCKET_TYPE = SOCKET;
-    using SOCKET_SIZE_TYPE = int;
-    #define CLOSE_SOCKET closesocket
-    #define SOCKET_ERROR_CODE WSAGetLastError()
-#else
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <arpa/inet.h>
-    #include <unistd.h>
-    #include <fcntl.h>
-    using SOCKET_TYPE = int;
-    using SOCKET_SIZE_TYPE = socklen_t;
-    #define CLOSE_SOCKET close
-    #define SOCKET_ERROR_CODE errno
-    #define INVALID_SOCKET -1
-    #define SOCKET_ERROR -1
+std::atomic<bool> shouldStop(false);
+
+void signalHandler(int signal) {
+    std::cout << "\nReceived signal " << signal << ". Shutting down..." << std::endl;
+    shouldStop = true;
+}
 #endif
 
-class HTTPRequest {
-private:
-    std::string method;
-    std::string path;
-    std::string version;
-    bool isValid;
-    
-public:
-    HTTPRequest() : isValid(false) {}
-    
-    bool parse(const std::string& requestData) {
-        std::istringstream stream(requestData);
-        std::string requestLine;
-        
-        // Get the first line (request line)
-        if (!std::getline(stream, requestLine)) {
-            return false;
-        }
-        
-        // Remove carriage return if present
-        if (!requestLine.empty() && requestLine.back() == '\r') {
-            requestLine.pop_back();
-        }
-        
-        // Parse request line: METHOD PATH VERSION
-        std::istringstream lineStream(requestLine);
-        std::string token;
-        
-        // Parse method
-        if (!(lineStream >> token)) {
-            return false;
-        }
-        method = token;
-        
-        // Parse path
-        if (!(lineStream >> token)) {
-            return false;
-        }
-        path = token;
-        
-        // Parse version
-        if (!(lineStream >> token)) {
-            return false;
-        }
-        version = token;
-        
-        // Validate method (only support GET for now)
-        if (method != "GET") {
-            return false;
-        }
-        
-        // Validate version format
-        if (version.substr(0, 5) != "HTTP/") {
-            return false;
-        }
-        
-        isValid = true;
-        return true;
-    }
-    
-    std::string getMethod() const { return method; }
-    std::string getPath() const { return path; }
-    std::string getVersion() const { return version; }
-    bool getIsValid() const { return isValid; }
-    
-    std::string generateResponse() const {
-        if (!isValid) {
-            return "HTTP/1.1 400 Bad Request\r\n"
-                   "Content-Type: text/plain\r\n"
-                   "Content-Length: 25\r\n"
-                   "\r\n"
-                   "400 Bad Request";
+int queryNumber(const RequestContext& ctx, std::string_view name, int fallback) {
+    std::string_view text = ctx.queryParameter(name);
+    int value = fallback;
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    return value;
+}
+
+// Example coroutine handlers, enabled with --demo-routes. Exact paths known
+// at compile time go in a perfect-hash table; patterns are added at runtime.
+constexpr RouteKey kDemoRoutes[] = {
+    {"GET", "/demo/delay"},
+    {"GET", "/demo/stream"},
+    {"POST", "/demo/upload"},
+    {"GET", "/demo/download"},
+};
+constexpr auto kDemoTable = makeRouteTable(kDemoRoutes);
+
+// Answers after ?ms=N milliseconds without holding up the worker
+Task<> demoDelay(RequestContext& ctx) {
+    int ms = std::clamp(queryNumber(ctx, "ms", 100), 0, 10000);
+    co_await ctx.sleepFor(std::chrono::milliseconds(ms));
+    ctx.response.send("done\n");
+}
+
+// Writes ?chunks=N lines, one every 100 ms, each flushed as it is produced
+Task<> demoStream(RequestContext& ctx) {
+    int chunks = std::clamp(queryNumber(ctx, "chunks", 5), 1, 50);
+    constexpr size_t kLineLength = 9;   // "chunk NN\n"
+    ctx.response.begin(static_cast<size_t>(chunks) * kLineLength);
+    for (int i = 0; i < chunks; ++i) {
+        // Room for any int, so -Wformat-truncation cannot fire; i stays below 50
+        char line[24];
+        snprintf(line, sizeof(line), "chunk %02d\n", i);
+        ctx.response.write(std::string_view(line, kLineLength));
+        co_await ctx.flush();
+        if (i + 1 < chunks) {
+            co_await ctx.sleepFor(std::chrono::milliseconds(100));
         }
-        
-        // Return the exact response format specified in acceptance criteria
-        std::string body = "Hello World!";
-        std::string response = "HTTP/1.1 200 OK\r\n"
-                              "Content-Type: text/plain\r\n"
-                              "Content-Length: " + std::to_string(body.length()) + "\r\n"
-                              "\r\n"
-                              + body;
-        return response;
     }
-};
+}
 
-class TCPServer {
-private:
-    SOCKET_TYPE serverSocket;
-    std::atomic<bool> running;
-    std::vector<std::thread> clientThreads;
-    const int port;
-    
-public:
-    TCPServer(int port) : port(port), running(false) {
-        #ifdef _WIN32
-        WSADATA wsaData;
-        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-            throw std::runtime_error("WSAStartup failed");
+// Reads the request body (Content-Length or chunked) piece by piece as it
+// arrives and answers with its size and FNV-1a hash. Memory use is one
+// input buffer whatever the size of the upload.
+Task<> demoUpload(RequestContext& ctx) {
+    uint64_t bytes = 0;
+    uint32_t hash = 2166136261u;
+    for (std::string_view piece = co_await ctx.readBody(); !piece.empty(); piece = co_await ctx.readBody()) {
+        bytes += piece.size();
+        for (unsigned char c : piece) {
+            hash = (hash ^ c) * 16777619u;
         }
-        #endif
     }
-    
-    ~TCPServer() {
-        stop();
-        #ifdef _WIN32
-        WSACleanup();
-        #endif
+    if (!ctx.bodyComplete()) {
+        ctx.response.setStatus(ctx.body.isTooLarge() ? 413 : 400);
+        ctx.response.send("incomplete request body\n");
+        co_return;
     }
-    
-    bool start() {
-        // Create socket
-        serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-        if (serverSocket == INVALID_SOCKET) {
-            std::cerr << "Failed to create socket. Error: " << SOCKET_ERROR_CODE << std::endl;
-            return false;
-        }
-        
-        // Set socket options
-        int opt = 1;
-        if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, 
-                       reinterpret_cast<char*>(&opt), sizeof(opt)) < 0) {
-            std::cerr << "setsockopt failed. Error: " << SOCKET_ERROR_CODE << std::endl;
-            CLOSE_SOCKET(serverSocket);
-            return false;
-        }
-        
-        // Bind socket
-        struct sockaddr_in serverAddr;
-        serverAddr.sin_family = AF_INET;
-        serverAddr.sin_addr.s_addr = INADDR_ANY;
-        serverAddr.sin_port = htons(port);
-        
-        if (bind(serverSocket, reinterpret_cast<struct sockaddr*>(&serverAddr), 
-                 sizeof(serverAddr)) < 0) {
-            std::cerr << "Bind failed. Error: " << SOCKET_ERROR_CODE << std::endl;
-            CLOSE_SOCKET(serverSocket);
-            return false;
-        }
-        
-        // Listen for connections
-        if (listen(serverSocket, 5) < 0) {
-            std::cerr << "Listen failed. Error: " << SOCKET_ERROR_CODE << std::endl;
-            CLOSE_SOCKET(serverSocket);
-            return false;
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%llu bytes, fnv1a %08x\n",
+                          static_cast<unsigned long long>(bytes), hash);
+    ctx.response.send(std::string_view(line, static_cast<size_t>(length)));
+}
+
+// Streams ?kb=N kilobytes without a Content-Length (chunked for HTTP/1.1).
+// stream() waits for the socket whenever 64 KB are queued, so a slow client
+// slows the handler down instead of growing the queue. The body is text, so
+// a client sending Accept-Encoding gets it compressed as it streams.
+Task<> demoDownload(RequestContext& ctx) {
+    static const std::string kPiece = [] {
+        std::string piece(16 * 1024, '\0');
+        for (size_t i = 0; i < piece.size(); ++i) {
+            piece[i] = static_cast<char>('a' + i % 26);
         }
-        
-        running = true;
-        std::cout << "HTTP Server started on port " << port << std::endl;
-        std::cout << "Waiting for connections..." << std::endl;
-        
-        return true;
+        return piece;
+    }();
+    uint64_t remaining = static_cast<uint64_t>(std::clamp(queryNumber(ctx, "kb", 1024), 0, 4 * 1024 * 1024)) * 1024;
+    ctx.response.beginStream("text/plain; charset=utf-8");
+    while (remaining > 0) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(remaining, kPiece.size()));
+        co_await ctx.stream(std::string_view(kPiece).substr(0, length));
+        remaining -= length;
     }
-    
-    void run() {
-        while (running) {
-            struct sockaddr_in clientAddr;
-            SOCKET_SIZE_TYPE clientAddrLen = sizeof(clientAddr);
-            
-            SOCKET_TYPE clientSocket = accept(serverSocket, 
-                                            reinterpret_cast<struct sockaddr*>(&clientAddr), 
-                                            &clientAddrLen);
-            
-            if (clientSocket == INVALID_SOCKET) {
-                if (running) {
-                    std::cerr << "Accept failed. Error: " << SOCKET_ERROR_CODE << std::endl;
-                }
-                continue;
-            }
-            
-            // Get client IP address
-            char clientIP[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN);
-            std::cout << "New connection from " << clientIP << ":" << ntohs(clientAddr.sin_port) << std::endl;
-            
-            // Handle client in a separate thread
-            clientThreads.emplace_back(&TCPServer::handleClient, this, clientSocket);
-            
-            // Clean up finished threads
-            clientThreads.erase(
-                std::remove_if(clientThreads.begin(), clientThreads.end(),
-                    [](std::thread& t) {
-                        if (t.joinable()) {
-                            t.join();
-                            return true;
-                        }
-                        return false;
-                    }),
-                clientThreads.end()
-            );
+}
+
+void addDemoRoutes(Router& router) {
+    router.setStatic(kDemoTable.view(), {demoDelay, demoStream, demoUpload, demoDownload});
+
+    // Echoes the captured segment: /demo/echo/hello -> "hello"
+    router.get("/demo/echo/{word}", [](RequestContext& ctx) -> Task<> {
+        std::string body(ctx.pathParameter("word"));
+        body += '\n';
+        ctx.response.send(body);
+        co_return;
+    });
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program
+              << " [--config FILE] [--port N] [--mode threads|epoll|io_uring] [--workers N] [--pin-cpus]"
+              << " [--keepalive-timeout MS] [--header-timeout MS] [--body-timeout MS] [--write-timeout MS]"
+              << " [--drain-timeout MS] [--max-requests N] [--max-connections N] [--backlog N]"
+              << " [--root DIR] [--file-cache N] [--response-cache BYTES]"
+              << " [--zerocopy-threshold BYTES] [--access-log FILE] [--access-log-sample N]"
+              << " [--compress-min BYTES] [--max-body BYTES] [--metrics-path PATH|off]"
+              << " [--tls-port N] [--tls-cert FILE] [--tls-key FILE] [--ktls on|off] [--demo-routes]"
+              << " [--proxy PREFIX=HOST:PORT[,HOST:PORT...]] [--proxy-timeout MS] [--proxy-pool N]"
+              << " [--proxy-idle-timeout MS] [--proxy-health-interval MS] [--proxy-health-path PATH]"
+              << std::endl;
+}
+
+struct CommandLine {
+    std::string configPath;
+    // Options given as flags, applied over the config file on every load
+    std::vector<std::pair<std::string, std::string>> options;
+    bool demoRoutes = false;
+};
+
+bool parseCommandLine(int argc, char* argv[], CommandLine& commandLine) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc) {
+            commandLine.configPath = argv[++i];
+        } else if (arg == "--demo-routes") {
+            commandLine.demoRoutes = true;
+        } else if (arg == "--pin-cpus") {
+            commandLine.options.emplace_back("pin-cpus", "true");
+        } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0 && i + 1 < argc) {
+            commandLine.options.emplace_back(arg.substr(2), argv[++i]);
+        } else {
+            return false;
         }
     }
-    
-    void stop() {
-        running = false;
-        
-        // Close server socket
-        if (serverSocket != INVALID_SOCKET) {
-            CLOSE_SOCKET(serverSocket);
-            serverSocket = INVALID_SOCKET;
-        }
-        
-        // Wait for all client threads to finish
-        for (auto& thread : clientThreads) {
-            if (thread.joinable()) {
-                thread.join();
-            }
-        }
-        clientThreads.clear();
-        
-        std::cout << "Server stopped." << std::endl;
+    return true;
+}
+
+// The config file, then the flags over it
+bool buildConfig(const CommandLine& commandLine, ServerConfig& config) {
+    ServerConfig next;
+    std::string error;
+    if (!commandLine.configPath.empty() && !loadConfigFile(commandLine.configPath, next, error)) {
+        std::cerr << "Config error: " << error << std::endl;
+        return false;
     }
-    
-private:
-    void handleClient(SOCKET_TYPE clientSocket) {
-        char buffer[1024];
-        
-        while (running) {
-            int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
-            
-            if (bytesReceived <= 0) {
-                break; // Client disconnected or error
-            }
-            
-            // Null-terminate the received data
-            buffer[bytesReceived] = '\0';
-            
-            // Parse HTTP request
-            HTTPRequest request;
-            bool parseSuccess = request.parse(buffer);
-            
-            // Generate response
-            std::string response = request.generateResponse();
-            
-            // Send response to client
-            int bytesSent = send(clientSocket, response.c_str(), response.length(), 0);
-            if (bytesSent < 0) {
-                std::cerr << "Failed to send response to client. Error: " << SOCKET_ERROR_CODE << std::endl;
-                break;
-            }
-            
-            if (parseSuccess) {
-                std::cout << "Successfully parsed HTTP request: " << request.getMethod() 
-                          << " " << request.getPath() << " " << request.getVersion() << std::endl;
-                std::cout << "Sent HTTP response: " << bytesSent << " bytes" << std::endl;
-            } else {
-                std::cout << "Failed to parse HTTP request, sent 400 response" << std::endl;
-            }
-            
-            // Close connection after sending response (HTTP/1.0 behavior)
-            break;
+    for (const auto& [name, value] : commandLine.options) {
+        if (!applyConfigOption(name, value, next, error)) {
+            std::cerr << "--" << name << ": " << error << std::endl;
+            return false;
         }
-        
-        CLOSE_SOCKET(clientSocket);
-        std::cout << "Client disconnected" << std::endl;
     }
-};
-
-std::atomic<bool> shouldStop(false);
-
-void signalHandler(int signal) {
-    std::cout << "\nReceived signal " << signal << ". Shutting down..." << std::endl;
-    shouldStop = true;
+    config = next;
+    return true;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    CommandLine commandLine;
+    ServerConfig config;
+    if (!parseCommandLine(argc, argv, commandLine) || !buildConfig(commandLine, config)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
     std::cout << "HTTP Server starting..." << std::endl;
-    
-    // Set up signal handling
+
+    // Set up signal handling. On POSIX the signals are blocked in every
+    // thread and taken synchronously below, so a reload runs on this thread
+    // and nothing polls for a stop flag.
+    #ifdef _WIN32
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
-    
+    #else
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t handled;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTERM);
+    sigaddset(&handled, SIGHUP);
+    sigaddset(&handled, SIGQUIT);
+    // Before any thread starts, so they all inherit the mask
+    pthread_sigmask(SIG_BLOCK, &handled, nullptr);
+    #endif
+
     try {
-        TCPServer server(8080);
-        
+        TCPServer server(config);
+        if (commandLine.demoRoutes) {
+            addDemoRoutes(server.getRouter());
+        }
+
         if (!server.start()) {
             std::cerr << "Failed to start server" << std::endl;
             return 1;
         }
-        
+
         // Run server in a separate thread so we can handle signals
+        #ifdef _WIN32
         std::thread serverThread([&server]() {
             server.run();
         });
-        
+
         // Wait for stop signal
         while (!shouldStop) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
-        
-        // Stop server
         server.stop();
-        
+        #else
+        pthread_t mainThread = pthread_self();
+        std::atomic<bool> drained(false);
+        std::thread serverThread([&server, &drained, mainThread]() {
+            server.run();
+            // Done draining after SIGQUIT: wake sigwait() below
+            drained = true;
+            pthread_kill(mainThread, SIGTERM);
+        });
+
+        while (true) {
+            int received = 0;
+            if (sigwait(&handled, &received) != 0) {
+                continue;
+            }
+            if (received == SIGHUP) {
+                std::cout << "Received SIGHUP. Reloading..." << std::endl;
+                ServerConfig next;
+                if (buildConfig(commandLine, next)) {
+                    server.reload(next);
+                }
+                continue;
+            }
+            if (received == SIGQUIT) {
+                std::cout << "\nReceived SIGQUIT. Finishing open requests..." << std::endl;
+                server.stopGracefully();
+                continue;
+            }
+            // SIGINT, SIGTERM, or run() returning after a graceful stop
+            if (!drained) {
+                std::cout << "\nReceived signal " << received << ". Shutting down..." << std::endl;
+            }
+            server.stop();
+            break;
+        }
+        #endif
+
         if (serverThread.joinable()) {
             serverThread.join();
         }
-        
+
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
-    
+
     std::cout << "Server shutdown complete." << std::endl;
     return 0;
 }
@@ -0,0 +1,163 @@
+#include "metrics.h"
+
+#include <cstdio>
+
+namespace {
+
+struct HistogramTotals {
+    uint64_t buckets[kLatencyBucketCount + 1] = {};
+    uint64_t sumUs = 0;
+    uint64_t count = 0;
+
+    void add(const MetricsHistogram& histogram) {
+        for (size_t i = 0; i <= kLatencyBucketCount; ++i) {
+            buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+        }
+        sumUs += histogram.sumUs.load(std::memory_order_relaxed);
+        count += histogram.count.load(std::memory_order_relaxed);
+    }
+};
+
+void appendMetric(std::string& out, const char* name, const char* type, const char* help,
+                  uint64_t value) {
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+             name, help, name, type, name, static_cast<unsigned long long>(value));
+    out += line;
+}
+
+void appendHistogram(std::string& out, const char* name, const char* help,
+                     const HistogramTotals& totals) {
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    out += line;
+
+    // Prometheus buckets are cumulative and in seconds
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+        cumulative += totals.buckets[i];
+        snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name,
+                 static_cast<double>(kLatencyBucketsUs[i]) / 1e6,
+                 static_cast<unsigned long long>(cumulative));
+        out += line;
+    }
+    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.6f\n%s_count %llu\n",
+             name, static_cast<unsigned long long>(totals.count),
+             name, static_cast<double>(totals.sumUs) / 1e6,
+             name, static_cast<unsigned long long>(totals.count));
+    out += line;
+}
+
+}
+
+WorkerMetrics* MetricsRegistry::acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!freeBlocks.empty()) {
+        // The previous owner has stopped writing; the lock orders the handoff
+        WorkerMetrics* metrics = freeBlocks.back();
+        freeBlocks.pop_back();
+        return metrics;
+    }
+    blocks.push_back(std::make_unique<WorkerMetrics>());
+    return blocks.back().get();
+}
+
+void MetricsRegistry::release(WorkerMetrics* metrics) {
+    if (!metrics) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    freeBlocks.push_back(metrics);
+}
+
+std::string MetricsRegistry::render() {
+    uint64_t accepts = 0, active = 0, requests = 0, parseErrors = 0, bytesIn = 0, bytesOut = 0;
+    uint64_t responses[5] = {};
+    uint64_t shed = 0;
+    uint64_t timeouts[kTimeoutPhases] = {};
+    uint64_t tlsHandshakes[2] = {};
+    uint64_t tlsHandshakeErrors = 0, tlsKernelOffload = 0;
+    HistogramTotals firstByte, requestLatency;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& block : blocks) {
+            accepts += block->accepts.load(std::memory_order_relaxed);
+            active += block->activeConnections.load(std::memory_order_relaxed);
+            requests += block->requests.load(std::memory_order_relaxed);
+            parseErrors += block->parseErrors.load(std::memory_order_relaxed);
+            bytesIn += block->bytesIn.load(std::memory_order_relaxed);
+            bytesOut += block->bytesOut.load(std::memory_order_relaxed);
+            for (int i = 0; i < 5; ++i) {
+                responses[i] += block->responses[i].load(std::memory_order_relaxed);
+            }
+            shed += block->shedConnections.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < kTimeoutPhases; ++i) {
+                timeouts[i] += block->timeouts[i].load(std::memory_order_relaxed);
+            }
+            for (int i = 0; i < 2; ++i) {
+                tlsHandshakes[i] += block->tlsHandshakes[i].load(std::memory_order_relaxed);
+            }
+            tlsHandshakeErrors += block->tlsHandshakeErrors.load(std::memory_order_relaxed);
+            tlsKernelOffload += block->tlsKernelOffload.load(std::memory_order_relaxed);
+            firstByte.add(block->firstByte);
+            requestLatency.add(block->requestLatency);
+        }
+    }
+
+    std::string out;
+    out.reserve(4096);
+    appendMetric(out, "webserver_connections_accepted_total", "counter",
+                 "Connections accepted.", accepts);
+    appendMetric(out, "webserver_connections_active", "gauge",
+                 "Connections currently open.", active);
+    appendMetric(out, "webserver_requests_total", "counter",
+                 "Requests answered, including rejected ones.", requests);
+    appendMetric(out, "webserver_parse_errors_total", "counter",
+                 "Requests rejected as malformed.", parseErrors);
+    appendMetric(out, "webserver_received_bytes_total", "counter",
+                 "Bytes read from clients.", bytesIn);
+    appendMetric(out, "webserver_sent_bytes_total", "counter",
+                 "Response bytes written to clients.", bytesOut);
+
+    out += "# HELP webserver_responses_total Responses by status class.\n"
+           "# TYPE webserver_responses_total counter\n";
+    for (int i = 0; i < 5; ++i) {
+        char line[96];
+        snprintf(line, sizeof(line), "webserver_responses_total{code=\"%dxx\"} %llu\n",
+                 i + 1, static_cast<unsigned long long>(responses[i]));
+        out += line;
+    }
+
+    appendMetric(out, "webserver_connections_shed_total", "counter",
+                 "Connections turned away at the connection limit or for want of descriptors.", shed);
+    out += "# HELP webserver_timeouts_total Connections closed by a deadline, by what they were waiting for.\n"
+           "# TYPE webserver_timeouts_total counter\n";
+    static const char* const kPhases[kTimeoutPhases] = {"header", "body", "idle", "write"};
+    for (size_t i = 0; i < kTimeoutPhases; ++i) {
+        char line[96];
+        snprintf(line, sizeof(line), "webserver_timeouts_total{phase=\"%s\"} %llu\n",
+                 kPhases[i], static_cast<unsigned long long>(timeouts[i]));
+        out += line;
+    }
+
+    out += "# HELP webserver_tls_handshakes_total TLS handshakes completed, by whether a session was resumed.\n"
+           "# TYPE webserver_tls_handshakes_total counter\n";
+    static const char* const kSessions[2] = {"full", "resumed"};
+    for (int i = 0; i < 2; ++i) {
+        char line[96];
+        snprintf(line, sizeof(line), "webserver_tls_handshakes_total{session=\"%s\"} %llu\n",
+                 kSessions[i], static_cast<unsigned long long>(tlsHandshakes[i]));
+        out += line;
+    }
+    appendMetric(out, "webserver_tls_handshake_errors_total", "counter",
+                 "TLS handshakes that failed.", tlsHandshakeErrors);
+    appendMetric(out, "webserver_tls_ktls_connections_total", "counter",
+                 "TLS connections whose records the kernel encrypts (kTLS).", tlsKernelOffload);
+
+    appendHistogram(out, "webserver_first_byte_seconds",
+                    "Time from accept to the first request byte.", firstByte);
+    appendHistogram(out, "webserver_request_duration_seconds",
+                    "Time from the read that completed a request to its response being written.",
+                    requestLatency);
+    return out;
+}
@@ -0,0 +1,914 @@
+#include "proxy.h"
+#include "http_request.h"
+#include "router.h"
+#include "string_util.h"
+
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#ifdef HAVE_PROXY
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#endif
+
+#ifdef HAVE_PROXY
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Largest upstream response head, and the read buffer behind it
+constexpr size_t kBufferSize = 16 * 1024;
+// Request bytes gathered before they are sent on
+constexpr size_t kSendBatch = 64 * 1024;
+// Longest chunk-size or trailer line, and all trailer lines together
+constexpr size_t kMaxLineLength = 1024;
+constexpr size_t kMaxTrailerBytes = 8192;
+// Tries per request: an upstream may fail to connect, and for a request
+// that may be repeated, a pooled connection may turn out to be closed
+constexpr int kMaxAttempts = 3;
+// Without health checks, a failed upstream is tried again after this long
+constexpr int64_t kRetryAfterMs = 1000;
+// Idle pipes each thread keeps for splicing, and the size asked for them
+constexpr size_t kMaxPipes = 16;
+constexpr int kPipeSize = 256 * 1024;
+
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
+}
+
+std::chrono::milliseconds timeLeft(Clock::time_point deadline) {
+    return std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+}
+
+bool wouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// Methods whose repeat does no more than the first request, so one lost with
+// its connection may be sent again (RFC 9110 section 9.2.2). PUT and DELETE
+// are idempotent by definition too, but upstreams do not all honour that.
+bool safeToRepeat(std::string_view method) {
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "TRACE";
+}
+
+// Lines are split at '\n', so trimming one also drops its '\r'
+constexpr std::string_view kLineWhitespace = " \t\r";
+
+// Headers that describe one connection rather than the message (RFC 9110
+// section 7.6.1), and the framing the proxy sets itself
+bool isHopByHop(std::string_view name) {
+    static constexpr std::string_view kNames[] = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Upgrade",
+        "Transfer-Encoding", "Content-Length",
+    };
+    for (std::string_view hop : kNames) {
+        if (equalsIgnoreCase(name, hop)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string buildRequestHead(const HTTPRequest& request, std::string_view host, uint32_t peerAddress) {
+    std::string head;
+    head.reserve(512);
+    head.append(request.getMethod());
+    head += ' ';
+    head.append(request.getPath());
+    head += " HTTP/1.1\r\n";
+
+    std::string_view forwardedFor;
+    bool hostSeen = false;
+    for (size_t i = 0; i < request.getHeaderCount(); ++i) {
+        std::string_view name = request.getHeaderName(i);
+        // 100-continue is negotiated with the client, not passed on
+        if (isHopByHop(name) || equalsIgnoreCase(name, "Expect")) {
+            continue;
+        }
+        if (equalsIgnoreCase(name, "X-Forwarded-For")) {
+            forwardedFor = request.getHeaderValue(i);
+            continue;
+        }
+        hostSeen = hostSeen || equalsIgnoreCase(name, "Host");
+        head.append(name);
+        head += ": ";
+        head.append(request.getHeaderValue(i));
+        head += "\r\n";
+    }
+    if (!hostSeen) {
+        // HTTP/1.0 clients may leave it out; HTTP/1.1 upstreams require it
+        head += "Host: ";
+        head.append(host);
+        head += "\r\n";
+    }
+    if (peerAddress != 0) {
+        char address[INET_ADDRSTRLEN] = {};
+        inet_ntop(AF_INET, &peerAddress, address, sizeof(address));
+        head += "X-Forwarded-For: ";
+        if (!forwardedFor.empty()) {
+            head.append(forwardedFor);
+            head += ", ";
+        }
+        head += address;
+        head += "\r\n";
+    }
+    if (request.getBodyFraming() == BodyFraming::Length) {
+        head += "Content-Length: " + std::to_string(request.getContentLength()) + "\r\n";
+    } else if (request.getBodyFraming() == BodyFraming::Chunked) {
+        head += "Transfer-Encoding: chunked\r\n";
+    }
+    head += "\r\n";
+    return head;
+}
+
+// What the proxy needs from an upstream response head
+struct ResponseHead {
+    int status = 0;
+    int minorVersion = 1;
+    size_t length = 0;
+    std::string_view contentType;
+    bool hasLength = false;
+    uint64_t contentLength = 0;
+    bool chunked = false;
+    // Delimited by the close, or any other transfer coding
+    bool untilClose = false;
+    bool close = false;
+};
+
+// "HTTP/1.x NNN reason"
+bool parseStatusLine(std::string_view line, ResponseHead& head) {
+    if (line.size() < 12 || line.substr(0, 7) != "HTTP/1." || line[8] != ' ') {
+        return false;
+    }
+    head.minorVersion = line[7] - '0';
+    auto [end, status] = std::from_chars(line.data() + 9, line.data() + 12, head.status);
+    return status == std::errc() && end == line.data() + 12 && head.status >= 100 && head.status <= 999;
+}
+
+// Fills `head` from the complete head in `text`. False if it is malformed.
+bool readResponseHead(std::string_view text, ResponseHead& head) {
+    size_t lineEnd = text.find('\n');
+    if (!parseStatusLine(trim(text.substr(0, lineEnd), kLineWhitespace), head)) {
+        return false;
+    }
+    text.remove_prefix(lineEnd + 1);
+    bool transferEncoding = false;
+    while (true) {
+        lineEnd = text.find('\n');
+        std::string_view line = trim(text.substr(0, lineEnd), kLineWhitespace);
+        text.remove_prefix(lineEnd + 1);
+        if (line.empty()) {
+            break;
+        }
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0) {
+            return false;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = trim(line.substr(colon + 1));
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            uint64_t length = 0;
+            auto [end, status] = std::from_chars(value.data(), value.data() + value.size(), length);
+            if (status != std::errc() || end != value.data() + value.size()) {
+                return false;
+            }
+            // Repeats must agree, or the body's end is anyone's guess (RFC 9112 section 6.3)
+            if (head.hasLength && length != head.contentLength) {
+                return false;
+            }
+            head.contentLength = length;
+            head.hasLength = true;
+        } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+            transferEncoding = true;
+            // Chunked only when it is the final coding (RFC 9112 section 6.3)
+            size_t comma = value.rfind(',');
+            std::string_view last = trim(comma == std::string_view::npos ? value : value.substr(comma + 1));
+            head.chunked = equalsIgnoreCase(last, "chunked");
+            head.untilClose = !head.chunked;
+        } else if (equalsIgnoreCase(name, "Connection")) {
+            head.close = head.close || hasToken(value, "close");
+        } else if (equalsIgnoreCase(name, "Content-Type")) {
+            head.contentType = value;
+        }
+    }
+    if (transferEncoding && head.hasLength) {
+        // Transfer-Encoding wins, but whatever sent both may have framed the
+        // body either way: never read another response from this connection
+        head.close = true;
+    }
+    if (head.chunked || head.untilClose) {
+        head.hasLength = false;
+    }
+    return true;
+}
+
+// Passes the end-to-end headers of a head readResponseHead() accepted on to
+// `response`. Only then, so a malformed head adds none to the 502.
+void copyHeaders(std::string_view text, Response& response) {
+    text.remove_prefix(text.find('\n') + 1);
+    while (true) {
+        size_t lineEnd = text.find('\n');
+        std::string_view line = trim(text.substr(0, lineEnd), kLineWhitespace);
+        text.remove_prefix(lineEnd + 1);
+        if (line.empty()) {
+            break;
+        }
+        size_t colon = line.find(':');
+        std::string_view name = line.substr(0, colon);
+        if (!isHopByHop(name) && !equalsIgnoreCase(name, "Content-Type")) {
+            response.setHeader(name, trim(line.substr(colon + 1)));
+        }
+    }
+}
+
+// Bytes read from an upstream and not yet passed on
+class ReadBuffer {
+private:
+    std::unique_ptr<char[]> data;
+    size_t start = 0;
+    size_t end = 0;
+
+public:
+    ReadBuffer() : data(std::make_unique<char[]>(kBufferSize)) {}
+
+    std::string_view view() const { return std::string_view(data.get() + start, end - start); }
+    size_t size() const { return end - start; }
+    bool empty() const { return start == end; }
+    bool full() const { return start == 0 && end == kBufferSize; }
+    void consume(size_t length) {
+        start += length;
+        if (start == end) {
+            start = end = 0;
+        }
+    }
+    // Room for the next read, after moving what is left to the front
+    char* space(size_t& room) {
+        if (start > 0) {
+            memmove(data.get(), data.get() + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        room = kBufferSize - end;
+        return data.get() + end;
+    }
+    void commit(size_t length) { end += length; }
+    void clear() { start = end = 0; }
+};
+
+// Idle keep-alive connections per upstream, for one worker (or client thread)
+class ConnectionPool {
+private:
+    struct Idle {
+        int fd;
+        Clock::time_point since;
+    };
+    std::unordered_map<const Upstream*, std::vector<Idle>> idle;
+
+public:
+    ConnectionPool() = default;
+    ~ConnectionPool() {
+        for (auto& [upstream, connections] : idle) {
+            for (const Idle& connection : connections) {
+                close(connection.fd);
+            }
+        }
+    }
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // The most recently used connection still open, or -1
+    int acquire(const Upstream* upstream, std::chrono::milliseconds idleTimeout) {
+        auto found = idle.find(upstream);
+        if (found == idle.end()) {
+            return -1;
+        }
+        std::vector<Idle>& connections = found->second;
+        Clock::time_point oldest = Clock::now() - idleTimeout;
+        while (!connections.empty()) {
+            Idle connection = connections.back();
+            connections.pop_back();
+            // Pending input on an idle connection is a close or a stray byte;
+            // either way it cannot carry the next response
+            char byte;
+            if (connection.since >= oldest && recv(connection.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+                wouldBlock()) {
+                return connection.fd;
+            }
+            close(connection.fd);
+        }
+        return -1;
+    }
+
+    void release(const Upstream* upstream, int fd, size_t limit) {
+        std::vector<Idle>& connections = idle[upstream];
+        if (connections.size() >= limit) {
+            // The longest idle goes first
+            close(connections.front().fd);
+            connections.erase(connections.begin());
+        }
+        connections.push_back({fd, Clock::now()});
+    }
+};
+
+ConnectionPool& workerPool() {
+    thread_local ConnectionPool pool;
+    return pool;
+}
+
+#ifdef HAVE_SPLICE
+// An empty pipe no queued response still refers to
+std::shared_ptr<SplicePipe> acquirePipe() {
+    thread_local std::vector<std::shared_ptr<SplicePipe>> pipes;
+    for (size_t i = 0; i < pipes.size(); ++i) {
+        if (pipes[i].use_count() > 1) {
+            continue;
+        }
+        if (pipes[i]->buffered == 0) {
+            return pipes[i];
+        }
+        // Left holding bytes by a client that went away
+        pipes.erase(pipes.begin() + static_cast<std::ptrdiff_t>(i--));
+    }
+    auto pipe = std::make_shared<SplicePipe>();
+    if (!pipe->open()) {
+        return nullptr;
+    }
+    // Best effort: fewer round trips through the pipe per response
+    fcntl(pipe->writeFd, F_SETPIPE_SZ, kPipeSize);
+    if (pipes.size() < kMaxPipes) {
+        pipes.push_back(pipe);
+    }
+    return pipe;
+}
+#endif
+
+// Closes the upstream socket unless it was handed back to the pool
+struct UpstreamSocket {
+    int fd = -1;
+    bool reused = false;
+
+    UpstreamSocket() = default;
+    ~UpstreamSocket() { reset(); }
+    UpstreamSocket(const UpstreamSocket&) = delete;
+    UpstreamSocket& operator=(const UpstreamSocket&) = delete;
+
+    void reset() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    int release() { return std::exchange(fd, -1); }
+};
+
+enum class IoResult { Done, Closed, TimedOut, Failed };
+
+// Sends all of `data`, waiting up to `timeout` at a time for the socket
+Task<IoResult> sendAll(RequestContext& ctx, int fd, std::string_view data, std::chrono::milliseconds timeout) {
+    Clock::time_point deadline = Clock::now() + timeout;
+    while (!data.empty()) {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0) {
+            data.remove_prefix(static_cast<size_t>(sent));
+            deadline = Clock::now() + timeout;
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent == 0 || !wouldBlock()) {
+            co_return IoResult::Failed;
+        }
+        std::chrono::milliseconds left = timeLeft(deadline);
+        if (left.count() <= 0) {
+            co_return IoResult::TimedOut;
+        }
+        co_await ctx.writable(fd, left);
+    }
+    co_return IoResult::Done;
+}
+
+// Reads whatever arrives next into `in`, waiting up to `timeout`
+Task<IoResult> readMore(RequestContext& ctx, int fd, ReadBuffer& in, std::chrono::milliseconds timeout) {
+    Clock::time_point deadline = Clock::now() + timeout;
+    while (true) {
+        size_t room = 0;
+        char* space = in.space(room);
+        if (room == 0) {
+            co_return IoResult::Failed;
+        }
+        ssize_t received = recv(fd, space, room, MSG_DONTWAIT);
+        if (received > 0) {
+            in.commit(static_cast<size_t>(received));
+            co_return IoResult::Done;
+        }
+        if (received == 0) {
+            co_return IoResult::Closed;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (!wouldBlock()) {
+            co_return IoResult::Failed;
+        }
+        std::chrono::milliseconds left = timeLeft(deadline);
+        if (left.count() <= 0) {
+            co_return IoResult::TimedOut;
+        }
+        co_await ctx.readable(fd, left);
+    }
+}
+
+// Non-blocking connect, waiting up to `timeout` for it to complete
+Task<IoResult> connectTo(RequestContext& ctx, const Upstream& upstream, UpstreamSocket& socket,
+                         std::chrono::milliseconds timeout) {
+    socket.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socket.fd < 0) {
+        co_return IoResult::Failed;
+    }
+    int one = 1;
+    setsockopt(socket.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(socket.fd, reinterpret_cast<const struct sockaddr*>(&upstream.address),
+                sizeof(upstream.address)) == 0) {
+        co_return IoResult::Done;
+    }
+    if (errno != EINPROGRESS) {
+        co_return IoResult::Failed;
+    }
+    Clock::time_point deadline = Clock::now() + timeout;
+    while (true) {
+        struct pollfd watched = {socket.fd, POLLOUT, 0};
+        if (poll(&watched, 1, 0) > 0) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(socket.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            co_return error == 0 ? IoResult::Done : IoResult::Failed;
+        }
+        std::chrono::milliseconds left = timeLeft(deadline);
+        if (left.count() <= 0) {
+            co_return IoResult::TimedOut;
+        }
+        co_await ctx.writable(socket.fd, left);
+    }
+}
+
+// Waits until `in` holds a whole line, returning its length including '\n'
+Task<size_t> readLine(RequestContext& ctx, int fd, ReadBuffer& in, std::chrono::milliseconds timeout) {
+    while (true) {
+        size_t end = in.view().find('\n');
+        if (end != std::string_view::npos) {
+            co_return end + 1;
+        }
+        if (in.size() >= kMaxLineLength || co_await readMore(ctx, fd, in, timeout) != IoResult::Done) {
+            throw std::runtime_error("upstream sent a malformed or truncated chunked body");
+        }
+    }
+}
+
+}
+
+ReverseProxy::~ReverseProxy() {
+    stop();
+}
+
+bool ReverseProxy::init(const ServerConfig& config) {
+    timeout = std::chrono::milliseconds(config.proxyTimeoutMs > 0 ? config.proxyTimeoutMs : INT_MAX);
+    poolSize = static_cast<size_t>(config.proxyPoolSize);
+    idleTimeout = std::chrono::milliseconds(config.proxyIdleTimeoutMs);
+    healthIntervalMs = config.proxyHealthIntervalMs;
+    healthPath = config.proxyHealthPath.empty() ? "/" : config.proxyHealthPath;
+
+    for (const ProxyRoute& configured : config.proxyRoutes) {
+        auto route = std::make_unique<Route>();
+        route->prefix = configured.prefix;
+        for (const std::string& name : configured.upstreams) {
+            size_t colon = name.rfind(':');
+            std::string host = name.substr(0, colon);
+            std::string port = name.substr(colon + 1);
+
+            struct addrinfo hints = {};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            struct addrinfo* found = nullptr;
+            int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+            if (error != 0 || !found) {
+                std::cerr << "Cannot resolve upstream " << name << ": " << gai_strerror(error) << std::endl;
+                return false;
+            }
+            auto upstream = std::make_unique<Upstream>();
+            upstream->name = name;
+            memcpy(&upstream->address, found->ai_addr, sizeof(upstream->address));
+            freeaddrinfo(found);
+            route->upstreams.push_back(std::move(upstream));
+        }
+        routes.push_back(std::move(route));
+    }
+    return true;
+}
+
+void ReverseProxy::addRoutes(Router& router) {
+    for (auto& route : routes) {
+        Route* target = route.get();
+        router.add("*", route->prefix, [this, target](RequestContext& ctx) { return forward(ctx, *target); });
+    }
+}
+
+void ReverseProxy::start() {
+    if (healthIntervalMs > 0 && !healthThread.joinable()) {
+        healthThread = std::thread(&ReverseProxy::runHealthChecks, this);
+    }
+}
+
+void ReverseProxy::stop() {
+    {
+        std::lock_guard<std::mutex> lock(healthMutex);
+        stopping = true;
+    }
+    healthWake.notify_all();
+    if (healthThread.joinable()) {
+        healthThread.join();
+    }
+}
+
+void ReverseProxy::printStats() const {
+    for (const auto& route : routes) {
+        for (const auto& upstream : route->upstreams) {
+            std::cout << "Upstream " << upstream->name << " (" << route->prefix << "): "
+                      << upstream->requests.load() << " requests, "
+                      << upstream->connectionsOpened.load() << " connections opened, "
+                      << upstream->failures.load() << " failures" << std::endl;
+        }
+    }
+}
+
+Upstream* ReverseProxy::pick(Route& route, const Upstream* avoid) {
+    size_t count = route.upstreams.size();
+    uint32_t first = route.turn.fetch_add(1, std::memory_order_relaxed);
+    int64_t now = nowMs();
+    for (size_t i = 0; i < count; ++i) {
+        Upstream* upstream = route.upstreams[(first + i) % count].get();
+        if (upstream != avoid && upstream->downUntil.load(std::memory_order_relaxed) <= now) {
+            return upstream;
+        }
+    }
+    return nullptr;
+}
+
+void ReverseProxy::markFailed(Upstream& upstream) {
+    upstream.failures.fetch_add(1, std::memory_order_relaxed);
+    // With health checks it stays out until one passes
+    int64_t until = healthIntervalMs > 0 ? INT64_MAX : nowMs() + kRetryAfterMs;
+    if (upstream.downUntil.exchange(until) == 0) {
+        std::cerr << "Upstream " << upstream.name << " failed; taking it out of rotation" << std::endl;
+    }
+}
+
+void ReverseProxy::runHealthChecks() {
+    std::unique_lock<std::mutex> lock(healthMutex);
+    while (!stopping) {
+        lock.unlock();
+        for (auto& route : routes) {
+            for (auto& upstream : route->upstreams) {
+                bool healthy = probe(*upstream);
+                int64_t was = upstream->downUntil.load();
+                if (healthy && was != 0) {
+                    upstream->downUntil.store(0);
+                    std::cout << "Upstream " << upstream->name << " passed its health check" << std::endl;
+                } else if (!healthy && was != INT64_MAX) {
+                    upstream->downUntil.store(INT64_MAX);
+                    std::cerr << "Upstream " << upstream->name << " failed its health check" << std::endl;
+                }
+            }
+        }
+        lock.lock();
+        healthWake.wait_for(lock, std::chrono::milliseconds(healthIntervalMs), [this] { return stopping; });
+    }
+}
+
+// GET healthPath on its own connection; healthy on any answer but a 5xx within
+// the timeout (a 404 still shows the server is up and speaking HTTP)
+bool ReverseProxy::probe(const Upstream& upstream) const {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    // Never longer than an interval, so one dead upstream cannot stall the others' checks
+    Clock::time_point deadline = Clock::now() + std::min(timeout, std::chrono::milliseconds(healthIntervalMs));
+    auto waitFor = [fd, deadline](short events) {
+        struct pollfd watched = {fd, events, 0};
+        int left = static_cast<int>(std::max<long long>(timeLeft(deadline).count(), 0));
+        return poll(&watched, 1, left) > 0;
+    };
+
+    bool healthy = false;
+    std::string request = "GET " + healthPath + " HTTP/1.1\r\nHost: " + upstream.name +
+                          "\r\nConnection: close\r\nUser-Agent: web_server health check\r\n\r\n";
+    char response[64];
+    size_t received = 0;
+    int connected = connect(fd, reinterpret_cast<const struct sockaddr*>(&upstream.address), sizeof(upstream.address));
+    if (connected == 0 || (errno == EINPROGRESS && waitFor(POLLOUT))) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        // A health request fits any send buffer
+        if (error == 0 && send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size())) {
+            while (received < 12 && waitFor(POLLIN)) {
+                ssize_t bytes = recv(fd, response + received, sizeof(response) - received, 0);
+                if (bytes <= 0) {
+                    break;
+                }
+                received += static_cast<size_t>(bytes);
+            }
+            ResponseHead head;
+            healthy = parseStatusLine(std::string_view(response, received), head) &&
+                      head.status < 500;
+        }
+    }
+    close(fd);
+    return healthy;
+}
+
+Task<> ReverseProxy::forward(RequestContext& ctx, Route& route) {
+    const HTTPRequest& request = ctx.request;
+    Response& response = ctx.response;
+    // Bodies go on as the upstream encoded them
+    response.setCompression(ContentEncoding::Identity, 0);
+
+    bool hasBody = request.hasBody();
+    bool chunkedBody = request.getBodyFraming() == BodyFraming::Chunked;
+    // Once sent, a request goes to another upstream only if repeating it is
+    // harmless. A body is read from the client as it is sent on, so it could
+    // not be sent twice anyway. Any request may move on after a failed connect.
+    bool repeatable = !hasBody && safeToRepeat(request.getMethod());
+
+    UpstreamSocket upstream;
+    Upstream* target = nullptr;
+    const Upstream* failed = nullptr;
+    ReadBuffer in;
+    ResponseHead head;
+    IoResult result = IoResult::Failed;
+
+    for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+        upstream.reset();
+        in.clear();
+        target = pick(route, failed);
+        if (!target) {
+            break;
+        }
+        // A request that cannot be repeated takes a new connection: on a
+        // pooled one the upstream's idle close could race the send and fail
+        // a request that was never forwarded
+        upstream.fd = repeatable ? workerPool().acquire(target, idleTimeout) : -1;
+        upstream.reused = upstream.fd >= 0;
+        if (!upstream.reused) {
+            result = co_await connectTo(ctx, *target, upstream, timeout);
+            if (result != IoResult::Done) {
+                markFailed(*target);
+                failed = target;
+                continue;
+            }
+            target->connectionsOpened.fetch_add(1, std::memory_order_relaxed);
+        }
+        target->requests.fetch_add(1, std::memory_order_relaxed);
+
+        // The head and the body after it, in batches
+        std::string out = buildRequestHead(request, target->name, ctx.peerAddress);
+        result = IoResult::Done;
+        if (hasBody) {
+            for (std::string_view piece = co_await ctx.readBody(); !piece.empty() && result == IoResult::Done;
+                 piece = co_await ctx.readBody()) {
+                if (chunkedBody) {
+                    char size[24];
+                    int length = snprintf(size, sizeof(size), "%zx\r\n", piece.size());
+                    out.append(size, static_cast<size_t>(length));
+                    out.append(piece);
+                    out += "\r\n";
+                } else {
+                    out.append(piece);
+                }
+                if (out.size() >= kSendBatch) {
+                    result = co_await sendAll(ctx, upstream.fd, out, timeout);
+                    out.clear();
+                }
+            }
+            if (result == IoResult::Done && !ctx.bodyComplete()) {
+                response.setStatus(ctx.body.isTooLarge() ? 413 : 400);
+                response.send("incomplete request body\n");
+                co_return;
+            }
+            if (chunkedBody) {
+                out += "0\r\n\r\n";
+            }
+        }
+        if (result == IoResult::Done) {
+            result = co_await sendAll(ctx, upstream.fd, out, timeout);
+        }
+
+        // The response head, past any 1xx interim responses
+        bool received = false;
+        while (result == IoResult::Done) {
+            size_t end = in.view().find("\r\n\r\n");
+            if (end != std::string_view::npos) {
+                ResponseHead interim;
+                if (!parseStatusLine(in.view().substr(0, in.view().find('\r')), interim)) {
+                    result = IoResult::Failed;
+                    break;
+                }
+                if (interim.status >= 100 && interim.status < 200 && interim.status != 101) {
+                    in.consume(end + 4);
+                    continue;
+                }
+                head.length = end + 4;
+                break;
+            }
+            if (in.full()) {
+                result = IoResult::Failed;   // Head too large
+                break;
+            }
+            result = co_await readMore(ctx, upstream.fd, in, timeout);
+            received = received || result == IoResult::Done;
+        }
+        if (result == IoResult::Done) {
+            break;
+        }
+        if (upstream.reused && !received && result != IoResult::TimedOut) {
+            // The pooled connection was closed under us; not the upstream's fault
+            continue;
+        }
+        markFailed(*target);
+        failed = target;
+        if (result == IoResult::TimedOut || !repeatable) {
+            break;
+        }
+    }
+
+    if (!target || result != IoResult::Done) {
+        bool timedOut = result == IoResult::TimedOut;
+        response.setStatus(timedOut ? 504 : 502);
+        response.send(timedOut ? "upstream timed out\n" : "upstream unavailable\n");
+        co_return;
+    }
+    if (!readResponseHead(in.view().substr(0, head.length), head) || head.status == 101) {
+        markFailed(*target);
+        response.setStatus(502);
+        response.send("malformed upstream response\n");
+        co_return;
+    }
+    if (target->downUntil.load(std::memory_order_relaxed) != 0) {
+        target->downUntil.store(0, std::memory_order_relaxed);
+    }
+    copyHeaders(in.view().substr(0, head.length), response);
+    in.consume(head.length);
+    response.setStatus(head.status);
+
+    bool reusable = head.minorVersion >= 1 && !head.close;
+    if (head.status < 200 || head.status == 204) {
+        // No body, and no Content-Length either (RFC 9110 section 8.6)
+        response.sendHead(std::nullopt, head.contentType);
+    } else if (request.getMethod() == "HEAD" || head.status == 304) {
+        // No body follows; the length is the one a GET would have had
+        response.sendHead(head.hasLength ? std::optional<uint64_t>(head.contentLength) : std::nullopt,
+                          head.contentType);
+    } else if (head.hasLength) {
+        response.begin(static_cast<size_t>(head.contentLength), head.contentType);
+        uint64_t remaining = head.contentLength;
+        size_t first = static_cast<size_t>(std::min<uint64_t>(in.size(), remaining));
+        response.write(in.view().substr(0, first));
+        in.consume(first);
+        remaining -= first;
+
+        #ifdef HAVE_SPLICE
+        std::shared_ptr<SplicePipe> pipe = remaining > 0 && response.canSplice() ? acquirePipe() : nullptr;
+        Clock::time_point deadline = Clock::now() + timeout;
+        while (pipe && remaining > 0) {
+            // Upstream socket to pipe to client socket, all in the kernel
+            ssize_t moved = pipe->fill(upstream.fd, static_cast<size_t>(std::min<uint64_t>(remaining, kPipeSize)));
+            if (moved > 0) {
+                response.writePipe(pipe, static_cast<size_t>(moved));
+                remaining -= static_cast<uint64_t>(moved);
+                co_await ctx.flush();
+                deadline = Clock::now() + timeout;
+                continue;
+            }
+            if (moved < 0 && errno == EINTR) {
+                continue;
+            }
+            if (moved < 0 && wouldBlock() && timeLeft(deadline).count() > 0) {
+                co_await ctx.readable(upstream.fd, timeLeft(deadline));
+                continue;
+            }
+            if (moved < 0 && errno == EINVAL) {
+                break;   // Not spliceable after all; copy the rest
+            }
+            throw std::runtime_error("upstream " + target->name + " closed or stalled mid-body");
+        }
+        #endif
+
+        while (remaining > 0) {
+            if (in.empty() && co_await readMore(ctx, upstream.fd, in, timeout) != IoResult::Done) {
+                throw std::runtime_error("upstream " + target->name + " closed or stalled mid-body");
+            }
+            size_t take = static_cast<size_t>(std::min<uint64_t>(in.size(), remaining));
+            co_await ctx.stream(in.view().substr(0, take));
+            in.consume(take);
+            remaining -= take;
+        }
+    } else if (head.chunked) {
+        // Decoded here and chunked again for the client (or sent until the
+        // close to an HTTP/1.0 one)
+        response.beginStream(head.contentType);
+        while (true) {
+            size_t lineLength = co_await readLine(ctx, upstream.fd, in, timeout);
+            std::string_view line = in.view().substr(0, lineLength);
+            uint64_t size = 0;
+            auto [end, status] = std::from_chars(line.data(), line.data() + line.size(), size, 16);
+            if (status != std::errc() || end == line.data()) {
+                throw std::runtime_error("upstream sent a malformed chunk size");
+            }
+            in.consume(lineLength);
+            if (size == 0) {
+                size_t trailerBytes = 0;
+                while (true) {
+                    lineLength = co_await readLine(ctx, upstream.fd, in, timeout);
+                    bool blank = trim(in.view().substr(0, lineLength - 1), kLineWhitespace).empty();
+                    in.consume(lineLength);
+                    trailerBytes += lineLength;
+                    if (blank) {
+                        break;
+                    }
+                    if (trailerBytes > kMaxTrailerBytes) {
+                        throw std::runtime_error("upstream sent oversized trailers");
+                    }
+                }
+                break;
+            }
+            while (size > 0) {
+                if (in.empty() && co_await readMore(ctx, upstream.fd, in, timeout) != IoResult::Done) {
+                    throw std::runtime_error("upstream " + target->name + " closed or stalled mid-body");
+                }
+                size_t take = static_cast<size_t>(std::min<uint64_t>(in.size(), size));
+                co_await ctx.stream(in.view().substr(0, take));
+                in.consume(take);
+                size -= take;
+            }
+            lineLength = co_await readLine(ctx, upstream.fd, in, timeout);
+            if (!trim(in.view().substr(0, lineLength - 1), kLineWhitespace).empty()) {
+                throw std::runtime_error("upstream sent a malformed chunk");
+            }
+            in.consume(lineLength);
+        }
+    } else {
+        // Delimited by the upstream closing the connection
+        response.beginStream(head.contentType);
+        reusable = false;
+        while (true) {
+            if (!in.empty()) {
+                co_await ctx.stream(in.view());
+                in.consume(in.size());
+            }
+            IoResult read = co_await readMore(ctx, upstream.fd, in, timeout);
+            if (read == IoResult::Closed) {
+                break;
+            }
+            if (read != IoResult::Done) {
+                throw std::runtime_error("upstream " + target->name + " stalled mid-body");
+            }
+        }
+    }
+
+    // Anything past the body would be mistaken for the next response
+    if (reusable && in.empty() && poolSize > 0) {
+        workerPool().release(target, upstream.release(), poolSize);
+    }
+}
+
+#else
+
+ReverseProxy::~ReverseProxy() = default;
+
+bool ReverseProxy::init(const ServerConfig&) {
+    std::cerr << "Reverse proxying is not available on this platform" << std::endl;
+    return false;
+}
+
+void ReverseProxy::addRoutes(Router&) {}
+void ReverseProxy::start() {}
+void ReverseProxy::stop() {}
+void ReverseProxy::printStats() const {}
+Upstream* ReverseProxy::pick(Route&, const Upstream*) { return nullptr; }
+void ReverseProxy::markFailed(Upstream&) {}
+void ReverseProxy::runHealthChecks() {}
+bool ReverseProxy::probe(const Upstream&) const { return false; }
+Task<> ReverseProxy::forward(RequestContext&, Route&) { co_return; }
+
+#endif // HAVE_PROXY
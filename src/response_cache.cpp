@@ -0,0 +1,203 @@
+#include "response_cache.h"
+#include "counters.h"
+
+#include <algorithm>
+
+namespace {
+
+// Distinguishes caches in the per-thread slot, even one reallocated at the
+// same address as a destroyed one
+std::atomic<uint64_t> nextCacheId{1};
+
+size_t tableCapacity(size_t maxEntries) {
+    size_t capacity = 16;
+    while (capacity < maxEntries * 2) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+}
+
+void ResponseCache::ThreadState::retire() {
+    if (!registry) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    registry->retiredHits += counters->hits.load(std::memory_order_relaxed);
+    registry->retiredMisses += counters->misses.load(std::memory_order_relaxed);
+    auto& live = registry->live;
+    live.erase(std::remove(live.begin(), live.end(), counters.get()), live.end());
+    registry.reset();
+    counters.reset();
+    table.reset();
+    ownerId = 0;
+}
+
+ResponseCache::ResponseCache(size_t maxBytes, size_t maxEntries)
+    : maxBytes(maxBytes), maxEntries(maxEntries > 0 ? maxEntries : 1),
+      id(nextCacheId.fetch_add(1)), generation(1),
+      registry(std::make_shared<CounterRegistry>()), clockHand(0), evictions(0) {
+    for (auto& slot : doorkeeper) {
+        slot.store(0, std::memory_order_relaxed);
+    }
+    auto table = std::make_shared<Table>();
+    table->slots.resize(tableCapacity(this->maxEntries));
+    table->generation = 1;
+    current = std::move(table);
+}
+
+ResponseCache::ThreadState& ResponseCache::threadState() const {
+    thread_local ThreadState state;
+
+    if (state.ownerId != id) {
+        state.retire();
+        state.counters = std::make_unique<ThreadCounters>();
+        state.registry = registry;
+        std::lock_guard<std::mutex> lock(registry->mutex);
+        registry->live.push_back(state.counters.get());
+        state.ownerId = id;
+        state.generation = 0;
+    }
+
+    // Common case: one acquire load, no lock
+    if (state.generation != generation.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        state.table = current;
+        state.generation = current->generation;
+    }
+    return state;
+}
+
+uint64_t ResponseCache::hashKey(std::string_view key) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+const ResponseCache::Entry* ResponseCache::find(const Table& table, std::string_view key, uint64_t hash) {
+    size_t mask = table.slots.size() - 1;
+    for (size_t i = hash & mask; table.slots[i]; i = (i + 1) & mask) {
+        const Entry& entry = *table.slots[i];
+        if (entry.hash == hash && entry.key == key) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void ResponseCache::place(Table& table, std::shared_ptr<const Entry> entry) {
+    size_t mask = table.slots.size() - 1;
+    size_t i = entry->hash & mask;
+    while (table.slots[i]) {
+        i = (i + 1) & mask;
+    }
+    table.entries += 1;
+    table.bytes += entry->key.size() + entry->buffer->size();
+    table.slots[i] = std::move(entry);
+}
+
+ResponseBuffer ResponseCache::find(std::string_view key) const {
+    ThreadState& state = threadState();
+    const Entry* entry = find(*state.table, key, hashKey(key));
+    if (!entry) {
+        bumpCounter(state.counters->misses);
+        return nullptr;
+    }
+    // Avoid dirtying the shared cache line when the bit is already set
+    if (!entry->referenced.load(std::memory_order_relaxed)) {
+        entry->referenced.store(true, std::memory_order_relaxed);
+    }
+    bumpCounter(state.counters->hits);
+    return entry->buffer;
+}
+
+bool ResponseCache::admit(uint64_t hash) {
+    // Remember a fingerprint of the first miss; admit on the second
+    std::atomic<uint32_t>& slot = doorkeeper[hash & (kDoorkeeperSlots - 1)];
+    uint32_t fingerprint = static_cast<uint32_t>(hash >> 32) | 1;
+    if (slot.load(std::memory_order_relaxed) == fingerprint) {
+        slot.store(0, std::memory_order_relaxed);
+        return true;
+    }
+    slot.store(fingerprint, std::memory_order_relaxed);
+    return false;
+}
+
+void ResponseCache::insert(std::string_view key, ResponseBuffer buffer) {
+    if (!buffer || buffer->size() > kMaxResponseSize || key.size() + buffer->size() > maxBytes) {
+        return;
+    }
+    uint64_t hash = hashKey(key);
+    if (!admit(hash)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (find(*current, key, hash)) {
+        return;   // Another thread got there first
+    }
+
+    // CLOCK sweep over the current table: clear referenced bits, evict the rest
+    // until the new entry fits
+    const auto& slots = current->slots;
+    std::vector<bool> evicted(slots.size(), false);
+    size_t bytes = current->bytes;
+    size_t entries = current->entries;
+    size_t needed = key.size() + buffer->size();
+    for (size_t step = 0; step < 2 * slots.size() && entries > 0 &&
+                          (bytes + needed > maxBytes || entries + 1 > maxEntries); ++step) {
+        size_t i = clockHand;
+        clockHand = (clockHand + 1) & (slots.size() - 1);
+        if (!slots[i] || evicted[i]) {
+            continue;
+        }
+        if (slots[i]->referenced.exchange(false, std::memory_order_relaxed)) {
+            continue;
+        }
+        evicted[i] = true;
+        bytes -= slots[i]->key.size() + slots[i]->buffer->size();
+        entries -= 1;
+        evictions += 1;
+    }
+
+    auto next = std::make_shared<Table>();
+    next->slots.resize(slots.size());
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (slots[i] && !evicted[i]) {
+            place(*next, slots[i]);
+        }
+    }
+
+    auto entry = std::make_shared<Entry>();
+    entry->key.assign(key.data(), key.size());
+    entry->hash = hash;
+    entry->buffer = std::move(buffer);
+    place(*next, std::move(entry));
+
+    next->generation = current->generation + 1;
+    current = std::move(next);
+    generation.store(current->generation, std::memory_order_release);
+}
+
+ResponseCacheStats ResponseCache::getStats() const {
+    ResponseCacheStats stats;
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex);
+        stats.hits = registry->retiredHits;
+        stats.misses = registry->retiredMisses;
+        for (const ThreadCounters* counters : registry->live) {
+            stats.hits += counters->hits.load(std::memory_order_relaxed);
+            stats.misses += counters->misses.load(std::memory_order_relaxed);
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.evictions = evictions;
+    stats.entries = current->entries;
+    stats.bytes = current->bytes;
+    return stats;
+}
@@ -0,0 +1,406 @@
+#include "response_queue.h"
+#include "file_cache.h"
+#include "tls.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+
+#ifdef HAVE_SPLICE
+SplicePipe::~SplicePipe() {
+    if (readFd >= 0) {
+        close(readFd);
+        close(writeFd);
+    }
+}
+
+bool SplicePipe::open() {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        return false;
+    }
+    readFd = fds[0];
+    writeFd = fds[1];
+    return true;
+}
+
+ssize_t SplicePipe::fill(int socket, size_t length) {
+    ssize_t moved = splice(socket, nullptr, writeFd, nullptr, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved > 0) {
+        buffered += static_cast<size_t>(moved);
+    }
+    return moved;
+}
+#endif
+
+void ResponseQueue::pushBytes(const char* data, size_t length, std::shared_ptr<const void> owner) {
+    Segment segment;
+    segment.data = data;
+    segment.length = length;
+    segment.owner = std::move(owner);
+    queuedBytes += length;
+    segments.push_back(std::move(segment));
+}
+
+void ResponseQueue::append(std::string_view bytes) {
+    if (bytes.empty()) {
+        return;
+    }
+
+    // Coalesce with a preceding arena segment so small pieces share an iovec
+    if (!empty()) {
+        Segment& last = segments.back();
+        if (last.inMemory() && !last.owner && arena.extend(last.data + last.length, bytes.size())) {
+            memcpy(const_cast<char*>(last.data) + last.length, bytes.data(), bytes.size());
+            last.length += bytes.size();
+            queuedBytes += bytes.size();
+            return;
+        }
+    }
+
+    char* copy = arena.allocate(bytes.size());
+    memcpy(copy, bytes.data(), bytes.size());
+    pushBytes(copy, bytes.size(), nullptr);
+}
+
+void ResponseQueue::appendStatic(std::string_view bytes) {
+    if (!bytes.empty()) {
+        pushBytes(bytes.data(), bytes.size(), nullptr);
+    }
+}
+
+void ResponseQueue::appendView(std::string_view bytes, std::shared_ptr<const void> owner) {
+    if (!bytes.empty()) {
+        pushBytes(bytes.data(), bytes.size(), std::move(owner));
+    }
+}
+
+void ResponseQueue::appendShared(ResponseBuffer buffer) {
+    if (buffer && !buffer->empty()) {
+        const std::string& bytes = *buffer;
+        pushBytes(bytes.data(), bytes.size(), std::move(buffer));
+    }
+}
+
+void ResponseQueue::appendFile(std::shared_ptr<const CachedFile> file) {
+    #ifdef HAVE_STATIC_FILES
+    if (!file || file->size <= 0) {
+        return;
+    }
+    Segment segment;
+    segment.length = static_cast<size_t>(file->size);
+    segment.file = std::move(file);
+    queuedBytes += segment.length;
+    segments.push_back(std::move(segment));
+    #else
+    (void)file;
+    #endif
+}
+
+#ifdef HAVE_SPLICE
+void ResponseQueue::appendPipe(std::shared_ptr<SplicePipe> pipe, size_t length) {
+    if (!pipe || length == 0) {
+        return;
+    }
+    Segment segment;
+    segment.length = length;
+    segment.pipe = std::move(pipe);
+    queuedBytes += length;
+    segments.push_back(std::move(segment));
+}
+#endif
+
+void ResponseQueue::clear() {
+    segments.clear();
+    head = 0;
+    queuedBytes = 0;
+    arena.reset();
+}
+
+void ResponseQueue::advance(size_t written) {
+    queuedBytes -= written;
+    while (written > 0) {
+        Segment& segment = segments[head];
+        size_t step = std::min(written, segment.length - segment.offset);
+        segment.offset += step;
+        written -= step;
+        if (segment.offset == segment.length) {
+            // Drop references now so cached files and buffers are not pinned
+            segment.owner.reset();
+            segment.file.reset();
+            #ifdef HAVE_SPLICE
+            segment.pipe.reset();
+            #endif
+            ++head;
+        }
+    }
+}
+
+// Every in-memory segment up to the next file body or pipe in one sendmsg()
+ssize_t ResponseQueue::sendGathered(SOCKET_TYPE socket) {
+    #ifdef _WIN32
+    Segment& segment = segments[head];
+    return send(socket, segment.data + segment.offset,
+                static_cast<int>(segment.length - segment.offset), 0);
+    #else
+    struct iovec iov[kMaxIovecs];
+    size_t count = 0;
+    size_t index = head;
+    for (; index < segments.size() && count < kMaxIovecs; ++index) {
+        const Segment& segment = segments[index];
+        if (!segment.inMemory()) {
+            break;
+        }
+        if (count > 0 && zeroCopyThreshold > 0 && segment.owner &&
+            segment.length - segment.offset >= zeroCopyThreshold) {
+            break;   // Goes out on its own with MSG_ZEROCOPY
+        }
+        iov[count].iov_base = const_cast<char*>(segment.data + segment.offset);
+        iov[count].iov_len = segment.length - segment.offset;
+        ++count;
+    }
+
+    int flags = MSG_NOSIGNAL;
+    #ifdef MSG_MORE
+    // Hold a head back briefly so it shares a packet with the body after it
+    if (index < segments.size()) {
+        flags |= MSG_MORE;
+    }
+    #endif
+
+    struct msghdr message = {};
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    return sendmsg(socket, &message, flags);
+    #endif
+}
+
+ssize_t ResponseQueue::sendZeroCopy(SOCKET_TYPE socket, Segment& segment) {
+    #ifdef HAVE_ZEROCOPY
+    ssize_t written = send(socket, segment.data + segment.offset, segment.length - segment.offset,
+                           MSG_NOSIGNAL | MSG_ZEROCOPY);
+    if (written >= 0) {
+        // The kernel numbers every successful zero-copy call; the pages stay
+        // pinned until it reports that number on the error queue
+        zeroCopySends.push_back({segment.owner, zeroCopyNextId++});
+        return written;
+    }
+    if (SOCKET_ERROR_CODE != ENOBUFS) {
+        return written;
+    }
+    // Out of option memory for notifications: fall back to copying
+    #endif
+    return send(socket, segment.data + segment.offset, segment.length - segment.offset, MSG_NOSIGNAL);
+}
+
+ssize_t ResponseQueue::sendFileSegment(SOCKET_TYPE socket, Segment& segment) {
+    #if defined(HAVE_SENDFILE)
+    // Zero-copy: the body goes from the page cache to the socket
+    off_t offset = static_cast<off_t>(segment.offset);
+    return sendfile(socket, segment.file->fd, &offset, segment.length - segment.offset);
+    #elif defined(HAVE_STATIC_FILES)
+    char buffer[64 * 1024];
+    size_t chunk = std::min(segment.length - segment.offset, sizeof(buffer));
+    ssize_t bytesRead = pread(segment.file->fd, buffer, chunk, static_cast<off_t>(segment.offset));
+    if (bytesRead <= 0) {
+        return bytesRead;
+    }
+    return send(socket, buffer, static_cast<size_t>(bytesRead), MSG_NOSIGNAL);
+    #else
+    (void)socket;
+    (void)segment;
+    return -1;
+    #endif
+}
+
+ssize_t ResponseQueue::sendPipeSegment(SOCKET_TYPE socket, Segment& segment) {
+    #ifdef HAVE_SPLICE
+    // Pipe to socket inside the kernel; SPLICE_F_MORE lets a short tail
+    // share a packet with the next response
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    if (head + 1 < segments.size()) {
+        flags |= SPLICE_F_MORE;
+    }
+    ssize_t moved = splice(segment.pipe->readFd, nullptr, socket, nullptr, segment.length - segment.offset, flags);
+    if (moved > 0) {
+        segment.pipe->buffered -= static_cast<size_t>(moved);
+    }
+    return moved;
+    #else
+    (void)socket;
+    (void)segment;
+    return -1;
+    #endif
+}
+
+// One TLS record's worth of the queue. Small in-memory segments are copied
+// together so they do not each become a record; OpenSSL copies into its
+// record buffer anyway. A write that would have blocked is repeated with the
+// same length, which the unchanged front of the queue reproduces.
+ssize_t ResponseQueue::sendTls(TlsStream& tls) {
+    Segment& first = segments[head];
+    size_t remaining = first.length - first.offset;
+    size_t retry = tls.pendingWriteLength();
+    if (!first.inMemory() && !first.file) {
+        // Pipes are only queued where enableSplice() was called, never on TLS
+        errno = EINVAL;
+        return -1;
+    }
+    if (first.file) {
+        // With kTLS the rest of the file goes to sendfile() in one call
+        size_t length = tls.kernelOffload() ? remaining
+                                            : std::min(remaining, retry > 0 ? retry : TlsStream::kRecordSize);
+        return tls.sendFile(first.file->fd, first.offset, length);
+    }
+    if (remaining >= TlsStream::kRecordSize) {
+        // Large enough to encrypt in place, several records per call
+        return tls.write(first.data + first.offset, retry > 0 ? retry : remaining);
+    }
+    size_t wanted = retry > 0 ? retry : TlsStream::kRecordSize;
+
+    char record[TlsStream::kRecordSize];
+    size_t length = 0;
+    for (size_t index = head; index < segments.size() && length < wanted; ++index) {
+        const Segment& segment = segments[index];
+        if (!segment.inMemory()) {
+            break;
+        }
+        size_t step = std::min(segment.length - segment.offset, wanted - length);
+        memcpy(record + length, segment.data + segment.offset, step);
+        length += step;
+    }
+    return tls.write(record, length);
+}
+
+ResponseQueue::FlushResult ResponseQueue::flush(SOCKET_TYPE socket, TlsStream* tls) {
+    while (!empty()) {
+        Segment& segment = segments[head];
+        ssize_t written;
+
+        if (tls) {
+            written = sendTls(*tls);
+            if (written == 0) {
+                return FlushResult::Error;   // A file shrank underneath us
+            }
+        } else if (!segment.inMemory() && !segment.file) {
+            written = sendPipeSegment(socket, segment);
+            if (written == 0) {
+                return FlushResult::Error;   // The pipe holds less than was queued
+            }
+        } else if (segment.file) {
+            written = sendFileSegment(socket, segment);
+            if (written == 0) {
+                // File shrank underneath us; Content-Length can no longer be honoured
+                return FlushResult::Error;
+            }
+        } else if (zeroCopyThreshold > 0 && segment.owner &&
+                   segment.length - segment.offset >= zeroCopyThreshold) {
+            written = sendZeroCopy(socket, segment);
+        } else {
+            written = sendGathered(socket);
+        }
+
+        if (written < 0) {
+            if (SOCKET_ERROR_CODE == EINTR) {
+                continue;
+            }
+            if (SOCKET_ERROR_CODE == EAGAIN || SOCKET_ERROR_CODE == EWOULDBLOCK) {
+                return FlushResult::WouldBlock;
+            }
+            return FlushResult::Error;
+        }
+
+        // A short write stops partway through some segment; resume from there
+        advance(static_cast<size_t>(written));
+    }
+    // Everything is on the wire: recycle the segment array and arena blocks.
+    // Zero-copy sends keep their own references until the kernel is done.
+    clear();
+    return FlushResult::Done;
+}
+
+#ifdef HAVE_IO_URING
+
+size_t ResponseQueue::gather(struct iovec* iov, size_t maxIovecs) const {
+    size_t count = 0;
+    for (size_t index = head; index < segments.size() && count < maxIovecs; ++index) {
+        const Segment& segment = segments[index];
+        if (!segment.inMemory()) {
+            break;
+        }
+        iov[count].iov_base = const_cast<char*>(segment.data + segment.offset);
+        iov[count].iov_len = segment.length - segment.offset;
+        ++count;
+    }
+    return count;
+}
+
+void ResponseQueue::consume(size_t written) {
+    advance(written);
+    if (empty()) {
+        clear();
+    }
+}
+
+#endif
+
+void ResponseQueue::completeZeroCopy(uint32_t first, uint32_t last) {
+    for (size_t i = zeroCopyHead; i < zeroCopySends.size(); ++i) {
+        // Unsigned distance handles the 32-bit counter wrapping
+        if (zeroCopySends[i].id - first <= last - first) {
+            zeroCopySends[i].owner.reset();
+        }
+    }
+    while (zeroCopyHead < zeroCopySends.size() && !zeroCopySends[zeroCopyHead].owner) {
+        ++zeroCopyHead;
+    }
+    if (zeroCopyHead == zeroCopySends.size()) {
+        zeroCopySends.clear();
+        zeroCopyHead = 0;
+    }
+}
+
+bool ResponseQueue::reapZeroCopy(SOCKET_TYPE socket) {
+    #ifdef HAVE_ZEROCOPY
+    while (true) {
+        char control[128];
+        struct msghdr message = {};
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        if (recvmsg(socket, &message, MSG_ERRQUEUE) < 0) {
+            // EAGAIN: the error queue is empty
+            return SOCKET_ERROR_CODE == EAGAIN || SOCKET_ERROR_CODE == EWOULDBLOCK;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            bool recvErr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                           (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!recvErr) {
+                continue;
+            }
+            struct sock_extended_err error;
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0) {
+                return false;
+            }
+            // [ee_info, ee_data] is the range of completed send calls
+            completeZeroCopy(error.ee_info, error.ee_data);
+        }
+    }
+    #else
+    (void)socket;
+    return true;
+    #endif
+}
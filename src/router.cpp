@@ -0,0 +1,150 @@
+#include "router.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// Splits off the segment at the front of `rest`, skipping leading slashes
+std::string_view nextSegment(std::string_view& rest) {
+    size_t start = rest.find_first_not_of('/');
+    if (start == std::string_view::npos) {
+        rest = {};
+        return {};
+    }
+    rest.remove_prefix(start);
+    size_t end = rest.find('/');
+    std::string_view segment = rest.substr(0, end);
+    rest = end == std::string_view::npos ? std::string_view() : rest.substr(end);
+    return segment;
+}
+
+bool isCapture(std::string_view segment) {
+    return segment.size() > 2 && segment.front() == '{' && segment.back() == '}';
+}
+
+}
+
+Router::Router() : nodes(1) {}
+
+uint32_t Router::childFor(uint32_t node, std::string_view segment) {
+    auto& children = nodes[node].children;
+    auto position = std::lower_bound(children.begin(), children.end(), segment,
+                                     [](const auto& child, std::string_view key) { return child.first < key; });
+    if (position != children.end() && position->first == segment) {
+        return position->second;
+    }
+    uint32_t added = static_cast<uint32_t>(nodes.size());
+    // Insert before growing `nodes`, which would invalidate `children`
+    children.insert(position, {std::string(segment), added});
+    nodes.emplace_back();
+    return added;
+}
+
+bool Router::add(std::string method, std::string_view prefix, RouteHandler handler) {
+    Endpoint endpoint{std::move(method), std::move(handler), {}};
+    uint32_t node = 0;
+    std::string_view rest = prefix.substr(0, prefix.find('?'));
+    for (std::string_view segment = nextSegment(rest); !segment.empty(); segment = nextSegment(rest)) {
+        if (!isCapture(segment)) {
+            node = childFor(node, segment);
+            continue;
+        }
+        if (endpoint.parameterNames.size() == RouteParameters::kMaxParameters) {
+            std::cerr << "Route " << prefix << " has more than " << RouteParameters::kMaxParameters
+                      << " parameters" << std::endl;
+            return false;
+        }
+        endpoint.parameterNames.emplace_back(segment.substr(1, segment.size() - 2));
+        if (nodes[node].capture == kNoNode) {
+            uint32_t added = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+            nodes[node].capture = added;
+        }
+        node = nodes[node].capture;
+    }
+    // Earlier registrations win for the same method and path
+    nodes[node].endpoints.push_back(std::move(endpoint));
+    return true;
+}
+
+bool Router::setStatic(RouteTableView table, std::vector<RouteHandler> handlers) {
+    if (handlers.size() != table.size) {
+        std::cerr << "Static route table has " << table.size << " routes but "
+                  << handlers.size() << " handlers" << std::endl;
+        return false;
+    }
+    staticTable = table;
+    staticHandlers = std::move(handlers);
+    return true;
+}
+
+void Router::search(const Node& node, size_t position, size_t depth, Walk& walk) const {
+    const Endpoint* found = nullptr;
+    for (const Endpoint& endpoint : node.endpoints) {
+        if (endpoint.method == walk.method) {
+            found = &endpoint;
+            break;
+        }
+        if (!found && endpoint.method == "*") {
+            found = &endpoint;
+        }
+    }
+    // Deeper is more specific; on a tie the literal branch, walked first, stays
+    if (found && (!walk.best || depth > walk.bestDepth)) {
+        walk.best = found;
+        walk.bestDepth = depth;
+        std::copy(walk.starts, walk.starts + walk.count, walk.bestStarts);
+        std::copy(walk.lengths, walk.lengths + walk.count, walk.bestLengths);
+    }
+
+    // Next segment, by hand: most are a few bytes long
+    std::string_view path = walk.path;
+    while (position < path.size() && path[position] == '/') {
+        ++position;
+    }
+    size_t end = position;
+    while (end < path.size() && path[end] != '/') {
+        ++end;
+    }
+    if (end == position) {
+        return;
+    }
+    std::string_view segment = path.substr(position, end - position);
+
+    auto child = std::lower_bound(node.children.begin(), node.children.end(), segment,
+                                  [](const auto& entry, std::string_view key) { return entry.first < key; });
+    if (child != node.children.end() && child->first == segment) {
+        search(nodes[child->second], end, depth + 1, walk);
+    }
+    if (node.capture != kNoNode && walk.count < RouteParameters::kMaxParameters) {
+        walk.starts[walk.count] = static_cast<uint32_t>(position);
+        walk.lengths[walk.count++] = static_cast<uint32_t>(end - position);
+        search(nodes[node.capture], end, depth + 1, walk);
+        --walk.count;
+    }
+}
+
+const RouteHandler* Router::match(std::string_view method, std::string_view target,
+                                  RouteParameters& parameters) const {
+    std::string_view path = target.substr(0, target.find('?'));
+    parameters.clear();
+
+    size_t index = staticTable.find(method, path);
+    if (index != RouteTableView::npos) {
+        return &staticHandlers[index];
+    }
+
+    Walk walk;
+    walk.method = method;
+    walk.path = path;
+    search(nodes[0], 0, 0, walk);
+    if (!walk.best) {
+        return nullptr;
+    }
+    // Captures along the winning path are exactly the endpoint's parameters
+    for (size_t i = 0; i < walk.best->parameterNames.size(); ++i) {
+        parameters.add(walk.best->parameterNames[i], path.substr(walk.bestStarts[i], walk.bestLengths[i]));
+    }
+    return &walk.best->handler;
+}
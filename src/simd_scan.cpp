@@ -0,0 +1,166 @@
+#include "simd_scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    #define HAVE_X86_SIMD 1
+    #include <immintrin.h>
+#endif
+
+namespace simd {
+
+namespace {
+
+constexpr bool isTchar(unsigned char c) {
+    if (c >= '0' && c <= '9') return true;
+    if (c >= 'a' && c <= 'z') return true;
+    if (c >= 'A' && c <= 'Z') return true;
+    switch (c) {
+        case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+        case '+': case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t scanScalar(const ByteClass& cls, const char* data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (!cls.allowed[static_cast<unsigned char>(data[i])]) {
+            return i;
+        }
+    }
+    return length;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse4.2")))
+size_t scanSSE42(const ByteClass& cls, const char* data, size_t length) {
+    const __m128i lowTable = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cls.lowNibble));
+    const __m128i highTable = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cls.highNibble));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i low = _mm_shuffle_epi8(lowTable, _mm_and_si128(bytes, nibbleMask));
+        __m128i high = _mm_shuffle_epi8(highTable, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask));
+        __m128i rejected = _mm_cmpeq_epi8(_mm_and_si128(low, high), zero);
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(rejected));
+        if (mask != 0) {
+            return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+    }
+    return i + scanScalar(cls, data + i, length - i);
+}
+
+__attribute__((target("avx2")))
+size_t scanAVX2(const ByteClass& cls, const char* data, size_t length) {
+    const __m256i lowTable = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(cls.lowNibble)));
+    const __m256i highTable = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(cls.highNibble)));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i low = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(bytes, nibbleMask));
+        __m256i high = _mm256_shuffle_epi8(highTable,
+                                           _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibbleMask));
+        __m256i rejected = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), zero);
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(rejected));
+        if (mask != 0) {
+            return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+    }
+    // Finish a 16..31 byte tail with one SSE step before going scalar
+    return i + scanSSE42(cls, data + i, length - i);
+}
+
+#endif // HAVE_X86_SIMD
+
+using ScanFunction = size_t (*)(const ByteClass&, const char*, size_t);
+
+ScanFunction kernelFor(Level level) {
+    #ifdef HAVE_X86_SIMD
+    switch (level) {
+        case Level::AVX2:  return scanAVX2;
+        case Level::SSE42: return scanSSE42;
+        case Level::Scalar: break;
+    }
+    #else
+    (void)level;
+    #endif
+    return scanScalar;
+}
+
+bool supports(Level level) {
+    #ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    switch (level) {
+        case Level::AVX2:  return __builtin_cpu_supports("avx2");
+        case Level::SSE42: return __builtin_cpu_supports("sse4.2");
+        case Level::Scalar: return true;
+    }
+    return false;
+    #else
+    return level == Level::Scalar;
+    #endif
+}
+
+Level currentLevel = bestSupportedLevel();
+ScanFunction currentKernel = kernelFor(currentLevel);
+
+}
+
+constexpr ByteClass kTokenChars = makeByteClass([](unsigned char c) {
+    return isTchar(c);
+});
+
+constexpr ByteClass kTargetChars = makeByteClass([](unsigned char c) {
+    return c > 0x20 && c != 0x7f;
+});
+
+constexpr ByteClass kFieldValueChars = makeByteClass([](unsigned char c) {
+    return c == '\t' || (c >= 0x20 && c != 0x7f);
+});
+
+size_t findFirstNotIn(const ByteClass& cls, const char* data, size_t length) {
+    return currentKernel(cls, data, length);
+}
+
+Level bestSupportedLevel() {
+    if (supports(Level::AVX2)) {
+        return Level::AVX2;
+    }
+    if (supports(Level::SSE42)) {
+        return Level::SSE42;
+    }
+    return Level::Scalar;
+}
+
+Level activeLevel() {
+    return currentLevel;
+}
+
+bool setLevel(Level level) {
+    if (!supports(level)) {
+        return false;
+    }
+    currentLevel = level;
+    currentKernel = kernelFor(level);
+    return true;
+}
+
+const char* levelName(Level level) {
+    switch (level) {
+        case Level::Scalar: return "scalar";
+        case Level::SSE42:  return "sse4.2";
+        case Level::AVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+}
@@ -0,0 +1,1080 @@
+#include "tcp_server.h"
+#include "access_log.h"
+#include "event_loop.h"
+#include "file_cache.h"
+#include "http_handler.h"
+#include "metrics.h"
+#include "proxy.h"
+#include "response_cache.h"
+#include "tls.h"
+#include "uring_loop.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_EPOLL
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+bool usesWorkers(const ServerConfig& settings) {
+    return settings.mode != ServerMode::Threads;
+}
+
+// Whether the kernel moves connections queued on a closed SO_REUSEPORT
+// listener to the others in its group (net.ipv4.tcp_migrate_req, Linux
+// 5.14+) rather than resetting them
+bool migratesQueuedConnections() {
+    #ifdef HAVE_EPOLL
+    int fd = open("/proc/sys/net/ipv4/tcp_migrate_req", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char value = '0';
+    bool enabled = read(fd, &value, 1) == 1 && value == '1';
+    close(fd);
+    return enabled;
+    #else
+    return false;
+    #endif
+}
+
+// Blocks until what a suspended handler waits for has happened
+// (flushes and body reads are done by the caller)
+void waitForHandler(const HandlerWait& wait) {
+    if (wait.kind == HandlerWait::Kind::Timer) {
+        std::this_thread::sleep_until(wait.deadline);
+        return;
+    }
+    if (wait.kind == HandlerWait::Kind::Readable || wait.kind == HandlerWait::Kind::Writable) {
+        short events = wait.kind == HandlerWait::Kind::Readable ? POLLIN : POLLOUT;
+        int timeoutMs = -1;
+        if (wait.hasDeadline()) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(wait.deadline -
+                                                                          std::chrono::steady_clock::now());
+            timeoutMs = static_cast<int>(std::clamp<long long>(remaining.count(), 0, INT_MAX));
+        }
+        #ifdef _WIN32
+        WSAPOLLFD watched = {};
+        watched.fd = static_cast<SOCKET>(wait.fd);
+        watched.events = events;
+        WSAPoll(&watched, 1, timeoutMs);
+        #else
+        struct pollfd watched = {};
+        watched.fd = wait.fd;
+        watched.events = events;
+        while (poll(&watched, 1, timeoutMs) < 0 && errno == EINTR) {
+        }
+        #endif
+    }
+}
+
+enum class WaitResult { Ready, Woken, TimedOut };
+
+// Waits for input until `deadline`, or until `wakeFd` (the read end of a
+// generation's wake pipe; -1 for none, and unused on Windows) is closed.
+// Blocking sockets have only per-call timeouts (SO_RCVTIMEO), which a client
+// trickling a byte at a time would keep resetting.
+WaitResult waitReadable(SOCKET_TYPE socket, std::optional<std::chrono::steady_clock::time_point> deadline,
+                        int wakeFd = -1) {
+    while (true) {
+        int timeoutMs = -1;
+        if (deadline) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0) {
+                return WaitResult::TimedOut;
+            }
+            timeoutMs = static_cast<int>(std::min<long long>(remaining.count(), INT_MAX));
+        }
+        #ifdef _WIN32
+        (void)wakeFd;
+        WSAPOLLFD watched = {};
+        watched.fd = socket;
+        watched.events = POLLRDNORM;
+        int ready = WSAPoll(&watched, 1, timeoutMs);
+        #else
+        struct pollfd watched[2] = {};
+        watched[0].fd = socket;
+        watched[0].events = POLLIN;
+        watched[1].fd = wakeFd;
+        watched[1].events = POLLIN;
+        int ready = poll(watched, wakeFd >= 0 ? 2 : 1, timeoutMs);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready > 0 && watched[1].revents != 0 && watched[0].revents == 0) {
+            return WaitResult::Woken;
+        }
+        #endif
+        // Errors and hang-ups are left for recv() or accept() to report
+        if (ready != 0) {
+            return WaitResult::Ready;
+        }
+    }
+}
+
+std::optional<std::chrono::steady_clock::time_point> deadlineAfter(std::chrono::steady_clock::time_point start,
+                                                                   int timeoutMs) {
+    if (timeoutMs <= 0) {
+        return std::nullopt;
+    }
+    return start + std::chrono::milliseconds(timeoutMs);
+}
+
+}
+
+bool parseServerMode(const std::string& name, ServerMode& mode) {
+    if (name == "threads") {
+        mode = ServerMode::Threads;
+        return true;
+    }
+    if (name == "epoll") {
+        mode = ServerMode::EventLoop;
+        return true;
+    }
+    if (name == "io_uring") {
+        mode = ServerMode::IoUring;
+        return true;
+    }
+    return false;
+}
+
+const char* serverModeName(ServerMode mode) {
+    switch (mode) {
+        case ServerMode::Threads:   return "threads";
+        case ServerMode::EventLoop: return "epoll";
+        case ServerMode::IoUring:   return "io_uring";
+    }
+    return "unknown";
+}
+
+TCPServer::Generation::~Generation() {
+    #ifndef _WIN32
+    for (int fd : wakePipe) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    #endif
+}
+
+TCPServer::TCPServer(const ServerConfig& config)
+    : running(false), activeClients(0), generationCount(0), requestedMode(config.mode),
+      metrics(std::make_unique<MetricsRegistry>()), config(config) {
+    #ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        throw std::runtime_error("WSAStartup failed");
+    }
+    #endif
+
+    normalize(this->config);
+}
+
+TCPServer::~TCPServer() {
+    stop();
+    // run() retires every generation it sees finish; these never ran
+    std::vector<std::unique_ptr<Generation>> remaining;
+    {
+        std::lock_guard<std::mutex> lock(generationsMutex);
+        remaining.swap(generations);
+    }
+    for (auto& generation : remaining) {
+        retire(*generation);
+    }
+    remaining.clear();
+    if (proxy) {
+        proxy->stop();
+        proxy->printStats();
+    }
+    #ifdef _WIN32
+    WSACleanup();
+    #endif
+}
+
+void TCPServer::normalize(ServerConfig& settings) const {
+    #ifndef HAVE_IO_URING
+    if (settings.mode == ServerMode::IoUring) {
+        std::cerr << "io_uring is not available on this platform, falling back to epoll" << std::endl;
+        settings.mode = ServerMode::EventLoop;
+    }
+    #endif
+
+    if (settings.tlsPort > 0 && settings.mode == ServerMode::IoUring) {
+        // Records are encrypted and decrypted in user space, between reads
+        // and writes the ring would otherwise issue on its own
+        std::cerr << "TLS is not supported in io_uring mode, falling back to epoll" << std::endl;
+        settings.mode = ServerMode::EventLoop;
+    }
+
+    #ifndef HAVE_EPOLL
+    if (settings.mode == ServerMode::EventLoop) {
+        std::cerr << "epoll is not available on this platform, falling back to threads" << std::endl;
+        settings.mode = ServerMode::Threads;
+    }
+    #endif
+
+    if (settings.workers <= 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        settings.workers = cores > 0 ? static_cast<int>(cores) : 1;
+    }
+}
+
+SOCKET_TYPE TCPServer::openListenSocket(const ServerConfig& settings, int port, bool reusePort) {
+    // Create socket
+    SOCKET_TYPE listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket == INVALID_SOCKET) {
+        std::cerr << "Failed to create socket. Error: " << SOCKET_ERROR_CODE << std::endl;
+        return INVALID_SOCKET;
+    }
+
+    // Set socket options
+    int opt = 1;
+    if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR,
+                   reinterpret_cast<char*>(&opt), sizeof(opt)) < 0) {
+        std::cerr << "setsockopt failed. Error: " << SOCKET_ERROR_CODE << std::endl;
+        CLOSE_SOCKET(listenSocket);
+        return INVALID_SOCKET;
+    }
+
+    #ifdef SO_REUSEPORT
+    // Every worker binds its own listener to the same port; the kernel
+    // hashes incoming connections across them. Set even for one worker so
+    // a reload can add more.
+    if (reusePort && setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT,
+                                reinterpret_cast<char*>(&opt), sizeof(opt)) < 0) {
+        std::cerr << "setsockopt(SO_REUSEPORT) failed. Error: " << SOCKET_ERROR_CODE << std::endl;
+        CLOSE_SOCKET(listenSocket);
+        return INVALID_SOCKET;
+    }
+    #else
+    (void)reusePort;
+    #endif
+
+    // Bind socket
+    struct sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port = htons(port);
+
+    if (bind(listenSocket, reinterpret_cast<struct sockaddr*>(&serverAddr),
+             sizeof(serverAddr)) < 0) {
+        std::cerr << "Bind failed. Error: " << SOCKET_ERROR_CODE << std::endl;
+        CLOSE_SOCKET(listenSocket);
+        return INVALID_SOCKET;
+    }
+
+    // Listen for connections. A deep backlog absorbs bursts of connects
+    // that arrive faster than a worker gets around to accepting them.
+    if (listen(listenSocket, std::max(settings.listenBacklog, 1)) < 0) {
+        std::cerr << "Listen failed. Error: " << SOCKET_ERROR_CODE << std::endl;
+        CLOSE_SOCKET(listenSocket);
+        return INVALID_SOCKET;
+    }
+
+    return listenSocket;
+}
+
+// `reuse` is the previous generation's listener on the same port, if any
+std::shared_ptr<TCPServer::Listener> TCPServer::listenOn(const ServerConfig& settings, int port, bool reusePort,
+                                                         const std::shared_ptr<Listener>& reuse) {
+    if (reuse) {
+        // On a listening socket, listen() again only changes the backlog
+        listen(reuse->socket, std::max(settings.listenBacklog, 1));
+        return reuse;
+    }
+    SOCKET_TYPE listenSocket = openListenSocket(settings, port, reusePort);
+    if (listenSocket == INVALID_SOCKET) {
+        return nullptr;
+    }
+    return std::make_shared<Listener>(listenSocket);
+}
+
+std::unique_ptr<TCPServer::Generation> TCPServer::buildGeneration(const ServerConfig& settings,
+                                                                  const Generation* previous) {
+    auto generation = std::make_unique<Generation>();
+    generation->config = settings;
+
+    if (!settings.accessLogPath.empty()) {
+        // Opened afresh, so a reload also picks up a rotated log file
+        generation->accessLog = std::make_unique<AccessLog>(
+            settings.accessLogPath, static_cast<uint32_t>(std::max(settings.accessLogSampleEvery, 1)));
+        if (!generation->accessLog->start()) {
+            return nullptr;
+        }
+    }
+
+    // Only file responses are worth caching; the built-in ones are prebuilt
+    if (!settings.documentRoot.empty() && settings.responseCacheBytes > 0) {
+        generation->responses = std::make_unique<ResponseCache>(static_cast<size_t>(settings.responseCacheBytes));
+    }
+
+    if (settings.tlsPort > 0) {
+        // Certificate and key are read again on every reload; the ticket keys carry over
+        generation->tls = std::make_unique<TlsContext>();
+        if (!generation->tls->init(settings, previous ? previous->tls.get() : nullptr)) {
+            return nullptr;
+        }
+    }
+
+    if (usesWorkers(settings)) {
+        if (!startWorkers(*generation, previous)) {
+            return nullptr;
+        }
+    } else {
+        #ifdef HAVE_STATIC_FILES
+        if (!settings.documentRoot.empty()) {
+            generation->files = std::make_unique<FileCache>(static_cast<size_t>(settings.fileCacheEntries),
+                                                            settings.fileRevalidateMs,
+                                                            settings.compressionMinBytes);
+            if (!generation->files->init(settings.documentRoot)) {
+                return nullptr;
+            }
+        }
+        #endif
+
+        bool samePort = previous && previous->config.port == settings.port;
+        generation->listener = listenOn(settings, settings.port, false,
+                                        samePort ? previous->listener : nullptr);
+        if (!generation->listener) {
+            return nullptr;
+        }
+        if (settings.tlsPort > 0) {
+            bool sameTlsPort = previous && previous->config.tlsPort == settings.tlsPort;
+            generation->tlsListener = listenOn(settings, settings.tlsPort, false,
+                                               sameTlsPort ? previous->tlsListener : nullptr);
+            if (!generation->tlsListener) {
+                return nullptr;
+            }
+        }
+
+        #ifndef _WIN32
+        // Two generations accept on them during a reload; the one that loses
+        // the race for a connection must not block in accept()
+        for (const auto& listener : {generation->listener, generation->tlsListener}) {
+            if (!listener) {
+                continue;
+            }
+            int flags = fcntl(listener->socket, F_GETFL, 0);
+            if (flags < 0 || fcntl(listener->socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+                std::cerr << "Failed to set up the accept loop. Error: " << errno << std::endl;
+                return nullptr;
+            }
+        }
+        if (pipe(generation->wakePipe) < 0) {
+            std::cerr << "Failed to set up the accept loop. Error: " << errno << std::endl;
+            return nullptr;
+        }
+        #endif
+    }
+
+    generation->number = ++generationCount;
+    return generation;
+}
+
+bool TCPServer::startWorkers(Generation& generation, const Generation* previous) {
+    #ifdef HAVE_EPOLL
+    ServerConfig& settings = generation.config;
+    generation.workers.resize(static_cast<size_t>(settings.workers));
+
+    // Listeners carry over by index on the same port, so connections queued
+    // in their backlogs are accepted by the new workers instead of reset
+    bool samePort = previous && previous->config.port == settings.port;
+    bool sameTlsPort = previous && previous->config.tlsPort == settings.tlsPort;
+    for (size_t i = 0; i < generation.workers.size(); ++i) {
+        Worker& worker = generation.workers[i];
+        const Worker* before = previous && i < previous->workers.size() ? &previous->workers[i] : nullptr;
+        worker.listener = listenOn(settings, settings.port, true,
+                                   samePort && before ? before->listener : nullptr);
+        if (!worker.listener) {
+            return false;
+        }
+        if (settings.tlsPort > 0) {
+            worker.tlsListener = listenOn(settings, settings.tlsPort, true,
+                                          sameTlsPort && before ? before->tlsListener : nullptr);
+            if (!worker.tlsListener) {
+                return false;
+            }
+        }
+    }
+
+    #ifdef HAVE_IO_URING
+    if (settings.mode == ServerMode::IoUring) {
+        bool supported = true;
+        for (auto& worker : generation.workers) {
+            worker.loop = std::make_unique<UringLoop>(worker.listener->socket, running, settings,
+                                                      generation.responses.get(), generation.accessLog.get(),
+                                                      metrics.get(), &router);
+            if (!worker.loop->init()) {
+                supported = false;
+                break;
+            }
+        }
+        if (supported) {
+            return true;
+        }
+        // Only the running kernel can tell; all workers switch so they behave alike
+        std::cerr << "io_uring is not usable here, falling back to epoll" << std::endl;
+        settings.mode = ServerMode::EventLoop;
+        for (auto& worker : generation.workers) {
+            worker.loop.reset();
+        }
+    }
+    #endif
+
+    for (auto& worker : generation.workers) {
+        auto loop = std::make_unique<EventLoop>(worker.listener->socket, running, settings,
+                                                generation.responses.get(), generation.accessLog.get(),
+                                                metrics.get(), &router);
+        if (worker.tlsListener) {
+            loop->addTlsListener(worker.tlsListener->socket, generation.tls.get());
+        }
+        worker.loop = std::move(loop);
+        if (!worker.loop->init()) {
+            return false;
+        }
+    }
+    return true;
+    #else
+    (void)generation;
+    (void)previous;
+    return false;
+    #endif
+}
+
+bool TCPServer::start() {
+    if (!config.proxyRoutes.empty() && !proxy) {
+        proxy = std::make_unique<ReverseProxy>();
+        if (!proxy->init(config)) {
+            proxy.reset();
+            return false;
+        }
+        proxy->addRoutes(router);
+    }
+
+    std::unique_ptr<Generation> generation = buildGeneration(config, nullptr);
+    if (!generation) {
+        return false;
+    }
+    config.mode = generation->config.mode;
+    if (proxy) {
+        proxy->start();
+    }
+
+    running = true;
+    Generation& first = *generation;
+    launch(first);
+    {
+        std::lock_guard<std::mutex> lock(generationsMutex);
+        generations.push_back(std::move(generation));
+    }
+
+    std::cout << "HTTP Server started on port " << config.port
+              << " (" << serverModeName(config.mode) << " mode";
+    if (usesWorkers(config)) {
+        std::cout << ", " << config.workers << " workers";
+    }
+    std::cout << ")" << std::endl;
+    if (config.tlsPort > 0) {
+        std::cout << "TLS on port " << config.tlsPort << " (certificate " << config.tlsCertificateFile << ")"
+                  << std::endl;
+    }
+    if (!config.documentRoot.empty()) {
+        std::cout << "Serving files from " << config.documentRoot << std::endl;
+    }
+    for (const ProxyRoute& route : config.proxyRoutes) {
+        std::cout << "Proxying " << route.prefix << " to";
+        for (const std::string& upstream : route.upstreams) {
+            std::cout << " " << upstream;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "Waiting for connections..." << std::endl;
+
+    return true;
+}
+
+void TCPServer::launch(Generation& generation) {
+    if (!usesWorkers(generation.config)) {
+        generation.threadsRunning = 1;
+        generation.acceptThread = std::thread([this, &generation]() {
+            runThreads(generation);
+            threadFinished(generation);
+        });
+        return;
+    }
+
+    #ifdef HAVE_EPOLL
+    unsigned int cores = std::thread::hardware_concurrency();
+    generation.threadsRunning = static_cast<int>(generation.workers.size());
+
+    for (size_t i = 0; i < generation.workers.size(); ++i) {
+        Worker& worker = generation.workers[i];
+        worker.thread = std::thread([this, &generation, &worker]() {
+            worker.loop->run();
+            threadFinished(generation);
+        });
+
+        if (generation.config.pinWorkers && cores > 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cores, &cpus);
+            int result = pthread_setaffinity_np(worker.thread.native_handle(), sizeof(cpus), &cpus);
+            if (result != 0) {
+                std::cerr << "Failed to pin worker " << i << " to CPU " << (i % cores)
+                          << ". Error: " << result << std::endl;
+            }
+        }
+    }
+    #endif
+}
+
+void TCPServer::threadFinished(Generation& generation) {
+    std::lock_guard<std::mutex> lock(generationsMutex);
+    if (--generation.threadsRunning == 0) {
+        generationsChanged.notify_all();
+    }
+}
+
+void TCPServer::run() {
+    std::unique_lock<std::mutex> lock(generationsMutex);
+    while (!generations.empty()) {
+        auto done = std::find_if(generations.begin(), generations.end(),
+                                 [](const std::unique_ptr<Generation>& generation) {
+                                     return generation->threadsRunning == 0;
+                                 });
+        if (done == generations.end()) {
+            generationsChanged.wait(lock);
+            continue;
+        }
+        std::unique_ptr<Generation> finished = std::move(*done);
+        generations.erase(done);
+        lock.unlock();
+        retire(*finished);
+        // Closes the listeners no later generation took over
+        finished.reset();
+        lock.lock();
+    }
+}
+
+bool TCPServer::reload(const ServerConfig& next) {
+    Generation* current = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(generationsMutex);
+        if (!running || generations.empty()) {
+            return false;
+        }
+        current = generations.back().get();
+    }
+
+    ServerConfig settings = next;
+    if (settings.mode != requestedMode) {
+        std::cerr << "Changing the mode needs a restart; staying in "
+                  << serverModeName(current->config.mode) << " mode" << std::endl;
+    }
+    if (settings.proxyRoutes != config.proxyRoutes || settings.proxyTimeoutMs != config.proxyTimeoutMs ||
+        settings.proxyPoolSize != config.proxyPoolSize || settings.proxyIdleTimeoutMs != config.proxyIdleTimeoutMs ||
+        settings.proxyHealthIntervalMs != config.proxyHealthIntervalMs ||
+        settings.proxyHealthPath != config.proxyHealthPath) {
+        std::cerr << "Changing proxy settings needs a restart; keeping the current ones" << std::endl;
+    }
+    // The effective mode, so an io_uring fallback is not retried
+    settings.mode = current->config.mode;
+    normalize(settings);
+    // A worker listener no new worker takes over is closed, and whatever is
+    // queued on it is lost unless the kernel migrates it
+    bool samePort = settings.port == current->config.port ||
+                    (settings.tlsPort > 0 && settings.tlsPort == current->config.tlsPort);
+    if (usesWorkers(settings) && samePort && static_cast<size_t>(settings.workers) < current->workers.size() &&
+        !migratesQueuedConnections()) {
+        std::cerr << "Lowering workers needs a restart (or net.ipv4.tcp_migrate_req = 1); keeping "
+                  << current->workers.size() << std::endl;
+        settings.workers = static_cast<int>(current->workers.size());
+    }
+
+    std::unique_ptr<Generation> generation = buildGeneration(settings, current);
+    if (!generation) {
+        std::cerr << "Reload failed; generation " << current->number << " keeps serving" << std::endl;
+        return false;
+    }
+    Generation& successor = *generation;
+    unsigned previousNumber = current->number;
+    launch(successor);
+    {
+        std::lock_guard<std::mutex> lock(generationsMutex);
+        generations.push_back(std::move(generation));
+        beginDrain(*current, &successor);
+    }
+
+    std::cout << "Reloaded: generation " << successor.number << " on port " << settings.port << " ("
+              << serverModeName(settings.mode) << " mode";
+    if (usesWorkers(settings)) {
+        std::cout << ", " << successor.workers.size() << " workers";
+    }
+    std::cout << "); draining generation " << previousNumber << std::endl;
+    return true;
+}
+
+// Called with generationsMutex held
+void TCPServer::beginDrain(Generation& generation, const Generation* successor) {
+    generation.drainStarted = std::chrono::steady_clock::now();
+    generation.draining = true;
+
+    auto handedOver = [successor](const std::shared_ptr<Listener>& listener) {
+        if (!successor) {
+            return false;
+        }
+        if (successor->listener == listener || successor->tlsListener == listener) {
+            return true;
+        }
+        return std::any_of(successor->workers.begin(), successor->workers.end(),
+                           [&listener](const Worker& worker) {
+                               return worker.listener == listener || worker.tlsListener == listener;
+                           });
+    };
+    auto shutDown = [&handedOver](const std::shared_ptr<Listener>& listener) {
+        if (listener && !handedOver(listener)) {
+            #ifndef _WIN32
+            shutdown(listener->socket, SHUT_RDWR);
+            #endif
+        }
+    };
+    // A listener nobody takes over is shut down now, not when the drain
+    // ends: the kernel stops queueing connections on it (and with
+    // net.ipv4.tcp_migrate_req moves those queued to the remaining
+    // SO_REUSEPORT listeners). The descriptor stays open until the
+    // generation is gone, so its number cannot be reused under a worker.
+    for (auto& worker : generation.workers) {
+        worker.loop->drain();
+        shutDown(worker.listener);
+        shutDown(worker.tlsListener);
+    }
+    shutDown(generation.listener);
+    shutDown(generation.tlsListener);
+    wake(generation);
+}
+
+// Called with generationsMutex held
+void TCPServer::wake(Generation& generation) {
+    for (auto& worker : generation.workers) {
+        worker.loop->wakeup();
+    }
+    #ifndef _WIN32
+    if (generation.wakePipe[1] >= 0) {
+        close(generation.wakePipe[1]);
+        generation.wakePipe[1] = -1;
+    }
+    #endif
+}
+
+void TCPServer::stop() {
+    running = false;
+    {
+        std::lock_guard<std::mutex> lock(generationsMutex);
+        for (auto& generation : generations) {
+            wake(*generation);
+        }
+    }
+    std::cout << "Server stopped." << std::endl;
+}
+
+void TCPServer::stopGracefully() {
+    std::lock_guard<std::mutex> lock(generationsMutex);
+    if (!generations.empty() && !generations.back()->draining) {
+        beginDrain(*generations.back(), nullptr);
+    }
+}
+
+void TCPServer::retire(Generation& generation) {
+    for (auto& worker : generation.workers) {
+        if (worker.thread.joinable()) {
+            worker.thread.join();
+        }
+    }
+    if (generation.acceptThread.joinable()) {
+        generation.acceptThread.join();
+    }
+    if (generation.draining) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - generation.drainStarted);
+        std::cout << "Generation " << generation.number << " drained in " << elapsed.count() << " ms"
+                  << std::endl;
+    }
+    printWorkerStats(generation);
+}
+
+void TCPServer::printWorkerStats(const Generation& generation) const {
+    #ifdef HAVE_EPOLL
+    for (size_t i = 0; i < generation.workers.size(); ++i) {
+        if (!generation.workers[i].loop) {
+            continue;
+        }
+        const WorkerMetrics* stats = generation.workers[i].loop->getMetrics();
+        BufferPoolStats pool = generation.workers[i].loop->getPoolStats();
+        std::cout << "Worker " << i << ": "
+                  << stats->accepts.load(std::memory_order_relaxed) << " connections, "
+                  << stats->requests.load(std::memory_order_relaxed) << " requests, "
+                  << "buffer pool " << pool.blocksInUse << "/" << pool.totalBlocks
+                  << " blocks in use (peak " << pool.peakBlocksInUse << ", "
+                  << pool.blockSize / 1024 << " KB each)" << std::endl;
+    }
+    #endif
+
+    if (generation.responses) {
+        ResponseCacheStats stats = generation.responses->getStats();
+        std::cout << "Response cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                  << stats.evictions << " evictions, " << stats.entries << " entries, "
+                  << stats.bytes << " bytes" << std::endl;
+    }
+
+    if (generation.accessLog) {
+        AccessLogStats stats = generation.accessLog->getStats();
+        std::cout << "Access log: " << stats.records << " records, "
+                  << stats.dropped << " dropped (ring full)" << std::endl;
+    }
+}
+
+void TCPServer::runThreads(Generation& generation) {
+    const ServerConfig& settings = generation.config;
+    SOCKET_TYPE listenSocket = generation.listener->socket;
+    SOCKET_TYPE tlsListenSocket = generation.tlsListener ? generation.tlsListener->socket : INVALID_SOCKET;
+    // The accept loop's own counters: connections it turned away
+    WorkerMetrics* counters = metrics->acquire();
+    SpareDescriptor spare;
+    // Set after a failure that leaves the connection queued: the listener
+    // stays readable, so polling it again at once would spin
+    bool backOff = false;
+
+    auto acceptClient = [&](SOCKET_TYPE listener) {
+        bool secure = listener == tlsListenSocket;
+        struct sockaddr_in clientAddr;
+        SOCKET_SIZE_TYPE clientAddrLen = sizeof(clientAddr);
+
+        SOCKET_TYPE clientSocket = accept(listener,
+                                        reinterpret_cast<struct sockaddr*>(&clientAddr),
+                                        &clientAddrLen);
+
+        if (clientSocket == INVALID_SOCKET) {
+            // Another generation on the same listener may have taken it
+            int error = SOCKET_ERROR_CODE;
+            if (error == EMFILE || error == ENFILE) {
+                // Out of descriptors: close what is queued unanswered
+                while (spare.shed(listener)) {
+                    bumpCounter(counters->shedConnections);
+                }
+                error = SOCKET_ERROR_CODE;
+            }
+            if (running && !generation.draining && error != EAGAIN && error != EWOULDBLOCK &&
+                error != ECONNABORTED && error != EINTR) {
+                std::cerr << "Accept failed. Error: " << error << std::endl;
+                backOff = true;
+            }
+            return;
+        }
+        #ifndef _WIN32
+        // BSDs pass the listener's O_NONBLOCK on; client threads block
+        fcntl(clientSocket, F_SETFL, fcntl(clientSocket, F_GETFL, 0) & ~O_NONBLOCK);
+        #endif
+
+        if (settings.maxConnections > 0 && activeClients.load() >= settings.maxConnections) {
+            // Shed load without starting a thread for it (or a handshake)
+            if (!secure) {
+                sendNotice(clientSocket, ConnectionNotice::ServiceUnavailable);
+            }
+            CLOSE_SOCKET(clientSocket);
+            bumpCounter(counters->shedConnections);
+            return;
+        }
+
+        // Handle client in a separate thread
+        ++activeClients;
+        auto finished = std::make_shared<std::atomic<bool>>(false);
+        generation.clientThreads.push_back({std::thread(&TCPServer::handleClient, this, std::ref(generation),
+                                                        clientSocket, clientAddr, secure, finished),
+                                            finished});
+
+        // Clean up finished threads without blocking the accept path
+        reapClientThreads(generation);
+    };
+
+    while (running && !generation.draining) {
+        if (backOff) {
+            backOff = false;
+            #ifdef _WIN32
+            std::this_thread::sleep_for(std::chrono::milliseconds(kAcceptRetryMs));
+            #else
+            struct pollfd wake = {};
+            wake.fd = generation.wakePipe[0];
+            wake.events = POLLIN;
+            poll(&wake, 1, kAcceptRetryMs);
+            #endif
+            continue;
+        }
+        #ifdef _WIN32
+        // No wake pipe here: look at the flags every 100 ms (and no TLS)
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        if (waitReadable(listenSocket, deadline) == WaitResult::Ready) {
+            acceptClient(listenSocket);
+        }
+        #else
+        struct pollfd watched[3] = {};
+        watched[0].fd = generation.wakePipe[0];
+        watched[1].fd = listenSocket;
+        watched[2].fd = tlsListenSocket;
+        for (auto& entry : watched) {
+            entry.events = POLLIN;
+        }
+        int ready = poll(watched, tlsListenSocket != INVALID_SOCKET ? 3 : 2, -1);
+        if (ready <= 0 || watched[0].revents != 0) {
+            continue;
+        }
+        for (int i = 1; i < 3; ++i) {
+            if (watched[i].revents != 0) {
+                acceptClient(watched[i].fd);
+            }
+        }
+        #endif
+    }
+
+    // Draining or stopping: the client threads wind down on their own
+    for (auto& client : generation.clientThreads) {
+        if (client.thread.joinable()) {
+            client.thread.join();
+        }
+    }
+    generation.clientThreads.clear();
+    metrics->release(counters);
+}
+
+void TCPServer::reapClientThreads(Generation& generation) {
+    generation.clientThreads.erase(
+        std::remove_if(generation.clientThreads.begin(), generation.clientThreads.end(),
+            [](ClientThread& client) {
+                if (!client.finished->load()) {
+                    return false;
+                }
+                if (client.thread.joinable()) {
+                    client.thread.join();
+                }
+                return true;
+            }),
+        generation.clientThreads.end()
+    );
+}
+
+void TCPServer::handleClient(Generation& generation, SOCKET_TYPE clientSocket, struct sockaddr_in clientAddr,
+                             bool secure, std::shared_ptr<std::atomic<bool>> finished) {
+    const ServerConfig& settings = generation.config;
+    // One slab covers the input buffer plus a response arena block
+    BufferPool pool(BufferPool::kDefaultBlockSize, 2);
+    InputBuffer inBuffer(pool);
+    ResponseQueue output(pool);
+    if (!secure) {
+        output.enableSplice();
+    }
+    PipelineState pipeline;
+    pipeline.peerAddress = clientAddr.sin_addr.s_addr;
+    pipeline.peerPort = ntohs(clientAddr.sin_port);
+    AccessLog* accessLog = generation.accessLog.get();
+    AccessLogRing* logRing = accessLog ? accessLog->acquireRing() : nullptr;
+    WorkerMetrics* counters = metrics->acquire();
+    HandlerContext context{settings, generation.files.get(), generation.responses.get(), logRing, counters,
+                           metrics.get(), &router};
+    auto acceptedAt = std::chrono::steady_clock::now();
+    bool awaitingFirstByte = true;
+    bumpCounter(counters->accepts);
+    bumpCounter(counters->activeConnections);
+    std::unique_ptr<TlsStream> tls;
+    if (secure) {
+        tls = generation.tls->accept(clientSocket, counters);
+        if (!tls) {
+            pipeline.keepAlive = false;   // Straight to the cleanup below
+        }
+    }
+
+    // A blocking send gives up once the client has taken nothing for the
+    // write timeout; reads wait in poll() against the deadlines below
+    if (settings.writeTimeoutMs > 0) {
+        #ifdef _WIN32
+        DWORD timeout = static_cast<DWORD>(settings.writeTimeoutMs);
+        #else
+        struct timeval timeout;
+        timeout.tv_sec = settings.writeTimeoutMs / 1000;
+        timeout.tv_usec = (settings.writeTimeoutMs % 1000) * 1000;
+        #endif
+        setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO,
+                   reinterpret_cast<char*>(&timeout), sizeof(timeout));
+    }
+    bool handshakeTimeout = false;
+    #ifndef _WIN32
+    if (tls && settings.headerTimeoutMs > 0) {
+        // The handshake reads inside one blocking call, which poll() cannot
+        // bound; a client that stalls halfway through fails it here instead.
+        // Cleared once the handshake is done, so that it does not cut short
+        // the reads of a body, which have their own timeout.
+        struct timeval timeout;
+        timeout.tv_sec = settings.headerTimeoutMs / 1000;
+        timeout.tv_usec = (settings.headerTimeoutMs % 1000) * 1000;
+        handshakeTimeout = setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+    }
+    #endif
+    auto requestStartedAt = acceptedAt;
+    auto lastResponseAt = acceptedAt;
+    #ifdef _WIN32
+    int wakeFd = -1;
+    #else
+    int wakeFd = generation.wakePipe[0];
+    #endif
+
+    while (running && pipeline.keepAlive) {
+        size_t available;
+        char* buffer = inBuffer.writePointer(available);
+        if (available == 0) {
+            break; // Cannot happen: a full buffer always holds a complete or rejected request
+        }
+
+        // Between requests the idle timeout applies; a request head, however
+        // slowly it trickles in, must be complete within the header timeout
+        bool betweenRequests = inBuffer.empty() && !awaitingFirstByte;
+        auto deadline = betweenRequests ? deadlineAfter(lastResponseAt, settings.keepAliveTimeoutMs)
+                                        : deadlineAfter(requestStartedAt, settings.headerTimeoutMs);
+        if (generation.draining) {
+            auto drainEnd = deadlineAfter(generation.drainStarted, settings.drainTimeoutMs);
+            if (drainEnd && (!deadline || *drainEnd < *deadline)) {
+                deadline = drainEnd;
+            }
+        }
+        // Plaintext already decrypted into the TLS stream does not show in poll()
+        WaitResult waited = tls && tls->pending() ? WaitResult::Ready
+                                                  : waitReadable(clientSocket, deadline, wakeFd);
+        if (waited == WaitResult::Woken) {
+            // A stop or a drain. Draining, the connection waits on (without
+            // the pipe, which stays readable) for a request to answer with
+            // Connection: close, until its idle timeout or the drain timeout.
+            wakeFd = -1;
+            continue;
+        }
+        if (waited == WaitResult::TimedOut) {
+            counters->countTimeout(betweenRequests ? TimeoutPhase::Idle : TimeoutPhase::Header);
+            if (!inBuffer.empty()) {
+                sendNotice(clientSocket, ConnectionNotice::RequestTimeout, tls.get());
+            }
+            break;
+        }
+
+        int bytesReceived = tls ? static_cast<int>(tls->read(buffer, available))
+                                : recv(clientSocket, buffer, static_cast<int>(available), 0);
+        #ifndef _WIN32
+        if (handshakeTimeout && tls->isEstablished()) {
+            struct timeval none = {};
+            setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+            handshakeTimeout = false;
+        }
+        #endif
+
+        if (bytesReceived <= 0) {
+            break; // Client disconnected or error
+        }
+
+        inBuffer.commit(static_cast<size_t>(bytesReceived));
+        auto receivedAt = std::chrono::steady_clock::now();
+        if (betweenRequests) {
+            requestStartedAt = receivedAt;
+        }
+        bumpCounter(counters->bytesIn, static_cast<uint64_t>(bytesReceived));
+        if (awaitingFirstByte) {
+            awaitingFirstByte = false;
+            counters->firstByte.observe(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(receivedAt - acceptedAt).count()));
+        }
+
+        // Answer every complete request received so far with one batched write
+        pipeline.draining = generation.draining.load(std::memory_order_relaxed);
+        size_t answered = processPipelinedRequests(inBuffer, output, pipeline, context);
+        if (answered == 0 && !pipeline.handler.suspended()) {
+            continue;
+        }
+
+        bool sent = true;
+        while (true) {
+            size_t queued = output.size();
+            ResponseQueue::FlushResult result = output.flush(clientSocket, tls.get());
+            bumpCounter(counters->bytesOut, queued - output.size());
+            if (result == ResponseQueue::FlushResult::WouldBlock) {
+                // The send timeout ran out with the client taking nothing
+                counters->countTimeout(TimeoutPhase::Write);
+                sent = false;
+                break;
+            }
+            if (result != ResponseQueue::FlushResult::Done) {
+                std::cerr << "Failed to send response to client. Error: " << SOCKET_ERROR_CODE << std::endl;
+                sent = false;
+                break;
+            }
+            if (!pipeline.handler.suspended()) {
+                break;
+            }
+            // A suspended handler: this thread blocks on its behalf, then runs it on
+            const HandlerWait& wait = pipeline.handler.wait();
+            if (wait.kind == HandlerWait::Kind::Body) {
+                if (!(tls && tls->pending()) &&
+                    waitReadable(clientSocket, deadlineAfter(std::chrono::steady_clock::now(),
+                                                             settings.bodyTimeoutMs)) != WaitResult::Ready) {
+                    counters->countTimeout(TimeoutPhase::Body);
+                    sent = false;   // Give up on the connection, handler and all
+                    break;
+                }
+                // Its request sits at the start of the block, so this read moves nothing
+                char* more = inBuffer.writePointer(available);
+                int moreReceived = available == 0 ? 0
+                                 : tls ? static_cast<int>(tls->read(more, available))
+                                       : recv(clientSocket, more, static_cast<int>(available), 0);
+                if (moreReceived > 0) {
+                    inBuffer.commit(static_cast<size_t>(moreReceived));
+                    bumpCounter(counters->bytesIn, static_cast<uint64_t>(moreReceived));
+                } else {
+                    pipeline.handler.body.setInputClosed();   // Disconnected, timed out or failed
+                }
+            } else {
+                waitForHandler(wait);
+            }
+            pipeline.handler.resume();
+            answered += processPipelinedRequests(inBuffer, output, pipeline, context);
+        }
+        if (!sent) {
+            break;
+        }
+        lastResponseAt = std::chrono::steady_clock::now();
+        // Whatever is left over arrived with the read that completed the batch
+        requestStartedAt = receivedAt;
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(lastResponseAt - receivedAt);
+        counters->requestLatency.observe(static_cast<uint64_t>(elapsed.count()), answered);
+    }
+
+    dropCounter(counters->activeConnections);
+    --activeClients;
+    metrics->release(counters);
+    if (tls) {
+        tls->shutdown();
+    }
+    CLOSE_SOCKET(clientSocket);
+    if (accessLog) {
+        accessLog->releaseRing(logRing);
+    }
+    *finished = true;
+}
@@ -0,0 +1,316 @@
+// Asserts that the steady-state request path performs no heap allocations.
+//
+// Runs a real worker loop (epoll, and io_uring where the kernel has it) on a
+// loopback listener, drives keep-alive and pipelined traffic at it from this
+// thread (using only stack buffers), and counts every call to the global
+// operator new. After a warm-up phase the count must not move.
+
+#include "event_loop.h"
+#include "uring_loop.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+
+#ifdef HAVE_EPOLL
+
+#include "access_log.h"
+#include "metrics.h"
+#include "response_cache.h"
+
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+static std::atomic<size_t> allocationCount{0};
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* memory = malloc(size > 0 ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    void* memory = aligned_alloc(align, (size + align - 1) / align * align);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { free(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { free(memory); }
+
+namespace {
+
+constexpr int kWarmupRounds = 500;
+constexpr int kMeasuredRounds = 5000;
+constexpr int kPipelineDepth = 8;
+
+SOCKET_TYPE openLoopbackListener(int& port) {
+    SOCKET_TYPE listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    SOCKET_SIZE_TYPE length = sizeof(addr);
+    if (listenSocket == INVALID_SOCKET ||
+        bind(listenSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listenSocket, 16) < 0 ||
+        getsockname(listenSocket, reinterpret_cast<struct sockaddr*>(&addr), &length) < 0) {
+        std::cerr << "Failed to open listener. Error: " << errno << std::endl;
+        return INVALID_SOCKET;
+    }
+    port = ntohs(addr.sin_port);
+    return listenSocket;
+}
+
+SOCKET_TYPE connectTo(int port) {
+    SOCKET_TYPE clientSocket = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (connect(clientSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        std::cerr << "Failed to connect. Error: " << errno << std::endl;
+        CLOSE_SOCKET(clientSocket);
+        return INVALID_SOCKET;
+    }
+    int one = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return clientSocket;
+}
+
+bool sendAll(SOCKET_TYPE socket, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// Reads one response and returns its status code, or -1. Allocation-free.
+int readResponse(SOCKET_TYPE socket) {
+    static char buffer[512 * 1024];
+    static size_t buffered = 0;
+
+    while (true) {
+        size_t headEnd = 0;
+        for (size_t i = 0; i + 3 < buffered; ++i) {
+            if (memcmp(buffer + i, "\r\n\r\n", 4) == 0) {
+                headEnd = i + 4;
+                break;
+            }
+        }
+        if (headEnd > 0) {
+            int status = atoi(buffer + 9);
+            size_t bodyLength = 0;
+            const char* header = static_cast<const char*>(memmem(buffer, headEnd, "Content-Length: ", 16));
+            if (header) {
+                bodyLength = strtoul(header + 16, nullptr, 10);
+            }
+            if (buffered >= headEnd + bodyLength) {
+                size_t total = headEnd + bodyLength;
+                memmove(buffer, buffer + total, buffered - total);
+                buffered -= total;
+                return status;
+            }
+        }
+        if (buffered == sizeof(buffer)) {
+            return -1;
+        }
+        ssize_t received = recv(socket, buffer + buffered, sizeof(buffer) - buffered, 0);
+        if (received <= 0) {
+            return -1;
+        }
+        buffered += static_cast<size_t>(received);
+    }
+}
+
+// One round: a single request, then a pipelined batch
+bool runRound(SOCKET_TYPE socket, const char* request, int expectedStatus) {
+    if (!sendAll(socket, request, strlen(request)) || readResponse(socket) != expectedStatus) {
+        return false;
+    }
+    char batch[8192];
+    size_t length = strlen(request);
+    for (int i = 0; i < kPipelineDepth; ++i) {
+        memcpy(batch + i * length, request, length);
+    }
+    if (!sendAll(socket, batch, length * kPipelineDepth)) {
+        return false;
+    }
+    for (int i = 0; i < kPipelineDepth; ++i) {
+        if (readResponse(socket) != expectedStatus) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Scenario {
+    const char* name;
+    const char* requests[4];
+    int statuses[4];
+};
+
+bool runScenario(const Scenario& scenario, const std::string& documentRoot, ServerMode mode) {
+    ServerConfig config;
+    config.documentRoot = documentRoot;
+    config.keepAliveTimeoutMs = 0;
+    config.maxRequestsPerConnection = 0;
+    // Revalidation re-runs the lookup miss path; keep it out of the measured window
+    config.fileRevalidateMs = 60 * 1000;
+
+    int port = 0;
+    SOCKET_TYPE listenSocket = openLoopbackListener(port);
+    if (listenSocket == INVALID_SOCKET) {
+        return false;
+    }
+
+    std::atomic<bool> running(true);
+    ResponseCache responses(1024 * 1024);
+    // Every request is logged and counted; the drain thread is counted too
+    AccessLog accessLog("/dev/null", 1);
+    MetricsRegistry metrics;
+    const char* engineName = mode == ServerMode::IoUring ? "io_uring" : "epoll";
+    ResponseCache* cache = documentRoot.empty() ? nullptr : &responses;
+    std::unique_ptr<WorkerLoop> loop;
+    #ifdef HAVE_IO_URING
+    if (mode == ServerMode::IoUring) {
+        loop = std::make_unique<UringLoop>(listenSocket, running, config, cache, &accessLog, &metrics, nullptr);
+    }
+    #endif
+    if (!loop) {
+        loop = std::make_unique<EventLoop>(listenSocket, running, config, cache, &accessLog, &metrics, nullptr);
+    }
+    if (!loop->init()) {
+        CLOSE_SOCKET(listenSocket);
+        if (mode == ServerMode::IoUring) {
+            printf("%-12s %-8s SKIP: io_uring not usable here\n", scenario.name, engineName);
+            return true;
+        }
+        return false;
+    }
+    if (!accessLog.start()) {
+        CLOSE_SOCKET(listenSocket);
+        return false;
+    }
+    WorkerLoop& engine = *loop;
+    std::thread worker([&engine]() { engine.run(); });
+
+    bool ok = true;
+    SOCKET_TYPE clientSocket = connectTo(port);
+    size_t baseline = 0;
+    if (clientSocket == INVALID_SOCKET) {
+        ok = false;
+    }
+
+    for (int round = 0; ok && round < kWarmupRounds + kMeasuredRounds; ++round) {
+        if (round == kWarmupRounds) {
+            baseline = allocationCount.load();
+        }
+        for (int i = 0; ok && i < 4 && scenario.requests[i]; ++i) {
+            ok = runRound(clientSocket, scenario.requests[i], scenario.statuses[i]);
+        }
+    }
+    size_t allocations = allocationCount.load() - baseline;
+
+    if (clientSocket != INVALID_SOCKET) {
+        CLOSE_SOCKET(clientSocket);
+    }
+    running = false;
+    loop->wakeup();
+    worker.join();
+    BufferPoolStats pool = loop->getPoolStats();
+    loop.reset();
+    CLOSE_SOCKET(listenSocket);
+
+    if (!ok) {
+        printf("%-12s %-8s FAIL: unexpected response\n", scenario.name, engineName);
+        return false;
+    }
+    printf("%-12s %-8s %s: %zu allocations after warm-up (pool: %zu blocks, peak %zu in use)\n",
+           scenario.name, engineName, allocations == 0 ? "PASS" : "FAIL", allocations,
+           pool.totalBlocks, pool.peakBlocksInUse);
+    return allocations == 0;
+}
+
+bool writeFile(const std::string& path, size_t size) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        fputc('a' + static_cast<int>(i % 26), file);
+    }
+    fclose(file);
+    return true;
+}
+
+}
+
+int main() {
+    char rootTemplate[] = "/tmp/test_allocations_XXXXXX";
+    if (!mkdtemp(rootTemplate)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string root = rootTemplate;
+    if (!writeFile(root + "/index.html", 2000) || !writeFile(root + "/large.bin", 200 * 1024)) {
+        perror("write");
+        return 1;
+    }
+
+    Scenario builtin = {
+        "built-in",
+        {"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n",
+         "GET /hello HTTP/1.0\r\nConnection: keep-alive\r\n\r\n",
+         nullptr, nullptr},
+        {200, 200, 0, 0},
+    };
+    Scenario files = {
+        "static-files",
+        {"GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n",
+         "GET /large.bin HTTP/1.1\r\nHost: localhost\r\n\r\n",
+         "GET /missing.html HTTP/1.1\r\nHost: localhost\r\n\r\n",
+         "GET /index.html HTTP/1.1\r\nHost: localhost\r\nIf-None-Match: *\r\n\r\n"},
+        {200, 200, 404, 304},
+    };
+
+    bool passed = true;
+    for (ServerMode mode : {ServerMode::EventLoop, ServerMode::IoUring}) {
+        passed = runScenario(builtin, "", mode) && passed;
+        passed = runScenario(files, root, mode) && passed;
+    }
+
+    unlink((root + "/index.html").c_str());
+    unlink((root + "/large.bin").c_str());
+    rmdir(root.c_str());
+    return passed ? 0 : 1;
+}
+
+#else
+
+int main() {
+    std::cout << "Skipped: the allocation test drives the epoll event loop" << std::endl;
+    return 0;
+}
+
+#endif // HAVE_EPOLL
@@ -0,0 +1,213 @@
+// Request body framing: the rejections in HTTPRequest::parseBodyFraming that
+// keep requests from being smuggled, and BodyReader's Content-Length and
+// chunked decoding, fed all at once and one byte per read.
+
+#include "buffer_pool.h"
+#include "handler.h"
+#include "http_request.h"
+#include "test_check.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace {
+
+const char* statusName(BodyReader::Status status) {
+    switch (status) {
+        case BodyReader::Status::Piece: return "Piece";
+        case BodyReader::Status::End: return "End";
+        case BodyReader::Status::NeedInput: return "NeedInput";
+        case BodyReader::Status::Error: return "Error";
+    }
+    return "?";
+}
+
+// Append up to `count` bytes of `source` to the input; returns how many fit
+size_t feed(InputBuffer& input, std::string_view source, size_t count) {
+    size_t available = 0;
+    char* destination = input.writePointer(available);
+    size_t length = std::min({count, source.size(), available});
+    memcpy(destination, source.data(), length);
+    input.commit(length);
+    return length;
+}
+
+struct Decoded {
+    BodyReader::Status status = BodyReader::Status::Error;
+    std::string body;
+    uint64_t received = 0;   // As counted by the reader
+    bool tooLarge = false;
+    // Input left behind the request once the reader is finished with it
+    std::string rest;
+};
+
+// Parses the head of `request` and reads its body `step` bytes per read.
+// Once all of it has been fed the peer is treated as closed.
+Decoded decode(std::string_view request, uint64_t maxBytes, size_t step) {
+    BufferPool pool;
+    InputBuffer input(pool);
+    HTTPRequest head;
+    Decoded decoded;
+    size_t fed = 0;
+
+    ParseResult parsed = ParseResult::Incomplete;
+    while (parsed == ParseResult::Incomplete && fed < request.size()) {
+        fed += feed(input, request.substr(fed), step);
+        parsed = head.parse(input.view());
+    }
+    if (parsed != ParseResult::Complete || !head.getIsValid()) {
+        return decoded;
+    }
+
+    BodyReader reader;
+    reader.begin(input, head, maxBytes);
+    while (true) {
+        std::string_view piece;
+        BodyReader::Status status = reader.next(piece);
+        if (status == BodyReader::Status::Piece) {
+            decoded.body += piece;
+            continue;
+        }
+        if (status == BodyReader::Status::NeedInput) {
+            if (fed == request.size()) {
+                reader.setInputClosed();
+            } else {
+                fed += feed(input, request.substr(fed), step);
+            }
+            continue;
+        }
+        decoded.status = status;
+        break;
+    }
+    decoded.received = reader.getReceived();
+    decoded.tooLarge = reader.isTooLarge();
+    if (decoded.status == BodyReader::Status::End) {
+        decoded.rest = std::string(input.view().substr(reader.requestBytes()));
+        decoded.rest += request.substr(fed);
+    }
+    return decoded;
+}
+
+// Decodes one-shot and byte by byte; both must give the same result
+void expectBody(const char* name, std::string_view request, std::string_view body,
+                std::string_view rest = "", uint64_t maxBytes = 0) {
+    for (size_t step : {request.size(), size_t(1)}) {
+        Decoded decoded = decode(request, maxBytes, step);
+        std::string label = std::string(name) + (step == 1 ? " (byte by byte)" : "");
+        bool passed = decoded.status == BodyReader::Status::End && decoded.body == body &&
+                      decoded.received == body.size() && decoded.rest == rest;
+        check(passed, label,
+              passed ? "" : std::string(statusName(decoded.status)) + ", " + std::to_string(decoded.body.size()) +
+                                " body bytes, " + std::to_string(decoded.rest.size()) + " left over");
+    }
+}
+
+void expectError(const char* name, std::string_view request, uint64_t maxBytes = 0, bool tooLarge = false) {
+    for (size_t step : {request.size(), size_t(1)}) {
+        Decoded decoded = decode(request, maxBytes, step);
+        std::string label = std::string(name) + (step == 1 ? " (byte by byte)" : "");
+        bool passed = decoded.status == BodyReader::Status::Error && decoded.tooLarge == tooLarge;
+        check(passed, label, passed ? "" : std::string(statusName(decoded.status)));
+    }
+}
+
+// Framing the parser must refuse (the request is answered 400)
+void expectRejected(const char* name, std::string_view headers) {
+    std::string request = "POST /upload HTTP/1.1\r\nHost: localhost\r\n" + std::string(headers) + "\r\n";
+    HTTPRequest parsed;
+    ParseResult result = parsed.parse(request);
+    check(result == ParseResult::Complete && !parsed.getIsValid(), name);
+}
+
+void expectFraming(const char* name, std::string_view headers, BodyFraming framing, uint64_t length) {
+    std::string request = "POST /upload HTTP/1.1\r\nHost: localhost\r\n" + std::string(headers) + "\r\n";
+    HTTPRequest parsed;
+    ParseResult result = parsed.parse(request);
+    check(result == ParseResult::Complete && parsed.getIsValid() && parsed.getBodyFraming() == framing &&
+              parsed.getContentLength() == length,
+          name);
+}
+
+constexpr const char* kChunkedHead = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+
+std::string chunked(std::string_view body) {
+    return kChunkedHead + std::string(body);
+}
+
+}
+
+int main() {
+    // Body framing chosen from the head
+    expectFraming("no body", "", BodyFraming::None, 0);
+    expectFraming("Content-Length: 0", "Content-Length: 0\r\n", BodyFraming::None, 0);
+    expectFraming("Content-Length", "Content-Length: 42\r\n", BodyFraming::Length, 42);
+    expectFraming("repeated equal Content-Length", "Content-Length: 7\r\nContent-Length: 7\r\n",
+                  BodyFraming::Length, 7);
+    expectFraming("chunked, any case", "transfer-encoding: Chunked\r\n", BodyFraming::Chunked, 0);
+
+    // Smuggling combinations
+    expectRejected("Content-Length with Transfer-Encoding",
+                   "Content-Length: 5\r\nTransfer-Encoding: chunked\r\n");
+    expectRejected("Transfer-Encoding with Content-Length",
+                   "Transfer-Encoding: chunked\r\nContent-Length: 5\r\n");
+    expectRejected("conflicting Content-Length", "Content-Length: 5\r\nContent-Length: 6\r\n");
+    expectRejected("Content-Length list", "Content-Length: 5, 5\r\n");
+    expectRejected("signed Content-Length", "Content-Length: +5\r\n");
+    expectRejected("hex Content-Length", "Content-Length: 0x5\r\n");
+    expectRejected("empty Content-Length", "Content-Length:\r\n");
+    expectRejected("19-digit Content-Length", "Content-Length: 1000000000000000000\r\n");
+    expectRejected("non-chunked Transfer-Encoding", "Transfer-Encoding: gzip\r\n");
+    expectRejected("chunked not alone", "Transfer-Encoding: gzip, chunked\r\n");
+    expectRejected("Transfer-Encoding twice", "Transfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n");
+    expectRejected("identity Transfer-Encoding", "Transfer-Encoding: identity\r\n");
+
+    // Content-Length bodies
+    expectBody("Content-Length body", "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello", "hello");
+    expectBody("Content-Length body, pipelined",
+               "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET / HTTP/1.1\r\n\r\n", "hello",
+               "GET / HTTP/1.1\r\n\r\n");
+    expectError("Content-Length body cut short", "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\nhello");
+    expectError("Content-Length body over the limit",
+                "POST / HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world", 10, true);
+    expectBody("Content-Length body at the limit", "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\nhelloworld",
+               "helloworld", "", 10);
+
+    // Chunked bodies
+    expectBody("chunked", chunked("5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n"), "hello world");
+    expectBody("chunked, upper-case hex", chunked("A\r\n0123456789\r\n0\r\n\r\n"), "0123456789");
+    expectBody("chunked, pipelined", chunked("3\r\nabc\r\n0\r\n\r\nGET / HTTP/1.1\r\n\r\n"), "abc",
+               "GET / HTTP/1.1\r\n\r\n");
+    expectBody("chunked, empty", chunked("0\r\n\r\n"), "");
+    expectBody("chunked, bare LF", chunked("5\nhello\n0\n\n"), "hello");
+    expectBody("chunk extensions", chunked("5;name=value\r\nhello\r\n0;last\r\n\r\n"), "hello");
+    expectBody("chunk extension after whitespace", chunked("5 \t;ext\r\nhello\r\n0\r\n\r\n"), "hello");
+    expectBody("trailers", chunked("5\r\nhello\r\n0\r\nX-Checksum: 1234\r\nX-Other: a\r\n\r\n"), "hello");
+    expectBody("15 hex digits", chunked("000000000000005\r\nhello\r\n0\r\n\r\n"), "hello");
+    expectError("16 hex digits", chunked("0000000000000005\r\nhello\r\n0\r\n\r\n"));
+    expectError("size over 15 hex digits", chunked("10000000000000000\r\nhello\r\n0\r\n\r\n"));
+    expectError("no chunk size", chunked(";ext\r\nhello\r\n0\r\n\r\n"));
+    expectError("junk after chunk size", chunked("5x\r\nhello\r\n0\r\n\r\n"));
+    expectError("signed chunk size", chunked("+5\r\nhello\r\n0\r\n\r\n"));
+    expectError("bare CR after chunk size", chunked("5\rhello\r\n0\r\n\r\n"));
+    expectError("CR CR LF after chunk size", chunked("5\r\r\nhello\r\n0\r\n\r\n"));
+    expectError("chunk longer than its size", chunked("3\r\nhello\r\n0\r\n\r\n"));
+    expectError("chunk data without CRLF", chunked("5\r\nhelloX0\r\n\r\n"));
+    expectError("chunked cut short", chunked("5\r\nhel"));
+    expectError("no last chunk", chunked("5\r\nhello\r\n"));
+    expectError("trailers cut short", chunked("5\r\nhello\r\n0\r\nX-Checksum: 1234\r\n"));
+    expectError("chunk-size line too long", chunked("5;" + std::string(BodyReader::kMaxLineLength, 'x') +
+                                                    "\r\nhello\r\n0\r\n\r\n"));
+    std::string trailers;
+    while (trailers.size() <= BodyReader::kMaxTrailerBytes) {
+        trailers += "X-Padding: " + std::string(100, 'p') + "\r\n";
+    }
+    expectError("trailers too large", chunked("5\r\nhello\r\n0\r\n" + trailers + "\r\n"));
+    expectError("chunked body over the limit", chunked("5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n"), 10, true);
+    expectBody("chunked body at the limit", chunked("5\r\nhello\r\n5\r\nworld\r\n0\r\n\r\n"), "helloworld",
+               "", 10);
+
+    return testResult();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+// Minimal checks for the focused tests: one line per check, and the exit
+// status reports whether any failed.
+
+inline int testFailures = 0;
+
+// `detail` is shown only when the check fails
+inline void check(bool passed, const std::string& name, const std::string& detail = "") {
+    if (passed) {
+        printf("%s: PASS\n", name.c_str());
+        return;
+    }
+    printf("%s: FAIL%s%s\n", name.c_str(), detail.empty() ? "" : " - ", detail.c_str());
+    ++testFailures;
+}
+
+inline int testResult() {
+    if (testFailures > 0) {
+        printf("%d checks failed\n", testFailures);
+    }
+    return testFailures == 0 ? 0 : 1;
+}
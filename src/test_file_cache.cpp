@@ -0,0 +1,197 @@
+// Traversal protection for static files: resolveRequestPath on its own, for
+// targets it must refuse and the ones it must still map, and FileCache on a
+// real document root where symlinks lead outside it. Also If-None-Match
+// against an ETag, which must match whole tags only.
+
+#include "file_cache.h"
+#include "test_check.h"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#ifdef HAVE_STATIC_FILES
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::string_literals;
+
+namespace {
+
+void expectResolved(std::string_view target, std::string_view relative) {
+    std::string resolved;
+    bool accepted = resolveRequestPath(target, resolved);
+    check(accepted && resolved == relative, "accepts " + std::string(target),
+          accepted ? "mapped to " + resolved : "rejected");
+}
+
+void expectRejected(const std::string& name, std::string_view target) {
+    std::string resolved;
+    bool accepted = resolveRequestPath(target, resolved);
+    check(!accepted, "rejects " + name, "mapped to " + resolved);
+}
+
+const char* statusName(FileCache::Status status) {
+    switch (status) {
+        case FileCache::Status::Found: return "Found";
+        case FileCache::Status::NotFound: return "NotFound";
+        case FileCache::Status::Forbidden: return "Forbidden";
+    }
+    return "?";
+}
+
+void expectLookup(FileCache& cache, std::string_view target, FileCache::Status expected) {
+    FileCache::Status status = FileCache::Status::NotFound;
+    std::shared_ptr<const CachedFile> file = cache.lookup(target, status);
+    check(status == expected && (file != nullptr) == (expected == FileCache::Status::Found),
+          "lookup " + std::string(target) + " is " + statusName(expected), statusName(status));
+}
+
+void expectEtag(const std::string& name, std::string_view ifNoneMatch, std::string_view etag, bool matches) {
+    check(etagMatches(ifNoneMatch, etag) == matches,
+          "If-None-Match " + name + (matches ? " matches" : " does not match"));
+}
+
+bool writeFile(const std::string& path, std::string_view contents) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    fwrite(contents.data(), 1, contents.size(), file);
+    fclose(file);
+    return true;
+}
+
+}
+
+int main() {
+    // Accepted forms
+    expectResolved("/", "index.html");
+    expectResolved("/index.html", "index.html");
+    expectResolved("/a/b.txt?x=../../etc/passwd", "a/b.txt");
+    expectResolved("/a//b/./c.txt", "a/b/c.txt");
+    expectResolved("/docs/", "docs/index.html");
+    expectResolved("/a%20b.txt", "a b.txt");
+    expectResolved("/a%2fb.txt", "a/b.txt");
+    expectResolved("/a%2Fb.txt", "a/b.txt");
+    expectResolved("/%2e/a.txt", "a.txt");
+    expectResolved("/.../a.txt", ".../a.txt");
+    expectResolved("/a..b", "a..b");
+    expectResolved("/..a/b..", "..a/b..");
+
+    // Climbing out with ".."
+    expectRejected("/..", "/..");
+    expectRejected("/../etc/passwd", "/../etc/passwd");
+    expectRejected("/a/../../etc/passwd", "/a/../../etc/passwd");
+    expectRejected("/a/..", "/a/..");
+    expectRejected("/a/../b", "/a/../b");
+    expectRejected("/./../a", "/./../a");
+
+    // ".." and '/' percent-encoded
+    expectRejected("/%2e%2e/etc/passwd", "/%2e%2e/etc/passwd");
+    expectRejected("/%2E%2E/etc/passwd", "/%2E%2E/etc/passwd");
+    expectRejected("/.%2e/etc/passwd", "/.%2e/etc/passwd");
+    expectRejected("/%2e./etc/passwd", "/%2e./etc/passwd");
+    expectRejected("/..%2fetc%2fpasswd", "/..%2fetc%2fpasswd");
+    expectRejected("/a%2f..%2f..%2fetc", "/a%2f..%2f..%2fetc");
+    expectRejected("/%2e%2e%2f%2e%2e%2fetc", "/%2e%2e%2f%2e%2e%2fetc");
+
+    // NUL and backslash, raw and encoded
+    expectRejected("/a.txt%00.html", "/a.txt%00.html");
+    expectRejected("raw NUL", "/a.txt\0.html"s);
+    expectRejected("/..\\..\\etc", "/..\\..\\etc");
+    expectRejected("/a\\b", "/a\\b");
+    expectRejected("/..%5c..%5cetc", "/..%5c..%5cetc");
+    expectRejected("/a%5Cb", "/a%5Cb");
+
+    // Malformed targets
+    expectRejected("empty target", "");
+    expectRejected("*", "*");
+    expectRejected("relative path", "a.txt");
+    expectRejected("absolute form", "http://localhost/a.txt");
+    expectRejected("truncated escape", "/a%2");
+    expectRejected("lone %", "/a%");
+    expectRejected("non-hex escape", "/a%zz");
+
+    // If-None-Match: whole tags, weak comparison
+    std::string_view etag = "\"1a-2b-3c\"";
+    expectEtag("the tag", "\"1a-2b-3c\"", etag, true);
+    expectEtag("later in a list", "\"x\",\t\"y\" , \"1a-2b-3c\"", etag, true);
+    expectEtag("*", " * ", etag, true);
+    expectEtag("weak form", "W/\"1a-2b-3c\"", etag, true);
+    expectEtag("against a weak ETag", "\"1a-2b-3c\"", "W/\"1a-2b-3c\"", true);
+    expectEtag("weak against weak", "\"x\", W/\"1a-2b-3c\"", "W/\"1a-2b-3c\"", true);
+    expectEtag("with a comma inside a tag", "\"x\", \"a,b\"", "\"a,b\"", true);
+    expectEtag("a longer tag", "\"1a-2b-3c-gzip\"", etag, false);
+    expectEtag("a shorter tag", "\"1a-2b\"", etag, false);
+    expectEtag("unquoted", "1a-2b-3c", etag, false);
+    expectEtag("the tag inside junk", "\"x\"1a-2b-3c\"", etag, false);
+    expectEtag("spanning two tags", "\"a\", \"b\"", "\", \"", false);
+    expectEtag("w/ in lower case", "w/\"1a-2b-3c\"", etag, false);
+    expectEtag("empty", "", etag, false);
+
+    // Symlinks, on a real root. Outside it: a secret, and a sibling directory
+    // whose name starts with the root's, so a bare prefix compare would pass
+    char baseTemplate[] = "/tmp/test_file_cache_XXXXXX";
+    if (!mkdtemp(baseTemplate)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string base = baseTemplate;
+    std::string root = base + "/www";
+    std::string sibling = base + "/www2";
+    bool ready = mkdir(root.c_str(), 0755) == 0 && mkdir(sibling.c_str(), 0755) == 0 &&
+                 mkdir((root + "/sub").c_str(), 0755) == 0 &&
+                 writeFile(root + "/index.html", "index") && writeFile(root + "/sub/page.html", "page") &&
+                 writeFile(base + "/secret.txt", "secret") && writeFile(sibling + "/secret.txt", "secret") &&
+                 symlink("../secret.txt", (root + "/escape.txt").c_str()) == 0 &&
+                 symlink(base.c_str(), (root + "/up").c_str()) == 0 &&
+                 symlink("../www2/secret.txt", (root + "/sibling.txt").c_str()) == 0 &&
+                 symlink("sub/page.html", (root + "/inside.html").c_str()) == 0 &&
+                 symlink("sub", (root + "/alias").c_str()) == 0;
+    check(ready, "document root set up");
+
+    FileCache cache(16, 1000);
+    if (ready && cache.init(root)) {
+        expectLookup(cache, "/index.html", FileCache::Status::Found);
+        expectLookup(cache, "/sub/page.html", FileCache::Status::Found);
+        expectLookup(cache, "/inside.html", FileCache::Status::Found);
+        expectLookup(cache, "/alias/page.html", FileCache::Status::Found);
+        expectLookup(cache, "/escape.txt", FileCache::Status::Forbidden);
+        expectLookup(cache, "/up/secret.txt", FileCache::Status::Forbidden);
+        expectLookup(cache, "/up/www/index.html", FileCache::Status::Found);
+        expectLookup(cache, "/sibling.txt", FileCache::Status::Forbidden);
+        expectLookup(cache, "/../secret.txt", FileCache::Status::Forbidden);
+        expectLookup(cache, "/%2e%2e/secret.txt", FileCache::Status::Forbidden);
+        expectLookup(cache, "/missing.html", FileCache::Status::NotFound);
+        // A second lookup is answered from the cache and must agree
+        expectLookup(cache, "/escape.txt", FileCache::Status::Forbidden);
+        expectLookup(cache, "/inside.html", FileCache::Status::Found);
+    } else {
+        check(false, "document root opened");
+    }
+
+    for (const char* link : {"/escape.txt", "/up", "/sibling.txt", "/inside.html", "/alias"}) {
+        unlink((root + link).c_str());
+    }
+    unlink((root + "/index.html").c_str());
+    unlink((root + "/sub/page.html").c_str());
+    unlink((base + "/secret.txt").c_str());
+    unlink((sibling + "/secret.txt").c_str());
+    rmdir((root + "/sub").c_str());
+    rmdir(root.c_str());
+    rmdir(sibling.c_str());
+    rmdir(base.c_str());
+    return testResult();
+}
+
+#else
+
+int main() {
+    std::cout << "Skipped: static files are not built on this platform" << std::endl;
+    return 0;
+}
+
+#endif // HAVE_STATIC_FILES
@@ -0,0 +1,202 @@
+// HTTPRequest::parse: resuming at every split point must give exactly what a
+// one-shot parse gives, the size limits hold at their boundaries, and
+// malformed heads are errors rather than "need more data".
+
+#include "http_request.h"
+#include "test_check.h"
+
+#include <string>
+#include <string_view>
+
+using namespace std::string_literals;
+
+namespace {
+
+// Everything a caller can read back from a parsed head
+std::string describe(const HTTPRequest& request) {
+    std::string text = std::string(request.getMethod()) + " " + std::string(request.getPath()) + " " +
+                       std::string(request.getVersion()) + " minor=" + std::to_string(request.getMinorVersion()) +
+                       " valid=" + std::to_string(request.getIsValid()) +
+                       " head=" + std::to_string(request.getHeadLength()) +
+                       " framing=" + std::to_string(static_cast<int>(request.getBodyFraming())) +
+                       " length=" + std::to_string(request.getContentLength());
+    for (size_t i = 0; i < request.getHeaderCount(); ++i) {
+        text += " [" + std::string(request.getHeaderName(i)) + "=" + std::string(request.getHeaderValue(i)) + "]";
+    }
+    return text;
+}
+
+const char* resultName(ParseResult result) {
+    switch (result) {
+        case ParseResult::Incomplete: return "Incomplete";
+        case ParseResult::Complete: return "Complete";
+        case ParseResult::Error: return "Error";
+    }
+    return "?";
+}
+
+// `request` is a complete head, possibly followed by body or pipelined bytes.
+// Split it at every offset: the first part must be Incomplete, and parsing the
+// whole again with the same object must match a one-shot parse. Then grow the
+// buffer a byte at a time. Each call gets a fresh copy, since the parser keeps
+// offsets, not pointers, across calls.
+void expectResumable(const std::string& name, const std::string& request) {
+    HTTPRequest whole;
+    ParseResult result = whole.parse(request);
+    if (result != ParseResult::Complete) {
+        check(false, name, std::string("one-shot parse: ") + resultName(result));
+        return;
+    }
+    std::string expected = describe(whole);
+    size_t headLength = whole.getHeadLength();
+
+    bool splitsMatch = true;
+    std::string detail;
+    for (size_t split = 0; split < headLength && splitsMatch; ++split) {
+        HTTPRequest parsed;
+        std::string first = request.substr(0, split);
+        ParseResult firstResult = parsed.parse(first);
+        std::string all = request;
+        ParseResult secondResult = parsed.parse(all);
+        if (firstResult != ParseResult::Incomplete || secondResult != ParseResult::Complete ||
+            describe(parsed) != expected) {
+            splitsMatch = false;
+            detail = "split at " + std::to_string(split) + ": " + resultName(firstResult) + ", " +
+                     resultName(secondResult) + ", " + describe(parsed);
+        }
+    }
+    check(splitsMatch, name + " (every split point)", detail);
+
+    HTTPRequest parsed;
+    bool bytesMatch = true;
+    detail.clear();
+    for (size_t length = 1; length <= headLength && bytesMatch; ++length) {
+        std::string prefix = request.substr(0, length);
+        ParseResult stepResult = parsed.parse(prefix);
+        ParseResult want = length < headLength ? ParseResult::Incomplete : ParseResult::Complete;
+        if (stepResult != want || (want == ParseResult::Complete && describe(parsed) != expected)) {
+            bytesMatch = false;
+            detail = "at " + std::to_string(length) + " bytes: " + resultName(stepResult);
+        }
+    }
+    check(bytesMatch, name + " (byte by byte)", detail);
+}
+
+// Error as soon as the bad byte is seen, whether or not the head is complete
+void expectError(const std::string& name, const std::string& request) {
+    HTTPRequest parsed;
+    ParseResult result = parsed.parse(request);
+    check(result == ParseResult::Error, name, resultName(result));
+}
+
+// A head that parses but has to be answered 400
+void expectInvalid(const std::string& name, const std::string& request) {
+    HTTPRequest parsed;
+    ParseResult result = parsed.parse(request);
+    check(result == ParseResult::Complete && !parsed.getIsValid(), name, resultName(result));
+}
+
+std::string withHeaders(size_t count) {
+    std::string request = "GET / HTTP/1.1\r\n";
+    for (size_t i = 0; i < count; ++i) {
+        request += "X-Header-" + std::to_string(i) + ": " + std::to_string(i) + "\r\n";
+    }
+    return request + "\r\n";
+}
+
+// A head of exactly `size` bytes, padded out in one header value
+std::string ofSize(size_t size) {
+    std::string start = "GET / HTTP/1.1\r\nX-Padding: ";
+    std::string end = "\r\n\r\n";
+    return start + std::string(size - start.size() - end.size(), 'p') + end;
+}
+
+}
+
+int main() {
+    // Resuming
+    expectResumable("simple GET", "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    expectResumable("HTTP/1.0 with headers",
+                    "GET /index.html?x=1&y=2 HTTP/1.0\r\nHost: localhost\r\nConnection: keep-alive\r\n"
+                    "Accept-Encoding: gzip, br\r\nUser-Agent: test/1.0\r\n\r\n");
+    expectResumable("POST with a body behind it",
+                    "POST /upload HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nhello");
+    expectResumable("chunked", "PUT /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n");
+    expectResumable("pipelined", "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n");
+    expectResumable("bare LF", "GET / HTTP/1.1\nHost: localhost\n\n");
+    expectResumable("leading empty lines", "\r\n\r\nGET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    expectResumable("whitespace around values", "GET / HTTP/1.1\r\nHost: \t localhost \t\r\nEmpty:\r\n\r\n");
+    expectResumable("at the header limit", withHeaders(HTTPRequest::kMaxHeaders));
+    expectResumable("at the size limit", ofSize(HTTPRequest::kMaxRequestSize));
+
+    // Limits
+    {
+        HTTPRequest parsed;
+        std::string request = withHeaders(HTTPRequest::kMaxHeaders);
+        check(parsed.parse(request) == ParseResult::Complete &&
+                  parsed.getHeaderCount() == HTTPRequest::kMaxHeaders,
+              "kMaxHeaders headers accepted");
+    }
+    expectError("kMaxHeaders + 1 headers", withHeaders(HTTPRequest::kMaxHeaders + 1));
+    {
+        HTTPRequest parsed;
+        std::string request = ofSize(HTTPRequest::kMaxRequestSize) + "GET / HTTP/1.1\r\n\r\n";
+        check(parsed.parse(request) == ParseResult::Complete &&
+                  parsed.getHeadLength() == HTTPRequest::kMaxRequestSize,
+              "kMaxRequestSize head accepted");
+    }
+    expectError("kMaxRequestSize + 1 head", ofSize(HTTPRequest::kMaxRequestSize + 1));
+    {
+        // No terminator yet, but already too big to ever fit
+        std::string partial = ofSize(HTTPRequest::kMaxRequestSize + 100);
+        partial.resize(HTTPRequest::kMaxRequestSize + 1);
+        expectError("kMaxRequestSize + 1 bytes without a terminator", partial);
+        partial.resize(HTTPRequest::kMaxRequestSize);
+        HTTPRequest parsed;
+        ParseResult result = parsed.parse(partial);
+        check(result == ParseResult::Incomplete, "kMaxRequestSize bytes without a terminator", resultName(result));
+    }
+
+    // Request line errors
+    expectError("empty method", " / HTTP/1.1\r\n\r\n");
+    expectError("separator in method", "GE(T / HTTP/1.1\r\n\r\n");
+    expectError("tab after method", "GET\t/ HTTP/1.1\r\n\r\n");
+    expectError("no target", "GET HTTP/1.1\r\n\r\n");
+    expectError("control byte in target", "GET /a\x01 HTTP/1.1\r\n\r\n");
+    expectError("no version", "GET /\r\n\r\n");
+    expectError("HTTP/2.0", "GET / HTTP/2.0\r\n\r\n");
+    expectError("wrong version prefix, incomplete", "GET / HTTX");
+    expectError("non-digit minor version", "GET / HTTP/1.x\r\n\r\n");
+    expectError("two-digit minor version", "GET / HTTP/1.10\r\n\r\n");
+    expectError("bare CR after version", "GET / HTTP/1.1\rHost: x\r\n\r\n");
+
+    // Header errors
+    expectError("space before colon", "GET / HTTP/1.1\r\nHost : x\r\n\r\n");
+    expectError("no colon", "GET / HTTP/1.1\r\nHost\r\n\r\n");
+    expectError("empty name", "GET / HTTP/1.1\r\n: x\r\n\r\n");
+    expectError("obsolete line folding", "GET / HTTP/1.1\r\nX-A: a\r\n b\r\n\r\n");
+    expectError("control byte in value", std::string("GET / HTTP/1.1\r\nX-A: a\x01") + "b\r\n\r\n");
+    expectError("NUL in value", "GET / HTTP/1.1\r\nX-A: a\0b\r\n\r\n"s);
+    expectError("bare CR in value", "GET / HTTP/1.1\r\nX-A: a\rb\r\n\r\n");
+    expectError("bare CR ending the head", "GET / HTTP/1.1\r\nHost: x\r\n\rX");
+
+    // Complete but invalid: ambiguous body framing (more in test_body)
+    expectInvalid("Content-Length with Transfer-Encoding",
+                  "POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n");
+    expectInvalid("bad Content-Length", "POST / HTTP/1.1\r\nContent-Length: abc\r\n\r\n");
+
+    // reset() leaves the object ready for the next request
+    {
+        HTTPRequest parsed;
+        std::string first = "GET /a HTTP/1.1\r\nX-A: 1\r\n\r\n";
+        std::string second = "GET /b HTTP/1.0\r\n\r\n";
+        parsed.parse(first);
+        parsed.reset();
+        HTTPRequest fresh;
+        fresh.parse(second);
+        check(parsed.parse(second) == ParseResult::Complete && describe(parsed) == describe(fresh),
+              "reset between requests");
+    }
+
+    return testResult();
+}
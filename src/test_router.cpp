@@ -0,0 +1,183 @@
+// Route precedence: for overlapping routes, which handler a request reaches
+// and what its `{name}` segments capture. Also the compile-time route table,
+// checked with static_assert where it can be.
+
+#include "router.h"
+#include "test_check.h"
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace {
+
+// A handler that is never run, only told apart from the others
+struct Tagged {
+    int id;
+    Task<> operator()(RequestContext&) const { co_return; }
+};
+
+constexpr RouteKey kRoutes[] = {
+    {"GET", "/users/me"},
+    {"GET", "/health"},
+    {"POST", "/health"},
+    {"GET", "/"},
+};
+constexpr auto kTable = makeRouteTable(kRoutes);
+
+static_assert(kTable.size() == 4);
+static_assert(kTable.find("GET", "/users/me") == 0);
+static_assert(kTable.find("GET", "/health") == 1);
+static_assert(kTable.find("POST", "/health") == 2);
+static_assert(kTable.find("GET", "/") == 3);
+// Exact keys only: no other method, no prefixes, no trailing slash, case matters
+static_assert(kTable.find("PUT", "/health") == RouteTableView::npos);
+static_assert(kTable.find("get", "/health") == RouteTableView::npos);
+static_assert(kTable.find("GET", "/health/") == RouteTableView::npos);
+static_assert(kTable.find("GET", "/users") == RouteTableView::npos);
+static_assert(kTable.find("GET", "/users/me/x") == RouteTableView::npos);
+static_assert(kTable.find("GET", "") == RouteTableView::npos);
+
+// Which handler `target` reaches (0 for none) and its captures, as
+// "id name=value ..." in route order
+std::string route(const Router& router, std::string_view method, std::string_view target,
+                  std::initializer_list<std::string_view> names = {}) {
+    RouteParameters parameters;
+    const RouteHandler* handler = router.match(method, target, parameters);
+    std::string result = std::to_string(handler ? handler->target<Tagged>()->id : 0);
+    for (std::string_view name : names) {
+        result += " " + std::string(name) + "=" + std::string(parameters.get(name));
+    }
+    return result;
+}
+
+void expectRoute(const Router& router, std::string_view method, std::string_view target, std::string_view expected,
+                 std::initializer_list<std::string_view> names = {}) {
+    std::string actual = route(router, method, target, names);
+    check(actual == expected, std::string(method) + " " + std::string(target) + " -> " + std::string(expected),
+          "got " + actual);
+}
+
+}
+
+int main() {
+    {
+        // Literal beats {name} at the same depth, whatever the order added
+        Router router;
+        router.get("/users/{id}", Tagged{1});
+        router.get("/users/me", Tagged{2});
+        router.get("/users/{id}/posts/{post}", Tagged{3});
+        router.get("/users/me/posts/latest", Tagged{4});
+        expectRoute(router, "GET", "/users/me", "2 id=", {"id"});
+        expectRoute(router, "GET", "/users/42", "1 id=42", {"id"});
+        expectRoute(router, "GET", "/users/42?me=1", "1 id=42", {"id"});
+        expectRoute(router, "GET", "/users/me/posts/7", "3 id=me post=7", {"id", "post"});
+        expectRoute(router, "GET", "/users/me/posts/latest", "4 id=", {"id"});
+        expectRoute(router, "GET", "/users/42/posts/latest", "3 id=42 post=latest", {"id", "post"});
+        // A capture takes one whole segment, never an empty one
+        expectRoute(router, "GET", "/users/", "0");
+        expectRoute(router, "GET", "/users", "0");
+    }
+    {
+        // Deeper beats shallower, even a capture over a literal
+        Router router;
+        router.get("/api", Tagged{1});
+        router.get("/api/v1/{name}", Tagged{2});
+        router.get("/files", Tagged{3});
+        router.get("/files/{name}", Tagged{4});
+        expectRoute(router, "GET", "/api/v1/users", "2 name=users", {"name"});
+        expectRoute(router, "GET", "/api/v1/users/42", "2 name=users", {"name"});
+        expectRoute(router, "GET", "/api/v1", "1 name=", {"name"});
+        expectRoute(router, "GET", "/api/v2/users", "1");
+        expectRoute(router, "GET", "/api?x=/api/v1/y", "1");
+        expectRoute(router, "GET", "/apis", "0");
+        expectRoute(router, "GET", "/files/a.txt", "4 name=a.txt", {"name"});
+        expectRoute(router, "GET", "//files///a.txt", "4 name=a.txt", {"name"});
+    }
+    {
+        // Equal depth: the literal branch is walked first and keeps the match
+        Router router;
+        router.get("/a/{x}/c", Tagged{1});
+        router.get("/a/b/{y}", Tagged{2});
+        expectRoute(router, "GET", "/a/b/c", "2 x= y=c", {"x", "y"});
+        expectRoute(router, "GET", "/a/z/c", "1 x=z y=", {"x", "y"});
+        expectRoute(router, "GET", "/a/b/d", "2 x= y=d", {"x", "y"});
+        expectRoute(router, "GET", "/a/z/d", "0");
+    }
+    {
+        // The exact method beats "*" on the same route, whatever the order
+        // added; depth still comes first
+        Router router;
+        router.add("*", "/api", Tagged{1});
+        router.add("POST", "/api", Tagged{2});
+        router.add("*", "/api/v1", Tagged{3});
+        router.add("GET", "/only", Tagged{4});
+        expectRoute(router, "POST", "/api", "2");
+        expectRoute(router, "GET", "/api", "1");
+        expectRoute(router, "DELETE", "/api/x", "1");
+        expectRoute(router, "POST", "/api/v1", "3");
+        expectRoute(router, "GET", "/only", "4");
+        expectRoute(router, "POST", "/only", "0");
+        expectRoute(router, "get", "/only", "0");
+    }
+    {
+        // Static routes beat dynamic ones, but only on an exact method and path
+        Router router;
+        router.get("/users/{id}", Tagged{1});
+        router.get("/users/me", Tagged{2});
+        router.add("*", "/health", Tagged{3});
+        router.get("/", Tagged{4});
+        check(router.setStatic(kTable.view(), {Tagged{10}, Tagged{11}, Tagged{12}, Tagged{13}}),
+              "static table accepted");
+        expectRoute(router, "GET", "/users/me", "10");
+        expectRoute(router, "GET", "/users/me?x=1", "10");
+        expectRoute(router, "POST", "/users/me", "0");
+        expectRoute(router, "GET", "/users/me/x", "2");
+        expectRoute(router, "GET", "/users/42", "1 id=42", {"id"});
+        expectRoute(router, "GET", "/health", "11");
+        expectRoute(router, "POST", "/health", "12");
+        expectRoute(router, "PUT", "/health", "3");
+        expectRoute(router, "GET", "/health/", "3");
+        expectRoute(router, "GET", "/", "13");
+        expectRoute(router, "GET", "/other", "4");
+        check(!router.setStatic(kTable.view(), {Tagged{10}}), "static table with too few handlers rejected");
+    }
+    {
+        // Duplicates: at runtime the earlier registration wins; in a static
+        // table they are an error (a compile error when the table is constexpr)
+        Router router;
+        router.get("/dup", Tagged{1});
+        router.get("/dup", Tagged{2});
+        router.get("/dup/{a}", Tagged{3});
+        router.get("/dup/{b}", Tagged{4});
+        expectRoute(router, "GET", "/dup", "1");
+        expectRoute(router, "GET", "/dup/x", "3 a=x b=", {"a", "b"});
+
+        const RouteKey duplicates[] = {{"GET", "/a"}, {"POST", "/a"}, {"GET", "/a"}};
+        bool rejected = false;
+        try {
+            makeRouteTable(duplicates);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        check(rejected, "duplicate static route rejected");
+        const RouteKey distinct[] = {{"GET", "/a"}, {"POST", "/a"}, {"GET", "/a/"}};
+        auto table = makeRouteTable(distinct);
+        check(table.find("GET", "/a") == 0 && table.find("POST", "/a") == 1 && table.find("GET", "/a/") == 2,
+              "same path, other method or slash, is distinct");
+    }
+    {
+        // Captures are limited to kMaxParameters per route
+        std::string tooMany;
+        for (size_t i = 0; i <= RouteParameters::kMaxParameters; ++i) {
+            tooMany += "/{p" + std::to_string(i) + "}";
+        }
+        std::string atLimit = tooMany.substr(0, tooMany.rfind('/'));
+        Router router;
+        check(router.get(atLimit, Tagged{1}), "kMaxParameters captures accepted");
+        check(!router.get(tooMany, Tagged{2}), "kMaxParameters + 1 captures rejected");
+        expectRoute(router, "GET", "/1/2/3/4/5/6/7/8", "1 p0=1 p7=8", {"p0", "p7"});
+    }
+
+    return testResult();
+}
@@ -0,0 +1,106 @@
+// The SSE4.2 and AVX2 kernels must find exactly what the scalar loop finds.
+// Each level the CPU has is forced in turn with setLevel() and compared with
+// the ByteClass table itself, for every byte value at every position of
+// every length up to two AVX2 blocks and one, from every alignment in a block.
+
+#include "simd_scan.h"
+#include "test_check.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t kMaxLength = 2 * 32 + 1;
+constexpr size_t kAlignments = 32;
+
+struct NamedClass {
+    const char* name;
+    const simd::ByteClass& cls;
+};
+
+size_t reference(const simd::ByteClass& cls, const char* data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (!cls.allowed[static_cast<unsigned char>(data[i])]) {
+            return i;
+        }
+    }
+    return length;
+}
+
+// Allowed filler that runs through the whole class, so every nibble entry
+// of the tables is used, and some rejected byte
+void classBytes(const simd::ByteClass& cls, std::vector<char>& allowed, char& rejected) {
+    allowed.clear();
+    for (int c = 0; c < 256; ++c) {
+        if (cls.allowed[c]) {
+            allowed.push_back(static_cast<char>(c));
+        } else {
+            rejected = static_cast<char>(c);
+        }
+    }
+}
+
+// First failure for this class at the active level, or empty
+std::string compare(const simd::ByteClass& cls) {
+    std::vector<char> allowed;
+    char rejected = 0;
+    classBytes(cls, allowed, rejected);
+
+    alignas(64) char block[kAlignments + kMaxLength + 64];
+    for (size_t alignment = 0; alignment < kAlignments; ++alignment) {
+        char* data = block + alignment;
+        for (size_t length = 0; length <= kMaxLength; ++length) {
+            for (size_t i = 0; i < length; ++i) {
+                data[i] = allowed[(i + alignment) % allowed.size()];
+            }
+            // Past the end: a kernel that reads ahead must not report it
+            memset(data + length, rejected, sizeof(block) - alignment - length);
+
+            size_t found = simd::findFirstNotIn(cls, data, length);
+            if (found != length) {
+                return "all allowed, alignment " + std::to_string(alignment) + ", length " +
+                       std::to_string(length) + ": " + std::to_string(found);
+            }
+            for (size_t position = 0; position < length; ++position) {
+                char saved = data[position];
+                for (int c = 0; c < 256; ++c) {
+                    data[position] = static_cast<char>(c);
+                    size_t expected = reference(cls, data, length);
+                    found = simd::findFirstNotIn(cls, data, length);
+                    if (found != expected) {
+                        return "byte " + std::to_string(c) + " at " + std::to_string(position) + ", alignment " +
+                               std::to_string(alignment) + ", length " + std::to_string(length) + ": " +
+                               std::to_string(found) + " instead of " + std::to_string(expected);
+                    }
+                }
+                data[position] = saved;
+            }
+        }
+    }
+    return {};
+}
+
+}
+
+int main() {
+    const NamedClass classes[] = {
+        {"kTokenChars", simd::kTokenChars},
+        {"kTargetChars", simd::kTargetChars},
+        {"kFieldValueChars", simd::kFieldValueChars},
+    };
+    simd::Level original = simd::activeLevel();
+    for (simd::Level level : {simd::Level::Scalar, simd::Level::SSE42, simd::Level::AVX2}) {
+        if (!simd::setLevel(level)) {
+            printf("%s: skipped, not supported by this CPU\n", simd::levelName(level));
+            continue;
+        }
+        for (const NamedClass& named : classes) {
+            std::string failure = compare(named.cls);
+            check(failure.empty(), std::string(simd::levelName(level)) + " " + named.name, failure);
+        }
+    }
+    simd::setLevel(original);
+    return testResult();
+}
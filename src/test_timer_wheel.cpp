@@ -0,0 +1,202 @@
+// TimerWheel on a fake clock: timers either side of every level boundary fire
+// exactly once, never early and at most a tick late, whether the clock moves
+// a tick at a time or jumps as far as timeoutMs() allows. Deadlines past the
+// top level wait there, and callbacks may cancel or re-arm any timer.
+
+#include "test_check.h"
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Timer {
+    TimerNode node;
+    uint64_t deadline = 0;
+    std::vector<uint64_t> fired;
+};
+
+uint64_t levelSpan(unsigned level) {
+    return uint64_t(1) << (TimerWheel::kSlotBits * level);
+}
+
+// One tick either side of each level's span from `start`, and of the next
+// tick where that level's slot changes
+std::vector<uint64_t> acrossLevels(uint64_t start, unsigned levels) {
+    std::vector<uint64_t> deadlines = {start + 1, start + 2};
+    for (unsigned level = 1; level <= levels; ++level) {
+        uint64_t span = levelSpan(level);
+        uint64_t boundary = (start / span + 1) * span;
+        for (uint64_t deadline : {start + span - 1, start + span, start + span + 1,
+                                  boundary - 1, boundary, boundary + 1}) {
+            if (deadline > start) {
+                deadlines.push_back(deadline);
+            }
+        }
+    }
+    return deadlines;
+}
+
+// Arms a timer per deadline and runs the wheel until it is empty. Returns
+// the first failure, or empty.
+std::string fireAll(uint64_t start, const std::vector<uint64_t>& deadlines, bool everyTick) {
+    TimerWheel wheel(start);
+    std::vector<Timer> timers(deadlines.size());
+    uint64_t last = start;
+    for (size_t i = 0; i < timers.size(); ++i) {
+        timers[i].deadline = deadlines[i];
+        timers[i].node.owner = &timers[i];
+        wheel.schedule(timers[i].node, deadlines[i]);
+        last = std::max(last, deadlines[i]);
+    }
+
+    uint64_t now = start;
+    auto expire = [&](TimerNode& node) {
+        static_cast<Timer*>(node.owner)->fired.push_back(now);
+    };
+    size_t wakeups = 0;
+    while (wheel.size() > 0) {
+        if (everyTick) {
+            ++now;
+        } else {
+            int timeout = wheel.timeoutMs(now);
+            if (timeout < 0) {
+                return "timeoutMs() is -1 with " + std::to_string(wheel.size()) + " timers armed";
+            }
+            now += static_cast<uint64_t>(timeout);
+            // A few moves between levels per timer, and a wait per INT_MAX ms
+            if (++wakeups > 64 * timers.size() + (last - start) / INT_MAX) {
+                return "still " + std::to_string(wheel.size()) + " timers armed after " +
+                       std::to_string(wakeups) + " wakeups";
+            }
+        }
+        if (now > last + 1) {
+            return std::to_string(wheel.size()) + " timers not fired by " + std::to_string(now - start);
+        }
+        wheel.advance(now, expire);
+    }
+
+    for (const Timer& timer : timers) {
+        std::string at = "deadline start+" + std::to_string(timer.deadline - start);
+        if (timer.fired.size() != 1) {
+            return at + " fired " + std::to_string(timer.fired.size()) + " times";
+        }
+        if (timer.fired[0] < timer.deadline) {
+            return at + " fired early, at start+" + std::to_string(timer.fired[0] - start);
+        }
+        if (timer.fired[0] > timer.deadline + 1) {
+            return at + " fired late, at start+" + std::to_string(timer.fired[0] - start);
+        }
+    }
+    return {};
+}
+
+void expectFired(const std::string& name, uint64_t start, const std::vector<uint64_t>& deadlines,
+                 bool everyTick) {
+    std::string failure = fireAll(start, deadlines, everyTick);
+    check(failure.empty(), name + (everyTick ? " (every tick)" : " (timeoutMs jumps)"), failure);
+}
+
+// The first callback to fire cancels a timer due at the same tick and one
+// due later, moves a third, and re-arms itself for the tick it fired at
+// (which waits one tick), then once more across a level boundary.
+void expectCallbackChanges(uint64_t start, uint64_t delay) {
+    TimerWheel wheel(start);
+    Timer self, sameTick, later, moved;
+    uint64_t due = start + delay;
+    for (Timer* timer : {&self, &sameTick, &later, &moved}) {
+        timer->node.owner = timer;
+    }
+    wheel.schedule(self.node, due);
+    wheel.schedule(sameTick.node, due);
+    wheel.schedule(moved.node, due);
+    wheel.schedule(later.node, due + 1000);
+
+    uint64_t now = start;
+    auto expire = [&](TimerNode& node) {
+        Timer& timer = *static_cast<Timer*>(node.owner);
+        timer.fired.push_back(now);
+        if (&timer != &self) {
+            return;
+        }
+        if (self.fired.size() == 1) {
+            wheel.cancel(sameTick.node);
+            wheel.cancel(later.node);
+            wheel.schedule(moved.node, now + 10);
+            wheel.schedule(self.node, now);
+        } else if (self.fired.size() == 2) {
+            wheel.schedule(self.node, now + TimerWheel::kSlots + 6);
+        }
+    };
+    while (now < due + 2000) {
+        wheel.advance(++now, expire);
+    }
+
+    std::string name = "callback cancels and re-arms, delay " + std::to_string(delay);
+    std::vector<uint64_t> expected = {due, due + 1, due + 1 + TimerWheel::kSlots + 6};
+    check(self.fired == expected, name + ": re-armed timer fires at each deadline",
+          std::to_string(self.fired.size()) + " fires");
+    check(sameTick.fired.empty(), name + ": cancelled timer due the same tick",
+          "fired at start+" + std::to_string(sameTick.fired.empty() ? 0 : sameTick.fired[0] - start));
+    check(later.fired.empty(), name + ": cancelled later timer");
+    check(moved.fired == std::vector<uint64_t>{due + 10}, name + ": moved timer fires once, at its new deadline",
+          std::to_string(moved.fired.size()) + " fires");
+    check(wheel.size() == 0, name + ": wheel empty", std::to_string(wheel.size()) + " timers left");
+}
+
+}
+
+int main() {
+    // Every level boundary, from starts aligned and not aligned to a level
+    for (uint64_t start : {uint64_t(0), uint64_t(1), levelSpan(2) - 1, levelSpan(3) - 3, uint64_t(0x123456789ab)}) {
+        std::string name = "levels from " + std::to_string(start);
+        expectFired(name, start, acrossLevels(start, 3), true);
+        expectFired(name, start, acrossLevels(start, TimerWheel::kLevels - 1), false);
+    }
+
+    // Past the top level's span: clamped into its farthest slot and placed
+    // again from there, as often as needed
+    for (uint64_t start : {uint64_t(0), uint64_t(12345)}) {
+        uint64_t top = levelSpan(TimerWheel::kLevels);
+        expectFired("beyond the top level from " + std::to_string(start), start,
+                    {start + top - 1, start + top, start + top + 1, start + 3 * top + 5,
+                     start + (uint64_t(1) << 40) + 7},
+                    false);
+    }
+
+    // timeoutMs()
+    {
+        TimerWheel wheel(1000);
+        Timer near, far, past;
+        check(wheel.timeoutMs(1000) == -1, "timeoutMs() is -1 when empty");
+        wheel.schedule(near.node, 1010);
+        check(wheel.timeoutMs(1000) == 10, "timeoutMs() to a level-0 deadline is exact",
+              std::to_string(wheel.timeoutMs(1000)));
+        check(wheel.timeoutMs(1010) == 0 && wheel.timeoutMs(5000) == 0, "timeoutMs() is 0 once due");
+        wheel.cancel(near.node);
+        check(wheel.timeoutMs(1000) == -1 && wheel.size() == 0, "timeoutMs() is -1 after cancel");
+
+        wheel.schedule(far.node, 1000 + (uint64_t(1) << 40));
+        int timeout = wheel.timeoutMs(1000);
+        check(timeout > 0, "timeoutMs() past the top level is positive", std::to_string(timeout));
+        wheel.cancel(far.node);
+
+        // Already past when scheduled: due on the next advance
+        wheel.schedule(past.node, 500);
+        check(wheel.timeoutMs(1000) == 0, "timeoutMs() is 0 for a deadline already past");
+        int fires = 0;
+        wheel.advance(1000, [&](TimerNode&) { ++fires; });
+        check(fires == 1 && wheel.size() == 0, "deadline already past fires once",
+              std::to_string(fires) + " fires");
+    }
+
+    // Changes made from inside a callback, due in level 0 and after a cascade
+    expectCallbackChanges(100, 5);
+    expectCallbackChanges(100, 5000);
+
+    return testResult();
+}
@@ -0,0 +1,131 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+
+TimerWheel::TimerWheel(uint64_t now) : current(now) {
+    for (TimerNode& head : slots) {
+        head.prev = head.next = &head;
+    }
+}
+
+uint64_t TimerWheel::tickNow() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t TimerWheel::tickAt(std::chrono::steady_clock::time_point time) {
+    return static_cast<uint64_t>(std::chrono::ceil<std::chrono::milliseconds>(time.time_since_epoch()).count());
+}
+
+void TimerWheel::link(TimerNode& head, TimerNode& node) {
+    node.prev = head.prev;
+    node.next = &head;
+    head.prev->next = &node;
+    head.prev = &node;
+}
+
+void TimerWheel::unlink(TimerNode& node) {
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev = node.next = nullptr;
+    node.slot = kDetached;
+}
+
+void TimerWheel::place(TimerNode& node) {
+    // Past the top level's span it waits in the farthest slot and is placed
+    // again from there
+    uint64_t limit = current | ((uint64_t(1) << (kSlotBits * kLevels)) - 1);
+    uint64_t expiry = std::clamp(node.expiry, current, limit);
+    uint64_t differing = expiry ^ current;
+    unsigned level = 0;
+    while (level + 1 < kLevels && (differing >> (kSlotBits * (level + 1))) != 0) {
+        ++level;
+    }
+    unsigned position = static_cast<unsigned>((expiry >> (kSlotBits * level)) & (kSlots - 1));
+    node.slot = static_cast<uint16_t>(level * kSlots + position);
+    link(slots[node.slot], node);
+    occupied[level] |= uint64_t(1) << position;
+}
+
+void TimerWheel::detach(unsigned index, TimerNode& list) {
+    TimerNode& head = slots[index];
+    occupied[index / kSlots] &= ~(uint64_t(1) << (index % kSlots));
+    if (head.next == &head) {
+        return;
+    }
+    list.next = head.next;
+    list.prev = head.prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head.prev = head.next = &head;
+    for (TimerNode* node = list.next; node != &list; node = node->next) {
+        node->slot = kDetached;
+    }
+}
+
+void TimerWheel::cascade(uint64_t tick) {
+    // Highest level first, so a node moved down lands in a slot that the
+    // lower levels then cascade in turn if it starts at this tick too
+    for (unsigned level = kLevels - 1; level > 0; --level) {
+        unsigned shift = kSlotBits * level;
+        if ((tick & ((uint64_t(1) << shift) - 1)) != 0) {
+            continue;
+        }
+        TimerNode moving;
+        moving.prev = moving.next = &moving;
+        detach(level * kSlots + static_cast<unsigned>((tick >> shift) & (kSlots - 1)), moving);
+        while (moving.next != &moving) {
+            TimerNode& node = *moving.next;
+            unlink(node);
+            place(node);
+        }
+    }
+}
+
+uint64_t TimerWheel::nextTick() const {
+    uint64_t best = UINT64_MAX;
+    for (unsigned level = 0; level < kLevels; ++level) {
+        unsigned shift = kSlotBits * level;
+        // Occupied slots never lie behind the current one on their level
+        unsigned position = static_cast<unsigned>((current >> shift) & (kSlots - 1));
+        uint64_t pending = occupied[level] & (~uint64_t(0) << position);
+        if (pending == 0) {
+            continue;
+        }
+        uint64_t block = current >> (shift + kSlotBits) << (shift + kSlotBits);
+        best = std::min(best, block + (static_cast<uint64_t>(std::countr_zero(pending)) << shift));
+    }
+    return best;
+}
+
+void TimerWheel::schedule(TimerNode& node, uint64_t expiry) {
+    cancel(node);
+    node.expiry = expiry;
+    place(node);
+    ++count;
+}
+
+void TimerWheel::cancel(TimerNode& node) {
+    if (!node.armed()) {
+        return;
+    }
+    uint16_t slot = node.slot;
+    unlink(node);
+    --count;
+    if (slot != kDetached && slots[slot].next == &slots[slot]) {
+        occupied[slot / kSlots] &= ~(uint64_t(1) << (slot % kSlots));
+    }
+}
+
+int TimerWheel::timeoutMs(uint64_t now) const {
+    if (count == 0) {
+        return -1;
+    }
+    uint64_t tick = nextTick();
+    if (tick == UINT64_MAX) {
+        return -1;
+    }
+    return tick <= now ? 0 : static_cast<int>(std::min<uint64_t>(tick - now, INT_MAX));
+}
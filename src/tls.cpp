@@ -0,0 +1,257 @@
+#include "tls.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <string>
+
+#ifdef HAVE_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+// kTLS, and reading a close without close_notify as a plain EOF, need
+// OpenSSL 3.0. 1.1.1 encrypts every record in user space.
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    #define HAVE_KTLS 1
+#endif
+
+namespace {
+
+// Ticket keys as SSL_CTX_get_tlsext_ticket_keys() hands them out: name,
+// HMAC secret and AES key
+constexpr size_t kTicketKeysLength = 80;
+
+void printTlsError(const std::string& what) {
+    char text[256];
+    ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+    std::cerr << what << ". Error: " << text << std::endl;
+    ERR_clear_error();
+}
+
+// Agrees on HTTP/1.1 with clients that use ALPN. One offering only other
+// protocols (h2) gets no answer and speaks HTTP/1.1 anyway.
+int selectProtocol(SSL*, const unsigned char** out, unsigned char* outLength, const unsigned char* in,
+                   unsigned int inLength, void*) {
+    static const unsigned char kHttp11[] = "\x08http/1.1";
+    unsigned char* selected = nullptr;
+    unsigned char selectedLength = 0;
+    if (SSL_select_next_proto(&selected, &selectedLength, kHttp11, sizeof(kHttp11) - 1, in, inLength) !=
+        OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    *outLength = selectedLength;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+// SSL_get_error() as errno, the way the engines expect a socket to fail
+ssize_t tlsFailure(SSL* ssl, int result, bool writing, bool established, WorkerMetrics* metrics) {
+    int error = SSL_get_error(ssl, result);
+    switch (error) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            // close_notify, or (with SSL_OP_IGNORE_UNEXPECTED_EOF) a plain EOF;
+            // before OpenSSL 3.0 the latter is SSL_ERROR_SYSCALL instead
+            if (!writing) {
+                return 0;
+            }
+            errno = EPIPE;
+            return -1;
+        case SSL_ERROR_SYSCALL:
+            if (errno == 0) {
+                errno = ECONNRESET;
+            }
+            break;
+        default:
+            // Protocol error: plain HTTP on the TLS port, no shared cipher, ...
+            errno = EPROTO;
+            break;
+    }
+    ERR_clear_error();
+    if (!established && metrics) {
+        bumpCounter(metrics->tlsHandshakeErrors);
+    }
+    // A fatal error leaves nothing to shut down cleanly
+    SSL_set_quiet_shutdown(ssl, 1);
+    return -1;
+}
+
+}
+
+TlsContext::~TlsContext() {
+    SSL_CTX_free(context);
+}
+
+bool TlsContext::init(const ServerConfig& config, const TlsContext* previous) {
+    if (config.tlsCertificateFile.empty() || config.tlsKeyFile.empty()) {
+        std::cerr << "TLS needs a certificate and a key (tls-cert and tls-key)" << std::endl;
+        return false;
+    }
+    context = SSL_CTX_new(TLS_server_method());
+    if (!context) {
+        printTlsError("Failed to create TLS context");
+        return false;
+    }
+
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+    #ifdef HAVE_KTLS
+    options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+    if (config.tlsKernelOffload) {
+        // Takes effect per connection once the handshake is done, where the
+        // kernel has the tls module and supports the negotiated cipher
+        options |= SSL_OP_ENABLE_KTLS;
+    }
+    #endif
+    SSL_CTX_set_options(context, options);
+    // Writes may complete a record at a time and be retried from another
+    // address; idle connections hand their record buffers back
+    SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                              SSL_MODE_RELEASE_BUFFERS);
+
+    static const unsigned char kSessionContext[] = "web_server";
+    SSL_CTX_set_session_id_context(context, kSessionContext, sizeof(kSessionContext) - 1);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_alpn_select_cb(context, selectProtocol, nullptr);
+
+    if (SSL_CTX_use_certificate_chain_file(context, config.tlsCertificateFile.c_str()) != 1) {
+        printTlsError("Failed to load TLS certificate " + config.tlsCertificateFile);
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(context, config.tlsKeyFile.c_str(), SSL_FILETYPE_PEM) != 1) {
+        printTlsError("Failed to load TLS key " + config.tlsKeyFile);
+        return false;
+    }
+    if (SSL_CTX_check_private_key(context) != 1) {
+        printTlsError("TLS key does not match the certificate");
+        return false;
+    }
+
+    if (previous && previous->context) {
+        unsigned char keys[kTicketKeysLength];
+        if (SSL_CTX_get_tlsext_ticket_keys(previous->context, keys, sizeof(keys)) == 1) {
+            SSL_CTX_set_tlsext_ticket_keys(context, keys, sizeof(keys));
+        }
+        OPENSSL_cleanse(keys, sizeof(keys));
+    }
+    return true;
+}
+
+std::unique_ptr<TlsStream> TlsContext::accept(SOCKET_TYPE socket, WorkerMetrics* metrics) const {
+    SSL* ssl = SSL_new(context);
+    if (!ssl || SSL_set_fd(ssl, socket) != 1) {
+        SSL_free(ssl);
+        printTlsError("Failed to set up TLS connection");
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return std::make_unique<TlsStream>(ssl, metrics);
+}
+
+TlsStream::TlsStream(SSL* ssl, WorkerMetrics* metrics) : ssl(ssl), metrics(metrics) {}
+
+TlsStream::~TlsStream() {
+    // The socket BIO does not own the descriptor; the engine closes it
+    SSL_free(ssl);
+}
+
+void TlsStream::finishHandshake() {
+    established = true;
+    #ifdef HAVE_KTLS
+    kernelSend = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+    #endif
+    if (metrics) {
+        bumpCounter(metrics->tlsHandshakes[SSL_session_reused(ssl) ? 1 : 0]);
+        if (kernelSend) {
+            bumpCounter(metrics->tlsKernelOffload);
+        }
+    }
+}
+
+ssize_t TlsStream::read(char* buffer, size_t length) {
+    ERR_clear_error();
+    // The handshake runs inside the first reads of a new connection
+    int result = SSL_read(ssl, buffer, static_cast<int>(std::min<size_t>(length, INT_MAX)));
+    if (!established && SSL_is_init_finished(ssl)) {
+        finishHandshake();
+    }
+    if (result > 0) {
+        return result;
+    }
+    return tlsFailure(ssl, result, false, established, metrics);
+}
+
+ssize_t TlsStream::write(const char* data, size_t length) {
+    ERR_clear_error();
+    int result = SSL_write(ssl, data, static_cast<int>(std::min<size_t>(length, INT_MAX)));
+    if (result > 0) {
+        retryLength = 0;
+        return result;
+    }
+    ssize_t status = tlsFailure(ssl, result, true, established, metrics);
+    if (errno == EAGAIN) {
+        retryLength = length;
+    }
+    return status;
+}
+
+ssize_t TlsStream::sendFile(int fd, size_t offset, size_t length) {
+    #ifdef HAVE_KTLS
+    if (kernelSend) {
+        // Page cache to socket; the kernel encrypts as it goes
+        ERR_clear_error();
+        ossl_ssize_t result = SSL_sendfile(ssl, fd, static_cast<off_t>(offset), length, 0);
+        if (result >= 0) {
+            return result;
+        }
+        return tlsFailure(ssl, static_cast<int>(result), true, established, metrics);
+    }
+    #endif
+    char record[kRecordSize];
+    ssize_t bytesRead = pread(fd, record, std::min(length, sizeof(record)), static_cast<off_t>(offset));
+    if (bytesRead <= 0) {
+        return bytesRead;
+    }
+    return write(record, static_cast<size_t>(bytesRead));
+}
+
+bool TlsStream::pending() const {
+    return SSL_has_pending(ssl) == 1;
+}
+
+void TlsStream::shutdown() {
+    if (established) {
+        ERR_clear_error();
+        SSL_shutdown(ssl);
+        ERR_clear_error();
+    }
+}
+
+#else
+
+TlsContext::~TlsContext() = default;
+
+bool TlsContext::init(const ServerConfig&, const TlsContext*) {
+    std::cerr << "TLS is not available in this build (needs OpenSSL and POSIX sockets)" << std::endl;
+    return false;
+}
+
+std::unique_ptr<TlsStream> TlsContext::accept(SOCKET_TYPE, WorkerMetrics*) const {
+    return nullptr;
+}
+
+// Never constructed: without a TlsContext there are no streams
+TlsStream::TlsStream(SSL* ssl, WorkerMetrics* metrics) : ssl(ssl), metrics(metrics) {}
+TlsStream::~TlsStream() = default;
+void TlsStream::finishHandshake() {}
+ssize_t TlsStream::read(char*, size_t) { return -1; }
+ssize_t TlsStream::write(const char*, size_t) { return -1; }
+ssize_t TlsStream::sendFile(int, size_t, size_t) { return -1; }
+bool TlsStream::pending() const { return false; }
+void TlsStream::shutdown() {}
+
+#endif // HAVE_TLS
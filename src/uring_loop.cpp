@@ -0,0 +1,895 @@
+#include "uring_loop.h"
+
+#ifdef HAVE_IO_URING
+
+#include "access_log.h"
+#include "file_cache.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace {
+
+constexpr unsigned kRingEntries = 256;
+// Provided receive buffers per worker (a power of two), each one pool block
+constexpr unsigned kReceiveBuffers = 128;
+constexpr uint16_t kBufferGroup = 0;
+
+// user_data is a connection pointer with the operation in the low bits;
+// the loop's own operations carry no pointer
+enum Op : uint64_t {
+    OpCancel = 0,
+    OpAccept = 1,
+    OpWake = 2,
+    OpHandler = 3,    // Poll on a parked handler's own socket
+    OpReceive = 4,
+    OpSend = 5,
+    OpPoll = 6,
+    OpClose = 7,
+};
+constexpr uint64_t kOpMask = 7;
+
+uint64_t tag(UringConnection* conn, Op op) {
+    return reinterpret_cast<uint64_t>(conn) | op;
+}
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+                 const void* arg, size_t argSize) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+int ioUringRegister(int fd, unsigned opcode, const void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+}
+
+IoRing::~IoRing() {
+    if (sqes) {
+        munmap(sqes, sqesSize);
+    }
+    if (rings) {
+        munmap(rings, ringsSize);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool IoRing::init(unsigned entries) {
+    // Deferred task work runs completions only inside our own io_uring_enter
+    // calls instead of interrupting the worker; it needs a single issuer
+    // (6.1+). Older kernels get a plain ring.
+    io_uring_params params = {};
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+    fd = ioUringSetup(entries, &params);
+    if (fd < 0 && errno == EINVAL) {
+        params = {};
+        fd = ioUringSetup(entries, &params);
+    }
+    if (fd < 0) {
+        std::cerr << "io_uring_setup failed. Error: " << errno << std::endl;
+        return false;
+    }
+    disabled = (params.flags & IORING_SETUP_R_DISABLED) != 0;
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        std::cerr << "io_uring is too old on this kernel" << std::endl;
+        return false;
+    }
+
+    ringsSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                         params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    void* mapped = mmap(nullptr, ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map io_uring queues. Error: " << errno << std::endl;
+        return false;
+    }
+    rings = mapped;
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    mapped = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQES);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map io_uring entries. Error: " << errno << std::endl;
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(mapped);
+
+    char* base = static_cast<char*>(rings);
+    sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+    // SQE slot i is always submitted through array entry i
+    for (unsigned i = 0; i < sqEntries; ++i) {
+        sqArray[i] = i;
+    }
+    localTail = *sqTail;
+    return true;
+}
+
+bool IoRing::enable() {
+    if (!disabled) {
+        return true;
+    }
+    if (ioUringRegister(fd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) < 0) {
+        std::cerr << "Failed to enable io_uring. Error: " << errno << std::endl;
+        return false;
+    }
+    disabled = false;
+    return true;
+}
+
+io_uring_sqe* IoRing::nextSqe() {
+    makeRoom(1);
+    io_uring_sqe* sqe = &sqes[localTail & sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++localTail;
+    return sqe;
+}
+
+void IoRing::makeRoom(unsigned count) {
+    if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) + count > sqEntries) {
+        submit();
+    }
+}
+
+int IoRing::enter(unsigned minComplete, unsigned flags, int timeoutMs) {
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+    unsigned pending = localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+    struct __kernel_timespec timeout = {};
+    io_uring_getevents_arg arg = {};
+    const void* argPointer = nullptr;
+    size_t argSize = 0;
+    if (timeoutMs >= 0) {
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        argPointer = &arg;
+        argSize = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    int result = ioUringEnter(fd, pending, minComplete, flags, argPointer, argSize);
+    return result < 0 ? -errno : 0;
+}
+
+int IoRing::submitAndWait(int timeoutMs) {
+    return enter(1, IORING_ENTER_GETEVENTS, timeoutMs);
+}
+
+int IoRing::submit() {
+    return enter(0, 0, -1);
+}
+
+UringLoop::UringLoop(SOCKET_TYPE listenSocket, std::atomic<bool>& running, const ServerConfig& config,
+                     ResponseCache* responses, AccessLog* accessLog, MetricsRegistry* metricsRegistry,
+                     const Router* router)
+    : listenSocket(listenSocket), running(running), config(config), operations(0), wakeFd(-1),
+      wakeValue(0), bufferRing(nullptr), bufferTail(0), connectionLimit(0), drainRequested(false),
+      draining(false), responses(responses),
+      accessLog(accessLog), accessLogRing(nullptr), metricsRegistry(metricsRegistry), metrics(nullptr),
+      router(router) {
+    if (config.maxConnections > 0) {
+        size_t workers = static_cast<size_t>(std::max(config.workers, 1));
+        connectionLimit = (static_cast<size_t>(config.maxConnections) + workers - 1) / workers;
+    }
+}
+
+UringLoop::~UringLoop() {
+    // run() has normally closed everything already
+    for (auto& entry : connections) {
+        if (entry.second->socketOpen) {
+            CLOSE_SOCKET(entry.second->socket);
+        }
+    }
+    connections.clear();
+
+    if (accessLog) {
+        accessLog->releaseRing(accessLogRing);
+    }
+    if (metricsRegistry) {
+        metricsRegistry->release(metrics);
+    }
+
+    if (wakeFd >= 0) {
+        close(wakeFd);
+    }
+    // The kernel keeps the ring's pages pinned until the ring itself goes
+    if (bufferRing) {
+        munmap(bufferRing, kReceiveBuffers * sizeof(io_uring_buf));
+    }
+}
+
+bool UringLoop::init() {
+    #ifdef HAVE_STATIC_FILES
+    if (!config.documentRoot.empty()) {
+        files = std::make_unique<FileCache>(static_cast<size_t>(config.fileCacheEntries),
+                                            config.fileRevalidateMs, config.compressionMinBytes);
+        if (!files->init(config.documentRoot)) {
+            return false;
+        }
+    }
+    #endif
+
+    if (!ring.init(kRingEntries) || !setupBufferRing()) {
+        return false;
+    }
+
+    wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        std::cerr << "eventfd failed. Error: " << errno << std::endl;
+        return false;
+    }
+
+    // Only acquired once the engine is known to work, so a fallback to
+    // epoll does not leave an unused block behind
+    if (accessLog) {
+        accessLogRing = accessLog->acquireRing();
+    }
+    if (metricsRegistry) {
+        metrics = metricsRegistry->acquire();
+    }
+    return true;
+}
+
+bool UringLoop::setupBufferRing() {
+    // Provided buffer rings (5.19) arrived together with multishot accept,
+    // so registering one doubles as the kernel version check
+    size_t ringBytes = kReceiveBuffers * sizeof(io_uring_buf);
+    void* mapped = mmap(nullptr, ringBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to allocate the receive buffer ring. Error: " << errno << std::endl;
+        return false;
+    }
+    bufferRing = static_cast<io_uring_buf*>(mapped);
+
+    io_uring_buf_reg registration = {};
+    registration.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+    registration.ring_entries = kReceiveBuffers;
+    registration.bgid = kBufferGroup;
+    if (ioUringRegister(ring.getFd(), IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        std::cerr << "io_uring provided buffer rings are not supported. Error: " << errno << std::endl;
+        return false;
+    }
+
+    receiveBuffers = std::make_unique<char[]>(kReceiveBuffers * pool.getBlockSize());
+    for (unsigned id = 0; id < kReceiveBuffers; ++id) {
+        recycleBuffer(static_cast<uint16_t>(id));
+    }
+    return true;
+}
+
+void UringLoop::recycleBuffer(uint16_t id) {
+    io_uring_buf& entry = bufferRing[bufferTail & (kReceiveBuffers - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(receiveBuffers.get() + id * pool.getBlockSize());
+    entry.len = static_cast<uint32_t>(pool.getBlockSize());
+    entry.bid = id;
+    // The ring's tail overlays the reserved field of its first entry
+    __atomic_store_n(&bufferRing[0].resv, ++bufferTail, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe* UringLoop::prepare(uint8_t opcode, int fd, uint64_t userData) {
+    io_uring_sqe* sqe = ring.nextSqe();
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+    ++operations;
+    return sqe;
+}
+
+void UringLoop::run() {
+    if (!ring.enable()) {
+        return;
+    }
+    armWake();
+    armAccept();
+
+    while (running && !(draining && connections.empty())) {
+        if (!draining && drainRequested.load(std::memory_order_acquire)) {
+            beginDrain();
+            continue;
+        }
+        int timeout = runTimers();
+        if (draining && connections.empty()) {
+            break;   // The drain timer closed the last ones
+        }
+        int result = ring.submitAndWait(timeout);
+        if (result < 0 && result != -ETIME && result != -EINTR && result != -EBUSY) {
+            std::cerr << "io_uring_enter failed. Error: " << -result << std::endl;
+            break;
+        }
+        ring.reap([this](const io_uring_cqe& cqe) { handleCompletion(cqe); });
+    }
+
+    drainOperations();
+}
+
+// Nothing may be left in flight once run() returns: the kernel would still
+// be writing into connection state and receive buffers
+void UringLoop::drainOperations() {
+    std::vector<UringConnection*> open;
+    open.reserve(connections.size());
+    for (auto& entry : connections) {
+        open.push_back(entry.second.get());
+    }
+    for (UringConnection* conn : open) {
+        closeConnection(*conn);
+    }
+
+    io_uring_sqe* sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, OpCancel);
+    sqe->addr = OpAccept;
+    sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, OpCancel);
+    sqe->addr = OpWake;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (operations > 0 && std::chrono::steady_clock::now() < deadline) {
+        int result = ring.submitAndWait(100);
+        if (result < 0 && result != -ETIME && result != -EINTR && result != -EBUSY) {
+            break;
+        }
+        ring.reap([this](const io_uring_cqe& cqe) { handleCompletion(cqe); });
+    }
+}
+
+void UringLoop::wakeup() {
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void UringLoop::drain() {
+    drainRequested.store(true, std::memory_order_release);
+    wakeup();
+}
+
+void UringLoop::beginDrain() {
+    draining = true;
+    // The listener stays open for the next generation; only our accept goes
+    io_uring_sqe* sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, OpCancel);
+    sqe->addr = OpAccept;
+    if (config.drainTimeoutMs > 0) {
+        timers.schedule(drainTimer, TimerWheel::tickAt(std::chrono::steady_clock::now() +
+                                                       std::chrono::milliseconds(config.drainTimeoutMs)));
+    }
+
+    // As on EventLoop: nothing is closed between requests
+    for (auto& entry : connections) {
+        entry.second->pipeline.draining = true;
+    }
+}
+
+void UringLoop::closeAll() {
+    std::vector<UringConnection*> open;
+    open.reserve(connections.size());
+    for (auto& entry : connections) {
+        open.push_back(entry.second.get());
+    }
+    for (UringConnection* conn : open) {
+        closeConnection(*conn);
+    }
+}
+
+void UringLoop::armWake() {
+    io_uring_sqe* sqe = prepare(IORING_OP_READ, wakeFd, OpWake);
+    sqe->addr = reinterpret_cast<uint64_t>(&wakeValue);
+    sqe->len = sizeof(wakeValue);
+}
+
+void UringLoop::armAccept() {
+    // One submission keeps producing a completion per accepted connection
+    io_uring_sqe* sqe = prepare(IORING_OP_ACCEPT, listenSocket, OpAccept);
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+void UringLoop::armReceive(UringConnection& conn) {
+    // The kernel picks a ring buffer only once data arrives; never ask for
+    // more than the input buffer can take so a completion is always consumed whole
+    size_t room = conn.inBuffer.writableSize();
+    io_uring_sqe* sqe = prepare(IORING_OP_RECV, conn.socket, tag(&conn, OpReceive));
+    sqe->len = static_cast<uint32_t>(std::min(room, pool.getBlockSize()));
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    ++conn.inFlight;
+    armTimer(conn);
+}
+
+void UringLoop::handleCompletion(const io_uring_cqe& cqe) {
+    uint64_t op = cqe.user_data & kOpMask;
+    UringConnection* conn = reinterpret_cast<UringConnection*>(cqe.user_data & ~kOpMask);
+
+    // Multishot completions keep their operation alive while F_MORE is set
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        --operations;
+    }
+
+    switch (op) {
+        case OpAccept:
+            handleAccept(cqe);
+            return;
+        case OpWake:
+            // Cancelled only on the way out, which a drain takes with running still set
+            if (running && cqe.res != -ECANCELED) {
+                armWake();
+            }
+            return;
+        case OpCancel:
+            return;
+    }
+
+    --conn->inFlight;
+    switch (op) {
+        case OpReceive:
+            handleReceive(*conn, cqe);
+            break;
+        case OpSend:
+        case OpPoll:
+            handleSend(*conn, cqe);
+            break;
+        case OpClose:
+            handleClose(*conn, cqe);
+            break;
+        case OpHandler:
+            // Ready or failed alike: the handler's own retry reports errors
+            if (conn->closing) {
+                releaseIfIdle(*conn);
+            } else {
+                timers.cancel(conn->timer);
+                resumeHandler(*conn);
+            }
+            break;
+    }
+}
+
+void UringLoop::handleAccept(const io_uring_cqe& cqe) {
+    bool handingOver = drainRequested.load(std::memory_order_relaxed);
+    // The kernel ends multishot on errors or CQ overflow; start again
+    bool rearm = !(cqe.flags & IORING_CQE_F_MORE) && running && !handingOver && cqe.res != -ECANCELED;
+    int error = -cqe.res;
+    bool report = true;
+    if (error == EMFILE || error == ENFILE) {
+        // Out of descriptors: close what is queued, as EventLoop does
+        while (spare.shed(listenSocket)) {
+            if (metrics) {
+                bumpCounter(metrics->shedConnections);
+            }
+        }
+        report = errno != EAGAIN;
+    }
+    if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+        // The accept fails this way before looking at the queue, so arming
+        // it again at once would only fail again, in a tight loop
+        if (rearm) {
+            if (report) {
+                std::cerr << "Accept failed. Error: " << error << std::endl;
+            }
+            timers.schedule(acceptTimer, TimerWheel::tickAt(std::chrono::steady_clock::now() +
+                                                            std::chrono::milliseconds(kAcceptRetryMs)));
+        }
+        return;
+    }
+    if (rearm) {
+        armAccept();
+    }
+    if (cqe.res < 0) {
+        // A listener given up in a reload is shut down under the accept
+        if (cqe.res != -ECANCELED && cqe.res != -ECONNABORTED && cqe.res != -EINTR && !handingOver) {
+            std::cerr << "Accept failed. Error: " << error << std::endl;
+        }
+        return;
+    }
+
+    SOCKET_TYPE clientSocket = cqe.res;
+    if (!running) {
+        // Raced with shutdown; drainOperations() has already closed the rest
+        CLOSE_SOCKET(clientSocket);
+        return;
+    }
+    if (connectionLimit > 0 && connections.size() >= connectionLimit) {
+        // Shed load at the door, synchronously: one non-blocking send, and
+        // the request is never read or parsed
+        sendNotice(clientSocket, ConnectionNotice::ServiceUnavailable);
+        CLOSE_SOCKET(clientSocket);
+        if (metrics) {
+            bumpCounter(metrics->shedConnections);
+        }
+        return;
+    }
+    auto conn = std::make_unique<UringConnection>(clientSocket, pool);
+    // Accepted before the cancel took effect: still served, then closed
+    conn->pipeline.draining = draining;
+    conn->output.enableSplice();
+    if (accessLog || !config.proxyRoutes.empty()) {
+        // Multishot accept has nowhere to put the address; only the log and
+        // the proxy's X-Forwarded-For need it
+        struct sockaddr_in clientAddr = {};
+        SOCKET_SIZE_TYPE clientAddrLen = sizeof(clientAddr);
+        if (getpeername(clientSocket, reinterpret_cast<struct sockaddr*>(&clientAddr), &clientAddrLen) == 0) {
+            conn->pipeline.peerAddress = clientAddr.sin_addr.s_addr;
+            conn->pipeline.peerPort = ntohs(clientAddr.sin_port);
+        }
+    }
+    conn->lastActivity = std::chrono::steady_clock::now();
+    conn->requestStartedAt = conn->lastActivity;
+    UringConnection& added = *conn;
+    connections[conn.get()] = std::move(conn);
+    if (metrics) {
+        bumpCounter(metrics->accepts);
+        bumpCounter(metrics->activeConnections);
+    }
+    armReceive(added);
+}
+
+void UringLoop::handleReceive(UringConnection& conn, const io_uring_cqe& cqe) {
+    // Bytes into an empty buffer between requests begin a new one
+    bool startsRequest = conn.inBuffer.empty() && !conn.awaitingFirstByte && !conn.pipeline.handler.active();
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (cqe.res > 0 && !conn.closing) {
+            size_t available;
+            char* buffer = conn.inBuffer.writePointer(available);
+            size_t length = std::min(static_cast<size_t>(cqe.res), available);
+            memcpy(buffer, receiveBuffers.get() + id * pool.getBlockSize(), length);
+            conn.inBuffer.commit(length);
+        }
+        recycleBuffer(id);
+    }
+
+    if (conn.closing) {
+        releaseIfIdle(conn);
+        return;
+    }
+
+    if (cqe.res == -ENOBUFS) {
+        // Every ring buffer was taken by this batch; they are back by now
+        armReceive(conn);
+        return;
+    }
+    if (cqe.res < 0) {
+        closeConnection(conn);
+        return;
+    }
+    if (cqe.res == 0) {
+        conn.peerClosed = true;
+    } else {
+        std::chrono::steady_clock::time_point previous = conn.lastActivity;
+        conn.lastActivity = std::chrono::steady_clock::now();
+        if (startsRequest) {
+            conn.requestStartedAt = conn.lastActivity;
+        }
+        if (metrics) {
+            bumpCounter(metrics->bytesIn, static_cast<uint64_t>(cqe.res));
+            if (conn.awaitingFirstByte) {
+                conn.awaitingFirstByte = false;
+                metrics->firstByte.observe(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        conn.lastActivity - previous).count()));
+            }
+        }
+    }
+    if (conn.parked) {
+        // More of a handler's request body, or the end of the input
+        if (conn.peerClosed) {
+            conn.pipeline.handler.body.setInputClosed();
+        }
+        resumeHandler(conn);
+        return;
+    }
+    serviceRequests(conn);
+}
+
+size_t UringLoop::runPipeline(UringConnection& conn) {
+    HandlerContext context{config, files.get(), responses, accessLogRing, metrics, metricsRegistry, router};
+    return processPipelinedRequests(conn.inBuffer, conn.output, conn.pipeline, context);
+}
+
+void UringLoop::serviceRequests(UringConnection& conn) {
+    size_t answered = runPipeline(conn);
+    if (answered == 0 && !conn.pipeline.handler.suspended()) {
+        // Need more data; a half-closed peer will never send it, and a full
+        // buffer holding no complete request never will either
+        if (conn.peerClosed || conn.inBuffer.full()) {
+            closeConnection(conn);
+            return;
+        }
+        armReceive(conn);
+        return;
+    }
+
+    // The last read that completed these requests set lastActivity, and
+    // anything left over arrived with it
+    conn.responsesPending = answered;
+    conn.requestsReadAt = conn.lastActivity;
+    conn.requestStartedAt = conn.lastActivity;
+    sendOutput(conn);
+}
+
+void UringLoop::sendOutput(UringConnection& conn) {
+    size_t count = conn.output.gather(conn.iov, ResponseQueue::kMaxIovecs);
+    if (count == 0) {
+        // A file body is next: sendfile() from here, synchronously, until
+        // the socket fills up, then wait for it to drain
+        size_t queued = conn.output.size();
+        ResponseQueue::FlushResult result = conn.output.flush(conn.socket);
+        if (metrics) {
+            bumpCounter(metrics->bytesOut, queued - conn.output.size());
+        }
+        if (result == ResponseQueue::FlushResult::Error) {
+            std::cerr << "Failed to send response to client. Error: " << errno << std::endl;
+            closeConnection(conn);
+        } else if (result == ResponseQueue::FlushResult::WouldBlock) {
+            io_uring_sqe* sqe = prepare(IORING_OP_POLL_ADD, conn.socket, tag(&conn, OpPoll));
+            sqe->poll32_events = POLLOUT;
+            ++conn.inFlight;
+            conn.sending = true;
+            armTimer(conn);
+        } else {
+            responseWritten(conn);
+        }
+        return;
+    }
+
+    size_t gathered = 0;
+    for (size_t i = 0; i < count; ++i) {
+        gathered += conn.iov[i].iov_len;
+    }
+
+    ring.makeRoom(2);
+    conn.message = {};
+    conn.message.msg_iov = conn.iov;
+    conn.message.msg_iovlen = count;
+    io_uring_sqe* sqe = prepare(IORING_OP_SENDMSG, conn.socket, tag(&conn, OpSend));
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.message);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    ++conn.inFlight;
+    conn.sending = true;
+    armTimer(conn);
+
+    if (gathered < conn.output.size()) {
+        // Hold a head back briefly so it shares a packet with the file body after it
+        sqe->msg_flags |= MSG_MORE;
+    }
+
+    bool lastResponse = !conn.pipeline.keepAlive || conn.peerClosed || (draining && conn.inBuffer.empty());
+    if (gathered == conn.output.size() && lastResponse && !conn.pipeline.handler.active()) {
+        // Last bytes on this connection: the close rides along in the same
+        // submission. MSG_WAITALL makes a short send an error, which cancels it.
+        sqe->msg_flags |= MSG_WAITALL;
+        sqe->flags |= IOSQE_IO_LINK;
+        prepare(IORING_OP_CLOSE, conn.socket, tag(&conn, OpClose));
+        ++conn.inFlight;
+        conn.closeLinked = true;
+    }
+}
+
+void UringLoop::handleSend(UringConnection& conn, const io_uring_cqe& cqe) {
+    conn.sending = false;
+    if (conn.closing) {
+        releaseIfIdle(conn);
+        return;
+    }
+
+    if (cqe.res < 0) {
+        if (cqe.res != -EPIPE && cqe.res != -ECONNRESET) {
+            std::cerr << "Failed to send response to client. Error: " << -cqe.res << std::endl;
+        }
+        closeConnection(conn);
+        return;
+    }
+
+    if ((cqe.user_data & kOpMask) == OpSend) {
+        conn.output.consume(static_cast<size_t>(cqe.res));
+        if (metrics) {
+            bumpCounter(metrics->bytesOut, static_cast<uint64_t>(cqe.res));
+        }
+    }
+    conn.lastActivity = std::chrono::steady_clock::now();
+
+    if (conn.output.empty()) {
+        responseWritten(conn);
+    } else if (!conn.closeLinked) {
+        sendOutput(conn);
+    }
+}
+
+void UringLoop::handleClose(UringConnection& conn, const io_uring_cqe& cqe) {
+    // Cancelled when the send before it failed; the socket is still ours then
+    if (cqe.res != -ECANCELED) {
+        conn.socketOpen = false;
+    }
+    conn.closeLinked = false;
+    closeConnection(conn);
+}
+
+void UringLoop::responseWritten(UringConnection& conn) {
+    if (metrics && conn.responsesPending > 0) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - conn.requestsReadAt);
+        metrics->requestLatency.observe(static_cast<uint64_t>(elapsed.count()), conn.responsesPending);
+        conn.responsesPending = 0;
+    }
+
+    PendingHandler& handler = conn.pipeline.handler;
+    while (handler.suspended()) {
+        if (handler.wait().kind != HandlerWait::Kind::Flush) {
+            parkHandler(conn);
+            return;
+        }
+        // Everything it queued is on the wire: run it to its next wait
+        handler.resume();
+        conn.responsesPending += runPipeline(conn);
+        if (!conn.output.empty()) {
+            sendOutput(conn);
+            return;
+        }
+    }
+
+    if (conn.closeLinked || !conn.pipeline.keepAlive || conn.peerClosed || (draining && conn.inBuffer.empty())) {
+        closeConnection(conn);
+        return;
+    }
+    // Pipelined requests may already be waiting in the input buffer
+    serviceRequests(conn);
+}
+
+void UringLoop::parkHandler(UringConnection& conn) {
+    const HandlerWait& wait = conn.pipeline.handler.wait();
+    conn.parked = true;
+    if (wait.kind == HandlerWait::Kind::Body) {
+        // Its request sits at the start of the block, so the receive cannot move it
+        armReceive(conn);
+        return;
+    }
+    if (wait.kind == HandlerWait::Kind::Readable || wait.kind == HandlerWait::Kind::Writable) {
+        io_uring_sqe* sqe = prepare(IORING_OP_POLL_ADD, wait.fd, tag(&conn, OpHandler));
+        sqe->poll32_events = wait.kind == HandlerWait::Kind::Readable ? POLLIN : POLLOUT;
+        ++conn.inFlight;
+    }
+    armTimer(conn);
+}
+
+void UringLoop::resumeHandler(UringConnection& conn) {
+    conn.parked = false;
+    conn.pipeline.handler.resume();
+    conn.responsesPending += runPipeline(conn);
+    // Writes what it queued, then follows its next wait
+    sendOutput(conn);
+}
+
+int UringLoop::runTimers() {
+    timers.advance(TimerWheel::tickNow(), [this](TimerNode& node) {
+        if (&node == &drainTimer) {
+            closeAll();   // Out of time to drain
+            return;
+        }
+        if (&node == &acceptTimer) {
+            if (running && !drainRequested.load(std::memory_order_relaxed)) {
+                armAccept();
+            }
+            return;
+        }
+        expireTimer(*static_cast<UringConnection*>(node.owner));
+    });
+    return timers.timeoutMs(TimerWheel::tickNow());
+}
+
+// The same deadlines as EventLoop::armTimer, read off the operation the
+// connection is waiting on
+void UringLoop::armTimer(UringConnection& conn) {
+    int timeoutMs = 0;
+    std::chrono::steady_clock::time_point start = conn.lastActivity;
+    if (conn.closing) {
+        timeoutMs = 0;
+    } else if (conn.parked) {
+        const HandlerWait& wait = conn.pipeline.handler.wait();
+        if (wait.kind == HandlerWait::Kind::Timer || wait.hasDeadline()) {
+            timers.schedule(conn.timer, TimerWheel::tickAt(wait.deadline));
+            return;
+        }
+        // A handler polling its own socket is busy, not idle
+        timeoutMs = wait.kind == HandlerWait::Kind::Body ? config.bodyTimeoutMs : 0;
+    } else if (conn.sending) {
+        timeoutMs = config.writeTimeoutMs;
+    } else if (conn.inBuffer.empty() && !conn.awaitingFirstByte) {
+        timeoutMs = config.keepAliveTimeoutMs;
+    } else {
+        timeoutMs = config.headerTimeoutMs;
+        start = conn.requestStartedAt;
+    }
+    if (timeoutMs > 0) {
+        timers.schedule(conn.timer, TimerWheel::tickAt(start + std::chrono::milliseconds(timeoutMs)));
+    } else {
+        timers.cancel(conn.timer);
+    }
+}
+
+void UringLoop::expireTimer(UringConnection& conn) {
+    TimeoutPhase phase = TimeoutPhase::Write;
+    if (conn.parked) {
+        const HandlerWait& wait = conn.pipeline.handler.wait();
+        if (wait.kind == HandlerWait::Kind::Timer) {
+            resumeHandler(conn);   // Its sleep is over
+            return;
+        }
+        if (wait.kind == HandlerWait::Kind::Readable || wait.kind == HandlerWait::Kind::Writable) {
+            // Past its deadline: the cancelled poll completes and resumes it
+            io_uring_sqe* sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, OpCancel);
+            sqe->addr = tag(&conn, OpHandler);
+            return;
+        }
+        phase = TimeoutPhase::Body;
+    } else if (!conn.sending) {
+        if (conn.inBuffer.empty()) {
+            phase = conn.awaitingFirstByte ? TimeoutPhase::Header : TimeoutPhase::Idle;
+        } else {
+            // Part of a request came in, but not all of it in time
+            phase = TimeoutPhase::Header;
+            sendNotice(conn.socket, ConnectionNotice::RequestTimeout);
+        }
+    }
+    if (metrics) {
+        metrics->countTimeout(phase);
+    }
+    closeConnection(conn);
+}
+
+void UringLoop::closeConnection(UringConnection& conn) {
+    if (!conn.closing) {
+        conn.closing = true;
+        timers.cancel(conn.timer);
+        if (metrics) {
+            dropCounter(metrics->activeConnections);
+        }
+        if (conn.parked) {
+            const HandlerWait& wait = conn.pipeline.handler.wait();
+            if (wait.kind == HandlerWait::Kind::Readable || wait.kind == HandlerWait::Kind::Writable) {
+                // A body wait's receive is ended by the shutdown below
+                io_uring_sqe* sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, OpCancel);
+                sqe->addr = tag(&conn, OpHandler);
+            }
+            conn.parked = false;
+        }
+        if (conn.sending || (conn.inFlight > 0 && !conn.closeLinked)) {
+            // Completes the pending receive or send so its memory can go
+            shutdown(conn.socket, SHUT_RDWR);
+        }
+    }
+    releaseIfIdle(conn);
+}
+
+void UringLoop::releaseIfIdle(UringConnection& conn) {
+    if (conn.inFlight > 0) {
+        return;
+    }
+    if (conn.socketOpen) {
+        CLOSE_SOCKET(conn.socket);
+    }
+    connections.erase(&conn);
+}
+
+#endif // HAVE_IO_URING
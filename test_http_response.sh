@@ -44,8 +44,8 @@ echo "Testing /api/users..."
 curl -s http://localhost:8080/api/users | grep "Hello World!"
 echo
 
-# Test 3: Test invalid request (should return 400)
-echo "Test 3: Testing invalid POST request (should return 400)"
+# Test 3: Test a method without a route (should return 405)
+echo "Test 3: Testing POST to an unrouted path (should return 405)"
 echo -e "POST /test HTTP/1.1\r\n\r\n" | nc -w 1 localhost 8080
 echo
 
@@ -1,6 +1,6 @@
 #!/bin/bash
 
-echo "=== TCP Echo Server Test Script ==="
+echo "=== HTTP Server Load Test Script ==="
 echo "Building project..."
 cd build
 make
@@ -11,18 +11,192 @@ if [ $? -ne 0 ]; then
 fi
 
 echo "Starting server in background..."
-./web_server &
+./web_server --header-timeout 2000 &
 SERVER_PID=$!
 
 echo "Server started with PID: $SERVER_PID"
 echo "Waiting for server to start..."
 sleep 3
 
-echo "Testing server with test client..."
-./test_client
+echo "Keep-alive load..."
+./bench_load --connections 16 --duration 3
+STATUS=$?
+
+echo "Pipelined load..."
+./bench_load --connections 16 --pipeline 8 --duration 3 || STATUS=1
+
+echo "Connection-per-request load..."
+./bench_load --connections 16 --no-keepalive --duration 3 || STATUS=1
+
+echo "Slowloris clients (cut off at the 2 s header timeout) under load..."
+./bench_load --connections 16 --duration 4 --slowloris 64 --slowloris-interval 250 || STATUS=1
+
+echo "Reloads (SIGHUP) under load must not fail a single request..."
+./bench_load --connections 16 --duration 4 &
+LOAD_PID=$!
+for i in 1 2 3; do
+    sleep 1
+    kill -HUP $SERVER_PID
+done
+wait $LOAD_PID || STATUS=1
 
 echo "Stopping server..."
 kill $SERVER_PID
 wait $SERVER_PID 2>/dev/null
 
+echo "A reload asking for fewer workers keeps them, under connection-per-request load..."
+CONFIG=$(mktemp)
+SERVER_LOG=$(mktemp)
+echo "workers = 4" > "$CONFIG"
+./web_server --config "$CONFIG" > >(tee "$SERVER_LOG") 2>&1 &
+SERVER_PID=$!
+sleep 2
+./bench_load --connections 16 --no-keepalive --duration 3 &
+LOAD_PID=$!
+sleep 1
+echo "workers = 1" > "$CONFIG"
+kill -HUP $SERVER_PID
+wait $LOAD_PID || STATUS=1
+# Closing the surplus listeners would reset what is queued on them, unless
+# the kernel migrates it
+if [ "$(cat /proc/sys/net/ipv4/tcp_migrate_req 2>/dev/null)" != 1 ]; then
+    grep -q '^Reloaded: .*, 4 workers' "$SERVER_LOG" || { echo "Workers shrank on reload"; STATUS=1; }
+fi
+kill $SERVER_PID
+wait $SERVER_PID 2>/dev/null
+rm -f "$CONFIG" "$SERVER_LOG"
+
+if command -v openssl >/dev/null && command -v curl >/dev/null; then
+    echo "TLS against a self-signed certificate..."
+    TLS_DIR=$(mktemp -d)
+    openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+        -keyout "$TLS_DIR/key.pem" -out "$TLS_DIR/cert.pem" 2>/dev/null
+    mkdir "$TLS_DIR/www"
+    head -c 1000000 /dev/urandom > "$TLS_DIR/www/large.bin"
+    ./web_server --tls-port 8443 --tls-cert "$TLS_DIR/cert.pem" --tls-key "$TLS_DIR/key.pem" \
+        --root "$TLS_DIR/www" &
+    SERVER_PID=$!
+    sleep 2
+
+    # A file body larger than many records, through kTLS sendfile() or in user space
+    curl -s --cacert "$TLS_DIR/cert.pem" https://localhost:8443/large.bin -o "$TLS_DIR/received.bin"
+    cmp -s "$TLS_DIR/www/large.bin" "$TLS_DIR/received.bin" || { echo "TLS file body differs"; STATUS=1; }
+
+    # The session ticket from the first connection must resume the second,
+    # even with a reload in between
+    (sleep 1) | openssl s_client -connect localhost:8443 -sess_out "$TLS_DIR/session.pem" >/dev/null 2>&1
+    kill -HUP $SERVER_PID
+    sleep 1
+    (sleep 1) | openssl s_client -connect localhost:8443 -sess_in "$TLS_DIR/session.pem" 2>/dev/null |
+        grep -q '^Reused,' || { echo "TLS session was not resumed"; STATUS=1; }
+    curl -s http://localhost:8080/metrics | grep '^webserver_tls'
+
+    kill $SERVER_PID
+    wait $SERVER_PID 2>/dev/null
+    rm -rf "$TLS_DIR"
+fi
+
+echo "Reverse proxy in front of a second instance..."
+PROXY_DIR=$(mktemp -d)
+head -c 1000000 /dev/urandom > "$PROXY_DIR/large.bin"
+echo "proxied" > "$PROXY_DIR/index.html"
+./web_server --port 8081 --root "$PROXY_DIR" &
+UPSTREAM_PID=$!
+./web_server --proxy /=127.0.0.1:8081 &
+SERVER_PID=$!
+sleep 2
+./bench_load --connections 16 --duration 3 || STATUS=1
+if command -v curl >/dev/null; then
+    # Spliced from the upstream socket to the client's where the platform allows it
+    curl -s http://localhost:8080/large.bin -o "$PROXY_DIR/received.bin"
+    cmp -s "$PROXY_DIR/large.bin" "$PROXY_DIR/received.bin" || { echo "Proxied file body differs"; STATUS=1; }
+fi
+kill $SERVER_PID $UPSTREAM_PID
+wait $SERVER_PID $UPSTREAM_PID 2>/dev/null
+rm -rf "$PROXY_DIR"
+
+if command -v python3 >/dev/null && command -v curl >/dev/null; then
+    echo "A POST lost with its upstream connection must not be sent to another..."
+    RETRY_DIR=$(mktemp -d)
+    # Reads each request head, counts it by method, and closes without answering
+    cat > "$RETRY_DIR/upstream.py" <<'EOF'
+import socket, sys
+listener = socket.socket()
+listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+listener.bind(("127.0.0.1", int(sys.argv[1])))
+listener.listen(16)
+while True:
+    client, _ = listener.accept()
+    head = b""
+    while b"\r\n\r\n" not in head:
+        data = client.recv(4096)
+        if not data:
+            break
+        head += data
+    if head:
+        with open(sys.argv[2], "a") as log:
+            log.write(head.split(b" ", 1)[0].decode() + "\n")
+    client.close()
+EOF
+    python3 "$RETRY_DIR/upstream.py" 8082 "$RETRY_DIR/seen" &
+    UPSTREAM_A=$!
+    python3 "$RETRY_DIR/upstream.py" 8083 "$RETRY_DIR/seen" &
+    UPSTREAM_B=$!
+    ./web_server --proxy /=127.0.0.1:8082,127.0.0.1:8083 --proxy-health-interval 0 &
+    SERVER_PID=$!
+    sleep 2
+    # A failed upstream sits out for a second, so space the requests out
+    curl -s -o /dev/null -X POST -H "Content-Length: 0" http://localhost:8080/order
+    sleep 1.5
+    curl -s -o /dev/null -X DELETE http://localhost:8080/order
+    sleep 1.5
+    curl -s -o /dev/null http://localhost:8080/order
+    # One POST and one DELETE, each sent once; the GET may be tried on both
+    [ "$(grep -c '^POST$' "$RETRY_DIR/seen")" = 1 ] || { echo "POST was sent more than once"; STATUS=1; }
+    [ "$(grep -c '^DELETE$' "$RETRY_DIR/seen")" = 1 ] || { echo "DELETE was sent more than once"; STATUS=1; }
+    [ "$(grep -c '^GET$' "$RETRY_DIR/seen")" -ge 2 ] || { echo "GET was not retried"; STATUS=1; }
+    kill $SERVER_PID $UPSTREAM_A $UPSTREAM_B
+    wait $SERVER_PID $UPSTREAM_A $UPSTREAM_B 2>/dev/null
+    rm -rf "$RETRY_DIR"
+fi
+
+if command -v python3 >/dev/null && command -v curl >/dev/null; then
+    echo "Out of descriptors, connections past the limit are closed and serving resumes..."
+    EMFILE_DIR=$(mktemp -d)
+    # 120 connections against 60 descriptors; prints how many got neither
+    # a response nor a close
+    cat > "$EMFILE_DIR/clients.py" <<'EOF'
+import socket, time
+clients = [socket.create_connection(("127.0.0.1", 8080)) for _ in range(120)]
+for client in clients:
+    client.sendall(b"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n")
+time.sleep(1.5)
+hung = 0
+for client in clients:
+    client.settimeout(0.05)
+    try:
+        client.recv(4096)
+    except socket.timeout:
+        hung += 1
+    except OSError:
+        pass
+print(hung)
+EOF
+    for mode in epoll io_uring threads; do
+        (ulimit -n 60; exec ./web_server --mode $mode --workers 1) &
+        SERVER_PID=$!
+        sleep 1
+        HUNG=$(python3 "$EMFILE_DIR/clients.py")
+        [ "$HUNG" = 0 ] || { echo "$mode: $HUNG connections left hanging"; STATUS=1; }
+        curl -s -o /dev/null -m 2 http://localhost:8080/ || { echo "$mode: not serving afterwards"; STATUS=1; }
+        kill $SERVER_PID
+        wait $SERVER_PID 2>/dev/null
+    done
+    rm -rf "$EMFILE_DIR"
+fi
+
+if [ $STATUS -ne 0 ]; then
+    echo "Load test reported errors!"
+    exit 1
+fi
 echo "Test complete!"